@@ -0,0 +1,426 @@
+// Host build of the load test described in "Load test the Azure layer" in README.md: azure_io.c
+// against the IoT Hub loopback in iothub_loopback.c, under the load generated by
+// load_generator.c, with the default options in build_options.h.  The event loop timers run on
+// a simulated clock, which CLOCK_MONOTONIC reads, so RUN_SECONDS take well under a second.
+// The test plays the part of eventloops/azure_eventloop.c: its Azure timer sets up the client
+// until it is authenticated, then flushes the telemetry on every tick.
+//
+// The client is set up before the generator starts, as on a device that is already connected
+// when the load begins.  Otherwise the batches produced before the first Azure tick go to the
+// telemetry journal, which at the generator's rate fills and drops its oldest records.
+//
+// The LOAD lines the generator logs are printed and checked against the values README.md says
+// to expect.  The generator is then stopped and the test runs for DRAIN_SECONDS more, long
+// enough to replay the failed messages at TELEMETRY_JOURNAL_REPLAY_PER_TICK per Azure tick.
+// By then every reading must have been sent to IoT Hub and the telemetry journal must be
+// empty, although the loopback fails LOOPBACK_FAIL_PERCENT of the messages.  Pass -v to see
+// the rest of the log.
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/storage.h>
+
+#include "azure_io.h"
+#include "build_options.h"
+#include "eventloop_timer_utilities.h"
+#include "inflight_tracker.h"
+#include "load_generator.h"
+#include "shared.h"
+#include "telemetry_batch.h"
+#include "telemetry_journal.h"
+
+#define RUN_SECONDS 60
+#define DRAIN_SECONDS 30
+#define MAX_TIMERS 8
+#define MAX_READINGS (LOAD_GENERATOR_READINGS_PER_SECOND * (RUN_SECONDS + 1))
+
+// What README.md says to expect with the default options: the generator's rate, one batch per
+// 8 readings as its keys repeat, and confirmations after LOOPBACK_CONFIRM_DELAY_MS plus the
+// jitter and one DoWork period.
+#define MIN_READINGS_PER_SECOND (LOAD_GENERATOR_READINGS_PER_SECOND - 1)
+#define MIN_MESSAGES_PER_SECOND 12
+#define MAX_MESSAGES_PER_SECOND 13
+#define MIN_LATENCY_MS LOOPBACK_CONFIRM_DELAY_MS
+#define MAX_LATENCY_MS \
+    (LOOPBACK_CONFIRM_DELAY_MS + LOOPBACK_CONFIRM_JITTER_MS + AZURE_DOWORK_MIN_PERIOD_MS)
+
+struct EventLoopTimer {
+    EventLoopTimerHandler handler;
+    uint64_t periodUs; // 0 for a one-shot timer
+    uint64_t dueUs;
+    bool armed;
+};
+
+typedef struct {
+    size_t size;
+    unsigned char payload[];
+} HostMessage;
+
+// Defined in eventloops/azure_eventloop.c and main.c.
+int AzureIoTDefaultPollPeriodSeconds = 5;
+char scopeId[SCOPEID_LENGTH] = "0ne00000000";
+
+static EventLoopTimer timers[MAX_TIMERS];
+static int timerCount = 0;
+static EventLoopTimer *azureTimer = NULL;
+static uint64_t nowUs = 0;
+static bool verbose = false;
+static unsigned long failures = 0;
+
+static bool readingSent[MAX_READINGS];
+static unsigned long readingsSeen = 0;
+static unsigned long messagesSent = 0;
+
+// Values from the LOAD lines of the last stats period, and the heap high-water of the one
+// before it.
+static unsigned long statsPeriods = 0;
+static unsigned long readingsPerSecond = 0;
+static unsigned long messagesPerSecond = 0;
+static unsigned long heapHighWater = 0;
+static unsigned long previousHeapHighWater = 0;
+static long latencyP50Ms = 0;
+static long latencyMaxMs = 0;
+
+static void Fail(const char *what, long value)
+{
+    printf("FAIL: %s: %ld\n", what, value);
+    failures++;
+}
+
+/// <summary>
+///     Prints the LOAD lines, and the rest of the log with -v, and picks up the values the
+///     LOAD lines report.
+/// </summary>
+int Log_Debug(const char *fmt, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    int result = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    unsigned long confirmedPerSecond, heap;
+    long cpuPerMessage, cpuPerReading, p95, p99;
+    if (sscanf(line, "LOAD: %lu readings/s, %lu messages/s, %lu confirmed/s", &readingsPerSecond,
+               &messagesPerSecond, &confirmedPerSecond) == 3) {
+        statsPeriods++;
+    } else if (sscanf(line, "LOAD: CPU %ld us per message, %ld us per reading, heap high-water %lu",
+                      &cpuPerMessage, &cpuPerReading, &heap) == 3) {
+        previousHeapHighWater = heapHighWater;
+        heapHighWater = heap;
+    } else if (sscanf(line, "LOAD: confirmation latency p50 %ld ms, p95 %ld ms, p99 %ld ms, max %ld",
+                      &latencyP50Ms, &p95, &p99, &latencyMaxMs) != 4) {
+        if (!verbose) {
+            return result;
+        }
+    }
+    fputs(line, stdout);
+    return result;
+}
+
+/// <summary>
+///     CLOCK_MONOTONIC reads the simulated clock.  The CPU time clocks are left to the system.
+/// </summary>
+int clock_gettime(clockid_t clockId, struct timespec *time)
+{
+    if (clockId != CLOCK_MONOTONIC) {
+        return (int)syscall(SYS_clock_gettime, clockId, time);
+    }
+    time->tv_sec = (time_t)(nowUs / 1000000);
+    time->tv_nsec = (long)(nowUs % 1000000) * 1000;
+    return 0;
+}
+
+int Storage_OpenMutableFile(void)
+{
+    FILE *file = tmpfile();
+    return file == NULL ? -1 : fileno(file);
+}
+
+void CloseFdAndPrintError(int fd, const char *fdName)
+{
+    (void)fdName;
+    close(fd);
+}
+
+// Defined in device_twin.c; the loopback has no twin.
+void flushDeviceTwinReport(void)
+{
+}
+
+int deviceTwinPayloadHandler(const char *payload, size_t size, bool complete)
+{
+    (void)payload;
+    (void)size;
+    (void)complete;
+    return 0;
+}
+
+/// <summary>
+///     Marks the readings in a telemetry message as sent.  The generator's readings are
+///     "loadK":"N" members, N counting up from 0.
+/// </summary>
+static void RecordReadings(const unsigned char *payload, size_t size)
+{
+    char text[TELEMETRY_BATCH_BUFFER_SIZE + 1];
+    if (size >= sizeof(text)) {
+        return;
+    }
+    memcpy(text, payload, size);
+    text[size] = '\0';
+
+    for (const char *p = strstr(text, "\"load"); p != NULL; p = strstr(p + 1, "\"load")) {
+        unsigned int key;
+        unsigned long reading;
+        if (sscanf(p, "\"load%u\":\"%lu\"", &key, &reading) == 2 && reading < MAX_READINGS) {
+            if (!readingSent[reading]) {
+                readingSent[reading] = true;
+                readingsSeen++;
+            }
+        }
+    }
+}
+
+IOTHUB_MESSAGE_HANDLE IoTHubMessage_CreateFromByteArray(const unsigned char *byteArray,
+                                                        size_t size)
+{
+    HostMessage *message = malloc(sizeof(HostMessage) + size);
+    if (message != NULL) {
+        message->size = size;
+        memcpy(message->payload, byteArray, size);
+        RecordReadings(byteArray, size);
+        messagesSent++;
+    }
+    return (IOTHUB_MESSAGE_HANDLE)message;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_GetByteArray(IOTHUB_MESSAGE_HANDLE handle,
+                                                 const unsigned char **buffer, size_t *size)
+{
+    HostMessage *message = (HostMessage *)handle;
+    *buffer = message->payload;
+    *size = message->size;
+    return IOTHUB_MESSAGE_OK;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetProperty(IOTHUB_MESSAGE_HANDLE handle, const char *key,
+                                                const char *value)
+{
+    (void)handle;
+    (void)key;
+    (void)value;
+    return IOTHUB_MESSAGE_OK;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetContentTypeSystemProperty(IOTHUB_MESSAGE_HANDLE handle,
+                                                                 const char *contentType)
+{
+    (void)handle;
+    (void)contentType;
+    return IOTHUB_MESSAGE_OK;
+}
+
+IOTHUB_MESSAGE_RESULT IoTHubMessage_SetContentEncodingSystemProperty(IOTHUB_MESSAGE_HANDLE handle,
+                                                                     const char *contentEncoding)
+{
+    (void)handle;
+    (void)contentEncoding;
+    return IOTHUB_MESSAGE_OK;
+}
+
+void IoTHubMessage_Destroy(IOTHUB_MESSAGE_HANDLE handle)
+{
+    free(handle);
+}
+
+static uint64_t ToUs(const struct timespec *time)
+{
+    return (uint64_t)time->tv_sec * 1000000 + (uint64_t)time->tv_nsec / 1000;
+}
+
+static EventLoopTimer *CreateTimer(EventLoopTimerHandler handler)
+{
+    if (timerCount == MAX_TIMERS) {
+        return NULL;
+    }
+    EventLoopTimer *timer = &timers[timerCount++];
+    timer->handler = handler;
+    timer->armed = false;
+    return timer;
+}
+
+EventLoopTimer *CreateEventLoopPeriodicTimer(EventLoop *eventLoop, EventLoopTimerHandler handler,
+                                             const struct timespec *period)
+{
+    (void)eventLoop;
+    EventLoopTimer *timer = CreateTimer(handler);
+    if (timer != NULL) {
+        SetEventLoopTimerPeriod(timer, period);
+    }
+    return timer;
+}
+
+EventLoopTimer *CreateEventLoopDisarmedTimer(EventLoop *eventLoop, EventLoopTimerHandler handler)
+{
+    (void)eventLoop;
+    return CreateTimer(handler);
+}
+
+int SetEventLoopTimerPeriod(EventLoopTimer *timer, const struct timespec *period)
+{
+    timer->periodUs = ToUs(period);
+    timer->dueUs = nowUs + timer->periodUs;
+    timer->armed = true;
+    return 0;
+}
+
+int SetEventLoopTimerOneShot(EventLoopTimer *timer, const struct timespec *delay)
+{
+    timer->periodUs = 0;
+    timer->dueUs = nowUs + ToUs(delay);
+    timer->armed = true;
+    return 0;
+}
+
+int ConsumeEventLoopTimerEvent(EventLoopTimer *timer)
+{
+    (void)timer;
+    return 0;
+}
+
+int DisarmEventLoopTimer(EventLoopTimer *timer)
+{
+    timer->armed = false;
+    return 0;
+}
+
+void DisposeEventLoopTimer(EventLoopTimer *timer)
+{
+    if (timer != NULL) {
+        timer->armed = false;
+    }
+}
+
+/// <summary>
+///     Azure timer event, as in eventloops/azure_eventloop.c without the sensor telemetry.
+/// </summary>
+static void AzureTimerEventHandler(EventLoopTimer *timer)
+{
+    if (!IsIoTHubAuthenticated()) {
+        SetupAzureClient(timer);
+    }
+    if (IsIoTHubAuthenticated()) {
+        FlushTelemetry();
+    }
+}
+
+/// <summary>
+///     Runs the timers in the order they fall due until the clock reaches endUs.
+/// </summary>
+static void RunUntil(uint64_t endUs)
+{
+    for (;;) {
+        EventLoopTimer *next = NULL;
+        for (int i = 0; i < timerCount; i++) {
+            if (timers[i].armed && (next == NULL || timers[i].dueUs < next->dueUs)) {
+                next = &timers[i];
+            }
+        }
+        if (next == NULL || next->dueUs > endUs) {
+            nowUs = endUs;
+            return;
+        }
+
+        if (next->dueUs > nowUs) {
+            nowUs = next->dueUs;
+        }
+        if (next->periodUs == 0) {
+            next->armed = false;
+        } else {
+            next->dueUs += next->periodUs;
+        }
+        next->handler(next);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    InitTelemetry();
+    struct timespec azurePeriod = {.tv_sec = AzureIoTDefaultPollPeriodSeconds, .tv_nsec = 0};
+    azureTimer = CreateEventLoopPeriodicTimer(NULL, &AzureTimerEventHandler, &azurePeriod);
+    if (azureTimer == NULL || InitAzureDoWork(NULL) != 0) {
+        printf("FAIL: could not create the timers\n");
+        return EXIT_FAILURE;
+    }
+    AzureTimerEventHandler(azureTimer);
+    if (LoadGenerator_Init(NULL) != 0) {
+        printf("FAIL: could not create the timers\n");
+        return EXIT_FAILURE;
+    }
+
+    RunUntil((uint64_t)RUN_SECONDS * 1000000);
+    LoadGenerator_Close();
+    RunUntil((uint64_t)(RUN_SECONDS + DRAIN_SECONDS) * 1000000);
+
+    // The generator numbers its readings from 0, so the highest one sent tells how many it made.
+    unsigned long readings = 0;
+    for (unsigned long i = 0; i < MAX_READINGS; i++) {
+        if (readingSent[i]) {
+            readings = i + 1;
+        }
+    }
+    LoopbackStats loopback = Loopback_GetStats();
+    TelemetryBatchStats batches = TelemetryBatch_GetStats();
+    printf("%lu readings in %lu batches, %lu messages sent, loopback confirmed %lu and failed "
+           "%lu, %u left in the journal\n",
+           readings, batches.messages, messagesSent, loopback.confirmed, loopback.failed,
+           TelemetryJournal_Count());
+
+    if (statsPeriods < RUN_SECONDS / LOAD_GENERATOR_STATS_PERIOD_SECONDS - 1) {
+        Fail("stats periods logged", (long)statsPeriods);
+    }
+    if (readingsPerSecond < MIN_READINGS_PER_SECOND) {
+        Fail("readings/s", (long)readingsPerSecond);
+    }
+    if (messagesPerSecond < MIN_MESSAGES_PER_SECOND || messagesPerSecond > MAX_MESSAGES_PER_SECOND) {
+        Fail("messages/s", (long)messagesPerSecond);
+    }
+    if (latencyP50Ms < MIN_LATENCY_MS || latencyMaxMs > MAX_LATENCY_MS) {
+        Fail("confirmation latency p50 or max, ms", latencyMaxMs);
+    }
+    if (heapHighWater != previousHeapHighWater) {
+        Fail("heap high-water growth over the last period, bytes",
+             (long)(heapHighWater - previousHeapHighWater));
+    }
+    if (loopback.failed == 0) {
+        Fail("messages failed by the loopback", 0);
+    }
+
+    // Messages the loopback failed were journalled and sent again, so nothing is lost.
+    if (readings < (unsigned long)LOAD_GENERATOR_READINGS_PER_SECOND * RUN_SECONDS - 1) {
+        Fail("readings generated", (long)readings);
+    }
+    if (readingsSeen != readings) {
+        Fail("readings never sent", (long)(readings - readingsSeen));
+    }
+    if (TelemetryJournal_Count() != 0) {
+        Fail("messages left in the journal", (long)TelemetryJournal_Count());
+    }
+    if (InFlight_Count(InFlight_Telemetry) != 0) {
+        Fail("telemetry messages still in flight", (long)InFlight_Count(InFlight_Telemetry));
+    }
+
+    CloseAzureDoWork();
+    CloseTelemetry();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
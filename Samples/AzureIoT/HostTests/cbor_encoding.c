@@ -0,0 +1,210 @@
+// Host test for cbor_writer.c.  Each item is encoded on its own and compared byte for byte with
+// its known encoding, most of them from the examples in appendix A of RFC 7049.  Typed telemetry
+// fields, a complete telemetry map and a buffer that is too small are checked the same way.
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cbor_writer.h"
+
+typedef enum { Item_Int, Item_Float, Item_Bool, Item_String } ItemType;
+
+typedef struct {
+    ItemType type;
+    long integer;
+    float number;
+    const char *string;
+    const char *expected; // hex
+} Item;
+
+static const Item items[] = {
+    {Item_Int, 0, 0, NULL, "00"},
+    {Item_Int, 1, 0, NULL, "01"},
+    {Item_Int, 10, 0, NULL, "0a"},
+    {Item_Int, 23, 0, NULL, "17"},
+    {Item_Int, 24, 0, NULL, "1818"},
+    {Item_Int, 25, 0, NULL, "1819"},
+    {Item_Int, 100, 0, NULL, "1864"},
+    {Item_Int, 255, 0, NULL, "18ff"},
+    {Item_Int, 256, 0, NULL, "190100"},
+    {Item_Int, 1000, 0, NULL, "1903e8"},
+    {Item_Int, 65535, 0, NULL, "19ffff"},
+    {Item_Int, 65536, 0, NULL, "1a00010000"},
+    {Item_Int, 1000000, 0, NULL, "1a000f4240"},
+    {Item_Int, 2147483647, 0, NULL, "1a7fffffff"},
+    {Item_Int, -1, 0, NULL, "20"},
+    {Item_Int, -10, 0, NULL, "29"},
+    {Item_Int, -24, 0, NULL, "37"},
+    {Item_Int, -25, 0, NULL, "3818"},
+    {Item_Int, -100, 0, NULL, "3863"},
+    {Item_Int, -1000, 0, NULL, "3903e7"},
+    {Item_Int, -2147483647 - 1, 0, NULL, "3a7fffffff"},
+    {Item_Float, 0, 0.0f, NULL, "fa00000000"},
+    {Item_Float, 0, -0.0f, NULL, "fa80000000"},
+    {Item_Float, 0, 100000.0f, NULL, "fa47c35000"},
+    {Item_Float, 0, 3.4028234663852886e+38f, NULL, "fa7f7fffff"},
+    {Item_Float, 0, INFINITY, NULL, "fa7f800000"},
+    {Item_Float, 0, -INFINITY, NULL, "faff800000"},
+    {Item_Float, 0, 1013.25f, NULL, "fa447d5000"},
+    {Item_Bool, 0, 0, NULL, "f4"},
+    {Item_Bool, 1, 0, NULL, "f5"},
+    {Item_String, 0, 0, "", "60"},
+    {Item_String, 0, 0, "a", "6161"},
+    {Item_String, 0, 0, "IETF", "6449455446"},
+    {Item_String, 0, 0, "\"\\", "62225c"},
+    {Item_String, 0, 0, "\xc3\xbc", "62c3bc"},
+    {Item_String, 0, 0, "\xe6\xb0\xb4", "63e6b0b4"},
+    {Item_String, 0, 0, "abcdefghijklmnopqrstuvw", "77616263646566676869"
+                                                  "6a6b6c6d6e6f7071727374757677"},
+    {Item_String, 0, 0, "abcdefghijklmnopqrstuvwx", "7818616263646566676869"
+                                                   "6a6b6c6d6e6f707172737475767778"},
+};
+
+static unsigned long checked = 0;
+static unsigned long failures = 0;
+
+static void ToHex(const uint8_t *data, int length, char *hex)
+{
+    for (int i = 0; i < length; i++) {
+        sprintf(hex + 2 * i, "%02x", data[i]);
+    }
+    hex[2 * (length > 0 ? length : 0)] = '\0';
+}
+
+/// <summary>
+///     Fails the test unless writer holds exactly the bytes given in hex.
+/// </summary>
+static void Expect(const char *what, CborWriter *writer, const char *expected)
+{
+    checked++;
+    char hex[256];
+    int length = CborWriter_Finish(writer);
+    ToHex(writer->buffer, length, hex);
+    if (length < 0 || strcmp(hex, expected) != 0) {
+        printf("FAIL: %s was encoded as %s, expected %s\n", what, length < 0 ? "overflow" : hex,
+               expected);
+        failures++;
+    }
+}
+
+static void CheckItems(void)
+{
+    for (size_t i = 0; i < sizeof(items) / sizeof(items[0]); i++) {
+        uint8_t buffer[64];
+        CborWriter writer;
+        CborWriter_Init(&writer, buffer, sizeof(buffer));
+        char what[64];
+        switch (items[i].type) {
+        case Item_Int:
+            CborWriter_Int(&writer, items[i].integer);
+            snprintf(what, sizeof(what), "%ld", items[i].integer);
+            break;
+        case Item_Float:
+            CborWriter_Float(&writer, items[i].number);
+            snprintf(what, sizeof(what), "%gf", (double)items[i].number);
+            break;
+        case Item_Bool:
+            CborWriter_Bool(&writer, items[i].integer != 0);
+            snprintf(what, sizeof(what), "%s", items[i].integer != 0 ? "true" : "false");
+            break;
+        case Item_String:
+            CborWriter_String(&writer, items[i].string);
+            snprintf(what, sizeof(what), "\"%s\"", items[i].string);
+            break;
+        }
+        Expect(what, &writer, items[i].expected);
+    }
+
+#if LONG_MAX > 2147483647
+    uint8_t buffer[16];
+    CborWriter writer;
+    CborWriter_Init(&writer, buffer, sizeof(buffer));
+    CborWriter_Int(&writer, 1000000000000);
+    Expect("1000000000000", &writer, "1b000000e8d4a51000");
+    CborWriter_Init(&writer, buffer, sizeof(buffer));
+    CborWriter_Int(&writer, LONG_MIN);
+    Expect("LONG_MIN", &writer, "3b7fffffffffffffff");
+#endif
+}
+
+static void CheckFields(void)
+{
+    static const struct {
+        JsonField field;
+        JsonFieldValue value;
+        const char *expected;
+    } fields[] = {
+        // Rounded to the field's decimal places, then sent as a float.
+        {{.name = "t", .type = JsonField_Fixed, .decimals = 2}, {.number = 23.456}, "fa41bbae14"},
+        {{.name = "t", .type = JsonField_Fixed, .decimals = 1}, {.number = 23.44}, "fa41bb3333"},
+        {{.name = "t", .type = JsonField_Fixed, .decimals = 1}, {.number = -0.46}, "fabf000000"},
+        // No decimal places: an integer, rounded half to even.
+        {{.name = "t", .type = JsonField_Fixed, .decimals = 0}, {.number = 23.6}, "1818"},
+        {{.name = "t", .type = JsonField_Fixed, .decimals = 0}, {.number = 24.5}, "1818"},
+        {{.name = "t", .type = JsonField_Fixed, .decimals = 0}, {.number = -0.4}, "00"},
+        {{.name = "t", .type = JsonField_Fixed, .decimals = 0}, {.number = -1000.2}, "3903e7"},
+        // Too large to round, and not finite: sent as they are.
+        {{.name = "t", .type = JsonField_Fixed, .decimals = 0}, {.number = 1e20}, "fa60ad78ec"},
+        {{.name = "t", .type = JsonField_Fixed, .decimals = 2}, {.number = INFINITY}, "fa7f800000"},
+        // The quoted flag only applies to JSON.
+        {{.name = "t", .type = JsonField_Fixed, .decimals = 0, .quoted = true},
+         {.number = 7.0},
+         "07"},
+        {{.name = "t", .type = JsonField_Int, .quoted = true}, {.integer = -25}, "3818"},
+        {{.name = "t", .type = JsonField_Bool}, {.boolean = true}, "f5"},
+        {{.name = "t", .type = JsonField_String}, {.string = "on"}, "626f6e"},
+    };
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        uint8_t buffer[16];
+        CborWriter writer;
+        CborWriter_Init(&writer, buffer, sizeof(buffer));
+        CborWriter_FieldValue(&writer, &fields[i].field, &fields[i].value);
+        char what[64];
+        snprintf(what, sizeof(what), "field %zu", i);
+        Expect(what, &writer, fields[i].expected);
+    }
+}
+
+static void CheckMapAndOverflow(void)
+{
+    // {_ "Fun": true, "Amt": -2}, from RFC 7049.
+    uint8_t buffer[32];
+    CborWriter writer;
+    CborWriter_Init(&writer, buffer, sizeof(buffer));
+    CborWriter_BeginMap(&writer);
+    CborWriter_Key(&writer, "Fun");
+    CborWriter_Bool(&writer, true);
+    CborWriter_Key(&writer, "Amt");
+    CborWriter_Int(&writer, -2);
+    CborWriter_EndMap(&writer);
+    Expect("{_ \"Fun\": true, \"Amt\": -2}", &writer, "bf6346756ef563416d7421ff");
+
+    // "IETF" takes 5 bytes, so it fits in 5 but not in 4, and nothing is written after it.
+    CborWriter_Init(&writer, buffer, 5);
+    CborWriter_String(&writer, "IETF");
+    Expect("\"IETF\" in 5 bytes", &writer, "6449455446");
+
+    CborWriter_Init(&writer, buffer, 4);
+    CborWriter_String(&writer, "IETF");
+    CborWriter_Bool(&writer, true);
+    checked++;
+    if (CborWriter_Finish(&writer) != -1) {
+        printf("FAIL: \"IETF\" in 4 bytes did not overflow\n");
+        failures++;
+    }
+}
+
+int main(void)
+{
+    CheckItems();
+    CheckFields();
+    CheckMapAndOverflow();
+
+    printf("%lu encodings checked, %lu failures\n", checked, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,337 @@
+// Host test of the LZ4 blocks telemetry_compress.c produces.  Each document is compressed and
+// decoded again with the reference decoder below, which follows the LZ4 block format and
+// rejects anything LZ4_decompress_safe_usingDict could misread, including its end-of-block
+// rules.  When CMake finds liblz4, every block is also decoded with
+// LZ4_decompress_safe_usingDict.  Both must give back the document.
+//
+// The documents are batch-sized: sensor telemetry and load generator batches as
+// telemetry_batch.c writes them, random documents of every size up to
+// TELEMETRY_COMPRESSION_MAX_INPUT, incompressible bytes, and runs long enough to need length
+// continuation bytes.  Output buffers one byte too small must be refused.  The random documents
+// come from a fixed seed, so every run checks the same ones.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "build_options.h"
+#include "telemetry_compress.h"
+
+// The dictionary TELEMETRY_COMPRESSION_PROPERTY names.  A service that decodes the messages
+// holds its own copy, as this test does, so the dictionary must not change under that name.
+#define DICTIONARY_NAME "lz4-block;dict=telemetry-v1"
+static const char dictionary[] = "\"ButtonPress\":\"True\",\"Orientation\":\"Down\",\"Up\","
+                                 "\"Temperature\":\"\",\"Pressure\":\"\",\"pressure\":\"\","
+                                 "\"aX\":\"-\",\"aY\":\"-\",\"aZ\":\"-\","
+                                 "\"gX\":\"-\",\"gY\":\"-\",\"gZ\":\"-\"";
+#define DICTIONARY_SIZE (sizeof(dictionary) - 1)
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MATCH_FIND_LIMIT 12
+// The worst case LZ4 allows for incompressible input.
+#define MAX_OUTPUT (TELEMETRY_COMPRESSION_MAX_INPUT + TELEMETRY_COMPRESSION_MAX_INPUT / 255 + 16)
+
+static uint64_t randomState = 88172645463325252ull;
+static unsigned long documents = 0;
+static unsigned long inputBytes = 0;
+static unsigned long outputBytes = 0;
+static unsigned long dictionaryMatches = 0;
+static unsigned long failures = 0;
+
+static uint64_t NextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static void Fail(const char *what, size_t size, const char *message)
+{
+    printf("FAIL: %s of %zu bytes: %s\n", what, size, message);
+    failures++;
+}
+
+static bool ReadLength(const uint8_t **in, const uint8_t *inEnd, size_t *length)
+{
+    uint8_t byte;
+    do {
+        if (*in >= inEnd) {
+            return false;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/// <summary>
+///     Decodes an LZ4 block compressed against the dictionary.  The last sequence must be
+///     literals only, the last LAST_LITERALS bytes must be literals, and no match may start in
+///     the last MATCH_FIND_LIMIT bytes.
+/// </summary>
+/// <returns>Size of the decoded data, or -1 with error set if the block is not valid</returns>
+static int Decode(const uint8_t *in, size_t inSize, uint8_t *out, size_t outSize,
+                  const char **error)
+{
+    const uint8_t *inEnd = in + inSize;
+    size_t produced = 0;
+    size_t lastMatchStart = 0;
+    size_t lastMatchEnd = 0;
+    bool matched = false;
+
+    for (;;) {
+        if (in >= inEnd) {
+            *error = "block ends before its last literals";
+            return -1;
+        }
+        uint8_t token = *in++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !ReadLength(&in, inEnd, &literalLength)) {
+            *error = "literal length runs past the block";
+            return -1;
+        }
+        if (literalLength > (size_t)(inEnd - in) || literalLength > outSize - produced) {
+            *error = "literals run past the block or the output";
+            return -1;
+        }
+        memcpy(out + produced, in, literalLength);
+        in += literalLength;
+        produced += literalLength;
+
+        if (in == inEnd) {
+            if ((token & 0x0F) != 0) {
+                *error = "last sequence has a match length";
+                return -1;
+            }
+            break;
+        }
+
+        if (inEnd - in < 2) {
+            *error = "offset runs past the block";
+            return -1;
+        }
+        size_t offset = (size_t)in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        size_t matchLength = token & 0x0F;
+        if (matchLength == 15 && !ReadLength(&in, inEnd, &matchLength)) {
+            *error = "match length runs past the block";
+            return -1;
+        }
+        matchLength += MIN_MATCH;
+        if (offset == 0 || offset > produced + DICTIONARY_SIZE) {
+            *error = "offset reaches before the dictionary";
+            return -1;
+        }
+        if (matchLength > outSize - produced) {
+            *error = "match runs past the output";
+            return -1;
+        }
+        if (offset > produced) {
+            dictionaryMatches++;
+        }
+        lastMatchStart = produced;
+        for (size_t i = 0; i < matchLength; i++, produced++) {
+            out[produced] = offset > produced
+                                ? (uint8_t)dictionary[DICTIONARY_SIZE - (offset - produced)]
+                                : out[produced - offset];
+        }
+        lastMatchEnd = produced;
+        matched = true;
+    }
+
+    if (matched && (lastMatchStart + MATCH_FIND_LIMIT > produced ||
+                    lastMatchEnd + LAST_LITERALS > produced)) {
+        *error = "a match is too close to the end of the block";
+        return -1;
+    }
+    return (int)produced;
+}
+
+/// <summary>
+///     Compresses a document and checks that it decodes back, and that it does not fit in an
+///     output buffer one byte smaller.
+/// </summary>
+static void RoundTrip(const char *what, const char *input, size_t inputSize)
+{
+    static char compressed[MAX_OUTPUT];
+    static uint8_t decoded[TELEMETRY_COMPRESSION_MAX_INPUT];
+    const char *error = NULL;
+
+    documents++;
+    int size = TelemetryCompress_Compress(input, inputSize, compressed, sizeof(compressed));
+    if (size < 0) {
+        Fail(what, inputSize, "not compressed");
+        return;
+    }
+    inputBytes += inputSize;
+    outputBytes += (unsigned long)size;
+
+    int decodedSize =
+        Decode((const uint8_t *)compressed, (size_t)size, decoded, sizeof(decoded), &error);
+    if (decodedSize < 0) {
+        Fail(what, inputSize, error);
+    } else if ((size_t)decodedSize != inputSize || memcmp(decoded, input, inputSize) != 0) {
+        Fail(what, inputSize, "decodes to a different document");
+    }
+
+#ifdef HAVE_LZ4
+    decodedSize = LZ4_decompress_safe_usingDict(compressed, (char *)decoded, size,
+                                                (int)sizeof(decoded), dictionary,
+                                                (int)DICTIONARY_SIZE);
+    if (decodedSize != (int)inputSize || memcmp(decoded, input, inputSize) != 0) {
+        Fail(what, inputSize, "LZ4_decompress_safe_usingDict decodes it differently");
+    }
+#endif
+
+    // Compressing again must give the same block, so no state is left from the last document.
+    static char again[MAX_OUTPUT];
+    if (TelemetryCompress_Compress(input, inputSize, again, (size_t)size) != size ||
+        memcmp(again, compressed, (size_t)size) != 0) {
+        Fail(what, inputSize, "compresses differently into a buffer of the exact size");
+    }
+    if (TelemetryCompress_Compress(input, inputSize, again, (size_t)size - 1) != -1) {
+        Fail(what, inputSize, "fits in a buffer one byte smaller than its block");
+    }
+}
+
+static void SensorTelemetry(void)
+{
+    char document[TELEMETRY_COMPRESSION_MAX_INPUT];
+    for (int i = 0; i < 2000; i++) {
+        double temperature = 15.0 + (double)(NextRandom() % 2000) / 100.0;
+        double pressure = 950.0 + (double)(NextRandom() % 10000) / 100.0;
+        int length = snprintf(
+            document, sizeof(document),
+            "{\"Temperature\":\"%.2f\",\"Pressure\":\"%.2f\",\"aX\":\"%.2f\",\"aY\":\"%.2f\","
+            "\"aZ\":\"%.2f\",\"gX\":\"%.2f\",\"gY\":\"%.2f\",\"gZ\":\"%.2f\"}",
+            temperature, pressure, (double)((int)(NextRandom() % 4000) - 2000) / 100.0,
+            (double)((int)(NextRandom() % 4000) - 2000) / 100.0,
+            (double)((int)(NextRandom() % 4000) - 2000) / 10.0,
+            (double)((int)(NextRandom() % 1000) - 500) / 100.0,
+            (double)((int)(NextRandom() % 1000) - 500) / 100.0,
+            (double)((int)(NextRandom() % 1000) - 500) / 100.0);
+        RoundTrip("sensor telemetry", document, (size_t)length);
+    }
+
+    static const char *const events[] = {"{\"ButtonPress\":\"True\"}",
+                                         "{\"Orientation\":\"Up\"}",
+                                         "{\"Orientation\":\"Down\"}"};
+    for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); i++) {
+        RoundTrip("event", events[i], strlen(events[i]));
+    }
+}
+
+/// <summary>
+///     Batches of the load generator's "loadK":"N" readings, as many as fit.
+/// </summary>
+static void LoadBatches(void)
+{
+    char document[TELEMETRY_COMPRESSION_MAX_INPUT];
+    unsigned long reading = 0;
+    for (int readings = 1; readings <= TELEMETRY_BATCH_MAX_READINGS; readings++) {
+        size_t length = 0;
+        document[length++] = '{';
+        for (int i = 0; i < readings; i++) {
+            length += (size_t)snprintf(document + length, sizeof(document) - length,
+                                       "%s\"load%d\":\"%lu\"", i > 0 ? "," : "", i % 8,
+                                       reading++);
+        }
+        document[length++] = '}';
+        RoundTrip("load generator batch", document, length);
+    }
+}
+
+static void RandomDocuments(void)
+{
+    static const char *const pieces[] = {"\"Temperature\":\"", "\"pressure\":\"", "\"aX\":\"-",
+                                         "\",", "0", "1", "2", "3", "4", "5", "6", "7", "8",
+                                         "9", ".", "{", "}", "\"x\":true,", "\\\"", "\xc3\xbc"};
+    char document[TELEMETRY_COMPRESSION_MAX_INPUT];
+    for (size_t size = 0; size <= TELEMETRY_COMPRESSION_MAX_INPUT; size++) {
+        for (int repeat = 0; repeat < 4; repeat++) {
+            size_t length = 0;
+            while (length < size) {
+                const char *piece = pieces[NextRandom() % (sizeof(pieces) / sizeof(pieces[0]))];
+                while (*piece != '\0' && length < size) {
+                    document[length++] = *piece++;
+                }
+            }
+            RoundTrip("random document", document, size);
+        }
+    }
+}
+
+static void EdgeCases(void)
+{
+    static char document[TELEMETRY_COMPRESSION_MAX_INPUT + 1];
+
+    // Incompressible bytes: one literal run needing length continuation bytes.
+    for (size_t i = 0; i < sizeof(document); i++) {
+        document[i] = (char)(NextRandom() >> 56);
+    }
+    for (size_t size = 0; size <= TELEMETRY_COMPRESSION_MAX_INPUT; size += 17) {
+        RoundTrip("random bytes", document, size);
+    }
+    RoundTrip("random bytes", document, TELEMETRY_COMPRESSION_MAX_INPUT);
+
+    // One byte repeated: a match of nearly the whole document at offset 1.
+    memset(document, 'a', sizeof(document));
+    for (size_t size = 0; size <= 300; size++) {
+        RoundTrip("repeated byte", document, size);
+    }
+    RoundTrip("repeated byte", document, TELEMETRY_COMPRESSION_MAX_INPUT);
+
+    // A literal run of exactly 15 and 15 + 255 bytes, then a repeat.
+    for (size_t literals = 14; literals <= 271; literals++) {
+        for (size_t i = 0; i < literals; i++) {
+            document[i] = (char)('A' + i % 26 + (i / 26) % 2 * 32);
+        }
+        size_t size = literals;
+        for (size_t i = 0; i < 40 && size < TELEMETRY_COMPRESSION_MAX_INPUT; i++) {
+            document[size++] = document[i];
+        }
+        RoundTrip("literal run and repeat", document, size);
+    }
+
+    static char output[MAX_OUTPUT];
+    if (TelemetryCompress_Compress(document, TELEMETRY_COMPRESSION_MAX_INPUT + 1, output,
+                                   sizeof(output)) != -1) {
+        Fail("input", TELEMETRY_COMPRESSION_MAX_INPUT + 1,
+             "compressed although larger than TELEMETRY_COMPRESSION_MAX_INPUT");
+    }
+}
+
+int main(void)
+{
+    if (strcmp(TELEMETRY_COMPRESSION_PROPERTY, DICTIONARY_NAME) != 0) {
+        printf("FAIL: the dictionary is now %s; update the copy in this test\n",
+               TELEMETRY_COMPRESSION_PROPERTY);
+        return EXIT_FAILURE;
+    }
+
+    SensorTelemetry();
+    LoadBatches();
+    RandomDocuments();
+    EdgeCases();
+
+    if (dictionaryMatches == 0) {
+        printf("FAIL: no match reached into the dictionary\n");
+        failures++;
+    }
+
+#ifdef HAVE_LZ4
+    printf("Also decoded with liblz4 %s.\n", LZ4_versionString());
+#endif
+    printf("%lu documents, %lu bytes compressed to %lu, %lu dictionary matches, %lu failures\n",
+           documents, inputBytes, outputBytes, dictionaryMatches, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,95 @@
+// Host test for JsonWriter_FormatFixed in json_writer.c, which formats telemetry readings
+// without the C library.  Its output must be the same as snprintf("%.*f") for every double of
+// the number corpus at every number of decimals it supports, including exact ties, negative
+// zero, and values large enough to take the snprintf fallback.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_writer.h"
+#include "number_corpus.h"
+
+#define MAX_DECIMALS 9
+
+static unsigned long checked = 0;
+static unsigned long failures = 0;
+
+static void Check(double number)
+{
+    if (!isfinite(number)) {
+        char text[8] = "x";
+        if (JsonWriter_FormatFixed(text, sizeof(text), number, 2) != 0) {
+            if (failures++ < 10) {
+                printf("FAIL: %g was formatted as %s\n", number, text);
+            }
+        }
+        return;
+    }
+
+    // From 2^51 up every number of decimals takes the fallback, and below 1e-10 every number
+    // of decimals writes zero.  snprintf is slow with the extreme values of the corpus, so
+    // these are checked at one number of decimals only.
+    unsigned int minDecimals = 0, maxDecimals = MAX_DECIMALS;
+    if (fabs(number) >= ldexp(1.0, 51)) {
+        maxDecimals = 0;
+    } else if (fabs(number) < 1e-10) {
+        minDecimals = MAX_DECIMALS;
+    }
+    for (unsigned int decimals = minDecimals; decimals <= maxDecimals; decimals++) {
+        checked++;
+        char expected[400];
+        char text[400];
+        int expectedLength = snprintf(expected, sizeof(expected), "%.*f", decimals, number);
+        size_t length = JsonWriter_FormatFixed(text, sizeof(text), number, decimals);
+        if (length != (size_t)expectedLength || strcmp(text, expected) != 0) {
+            if (failures++ < 10) {
+                printf("FAIL: %.17g with %u decimals was formatted as %s, expected %s\n", number,
+                       decimals, length == 0 ? "nothing" : text, expected);
+            }
+        }
+    }
+}
+
+/// <summary>
+///     Checks number and the doubles on either side of it.
+/// </summary>
+static void CheckNeighbourhood(double number)
+{
+    Check(nextafter(number, -INFINITY));
+    Check(number);
+    Check(nextafter(number, INFINITY));
+}
+
+int main(void)
+{
+    NumberCorpus_ForEach(Check);
+
+    // Negative values that round to zero keep their sign, as does negative zero.
+    static const double signs[] = {-0.0, -1e-300, -0.001, -0.004, -0.005, -0.4, -0.5, -0.6};
+    for (size_t i = 0; i < sizeof(signs) / sizeof(signs[0]); i++) {
+        Check(signs[i]);
+    }
+
+    // Decimal ties, exact and not: 0.125 is exact in binary, 2.675 and 1.005 fall just below.
+    for (long n = -100000; n <= 100000; n++) {
+        Check((double)n / 8.0);
+        Check((double)n / 1000.0 + 0.0005);
+    }
+
+    // Around 2^51 at each number of decimals, where the snprintf fallback takes over, and
+    // around the largest integers a long holds.
+    for (unsigned int decimals = 0; decimals <= MAX_DECIMALS; decimals++) {
+        double limit = ldexp(1.0, 51) / pow(10.0, decimals);
+        for (int k = -2; k <= 2; k++) {
+            CheckNeighbourhood(limit + k * limit * 1e-15);
+            CheckNeighbourhood(-limit + k * limit * 1e-15);
+        }
+    }
+    CheckNeighbourhood(9.0e18);
+    CheckNeighbourhood(9223372036854775807.0);
+
+    printf("%lu numbers formatted, %lu differ from snprintf\n", checked, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,303 @@
+// The JSON documents checked by the parson host tests: hand-written documents shaped like
+// device twin updates and telemetry, scalars at the root, escapes and surrogate pairs, large
+// objects and arrays, deep nesting, and random documents.  The random documents mix every kind
+// of value with escaped and raw UTF-8 strings, objects on both sides of the size at which
+// parson indexes their names, and whitespace runs long enough for the vector scanning.  They
+// come from a fixed seed, so every run checks the same ones.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_corpus.h"
+
+#define RANDOM_DOCUMENTS 600
+#define MAX_DEPTH 6
+#define DOCUMENT_SIZE (256 * 1024)
+
+static uint64_t randomState = 88172645463325252ull;
+static char document[DOCUMENT_SIZE];
+static size_t length = 0;
+
+static const char *const fixedDocuments[] = {
+    "{}",
+    "[]",
+    "0",
+    "-12.5e-3",
+    "\"text\"",
+    "\"\"",
+    "true",
+    "false",
+    "null",
+    " \t\r\n{ \"a\" : [ 1 , 2 ] } ",
+    "\xEF\xBB\xBF{\"bom\":true}",
+    "{\"desired\":{\"userLedRed\":true,\"userLedGreen\":{\"value\":false},\"sensorPollTime\":"
+    "5,\"telemetryDeadband\":0.25,\"$version\":12},\"reported\":{\"userLedRed\":true,"
+    "\"$version\":7}}",
+    "{\"Temperature\":\"23.45\",\"Pressure\":\"1013.25\",\"aX\":\"-12.30\",\"aY\":\"4.10\","
+    "\"aZ\":\"998.00\",\"gX\":\"0.12\",\"gY\":\"-0.05\",\"gZ\":\"0.00\"}",
+    "[[[]],[{}],[1,[2,[3,[4]]]],{\"a\":{\"b\":{\"c\":{}}}}]",
+    "{\"a\\u00e9\":\"\\ud83d\\ude00\",\"b\":\"x\\n\\t\\\"\\\\\\/\\b\\f\\r\",\"\\u0000k\":1}",
+    "{\"raw\":\"\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80\",\"mixed\":\"a\\u20acb\xC3\xA9\"}",
+    "[1,-0,1.5e300,2.2250738585072014e-308,123456789012345678,0.1,1e-7,-1E+2]",
+    "{\"a\":1,\"a.b\":2,\"\":3,\"x\":{\"\":{\"\":4}}}",
+};
+
+static const char *const invalidDocuments[] = {
+    "",
+    " ",
+    "{",
+    "[",
+    "{\"a\":}",
+    "{\"a\" 1}",
+    "{\"a\":1,}",
+    "[1,]",
+    "[1 2]",
+    "{a:1}",
+    "{\"a\":1,\"a\":2}",
+    "\"unterminated",
+    "\"\\x\"",
+    "\"\\u12\"",
+    "\"\\u12G4\"",
+    "\"\\ud800\"",
+    "\"\\ud800\\u0041\"",
+    "\"\\udc00\\ud800\"",
+    "\"\x01\"",
+    "\"tab\there\"",
+    "01",
+    "-01",
+    "1e999",
+    "0x10",
+    "tru",
+    "nul",
+    "[true,fals]",
+};
+
+static uint64_t NextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static unsigned int Below(unsigned int limit)
+{
+    return (unsigned int)(NextRandom() % limit);
+}
+
+static void Put(const char *text)
+{
+    size_t size = strlen(text);
+    if (length + size < sizeof(document)) {
+        memcpy(document + length, text, size);
+        length += size;
+    }
+}
+
+static void PutWhitespace(void)
+{
+    static const char spaces[] = " \t\n\r";
+    unsigned int run = Below(10) < 7 ? 0 : Below(4) == 0 ? 1 + Below(64) : 1 + Below(3);
+    for (unsigned int i = 0; i < run && length + 1 < sizeof(document); i++) {
+        document[length++] = spaces[Below(4)];
+    }
+}
+
+static void PutStringContent(void)
+{
+    static const char *const pieces[] = {
+        "\\\"",     "\\\\",     "\\/",          "\\b",      "\\f",          "\\n",
+        "\\r",      "\\t",      "\\u0041",      "\\u00e9",  "\\u20ac",      "\\ud83d\\ude00",
+        "\\u001f",  "\xC3\xA9", "\xE2\x82\xAC", "/",        "\xF0\x9F\x98\x80"};
+    unsigned int count = Below(8);
+    for (unsigned int i = 0; i < count; i++) {
+        if (Below(3) == 0) {
+            Put(pieces[Below(sizeof(pieces) / sizeof(pieces[0]))]);
+        } else {
+            // Plain runs, sometimes long enough to span several vector blocks.
+            unsigned int run = Below(5) == 0 ? Below(100) : Below(8);
+            for (unsigned int j = 0; j < run && length + 1 < sizeof(document); j++) {
+                document[length++] = (char)('a' + Below(26));
+            }
+        }
+    }
+}
+
+static void PutNumber(void)
+{
+    char number[40];
+    switch (Below(5)) {
+    case 0:
+        snprintf(number, sizeof(number), "%d", (int)Below(2000001) - 1000000);
+        break;
+    case 1:
+        snprintf(number, sizeof(number), "%.3f", ((double)Below(2000001) - 1000000.0) / 7.0);
+        break;
+    case 2:
+        // parson refuses a leading zero before an exponent, as in "0e5".
+        snprintf(number, sizeof(number), "%s%de%d", Below(2) == 0 ? "-" : "", 1 + (int)Below(1000),
+                 (int)Below(61) - 30);
+        break;
+    case 3:
+        snprintf(number, sizeof(number), "%llu", (unsigned long long)(NextRandom() >> 4));
+        break;
+    default:
+        snprintf(number, sizeof(number), "%.17g", (double)(NextRandom() >> 11) / 9007199254740992.0);
+        break;
+    }
+    Put(number);
+}
+
+static void PutValue(int depth);
+
+static void PutObject(int depth)
+{
+    // Mostly small objects, some just below and above parson's index threshold of 8 names.
+    unsigned int count = Below(4) == 0 ? 6 + Below(40) : Below(5);
+    Put("{");
+    for (unsigned int i = 0; i < count; i++) {
+        char key[24];
+        static const char *const prefixes[] = {"", "", "", "\\n", "\\u00e9", "\xC3\xA9", "a.b"};
+        PutWhitespace();
+        if (i > 0) {
+            Put(",");
+            PutWhitespace();
+        }
+        // The number makes every name unique, as a repeated name fails the parse.
+        snprintf(key, sizeof(key), "\"%sk%u\"", prefixes[Below(7)], i);
+        Put(key);
+        PutWhitespace();
+        Put(":");
+        PutWhitespace();
+        PutValue(depth + 1);
+    }
+    PutWhitespace();
+    Put("}");
+}
+
+static void PutArray(int depth)
+{
+    unsigned int count = Below(4) == 0 ? Below(40) : Below(5);
+    Put("[");
+    for (unsigned int i = 0; i < count; i++) {
+        PutWhitespace();
+        if (i > 0) {
+            Put(",");
+            PutWhitespace();
+        }
+        PutValue(depth + 1);
+    }
+    PutWhitespace();
+    Put("]");
+}
+
+static void PutValue(int depth)
+{
+    unsigned int kind = Below(depth < MAX_DEPTH ? 8 : 6);
+    switch (kind) {
+    case 0:
+        Put("\"");
+        PutStringContent();
+        Put("\"");
+        break;
+    case 1:
+    case 2:
+        PutNumber();
+        break;
+    case 3:
+        Put(Below(2) == 0 ? "true" : "false");
+        break;
+    case 4:
+        Put("null");
+        break;
+    case 5:
+        Put("\"");
+        PutStringContent();
+        Put("\"");
+        break;
+    case 6:
+        PutObject(depth);
+        break;
+    default:
+        PutArray(depth);
+        break;
+    }
+}
+
+static void CheckGenerated(JsonCorpusCheck check)
+{
+    document[length] = '\0';
+    check(document);
+    length = 0;
+}
+
+void JsonCorpus_ForEach(JsonCorpusCheck check)
+{
+    randomState = 88172645463325252ull;
+    length = 0;
+
+    for (size_t i = 0; i < sizeof(fixedDocuments) / sizeof(fixedDocuments[0]); i++) {
+        check(fixedDocuments[i]);
+    }
+
+    // Large documents: many array items, many object names, deep nesting.
+    Put("[");
+    for (int i = 0; i < 3000; i++) {
+        char item[16];
+        snprintf(item, sizeof(item), "%s%d", i > 0 ? "," : "", i * 7 - 5000);
+        Put(item);
+    }
+    Put("]");
+    CheckGenerated(check);
+
+    Put("{");
+    for (int i = 0; i < 300; i++) {
+        char member[48];
+        snprintf(member, sizeof(member), "%s\"name%d\":{\"v\":%d,\"s\":\"n%d\"}", i > 0 ? "," : "",
+                 i, i, i);
+        Put(member);
+    }
+    Put("}");
+    CheckGenerated(check);
+
+    for (int i = 0; i < 500; i++) {
+        Put(i % 2 == 0 ? "[" : "{\"d\":");
+    }
+    Put("0");
+    for (int i = 499; i >= 0; i--) {
+        Put(i % 2 == 0 ? "]" : "}");
+    }
+    CheckGenerated(check);
+
+    for (int i = 0; i < RANDOM_DOCUMENTS; i++) {
+        PutWhitespace();
+        if (Below(8) == 0) {
+            PutValue(MAX_DEPTH);
+        } else if (Below(2) == 0) {
+            PutObject(0);
+        } else {
+            PutArray(0);
+        }
+        PutWhitespace();
+        CheckGenerated(check);
+    }
+}
+
+void JsonCorpus_ForEachInvalid(JsonCorpusCheck check)
+{
+    for (size_t i = 0; i < sizeof(invalidDocuments) / sizeof(invalidDocuments[0]); i++) {
+        check(invalidDocuments[i]);
+    }
+
+    // Nesting deeper than parson allows.
+    length = 0;
+    for (int i = 0; i < 3000; i++) {
+        Put("[");
+    }
+    for (int i = 0; i < 3000; i++) {
+        Put("]");
+    }
+    CheckGenerated(check);
+}
@@ -0,0 +1,17 @@
+// The JSON documents checked by the parson host tests, shared so that every test covers the
+// same ones.
+
+#pragma once
+
+typedef void (*JsonCorpusCheck)(const char *document);
+
+/// <summary>
+///     Calls check with each valid document of the corpus, always in the same order.  The
+///     document is only valid during the call.
+/// </summary>
+void JsonCorpus_ForEach(JsonCorpusCheck check);
+
+/// <summary>
+///     Calls check with each document of a set that every parser must refuse.
+/// </summary>
+void JsonCorpus_ForEachInvalid(JsonCorpusCheck check);
@@ -0,0 +1,99 @@
+// The doubles checked by the number host tests: edge cases, powers of two and ten with their
+// neighbours, large integers, two-decimal sensor readings, float32 values, random bit patterns
+// and subnormals.  The random values come from a fixed seed, so every run checks the same ones.
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number_corpus.h"
+
+#define RANDOM_BIT_PATTERNS 1000000
+#define RANDOM_FLOATS 500000
+#define RANDOM_SUBNORMALS 100000
+#define READING_LIMIT 500000 // two-decimal readings from -5000.00 to 5000.00
+
+static uint64_t randomState = 88172645463325252ull;
+
+/// <summary>
+///     xorshift64, so that every run checks the same values.
+/// </summary>
+static uint64_t NextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+/// <summary>
+///     Checks number and the doubles on either side of it.
+/// </summary>
+static void CheckNeighbourhood(NumberCorpusCheck check, double number)
+{
+    check(nextafter(number, -INFINITY));
+    check(number);
+    check(nextafter(number, INFINITY));
+}
+
+void NumberCorpus_ForEach(NumberCorpusCheck check)
+{
+    randomState = 88172645463325252ull;
+
+    // Edge cases.
+    static const double special[] = {0.0,   -0.0,     1.0,      -1.0,     0.1,     0.2,
+                                     0.3,   23.4,     1013.25,  4.35,     2.675,   1e-7,
+                                     1e-6,  1e15,     1e16,     1e21,     1e22,    9007199254740992.0,
+                                     5e-324, DBL_MIN, DBL_MAX, -DBL_MAX, 999999999999999.0};
+    for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); i++) {
+        CheckNeighbourhood(check, special[i]);
+    }
+
+    // Every power of two and of ten in range, where the digit generation changes scale.
+    for (int e = -1074; e <= 1023; e++) {
+        CheckNeighbourhood(check, ldexp(1.0, e));
+    }
+    for (int e = -323; e <= 308; e++) {
+        char power[16];
+        snprintf(power, sizeof(power), "1e%d", e);
+        CheckNeighbourhood(check, strtod(power, NULL));
+    }
+
+    // Integers around the end of the fast parsing path and of exact doubles.
+    for (int64_t n = 999999999999000; n <= 1000000000001000; n++) {
+        check((double)n);
+    }
+    for (int shift = 0; shift < 64; shift++) {
+        for (int i = 0; i < 1000; i++) {
+            check((double)(int64_t)(NextRandom() >> shift));
+        }
+    }
+
+    // Sensor readings, as the sample sends them: every two-decimal value in range.
+    for (long n = -READING_LIMIT; n <= READING_LIMIT; n++) {
+        check((double)n / 100.0);
+    }
+
+    // float32 readings widened to double, random bit patterns and subnormals.
+    for (long i = 0; i < RANDOM_FLOATS; i++) {
+        uint32_t bits = (uint32_t)NextRandom();
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        check((double)f);
+    }
+    for (long i = 0; i < RANDOM_BIT_PATTERNS; i++) {
+        uint64_t bits = NextRandom();
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        check(d);
+    }
+    for (long i = 0; i < RANDOM_SUBNORMALS; i++) {
+        uint64_t bits = NextRandom() & 0x800FFFFFFFFFFFFFull;
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        check(d);
+    }
+}
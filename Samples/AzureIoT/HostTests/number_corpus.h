@@ -0,0 +1,11 @@
+// The doubles checked by the number host tests, shared so that every test covers the same ones.
+
+#pragma once
+
+typedef void (*NumberCorpusCheck)(double number);
+
+/// <summary>
+///     Calls check with each double of the corpus, about 2.7 million of them, always in the same
+///     order.  Some are infinite or NaN.
+/// </summary>
+void NumberCorpus_ForEach(NumberCorpusCheck check);
@@ -0,0 +1,116 @@
+// Host test for the number serialization and parsing in parson.c.  Every double written by
+// json_serialize_to_buffer must parse back, through json_parse_string, to the same bits.  The
+// output is also compared with the shortest "%.*g" form that reads back: Grisu2 is correct but
+// not always shortest, so longer output is counted and only fails the test above
+// MAX_NOT_SHORTEST_PERCENT.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number_corpus.h"
+#include "parson.h"
+
+#define SHORTEST_SAMPLE_INTERVAL 16
+#define MAX_NOT_SHORTEST_PERCENT 1.0
+
+static unsigned long checked = 0;
+static unsigned long failures = 0;
+static unsigned long sampled = 0;
+static unsigned long notShortest = 0;
+
+/// <summary>
+///     Returns the number of significant digits in a serialized number.
+/// </summary>
+static int SignificantDigits(const char *text)
+{
+    const char *c = text;
+    int digits = 0, trailingZeros = 0;
+    while (*c == '-' || *c == '0' || *c == '.') {
+        c++;
+    }
+    for (; *c != '\0' && *c != 'e' && *c != 'E'; c++) {
+        if (*c >= '0' && *c <= '9') {
+            digits++;
+            trailingZeros = (*c == '0') ? trailingZeros + 1 : 0;
+        }
+    }
+    // Zeros ending an integer only place the point.
+    if (strchr(text, '.') == NULL && strchr(text, 'e') == NULL) {
+        digits -= trailingZeros;
+    }
+    return digits;
+}
+
+/// <summary>
+///     Returns the fewest significant digits with which "%.*g" reads back as number.
+/// </summary>
+static int ShortestDigits(double number)
+{
+    char text[64];
+    for (int precision = 1; precision < 17; precision++) {
+        snprintf(text, sizeof(text), "%.*g", precision, number);
+        if (strtod(text, NULL) == number) {
+            return SignificantDigits(text);
+        }
+    }
+    return 17;
+}
+
+static void Check(double number)
+{
+    if (!isfinite(number)) {
+        return;
+    }
+    checked++;
+
+    char text[64];
+    JSON_Value *value = json_value_init_number(number);
+    if (value == NULL || json_serialize_to_buffer(value, text, sizeof(text)) != JSONSuccess) {
+        if (failures++ < 10) {
+            printf("FAIL: %.17g could not be serialized\n", number);
+        }
+        json_value_free(value);
+        return;
+    }
+    json_value_free(value);
+
+    JSON_Value *parsed = json_parse_string(text);
+    double result = json_value_get_number(parsed);
+    if (json_value_get_type(parsed) != JSONNumber || memcmp(&result, &number, sizeof(double)) != 0) {
+        if (failures++ < 10) {
+            printf("FAIL: %.17g was written as %s and read back as %.17g\n", number, text, result);
+        }
+    }
+    json_value_free(parsed);
+
+    if (checked % SHORTEST_SAMPLE_INTERVAL == 0) {
+        sampled++;
+        if (SignificantDigits(text) > ShortestDigits(number)) {
+            notShortest++;
+        }
+    }
+}
+
+/// <summary>
+///     Checks number and the doubles on either side of it.
+/// </summary>
+static void CheckNeighbourhood(double number)
+{
+    Check(nextafter(number, -INFINITY));
+    Check(number);
+    Check(nextafter(number, INFINITY));
+}
+
+int main(void)
+{
+    NumberCorpus_ForEach(Check);
+
+    double notShortestPercent = 100.0 * (double)notShortest / (double)sampled;
+    printf("%lu numbers, %lu round-trip failures, %lu of %lu sampled not shortest (%.3f%%)\n",
+           checked, failures, notShortest, sampled, notShortestPercent);
+    return (failures == 0 && notShortestPercent <= MAX_NOT_SHORTEST_PERCENT) ? EXIT_SUCCESS
+                                                                             : EXIT_FAILURE;
+}
@@ -0,0 +1,331 @@
+// Host test for parsing into an arena with json_parse_string_arena in parson.c.  Each document
+// of json_corpus.c is parsed into an arena and onto the heap.  The two must be equal, serialize
+// the same, and have the same parent links.  The same changes are then made to both: values
+// set, replaced and removed, objects grown past their arena capacity and name index, arrays
+// cleared, deep copies and other arena documents inserted.  They must still be equal, a deep
+// copy taken before the changes must outlive the arena, and every block parson allocated must
+// be freed.  Truncated documents, invalid documents and failing allocations must give the same
+// result in both parsers and leave nothing allocated.  CMake builds the test with AddressSanitizer
+// where the compiler has it, which also catches use of arena memory after it is released.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_corpus.h"
+#include "parson.h"
+
+// Documents up to these sizes are also parsed truncated at every length, and with each of their
+// allocations failing in turn.
+#define MAX_PREFIX_DOCUMENT 1024
+#define MAX_FAILING_DOCUMENT 512
+
+static unsigned long documents = 0;
+static unsigned long failures = 0;
+
+// Allocations made through parson and not yet freed, and all allocations made.  While
+// failAfter is not negative, the allocation after that many more fails.
+static long liveAllocations = 0;
+static unsigned long allocations = 0;
+static long failAfter = -1;
+
+// Allocations made by each parser over the whole corpus.
+static unsigned long heapParseAllocations = 0;
+static unsigned long arenaParseAllocations = 0;
+
+static void *CountingMalloc(size_t size)
+{
+    if (failAfter == 0) {
+        return NULL;
+    }
+    if (failAfter > 0) {
+        failAfter--;
+    }
+    void *block = malloc(size);
+    if (block != NULL) {
+        liveAllocations++;
+        allocations++;
+    }
+    return block;
+}
+
+static void CountingFree(void *block)
+{
+    if (block != NULL) {
+        liveAllocations--;
+    }
+    free(block);
+}
+
+static void Fail(const char *document, const char *what)
+{
+    printf("FAIL: %s: %.60s%s\n", what, document, strlen(document) > 60 ? "..." : "");
+    failures++;
+}
+
+/// <summary>
+///     Returns true if every value below value has it as its parent, and its object or array
+///     has it as the wrapping value.
+/// </summary>
+static bool LinksAreConsistent(const JSON_Value *value)
+{
+    JSON_Object *object = json_value_get_object(value);
+    JSON_Array *array = json_value_get_array(value);
+    if (object != NULL) {
+        if (json_object_get_wrapping_value(object) != value) {
+            return false;
+        }
+        for (size_t i = 0; i < json_object_get_count(object); i++) {
+            JSON_Value *child = json_object_get_value_at(object, i);
+            if (json_value_get_parent(child) != value || !LinksAreConsistent(child)) {
+                return false;
+            }
+        }
+    } else if (array != NULL) {
+        if (json_array_get_wrapping_value(array) != value) {
+            return false;
+        }
+        for (size_t i = 0; i < json_array_get_count(array); i++) {
+            JSON_Value *child = json_array_get_value(array, i);
+            if (json_value_get_parent(child) != value || !LinksAreConsistent(child)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/// <summary>
+///     Returns true if a and b serialize to the same text, compact and pretty.
+/// </summary>
+static bool SerializeSame(const JSON_Value *a, const JSON_Value *b)
+{
+    bool same = true;
+    for (int pretty = 0; pretty <= 1 && same; pretty++) {
+        char *textA = pretty ? json_serialize_to_string_pretty(a) : json_serialize_to_string(a);
+        char *textB = pretty ? json_serialize_to_string_pretty(b) : json_serialize_to_string(b);
+        same = textA != NULL && textB != NULL && strcmp(textA, textB) == 0;
+        json_free_serialized_string(textA);
+        json_free_serialized_string(textB);
+    }
+    return same;
+}
+
+/// <summary>
+///     Makes the same changes to any document equal to value.  Containers directly below value
+///     are changed first, down to depth 2, so that the changes reach arena values that are not
+///     the root.
+/// </summary>
+static void Change(JSON_Value *value, int depth)
+{
+    JSON_Object *object = json_value_get_object(value);
+    JSON_Array *array = json_value_get_array(value);
+
+    if (depth < 2) {
+        size_t count = object != NULL ? json_object_get_count(object)
+                                      : array != NULL ? json_array_get_count(array) : 0;
+        for (size_t i = 0; i < count && i < 3; i++) {
+            Change(object != NULL ? json_object_get_value_at(object, i)
+                                  : json_array_get_value(array, i),
+                   depth + 1);
+        }
+    }
+
+    if (object != NULL) {
+        size_t count = json_object_get_count(object);
+        if (count > 0) {
+            // Replaces a value parsed into the arena with one from the heap.
+            json_object_set_number(object, json_object_get_name(object, 0), 42);
+            json_object_remove(object, json_object_get_name(object, count / 2));
+        }
+        json_object_set_string(object, "added", "text with \"escapes\"\n");
+        json_object_dotset_number(object, "new.deep.path", 1.5);
+
+        JSON_Object *child = NULL;
+        count = json_object_get_count(object);
+        for (size_t i = 0; i < count && child == NULL; i++) {
+            child = json_value_get_object(json_object_get_value_at(object, i));
+        }
+        if (child != NULL) {
+            // Enough names to outgrow the capacity the arena gave the object and to index them.
+            for (int i = 0; i < 20; i++) {
+                char name[16];
+                snprintf(name, sizeof(name), "added%d", i);
+                json_object_set_number(child, name, i);
+            }
+            json_object_set_value(object, "copy",
+                                  json_value_deep_copy(json_object_get_wrapping_value(child)));
+            json_object_clear(child);
+        }
+        json_object_set_value(object, "nested", json_parse_string_arena("{\"n\":[1,\"two\",{}]}"));
+    } else if (array != NULL) {
+        size_t count = json_array_get_count(array);
+        if (count > 0) {
+            json_array_replace_number(array, 0, 42);
+            json_array_remove(array, count / 2);
+        }
+        json_array_append_string(array, "appended");
+        json_array_append_value(array, json_value_deep_copy(json_array_get_value(array, 0)));
+
+        JSON_Array *child = NULL;
+        count = json_array_get_count(array);
+        for (size_t i = 0; i < count && child == NULL; i++) {
+            child = json_value_get_array(json_array_get_value(array, i));
+        }
+        if (child != NULL) {
+            for (int i = 0; i < 20; i++) {
+                json_array_append_number(child, i);
+            }
+            json_array_clear(child);
+        }
+        json_array_append_value(array, json_parse_string_arena("[{\"n\":\"nested\"}]"));
+    }
+}
+
+static void CheckDocument(const char *document)
+{
+    documents++;
+    long baseline = liveAllocations;
+
+    unsigned long start = allocations;
+    JSON_Value *heap = json_parse_string(document);
+    heapParseAllocations += allocations - start;
+    start = allocations;
+    JSON_Value *arena = json_parse_string_arena(document);
+    arenaParseAllocations += allocations - start;
+
+    if (heap == NULL || arena == NULL) {
+        Fail(document, heap == NULL ? "heap parse failed" : "arena parse failed");
+        json_value_free(heap);
+        json_value_free(arena);
+        return;
+    }
+    if (!json_value_equals(heap, arena) || !SerializeSame(heap, arena)) {
+        Fail(document, "arena document differs from heap document");
+    }
+    if (json_value_get_parent(arena) != NULL || !LinksAreConsistent(arena)) {
+        Fail(document, "arena document has broken parent links");
+    }
+
+    JSON_Value *copy = json_value_deep_copy(arena);
+    char *original = json_serialize_to_string(arena);
+
+    Change(heap, 0);
+    Change(arena, 0);
+    if (!json_value_equals(heap, arena) || !SerializeSame(heap, arena)) {
+        Fail(document, "changed arena document differs from changed heap document");
+    }
+    if (!LinksAreConsistent(arena)) {
+        Fail(document, "changed arena document has broken parent links");
+    }
+
+    json_value_free(arena);
+    char *copied = json_serialize_to_string(copy);
+    if (original == NULL || copied == NULL || strcmp(original, copied) != 0) {
+        Fail(document, "deep copy changed when the arena was freed");
+    }
+    json_free_serialized_string(original);
+    json_free_serialized_string(copied);
+    json_value_free(copy);
+    json_value_free(heap);
+
+    if (liveAllocations != baseline) {
+        Fail(document, "allocations left after freeing the documents");
+    }
+}
+
+/// <summary>
+///     Parses document with both parsers, which must both fail or give equal documents, and
+///     frees the results.
+/// </summary>
+static void CheckSameResult(const char *document, const char *what)
+{
+    long baseline = liveAllocations;
+    JSON_Value *heap = json_parse_string(document);
+    JSON_Value *arena = json_parse_string_arena(document);
+    if ((heap == NULL) != (arena == NULL) || !json_value_equals(heap, arena)) {
+        Fail(document, what);
+    }
+    json_value_free(heap);
+    json_value_free(arena);
+    if (liveAllocations != baseline) {
+        Fail(document, "allocations left after a parse");
+    }
+}
+
+static void CheckPrefixes(const char *document)
+{
+    static char prefix[MAX_PREFIX_DOCUMENT + 1];
+    size_t length = strlen(document);
+    if (length > MAX_PREFIX_DOCUMENT) {
+        return;
+    }
+    for (size_t i = 0; i < length; i++) {
+        memcpy(prefix, document, i);
+        prefix[i] = '\0';
+        CheckSameResult(prefix, "truncated document parsed differently");
+    }
+}
+
+static void CheckInvalid(const char *document)
+{
+    long baseline = liveAllocations;
+    JSON_Value *arena = json_parse_string_arena(document);
+    if (arena != NULL) {
+        Fail(document, "invalid document parsed into an arena");
+        json_value_free(arena);
+    }
+    if (liveAllocations != baseline) {
+        Fail(document, "allocations left after a failed parse");
+    }
+}
+
+static void CheckFailingAllocations(const char *document)
+{
+    if (strlen(document) > MAX_FAILING_DOCUMENT) {
+        return;
+    }
+    long baseline = liveAllocations;
+    JSON_Value *arena = NULL;
+    for (long n = 0; arena == NULL && n < 1000; n++) {
+        failAfter = n;
+        arena = json_parse_string_arena(document);
+        failAfter = -1;
+        if (arena == NULL && liveAllocations != baseline) {
+            Fail(document, "allocations left after a failed allocation");
+            return;
+        }
+    }
+    if (arena == NULL) {
+        Fail(document, "arena parse never succeeded");
+    }
+    json_value_free(arena);
+}
+
+int main(void)
+{
+    json_set_allocation_functions(CountingMalloc, CountingFree);
+
+    JsonCorpus_ForEach(CheckDocument);
+    JsonCorpus_ForEach(CheckPrefixes);
+    JsonCorpus_ForEach(CheckFailingAllocations);
+    JsonCorpus_ForEachInvalid(CheckInvalid);
+    JsonCorpus_ForEachInvalid(CheckPrefixes);
+
+    // An arena is meant to replace the allocations of every value with a few blocks.
+    printf("%lu allocations parsing onto the heap, %lu into arenas\n", heapParseAllocations,
+           arenaParseAllocations);
+    if (arenaParseAllocations * 10 > heapParseAllocations) {
+        printf("FAIL: arena parsing saves less than 90%% of the allocations\n");
+        failures++;
+    }
+    if (liveAllocations != 0) {
+        printf("FAIL: %ld allocations left at the end\n", liveAllocations);
+        failures++;
+    }
+
+    printf("%lu documents checked, %lu failures\n", documents, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
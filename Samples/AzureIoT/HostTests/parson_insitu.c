@@ -0,0 +1,438 @@
+// Host test for parsing in place with json_parse_string_insitu in parson.c.  Strings with each
+// escape and with surrogate pairs must unescape to known UTF-8 bytes.  Each document of
+// json_corpus.c, and a set of documents made of string escapes, surrogate pairs and strings
+// right against the characters around them, is parsed in place and with json_parse_string.  The
+// two must be equal and serialize the same, and every string and name of the in-place document
+// must point into the buffer.  The document is then changed, and a deep copy of it must not
+// change when the buffer is overwritten.  Invalid documents, truncated ones, randomly damaged
+// ones and failing allocations must give the same result as json_parse_string and leave nothing
+// allocated.  Each buffer is allocated at the size of its document, so that AddressSanitizer
+// catches any read past it, and a free of memory inside it.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_corpus.h"
+#include "parson.h"
+
+// Documents up to these sizes are also parsed truncated at every length, with each of their
+// allocations failing in turn, and damaged this many times.
+#define MAX_PREFIX_DOCUMENT 1024
+#define MAX_FAILING_DOCUMENT 512
+#define DAMAGED_COPIES 20
+
+static const char *const stringDocuments[] = {
+    "[\"\\\"\",\"\\\\\",\"\\/\",\"\\b\",\"\\f\",\"\\n\",\"\\r\",\"\\t\"]",
+    "[\"\\\"\\\\\\/\\b\\f\\n\\r\\t\",\"a\\\"b\",\"\\\\\\\\\",\"x\\\\\"]",
+    "[\"\\u0041\",\"\\u00e9\",\"\\u07ff\",\"\\u0800\",\"\\u20AC\",\"\\uffff\",\"\\u0000\"]",
+    "[\"\\ud800\\udc00\",\"\\udbff\\udfff\",\"\\uD83D\\uDE00\",\"a\\ud83d\\ude00b\"]",
+    "[\"\\ud83d\\ude00\\ud83d\\ude00\",\"\\u00e9\\u00e9\\u00e9\",\"\\u0041\\n\\u0042\"]",
+    "{\"\\n\":1,\"\\u00e9\":2,\"\\ud83d\\ude00\":3,\"a\\\"b\":4,\"\":5,\"\\\\\":6}",
+    "{\"a\":\"\",\"b\":\"\\n\",\"c\":[\"\"],\"d\":{\"\":\"\"}}",
+    "[\"\xC3\xA9\",\"\xE2\x82\xAC\",\"\xF0\x9F\x98\x80\",\"\xEF\xBF\xBF\",\"a\xC3\xA9\\n\"]",
+    "\"\\u0041\"",
+    "\"\\ud83d\\ude00\"",
+    "\"plain\"",
+    "{\"k\":\"v\"}",
+    "[\"a\",\"b\"]",
+    "{\"a\":{\"b\":\"c\"},\"d\":[\"e\"]}",
+};
+
+// Strings and what they must unescape to.
+static const struct {
+    const char *document;
+    const char *expected;
+} unescaped[] = {
+    {"\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"", "\"\\/\b\f\n\r\t"},
+    {"\"\\u0041\\u00e9\\u07FF\"", "A\xC3\xA9\xDF\xBF"},
+    {"\"\\u0800\\u20ac\\uffff\"", "\xE0\xA0\x80\xE2\x82\xAC\xEF\xBF\xBF"},
+    {"\"\\ud800\\udc00\"", "\xF0\x90\x80\x80"},
+    {"\"a\\ud83d\\ude00b\"", "a\xF0\x9F\x98\x80" "b"},
+    {"\"\\udbff\\udfff\\n\"", "\xF4\x8F\xBF\xBF\n"},
+    {"\"x\\u0000y\"", "x"},
+    {"\"\xC3\xA9\\u00e9\"", "\xC3\xA9\xC3\xA9"},
+};
+
+static const char *const invalidStringDocuments[] = {
+    "\"\\ud800\"",
+    "\"\\udbff\"",
+    "\"\\udc00\"",
+    "\"\\udfff\\ud800\"",
+    "\"\\ud800\\u0041\"",
+    "\"\\ud800\\n\"",
+    "\"\\ud800\\\"",
+    "\"\\ud800\\u\"",
+    "\"\\ud800\\udc0\"",
+    "\"\\u\"",
+    "\"\\u004\"",
+    "\"\\u00G0\"",
+    "\"\\a\"",
+    "\"\\'\"",
+    "\"\\\"",
+    "\"\\",
+    "\"a\nb\"",
+    "\"a\x1f\"",
+    "{\"a\\x\":1}",
+    "{\"\\ud800\":1}",
+    "[\"\\u0041\",\"\\q\"]",
+};
+
+static unsigned long documents = 0;
+static unsigned long failures = 0;
+static uint64_t randomState = 88172645463325252ull;
+
+static long liveAllocations = 0;
+static long failAfter = -1;
+
+static uint64_t NextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static void *CountingMalloc(size_t size)
+{
+    if (failAfter == 0) {
+        return NULL;
+    }
+    if (failAfter > 0) {
+        failAfter--;
+    }
+    void *block = malloc(size);
+    if (block != NULL) {
+        liveAllocations++;
+    }
+    return block;
+}
+
+static void CountingFree(void *block)
+{
+    if (block != NULL) {
+        liveAllocations--;
+    }
+    free(block);
+}
+
+static void Fail(const char *document, const char *what)
+{
+    printf("FAIL: %s: %.60s%s\n", what, document, strlen(document) > 60 ? "..." : "");
+    failures++;
+}
+
+/// <summary>
+///     Returns a copy of the first length bytes of document, in a buffer of exactly that size
+///     and its terminating null.  The test allocates it with malloc, not through parson.
+/// </summary>
+static char *CopyDocument(const char *document, size_t length)
+{
+    char *buffer = malloc(length + 1);
+    memcpy(buffer, document, length);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+static bool InBuffer(const char *text, const char *buffer, size_t length)
+{
+    return text >= buffer && text < buffer + length;
+}
+
+/// <summary>
+///     Returns true if every string and name below value points into buffer.
+/// </summary>
+static bool StringsInBuffer(const JSON_Value *value, const char *buffer, size_t length)
+{
+    JSON_Object *object = json_value_get_object(value);
+    JSON_Array *array = json_value_get_array(value);
+    if (json_value_get_type(value) == JSONString) {
+        return InBuffer(json_value_get_string(value), buffer, length);
+    } else if (object != NULL) {
+        for (size_t i = 0; i < json_object_get_count(object); i++) {
+            if (!InBuffer(json_object_get_name(object, i), buffer, length) ||
+                !StringsInBuffer(json_object_get_value_at(object, i), buffer, length)) {
+                return false;
+            }
+        }
+    } else if (array != NULL) {
+        for (size_t i = 0; i < json_array_get_count(array); i++) {
+            if (!StringsInBuffer(json_array_get_value(array, i), buffer, length)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool SerializeSame(const JSON_Value *a, const JSON_Value *b)
+{
+    char *textA = json_serialize_to_string(a);
+    char *textB = json_serialize_to_string(b);
+    bool same = textA != NULL && textB != NULL && strcmp(textA, textB) == 0;
+    json_free_serialized_string(textA);
+    json_free_serialized_string(textB);
+    return same;
+}
+
+/// <summary>
+///     Replaces, removes and adds values of an in-place document, so that freeing it has to
+///     tell strings in the buffer from strings on the heap.
+/// </summary>
+static void Change(JSON_Value *value)
+{
+    JSON_Object *object = json_value_get_object(value);
+    JSON_Array *array = json_value_get_array(value);
+    if (object != NULL) {
+        size_t count = json_object_get_count(object);
+        if (count > 0) {
+            json_object_set_string(object, json_object_get_name(object, 0), "replaced");
+            json_object_remove(object, json_object_get_name(object, count / 2));
+        }
+        json_object_set_string(object, "added", "text");
+        json_object_dotset_string(object, "a.b", "dotted");
+    } else if (array != NULL) {
+        size_t count = json_array_get_count(array);
+        if (count > 0) {
+            json_array_replace_string(array, 0, "replaced");
+            json_array_remove(array, count / 2);
+        }
+        json_array_append_string(array, "added");
+    }
+}
+
+static void CheckDocument(const char *document)
+{
+    documents++;
+    long baseline = liveAllocations;
+    size_t length = strlen(document);
+    char *buffer = CopyDocument(document, length);
+
+    JSON_Value *heap = json_parse_string(document);
+    JSON_Value *insitu = json_parse_string_insitu(buffer);
+    if (heap == NULL || insitu == NULL) {
+        Fail(document, heap == NULL ? "parse failed" : "in-place parse failed");
+    } else {
+        if (!json_value_equals(heap, insitu) || !SerializeSame(heap, insitu)) {
+            Fail(document, "in-place document differs from parsed document");
+        }
+        if (!StringsInBuffer(insitu, buffer, length)) {
+            Fail(document, "in-place document has a string outside the buffer");
+        }
+
+        // A deep copy holds its own strings.
+        JSON_Value *copy = json_value_deep_copy(insitu);
+        char *copied = json_serialize_to_string(copy);
+        Change(insitu);
+        memset(buffer, 'x', length);
+        char *after = json_serialize_to_string(copy);
+        if (copied == NULL || after == NULL || strcmp(copied, after) != 0) {
+            Fail(document, "deep copy changed when the buffer was overwritten");
+        }
+        json_free_serialized_string(copied);
+        json_free_serialized_string(after);
+        json_value_free(copy);
+    }
+    json_value_free(insitu);
+    json_value_free(heap);
+    free(buffer);
+
+    if (liveAllocations != baseline) {
+        Fail(document, "allocations left after freeing the documents");
+    }
+}
+
+/// <summary>
+///     Parses the first length bytes of document in place and with json_parse_string, which must
+///     both fail or give equal documents.
+/// </summary>
+static void CheckSameResult(const char *document, size_t length, const char *what)
+{
+    long baseline = liveAllocations;
+    char *text = CopyDocument(document, length);
+    char *buffer = CopyDocument(document, length);
+    JSON_Value *heap = json_parse_string(text);
+    JSON_Value *insitu = json_parse_string_insitu(buffer);
+    if ((heap == NULL) != (insitu == NULL) || !json_value_equals(heap, insitu)) {
+        Fail(text, what);
+    }
+    json_value_free(insitu);
+    json_value_free(heap);
+    free(buffer);
+    free(text);
+    if (liveAllocations != baseline) {
+        Fail(document, "allocations left after a parse");
+    }
+}
+
+static void CheckPrefixes(const char *document)
+{
+    size_t length = strlen(document);
+    if (length <= MAX_PREFIX_DOCUMENT) {
+        for (size_t i = 0; i < length; i++) {
+            CheckSameResult(document, i, "truncated document parsed differently in place");
+        }
+    }
+}
+
+/// <summary>
+///     Damages copies of document by overwriting, inserting or removing a few bytes, favouring
+///     the characters that matter inside strings.
+/// </summary>
+static void CheckDamaged(const char *document)
+{
+    static const char characters[] = "\\\"u0aDd8c{}[],:\x01\xC3\xA9\xED\xF0";
+    size_t length = strlen(document);
+    if (length == 0 || length > MAX_PREFIX_DOCUMENT) {
+        return;
+    }
+    char *damaged = malloc(length + 8);
+    for (int copy = 0; copy < DAMAGED_COPIES; copy++) {
+        size_t damagedLength = length;
+        memcpy(damaged, document, length);
+        for (int change = 0, changes = 1 + (int)(NextRandom() % 3); change < changes; change++) {
+            size_t at = (size_t)(NextRandom() % damagedLength);
+            char character = characters[NextRandom() % (sizeof(characters) - 1)];
+            switch (NextRandom() % 3) {
+            case 0:
+                damaged[at] = character;
+                break;
+            case 1:
+                memmove(damaged + at + 1, damaged + at, damagedLength - at);
+                damaged[at] = character;
+                damagedLength++;
+                break;
+            default:
+                if (damagedLength > 1) {
+                    memmove(damaged + at, damaged + at + 1, damagedLength - at - 1);
+                    damagedLength--;
+                }
+                break;
+            }
+        }
+        CheckSameResult(damaged, damagedLength, "damaged document parsed differently in place");
+    }
+    free(damaged);
+}
+
+static void CheckInvalid(const char *document)
+{
+    long baseline = liveAllocations;
+    char *buffer = CopyDocument(document, strlen(document));
+    JSON_Value *insitu = json_parse_string_insitu(buffer);
+    if (insitu != NULL) {
+        Fail(document, "invalid document parsed in place");
+        json_value_free(insitu);
+    }
+    free(buffer);
+    if (liveAllocations != baseline) {
+        Fail(document, "allocations left after a failed in-place parse");
+    }
+}
+
+static void CheckFailingAllocations(const char *document)
+{
+    size_t length = strlen(document);
+    if (length > MAX_FAILING_DOCUMENT) {
+        return;
+    }
+    long baseline = liveAllocations;
+    JSON_Value *insitu = NULL;
+    char *buffer = NULL;
+    for (long n = 0; insitu == NULL && n < 1000; n++) {
+        // A failed parse may have unescaped part of the buffer already.
+        free(buffer);
+        buffer = CopyDocument(document, length);
+        failAfter = n;
+        insitu = json_parse_string_insitu(buffer);
+        failAfter = -1;
+        if (insitu == NULL && liveAllocations != baseline) {
+            Fail(document, "allocations left after a failed allocation");
+            break;
+        }
+    }
+    if (insitu == NULL) {
+        Fail(document, "in-place parse never succeeded");
+    }
+    json_value_free(insitu);
+    free(buffer);
+}
+
+static void ForEachStringDocument(JsonCorpusCheck check)
+{
+    for (size_t i = 0; i < sizeof(stringDocuments) / sizeof(stringDocuments[0]); i++) {
+        check(stringDocuments[i]);
+    }
+
+    // Long strings with escapes at every spacing, so that some fall at the end of the block the
+    // vector scanning reads and some straddle it.
+    char document[2048];
+    for (int spacing = 1; spacing <= 40; spacing++) {
+        size_t length = 0;
+        document[length++] = '[';
+        document[length++] = '"';
+        for (int i = 0; length < sizeof(document) - 32; i++) {
+            if (i % spacing == spacing - 1) {
+                static const char *const escapes[] = {"\\n", "\\\"", "\\u00e9", "\\ud83d\\ude00"};
+                const char *escape = escapes[i % 4];
+                memcpy(document + length, escape, strlen(escape));
+                length += strlen(escape);
+            } else {
+                document[length++] = (char)('a' + i % 26);
+            }
+        }
+        memcpy(document + length, "\",\"x\"]", 7);
+        check(document);
+    }
+}
+
+static void CheckUnescaped(void)
+{
+    for (size_t i = 0; i < sizeof(unescaped) / sizeof(unescaped[0]); i++) {
+        documents++;
+        char *buffer = CopyDocument(unescaped[i].document, strlen(unescaped[i].document));
+        JSON_Value *insitu = json_parse_string_insitu(buffer);
+        const char *string = json_value_get_string(insitu);
+        if (string == NULL || strcmp(string, unescaped[i].expected) != 0) {
+            Fail(unescaped[i].document, "string unescaped wrongly in place");
+        }
+        json_value_free(insitu);
+        free(buffer);
+    }
+}
+
+static void ForEachInvalidStringDocument(JsonCorpusCheck check)
+{
+    for (size_t i = 0; i < sizeof(invalidStringDocuments) / sizeof(invalidStringDocuments[0]);
+         i++) {
+        check(invalidStringDocuments[i]);
+    }
+}
+
+int main(void)
+{
+    json_set_allocation_functions(CountingMalloc, CountingFree);
+
+    CheckUnescaped();
+    JsonCorpus_ForEach(CheckDocument);
+    ForEachStringDocument(CheckDocument);
+    JsonCorpus_ForEach(CheckPrefixes);
+    ForEachStringDocument(CheckPrefixes);
+    JsonCorpus_ForEach(CheckDamaged);
+    ForEachStringDocument(CheckDamaged);
+    JsonCorpus_ForEach(CheckFailingAllocations);
+    ForEachStringDocument(CheckFailingAllocations);
+    JsonCorpus_ForEachInvalid(CheckInvalid);
+    ForEachInvalidStringDocument(CheckInvalid);
+    ForEachInvalidStringDocument(CheckPrefixes);
+
+    if (liveAllocations != 0) {
+        printf("FAIL: %ld allocations left at the end\n", liveAllocations);
+        failures++;
+    }
+
+    printf("%lu documents checked, %lu failures\n", documents, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,357 @@
+// Host test for the name index parson.c keeps for objects with more than OBJECT_INDEX_THRESHOLD
+// names.  Random sets, replacements, removals, clears and lookups are made on parson objects and
+// on a model of them, and the two must agree after every step: the same names in the same
+// order, with the same values, and every name found or not found as in the model.  The objects
+// grow and shrink across the threshold and up to thousands of names.  The names include
+// prefixes of each other, the empty name, UTF-8 and pairs with the same 32-bit hash, which the
+// index can only tell apart by comparing them.  Objects are also parsed, onto the heap and into
+// an arena, and then changed the same way, and some allocations are made to fail so that an
+// index that cannot grow is dropped.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parson.h"
+
+#define PLAIN_NAMES 5000
+#define COLLIDING_PAIRS 16
+#define MAX_NAMES (PLAIN_NAMES + 8 + 2 * COLLIDING_PAIRS)
+#define NAME_SIZE 16
+
+static uint64_t randomState = 88172645463325252ull;
+static unsigned long steps = 0;
+static unsigned long failures = 0;
+
+// Names the objects are made of.
+static char names[MAX_NAMES][NAME_SIZE];
+static size_t nameCount = 0;
+
+// The model: the name of each member in order, its value, and the position of each name or -1.
+static size_t members[MAX_NAMES];
+static double values[MAX_NAMES];
+static size_t memberCount = 0;
+static long positions[MAX_NAMES];
+
+// While failing is set, about one allocation in failEvery fails.
+static bool failing = false;
+static unsigned int failEvery = 20;
+
+static uint64_t NextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static size_t Below(size_t limit)
+{
+    return (size_t)(NextRandom() % limit);
+}
+
+static void *FailingMalloc(size_t size)
+{
+    if (failing && Below(failEvery) == 0) {
+        return NULL;
+    }
+    return malloc(size);
+}
+
+// FNV-1a, as parson hashes names.
+static uint32_t HashName(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int CompareHashes(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/// <summary>
+///     Writes the candidate name with the given number: 10 letters that depend only on the
+///     number and seed.
+/// </summary>
+static void CandidateName(uint64_t number, uint64_t seed, char *name)
+{
+    uint64_t bits = (number + 1) * 0x9e3779b97f4a7c15ull ^ seed;
+    for (int i = 0; i < 10; i++) {
+        bits ^= bits << 13;
+        bits ^= bits >> 7;
+        bits ^= bits << 17;
+        name[i] = (char)('a' + bits % 26);
+    }
+    name[10] = '\0';
+}
+
+static void AddName(const char *name)
+{
+    snprintf(names[nameCount++], NAME_SIZE, "%s", name);
+}
+
+/// <summary>
+///     Fills names with plain names, some special ones and pairs of names with the same hash,
+///     found among a few hundred thousand candidates.
+/// </summary>
+static void MakeNames(void)
+{
+    char name[NAME_SIZE];
+    for (int i = 0; i < PLAIN_NAMES; i++) {
+        snprintf(name, sizeof(name), "n%d", i);
+        AddName(name);
+    }
+    AddName("");
+    AddName("n");
+    AddName("n1.5");
+    AddName("\xC3\xA9");
+    AddName("\xC3\xA9\xC3\xA9");
+    AddName("N1");
+    AddName("n01");
+    AddName("n1 ");
+
+    // Each entry is a hash in the high bits and a candidate number in the low ones.  Numbered
+    // names hardly ever have the same hash, so the candidates are random letters.
+    enum { Candidates = 600000 };
+    uint64_t *hashes = malloc(Candidates * sizeof(uint64_t));
+    uint64_t seed = randomState;
+    for (uint64_t i = 0; i < Candidates; i++) {
+        CandidateName(i, seed, name);
+        hashes[i] = ((uint64_t)HashName(name) << 32) | i;
+    }
+    qsort(hashes, Candidates, sizeof(uint64_t), CompareHashes);
+    int pairs = 0;
+    for (size_t i = 1; i < Candidates && pairs < COLLIDING_PAIRS; i++) {
+        if (hashes[i] >> 32 == hashes[i - 1] >> 32) {
+            CandidateName(hashes[i - 1] & 0xffffffff, seed, name);
+            AddName(name);
+            CandidateName(hashes[i] & 0xffffffff, seed, name);
+            AddName(name);
+            pairs++;
+        }
+    }
+    free(hashes);
+    if (pairs < COLLIDING_PAIRS) {
+        printf("FAIL: found only %d names with the same hash\n", pairs);
+        failures++;
+    }
+}
+
+static void Fail(const char *what, const char *name)
+{
+    printf("FAIL: step %lu: %s \"%s\"\n", steps, what, name);
+    failures++;
+}
+
+static void ModelClear(void)
+{
+    for (size_t i = 0; i < memberCount; i++) {
+        positions[members[i]] = -1;
+    }
+    memberCount = 0;
+}
+
+static void ModelSet(size_t name, double value)
+{
+    if (positions[name] < 0) {
+        positions[name] = (long)memberCount;
+        members[memberCount++] = name;
+    }
+    values[positions[name]] = value;
+}
+
+// As parson does, the last member takes the place of a removed one.
+static void ModelRemove(size_t name)
+{
+    size_t i = (size_t)positions[name];
+    positions[name] = -1;
+    memberCount--;
+    if (i != memberCount) {
+        members[i] = members[memberCount];
+        values[i] = values[memberCount];
+        positions[members[i]] = (long)i;
+    }
+}
+
+/// <summary>
+///     Looks name up in object, which must find it exactly when the model holds it.
+/// </summary>
+static void CheckLookup(const JSON_Object *object, size_t name)
+{
+    JSON_Value *value = json_object_get_value(object, names[name]);
+    if (positions[name] < 0) {
+        if (value != NULL || json_object_has_value(object, names[name])) {
+            Fail("found removed or never set name", names[name]);
+        }
+    } else if (value == NULL || json_value_get_number(value) != values[positions[name]]) {
+        Fail(value == NULL ? "did not find name" : "found wrong value for name", names[name]);
+    }
+}
+
+/// <summary>
+///     Checks that object holds what the model does, in the same order.
+/// </summary>
+static void CheckAll(const JSON_Object *object)
+{
+    if (json_object_get_count(object) != memberCount) {
+        printf("FAIL: step %lu: %zu names, expected %zu\n", steps, json_object_get_count(object),
+               memberCount);
+        failures++;
+        return;
+    }
+    for (size_t i = 0; i < memberCount; i++) {
+        const char *name = json_object_get_name(object, i);
+        if (name == NULL || strcmp(name, names[members[i]]) != 0 ||
+            json_value_get_number(json_object_get_value_at(object, i)) != values[i]) {
+            Fail("name or value out of place", names[members[i]]);
+            return;
+        }
+        CheckLookup(object, members[i]);
+    }
+}
+
+/// <summary>
+///     Makes count random changes to object and to the model, which must already agree.  A
+///     quarter of the names are the special and colliding ones, the others are drawn from the
+///     first nameRange plain names.  A remove is made removeWeight times in 8, so that the object
+///     shrinks or grows.
+/// </summary>
+static void ChangeRandomly(JSON_Object *object, size_t nameRange, unsigned int removeWeight,
+                           unsigned long count)
+{
+    for (unsigned long i = 0; i < count; i++) {
+        steps++;
+        size_t name = Below(4) == 0 ? nameCount - 1 - Below(nameCount - PLAIN_NAMES)
+                                    : Below(nameRange);
+        unsigned int action = (unsigned int)Below(64);
+        if (action == 0 && Below(16) == 0) {
+            json_object_clear(object);
+            ModelClear();
+        } else if (action < removeWeight * 8) {
+            JSON_Status status = json_object_remove(object, names[name]);
+            if ((status == JSONSuccess) != (positions[name] >= 0)) {
+                Fail("remove gave the wrong result for", names[name]);
+            }
+            if (positions[name] >= 0) {
+                ModelRemove(name);
+            }
+        } else {
+            // json_object_set_number would leak the value when it cannot be added.
+            JSON_Value *value = json_value_init_number((double)steps);
+            if (value != NULL && json_object_set_value(object, names[name], value) == JSONSuccess) {
+                ModelSet(name, (double)steps);
+            } else {
+                json_value_free(value);
+                if (!failing) {
+                    Fail("could not set", names[name]);
+                }
+            }
+        }
+        CheckLookup(object, name);
+        CheckLookup(object, Below(nameCount));
+        if (memberCount <= 2 * 8 + 2 || i % 97 == 0) {
+            CheckAll(object);
+        }
+    }
+    CheckAll(object);
+}
+
+static void CheckBuiltObjects(void)
+{
+    JSON_Value *root = json_value_init_object();
+    JSON_Object *object = json_value_get_object(root);
+
+    // Around the threshold, with all of the special and colliding names in play.
+    ChangeRandomly(object, 12, 4, 20000);
+    ChangeRandomly(object, PLAIN_NAMES, 4, 20000);
+
+    // Up to thousands of names, and back down.
+    ChangeRandomly(object, PLAIN_NAMES, 1, 30000);
+    ChangeRandomly(object, PLAIN_NAMES, 6, 30000);
+
+    // With allocations failing, so that the index is sometimes dropped and rebuilt later.
+    failing = true;
+    ChangeRandomly(object, PLAIN_NAMES, 2, 20000);
+    ChangeRandomly(object, 40, 4, 20000);
+    failing = false;
+    ChangeRandomly(object, PLAIN_NAMES, 1, 10000);
+
+    json_value_free(root);
+    ModelClear();
+}
+
+/// <summary>
+///     Parses an object of count names, with both parsers, and checks and changes each parsed
+///     object as the built ones are.
+/// </summary>
+static void CheckParsedObject(size_t count)
+{
+    size_t size = count * (NAME_SIZE + 32) + 3;
+    char *document = malloc(size);
+    size_t length = 0;
+    document[length++] = '{';
+    for (size_t i = 0; i < count; i++) {
+        size_t name = Below(nameCount);
+        while (positions[name] >= 0) {
+            name = (name + 1) % nameCount;
+        }
+        ModelSet(name, (double)i);
+        length += (size_t)snprintf(document + length, size - length, "%s\"%s\":%zu",
+                                   i > 0 ? "," : "", names[name], i);
+    }
+    document[length++] = '}';
+    document[length] = '\0';
+
+    for (int arena = 0; arena <= 1; arena++) {
+        steps++;
+        // Each parser starts from the model of the document.
+        size_t savedMembers[MAX_NAMES];
+        memcpy(savedMembers, members, memberCount * sizeof(size_t));
+        size_t savedCount = memberCount;
+
+        JSON_Value *root = arena ? json_parse_string_arena(document) : json_parse_string(document);
+        JSON_Object *object = json_value_get_object(root);
+        if (object == NULL) {
+            Fail("could not parse an object of names", arena ? "in an arena" : "on the heap");
+        } else {
+            CheckAll(object);
+            ChangeRandomly(object, count + 16, 3, 2000);
+        }
+        json_value_free(root);
+
+        ModelClear();
+        for (size_t i = 0; i < savedCount; i++) {
+            ModelSet(savedMembers[i], (double)i);
+        }
+    }
+    ModelClear();
+    free(document);
+}
+
+int main(void)
+{
+    json_set_allocation_functions(FailingMalloc, free);
+
+    MakeNames();
+    for (size_t i = 0; i < nameCount; i++) {
+        positions[i] = -1;
+    }
+
+    CheckBuiltObjects();
+    for (size_t count = 0; count <= 20; count++) {
+        CheckParsedObject(count);
+    }
+    CheckParsedObject(100);
+    CheckParsedObject(3000);
+
+    printf("%lu steps checked, %lu failures\n", steps, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,348 @@
+// Host test for the compiled dotted paths of parson.c, json_path_compile and the
+// json_object_path_get functions, which must find exactly what the dotget functions find.  Paths
+// are compiled once and looked up in many random documents, and others are made by walking
+// down a document, so that most of them lead somewhere.  The paths have empty segments, names
+// that are missing, names that contain a dot, UTF-8, and intermediate values that are not
+// objects.  The documents have objects on both sides of the size at which parson indexes their
+// names, and are changed between lookups so that the indexes are rebuilt.  The documents of
+// json_corpus.c are walked the same way.  Compiling with failing allocations must fail and leave
+// nothing allocated.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_corpus.h"
+#include "parson.h"
+
+#define RANDOM_DOCUMENTS 300
+#define SHARED_PATHS 200
+#define WALKS_PER_DOCUMENT 50
+#define MAX_DEPTH 4
+#define PATH_SIZE 128
+
+static const char *const segments[] = {"",  "a",  "b", "ab", "ba", "a b", "A",
+                                       "a.b", "k0", "k1", "\xC3\xA9", "\xC3\xA9\xC3\xA9"};
+
+static uint64_t randomState = 88172645463325252ull;
+static unsigned long lookups = 0;
+static unsigned long found = 0;
+static unsigned long failures = 0;
+
+// Allocations made through parson and not yet freed.  While failAfter is not negative, the
+// allocation after that many more fails.
+static long liveAllocations = 0;
+static long failAfter = -1;
+
+static uint64_t NextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static size_t Below(size_t limit)
+{
+    return (size_t)(NextRandom() % limit);
+}
+
+static void *CountingMalloc(size_t size)
+{
+    if (failAfter == 0) {
+        return NULL;
+    }
+    if (failAfter > 0) {
+        failAfter--;
+    }
+    void *block = malloc(size);
+    if (block != NULL) {
+        liveAllocations++;
+    }
+    return block;
+}
+
+static void CountingFree(void *block)
+{
+    if (block != NULL) {
+        liveAllocations--;
+    }
+    free(block);
+}
+
+static void Fail(const char *path, const char *what)
+{
+    if (failures < 20) {
+        printf("FAIL: path \"%s\": %s\n", path, what);
+    }
+    failures++;
+}
+
+/// <summary>
+///     Writes a random name to name: one of segments, or one of the numbered names that large
+///     objects are made of.
+/// </summary>
+static void RandomName(char *name, size_t size)
+{
+    if (Below(3) == 0) {
+        snprintf(name, size, "n%zu", Below(300));
+    } else {
+        snprintf(name, size, "%s", segments[Below(sizeof(segments) / sizeof(segments[0]))]);
+    }
+}
+
+static JSON_Value *MakeValue(int depth);
+
+static JSON_Value *MakeObject(int depth)
+{
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *object = json_value_get_object(value);
+    // Mostly small objects, some large enough for parson to index their names.
+    size_t count = Below(4) == 0 ? 9 + Below(200) : Below(8);
+    for (size_t i = 0; i < count; i++) {
+        char name[32];
+        RandomName(name, sizeof(name));
+        if (json_object_get_value(object, name) == NULL) {
+            json_object_set_value(object, name, MakeValue(depth + 1));
+        }
+    }
+    return value;
+}
+
+static JSON_Value *MakeValue(int depth)
+{
+    switch (depth < MAX_DEPTH ? Below(8) : 3 + Below(4)) {
+    case 0:
+    case 1:
+    case 2:
+        return MakeObject(depth);
+    case 3:
+        return json_value_init_string("text");
+    case 4:
+        return json_value_init_number((double)Below(1000));
+    case 5:
+        return json_value_init_boolean((int)Below(2));
+    case 6:
+        return json_value_init_null();
+    default: {
+        // Arrays hold objects that no path can reach.
+        JSON_Value *array = json_value_init_array();
+        json_array_append_value(json_value_get_array(array), MakeObject(MAX_DEPTH));
+        return array;
+    }
+    }
+}
+
+/// <summary>
+///     Writes a random path to path: up to 6 segments, some of them empty.
+/// </summary>
+static void RandomPath(char *path)
+{
+    size_t length = 0;
+    size_t count = 1 + Below(6);
+    path[0] = '\0';
+    for (size_t i = 0; i < count; i++) {
+        char name[32] = "";
+        if (Below(8) != 0) {
+            RandomName(name, sizeof(name));
+        }
+        length += (size_t)snprintf(path + length, PATH_SIZE - length, "%s%s", i > 0 ? "." : "",
+                                   name);
+    }
+}
+
+/// <summary>
+///     Writes to path the names met walking down from object to a random depth, sometimes
+///     followed by a name that is not there or by an empty segment.
+/// </summary>
+static void WalkPath(const JSON_Object *object, char *path)
+{
+    size_t length = 0;
+    path[0] = '\0';
+    for (int depth = 0; object != NULL && depth < 8; depth++) {
+        size_t count = json_object_get_count(object);
+        if (count == 0 || (depth > 0 && Below(4) == 0)) {
+            break;
+        }
+        size_t i = Below(count);
+        const char *name = json_object_get_name(object, i);
+        if (length + strlen(name) + 2 >= PATH_SIZE) {
+            break;
+        }
+        length += (size_t)snprintf(path + length, PATH_SIZE - length, "%s%s", depth > 0 ? "." : "",
+                                   name);
+        object = json_value_get_object(json_object_get_value_at(object, i));
+    }
+    if (Below(4) == 0 && length + 12 < PATH_SIZE) {
+        snprintf(path + length, PATH_SIZE - length, Below(2) == 0 ? ".missing" : ".");
+    }
+}
+
+/// <summary>
+///     Looks path up in object with its compiled form and with the dotget functions, which must
+///     give the same results.
+/// </summary>
+static void CheckLookup(const JSON_Object *object, const char *path, const JSON_Path *compiled)
+{
+    lookups++;
+    JSON_Value *expected = json_object_dotget_value(object, path);
+    if (expected != NULL) {
+        found++;
+    }
+    if (json_object_path_get_value(object, compiled) != expected) {
+        Fail(path, expected != NULL ? "compiled path did not find the value dotget found"
+                                    : "compiled path found a value dotget did not");
+        return;
+    }
+    const char *string = json_object_path_get_string(object, compiled);
+    const char *dotString = json_object_dotget_string(object, path);
+    if (string != dotString ||
+        json_object_path_get_object(object, compiled) != json_object_dotget_object(object, path) ||
+        json_object_path_get_array(object, compiled) != json_object_dotget_array(object, path) ||
+        json_object_path_get_number(object, compiled) != json_object_dotget_number(object, path) ||
+        json_object_path_get_boolean(object, compiled) !=
+            json_object_dotget_boolean(object, path)) {
+        Fail(path, "typed getters differ from dotget");
+    }
+}
+
+static void CheckPath(const JSON_Object *object, const char *path)
+{
+    JSON_Path *compiled = json_path_compile(path);
+    if (compiled == NULL) {
+        Fail(path, "could not compile");
+        return;
+    }
+    CheckLookup(object, path, compiled);
+    json_path_free(compiled);
+}
+
+/// <summary>
+///     Makes random changes to object and the objects below it, adding and removing names so
+///     that objects cross the size at which they are indexed.
+/// </summary>
+static void Change(JSON_Object *object, int depth)
+{
+    size_t count = json_object_get_count(object);
+    for (size_t i = 0; i < count && i < 4 && depth < MAX_DEPTH; i++) {
+        JSON_Object *child = json_value_get_object(json_object_get_value_at(object, i));
+        if (child != NULL) {
+            Change(child, depth + 1);
+        }
+    }
+    size_t changes = Below(20);
+    for (size_t i = 0; i < changes; i++) {
+        char name[32];
+        RandomName(name, sizeof(name));
+        if (Below(2) == 0) {
+            json_object_remove(object, name);
+        } else {
+            JSON_Value *value = MakeValue(depth + 1);
+            if (json_object_set_value(object, name, value) != JSONSuccess) {
+                json_value_free(value);
+            }
+        }
+    }
+}
+
+static void CheckRandomDocuments(void)
+{
+    // Paths compiled once and looked up in every document.
+    static char paths[SHARED_PATHS][PATH_SIZE];
+    static JSON_Path *compiled[SHARED_PATHS];
+    for (int i = 0; i < SHARED_PATHS; i++) {
+        RandomPath(paths[i]);
+        compiled[i] = json_path_compile(paths[i]);
+    }
+
+    for (int i = 0; i < RANDOM_DOCUMENTS; i++) {
+        JSON_Value *root = MakeObject(0);
+        JSON_Object *object = json_value_get_object(root);
+        for (int round = 0; round < 3; round++) {
+            for (int j = 0; j < SHARED_PATHS; j++) {
+                CheckLookup(object, paths[j], compiled[j]);
+            }
+            for (int j = 0; j < WALKS_PER_DOCUMENT; j++) {
+                char path[PATH_SIZE];
+                WalkPath(object, path);
+                CheckPath(object, path);
+            }
+            Change(object, 0);
+        }
+        json_value_free(root);
+    }
+
+    for (int i = 0; i < SHARED_PATHS; i++) {
+        json_path_free(compiled[i]);
+    }
+}
+
+static void CheckDocument(const char *document)
+{
+    JSON_Value *root = json_parse_string(document);
+    JSON_Object *object = json_value_get_object(root);
+    if (object != NULL) {
+        for (int i = 0; i < WALKS_PER_DOCUMENT; i++) {
+            char path[PATH_SIZE];
+            WalkPath(object, path);
+            CheckPath(object, path);
+        }
+    }
+    json_value_free(root);
+}
+
+static void CheckEdgeCases(void)
+{
+    static const char *const paths[] = {"", ".", "..", "a.", ".a", "a..b", "a.b.c.d.e.f.g.h"};
+    JSON_Value *root = json_parse_string("{\"\":{\"\":{\"\":1}},\"a\":{\"\":{\"b\":2},\"b\":3},"
+                                         "\"a.b\":4}");
+    JSON_Object *object = json_value_get_object(root);
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        CheckPath(object, paths[i]);
+        // A path looked up from no object finds nothing.
+        JSON_Path *compiled = json_path_compile(paths[i]);
+        if (json_object_path_get_value(NULL, compiled) != NULL) {
+            Fail(paths[i], "found a value in no object");
+        }
+        json_path_free(compiled);
+    }
+    if (json_path_compile(NULL) != NULL || json_object_path_get_value(object, NULL) != NULL) {
+        Fail("(null)", "a null path was compiled or looked up");
+    }
+    json_value_free(root);
+
+    // A path is a single block, so the first failing allocation fails the compile.
+    long baseline = liveAllocations;
+    failAfter = 0;
+    JSON_Path *compiled = json_path_compile("a.b.c");
+    failAfter = -1;
+    if (compiled != NULL || liveAllocations != baseline) {
+        Fail("a.b.c", "compiled with a failing allocation");
+        json_path_free(compiled);
+    }
+}
+
+int main(void)
+{
+    json_set_allocation_functions(CountingMalloc, CountingFree);
+
+    CheckEdgeCases();
+    CheckRandomDocuments();
+    JsonCorpus_ForEach(CheckDocument);
+
+    if (liveAllocations != 0) {
+        printf("FAIL: %ld allocations left at the end\n", liveAllocations);
+        failures++;
+    }
+
+    // The shared random paths mostly miss, but the walked ones mostly lead to a value.
+    if (found * 10 < lookups) {
+        printf("FAIL: only %lu lookups found a value\n", found);
+        failures++;
+    }
+
+    printf("%lu lookups checked, %lu found a value, %lu failures\n", lookups, found, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
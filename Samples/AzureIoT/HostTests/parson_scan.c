@@ -0,0 +1,292 @@
+// Host test for the scanning functions of parson.c, which use vector instructions where the
+// compiler targets them.  parson.c is included in the test, so that its static scanners can be
+// compared with byte-by-byte references: skip_whitespaces, find_quote_or_escape, skip_ascii
+// and is_valid_utf8.  Random buffers of every length up to a few blocks are placed at every
+// alignment, with bytes after their terminating null that would stop or continue a scan that
+// went past it.  Buffers that end at the end of a page followed by an inaccessible page check
+// that no scan reads into the next page.  CMake builds the test once for each set of kernels the
+// compiler can target: the default ones, AVX2, and the scalar loops with PARSON_NO_SIMD.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "parson.c"
+
+#define ALIGNMENTS 64
+#define MAX_LENGTH 200
+#define TAIL 64
+#define TRIALS_PER_ALIGNMENT 3000
+
+static uint64_t randomState = 88172645463325252ull;
+static unsigned long checks = 0;
+static unsigned long failures = 0;
+
+static uint64_t NextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static size_t Below(size_t limit)
+{
+    return (size_t)(NextRandom() % limit);
+}
+
+static void Fail(const char *scan, size_t alignment, size_t length, long got, long expected)
+{
+    if (failures < 20) {
+        printf("FAIL: %s at alignment %zu, length %zu: got %ld, expected %ld\n", scan,
+               alignment, length, got, expected);
+    }
+    failures++;
+}
+
+static bool ReferenceSpace(unsigned char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/// <summary>
+///     Returns the length of the well-formed UTF-8 sequence at s, as RFC 3629 defines it, or 0.
+///     s is followed by a null byte, which ends any sequence.
+/// </summary>
+static int ReferenceUtf8Sequence(const unsigned char *s)
+{
+    if (s[0] < 0x80) {
+        return 1;
+    }
+    unsigned char low = 0x80, high = 0xBF;
+    int length = 0;
+    if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+        length = 2;
+    } else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+        length = 3;
+        low = s[0] == 0xE0 ? 0xA0 : 0x80;  // overlong
+        high = s[0] == 0xED ? 0x9F : 0xBF; // surrogates
+    } else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+        length = 4;
+        low = s[0] == 0xF0 ? 0x90 : 0x80;  // overlong
+        high = s[0] == 0xF4 ? 0x8F : 0xBF; // above U+10FFFF
+    } else {
+        return 0;
+    }
+    if (s[1] < low || s[1] > high) {
+        return 0;
+    }
+    for (int i = 2; i < length; i++) {
+        if (s[i] < 0x80 || s[i] > 0xBF) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+static bool ReferenceValidUtf8(const unsigned char *s, size_t length)
+{
+    for (size_t i = 0; i < length;) {
+        int sequence = ReferenceUtf8Sequence(s + i);
+        if (sequence == 0) {
+            return false;
+        }
+        i += (size_t)sequence;
+    }
+    return true;
+}
+
+/// <summary>
+///     Fills text with length random bytes of the kind a scan sees: mostly bytes that continue
+///     it, with a few that stop it.
+/// </summary>
+static void FillWhitespace(char *text, size_t length)
+{
+    static const char spaces[] = " \t\n\r\v\f";
+    for (size_t i = 0; i < length; i++) {
+        text[i] = Below(40) == 0 ? (char)(1 + Below(255)) : spaces[Below(6)];
+    }
+}
+
+static void FillString(char *text, size_t length)
+{
+    static const char stops[] = "\"\\";
+    for (size_t i = 0; i < length; i++) {
+        if (Below(60) == 0) {
+            text[i] = stops[Below(2)];
+        } else {
+            // Any byte but the null, including those just around the stops.
+            text[i] = (char)(1 + Below(255));
+        }
+    }
+}
+
+static void FillUtf8(char *text, size_t length)
+{
+    static const char *const sequences[] = {
+        "a", "\x7f", "\xC2\x80", "\xC3\xA9", "\xDF\xBF", "\xE0\xA0\x80", "\xE2\x82\xAC",
+        "\xED\x9F\xBF", "\xEE\x80\x80", "\xEF\xBF\xBF", "\xF0\x90\x80\x80", "\xF0\x9F\x98\x80",
+        "\xF4\x8F\xBF\xBF"};
+    // Some texts are mostly multibyte sequences, others have long ASCII runs.
+    size_t density = 2 + Below(60);
+    size_t i = 0;
+    while (i < length) {
+        const char *sequence = Below(density) == 0 ? sequences[Below(13)] : "x";
+        size_t size = strlen(sequence);
+        if (i + size > length) {
+            sequence = "y";
+            size = 1;
+        }
+        memcpy(text + i, sequence, size);
+        i += size;
+    }
+    // Now and then a byte is changed, which may make the text invalid.
+    if (length > 0 && Below(2) == 0) {
+        text[Below(length)] = (char)(1 + Below(255));
+    }
+}
+
+/// <summary>
+///     Fills the bytes after a terminating null with bytes that would not stop a scan.
+/// </summary>
+static void FillTail(char *tail)
+{
+    static const char bytes[] = " \t\nabc\xC3";
+    for (size_t i = 0; i < TAIL; i++) {
+        tail[i] = bytes[Below(sizeof(bytes) - 1)];
+    }
+}
+
+/// <summary>
+///     Runs each scan over text, which holds length bytes and a null, and compares it with its
+///     reference.
+/// </summary>
+static void CheckScans(char *text, size_t length, size_t alignment, int kind)
+{
+    checks++;
+    const unsigned char *bytes = (const unsigned char *)text;
+
+    if (kind == 0) {
+        size_t expected = 0;
+        while (ReferenceSpace(bytes[expected])) {
+            expected++;
+        }
+        const char *got = skip_whitespaces(text);
+        if (got != text + expected) {
+            Fail("skip_whitespaces", alignment, length, (long)(got - text), (long)expected);
+        }
+    } else if (kind == 1) {
+        size_t expected = 0;
+        while (bytes[expected] != '"' && bytes[expected] != '\\' && bytes[expected] != '\0') {
+            expected++;
+        }
+        const char *got = find_quote_or_escape(text);
+        if (got != text + expected) {
+            Fail("find_quote_or_escape", alignment, length, (long)(got - text), (long)expected);
+        }
+    } else {
+        // skip_ascii may stop anywhere from which the rest is checked byte by byte: at the
+        // first byte that is not ASCII, at the end, or less than a block before the end.  The
+        // scalar build leaves every byte to be checked that way.
+        const char *got = skip_ascii(text, text + length);
+        size_t stop = (size_t)(got - text);
+        size_t firstNonAscii = 0;
+        while (firstNonAscii < length && bytes[firstNonAscii] < 0x80) {
+            firstNonAscii++;
+        }
+#ifdef SIMD_BLOCK_SIZE
+        bool wrongStop = stop != firstNonAscii && length - stop >= SIMD_BLOCK_SIZE;
+#else
+        bool wrongStop = stop != 0;
+#endif
+        if (got < text || stop > firstNonAscii || wrongStop) {
+            Fail("skip_ascii", alignment, length, (long)stop, (long)firstNonAscii);
+        }
+
+        bool valid = is_valid_utf8(text, length) != 0;
+        if (valid != ReferenceValidUtf8(bytes, length)) {
+            Fail("is_valid_utf8", alignment, length, valid, !valid);
+        }
+    }
+}
+
+static void FillText(char *text, size_t length, int kind)
+{
+    if (kind == 0) {
+        FillWhitespace(text, length);
+    } else if (kind == 1) {
+        FillString(text, length);
+    } else {
+        FillUtf8(text, length);
+    }
+}
+
+static void CheckAlignments(void)
+{
+    // Aligned to the largest block, so that offsets give every alignment.
+    static char buffer[ALIGNMENTS + MAX_LENGTH + 1 + TAIL] __attribute__((aligned(64)));
+    for (size_t alignment = 0; alignment < ALIGNMENTS; alignment++) {
+        for (int trial = 0; trial < TRIALS_PER_ALIGNMENT; trial++) {
+            // Short lengths are the most common in documents, so they are drawn more often.
+            size_t length = Below(4) == 0 ? Below(MAX_LENGTH + 1) : Below(3 * 32 + 1);
+            int kind = (int)Below(3);
+            char *text = buffer + alignment;
+            FillText(text, length, kind);
+            text[length] = '\0';
+            FillTail(text + length + 1);
+            CheckScans(text, length, alignment, kind);
+        }
+    }
+}
+
+static void CheckPageEnd(void)
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+    char *pages = mmap(NULL, (size_t)pageSize * 2, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED || mprotect(pages + pageSize, (size_t)pageSize, PROT_NONE) != 0) {
+        printf("FAIL: could not map a page followed by an inaccessible one\n");
+        failures++;
+        return;
+    }
+    // Every length up to a few blocks, with its null as the last byte of the page.
+    char *pageEnd = pages + pageSize;
+    for (size_t length = 0; length <= 3 * 64; length++) {
+        for (int kind = 0; kind < 3; kind++) {
+            for (int trial = 0; trial < 20; trial++) {
+                char *text = pageEnd - length - 1;
+                FillText(text, length, kind);
+                text[length] = '\0';
+                CheckScans(text, length, (size_t)text & (ALIGNMENTS - 1), kind);
+            }
+        }
+    }
+    munmap(pages, (size_t)pageSize * 2);
+}
+
+int main(void)
+{
+#if defined(SIMD_AVX2)
+    if (!__builtin_cpu_supports("avx2")) {
+        printf("SKIP: this processor has no AVX2\n");
+        return 77;
+    }
+    const char *kernels = "AVX2";
+#elif defined(SIMD_SSE2)
+    const char *kernels = "SSE2";
+#elif defined(SIMD_NEON)
+    const char *kernels = "NEON";
+#else
+    const char *kernels = "scalar";
+#endif
+
+    CheckAlignments();
+    CheckPageEnd();
+
+    printf("%s kernels: %lu scans checked, %lu failures\n", kernels, checks, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
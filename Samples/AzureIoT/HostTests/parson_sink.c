@@ -0,0 +1,535 @@
+// Host test for serializing through a sink with json_serialize_to_sink in parson.c.  Each
+// document of json_corpus.c, and documents built nested up to hundreds of levels with strings of
+// every character that is escaped, is serialized compact and pretty by a reference serializer
+// in this file, which takes only public getters and formats numbers one at a time.  What
+// json_serialize_to_string, json_serialization_size and every kind of sink produce must match
+// it: growable sinks, buffer sinks of every size up to the whole text, and writer sinks with
+// chunks of several sizes.  Truncated buffers must hold the start of the text and count all of
+// it.  Writers must be passed the text in chunks, and a failing write must stop the
+// serialization.  Allocations that fail must make a growable sink fail and leave nothing
+// allocated.  Buffers are allocated at the size given to the sink, so that AddressSanitizer
+// catches a write past them.
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_corpus.h"
+#include "parson.h"
+
+// Texts up to this size are written to buffers of every size, and longer ones to a sample of
+// sizes.  Writers fail at each of their writes, or at a few of them when there are more.
+#define MAX_EVERY_SIZE_TEXT 256
+#define SAMPLES 10
+#define FAILING_WRITES 3
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Text;
+
+typedef struct {
+    Text text;
+    unsigned long calls;
+    unsigned long failAt; // The call that fails, counting from 0, or ULONG_MAX.
+    bool failed;
+    bool calledAfterFailure;
+    bool emptyWrite;
+} Writer;
+
+static const size_t chunkSizes[] = {0, 1, 2, 3, 7, 16, 64, 4096};
+
+static uint64_t randomState = 88172645463325252ull;
+static unsigned long texts = 0;
+static unsigned long failures = 0;
+
+// Allocations made through parson and not yet freed.  While failAfter is not negative, the
+// allocation after that many more fails.
+static long liveAllocations = 0;
+static long failAfter = -1;
+
+static uint64_t NextRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static size_t Below(size_t limit)
+{
+    return (size_t)(NextRandom() % limit);
+}
+
+static void *CountingMalloc(size_t size)
+{
+    if (failAfter == 0) {
+        return NULL;
+    }
+    if (failAfter > 0) {
+        failAfter--;
+    }
+    void *block = malloc(size);
+    if (block != NULL) {
+        liveAllocations++;
+    }
+    return block;
+}
+
+static void CountingFree(void *block)
+{
+    if (block != NULL) {
+        liveAllocations--;
+    }
+    free(block);
+}
+
+static void Fail(const char *text, bool pretty, const char *what)
+{
+    if (failures < 20) {
+        printf("FAIL: %s (%s): %.60s%s\n", what, pretty ? "pretty" : "compact", text,
+               strlen(text) > 60 ? "..." : "");
+    }
+    failures++;
+}
+
+static void Append(Text *text, const char *data, size_t size)
+{
+    if (text->length + size + 1 > text->capacity) {
+        text->capacity = (text->length + size + 1) * 2;
+        text->data = realloc(text->data, text->capacity);
+    }
+    memcpy(text->data + text->length, data, size);
+    text->length += size;
+    text->data[text->length] = '\0';
+}
+
+static void AppendString(Text *text, const char *string)
+{
+    Append(text, string, strlen(string));
+}
+
+static void ReferenceString(Text *out, const char *string)
+{
+    AppendString(out, "\"");
+    for (const char *c = string; *c != '\0'; c++) {
+        char escape[8];
+        switch (*c) {
+        case '"':
+            AppendString(out, "\\\"");
+            break;
+        case '\\':
+            AppendString(out, "\\\\");
+            break;
+        case '/':
+            AppendString(out, "\\/");
+            break;
+        case '\b':
+            AppendString(out, "\\b");
+            break;
+        case '\f':
+            AppendString(out, "\\f");
+            break;
+        case '\n':
+            AppendString(out, "\\n");
+            break;
+        case '\r':
+            AppendString(out, "\\r");
+            break;
+        case '\t':
+            AppendString(out, "\\t");
+            break;
+        default:
+            if ((unsigned char)*c < 0x20) {
+                snprintf(escape, sizeof(escape), "\\u%04x", (unsigned int)(unsigned char)*c);
+                AppendString(out, escape);
+            } else {
+                Append(out, c, 1);
+            }
+            break;
+        }
+    }
+    AppendString(out, "\"");
+}
+
+static void ReferenceIndent(Text *out, int level)
+{
+    for (int i = 0; i < level; i++) {
+        AppendString(out, "    ");
+    }
+}
+
+/// <summary>
+///     Appends value to out as parson serializes it: names and values in order, strings with
+///     '/' and control characters escaped, and pretty output indented by four spaces.
+/// </summary>
+static void Reference(Text *out, const JSON_Value *value, bool pretty, int level)
+{
+    JSON_Object *object = json_value_get_object(value);
+    JSON_Array *array = json_value_get_array(value);
+    size_t count = object != NULL ? json_object_get_count(object)
+                                  : array != NULL ? json_array_get_count(array) : 0;
+    char number[64];
+
+    switch (json_value_get_type(value)) {
+    case JSONObject:
+    case JSONArray:
+        AppendString(out, object != NULL ? "{" : "[");
+        for (size_t i = 0; i < count; i++) {
+            if (pretty) {
+                AppendString(out, i == 0 ? "\n" : ",\n");
+                ReferenceIndent(out, level + 1);
+            } else if (i > 0) {
+                AppendString(out, ",");
+            }
+            if (object != NULL) {
+                ReferenceString(out, json_object_get_name(object, i));
+                AppendString(out, pretty ? ": " : ":");
+            }
+            Reference(out,
+                      object != NULL ? json_object_get_value_at(object, i)
+                                     : json_array_get_value(array, i),
+                      pretty, level + 1);
+        }
+        if (pretty && count > 0) {
+            AppendString(out, "\n");
+            ReferenceIndent(out, level);
+        }
+        AppendString(out, object != NULL ? "}" : "]");
+        break;
+    case JSONString:
+        ReferenceString(out, json_value_get_string(value));
+        break;
+    case JSONNumber:
+        // Number formatting has its own test, number_roundtrip.
+        if (json_serialize_to_buffer(value, number, sizeof(number)) != JSONSuccess) {
+            Fail("", pretty, "could not format a number");
+        }
+        AppendString(out, number);
+        break;
+    case JSONBoolean:
+        AppendString(out, json_value_get_boolean(value) ? "true" : "false");
+        break;
+    default:
+        AppendString(out, "null");
+        break;
+    }
+}
+
+static int Write(void *context, const char *data, size_t size)
+{
+    Writer *writer = context;
+    if (writer->failed) {
+        writer->calledAfterFailure = true;
+    }
+    if (size == 0) {
+        writer->emptyWrite = true;
+    }
+    if (writer->calls++ == writer->failAt) {
+        writer->failed = true;
+        return -1;
+    }
+    Append(&writer->text, data, size);
+    return 0;
+}
+
+static void InitWriter(Writer *writer, unsigned long failAt)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->failAt = failAt;
+}
+
+static bool IsPrefix(const Text *text, const Text *expected)
+{
+    return text->length <= expected->length &&
+           (text->length == 0 || memcmp(text->data, expected->data, text->length) == 0);
+}
+
+static void CheckStrings(const JSON_Value *value, const Text *expected, bool pretty)
+{
+    char *string = pretty ? json_serialize_to_string_pretty(value) : json_serialize_to_string(value);
+    if (string == NULL || strcmp(string, expected->data) != 0) {
+        Fail(expected->data, pretty, "json_serialize_to_string differs from the reference");
+    }
+    json_free_serialized_string(string);
+
+    size_t size = pretty ? json_serialization_size_pretty(value) : json_serialization_size(value);
+    if (size != expected->length + 1) {
+        Fail(expected->data, pretty, "json_serialization_size is not the length of the text");
+    }
+}
+
+/// <summary>
+///     Serializes value twice into a growable sink, which must then hold the text twice.
+/// </summary>
+static void CheckGrowable(const JSON_Value *value, const Text *expected, bool pretty)
+{
+    JSON_Sink sink;
+    json_sink_init_growable(&sink);
+    for (int i = 1; i <= 2; i++) {
+        const char *string = NULL;
+        if (json_serialize_to_sink(&sink, value, pretty) != JSONSuccess ||
+            json_sink_length(&sink) != i * expected->length || json_sink_truncated(&sink) ||
+            (string = json_sink_get_string(&sink)) == NULL ||
+            strlen(string) != i * expected->length ||
+            memcmp(string + (i - 1) * expected->length, expected->data, expected->length) != 0 ||
+            memcmp(string, expected->data, expected->length) != 0) {
+            Fail(expected->data, pretty, "growable sink differs from the reference");
+            break;
+        }
+    }
+    json_sink_free(&sink);
+}
+
+/// <summary>
+///     Serializes value into a buffer sink of size bytes, which must hold as much of the text as
+///     fits, and count all of it.
+/// </summary>
+static void CheckBuffer(const JSON_Value *value, const Text *expected, bool pretty, size_t size)
+{
+    // Exactly size bytes, so that AddressSanitizer catches a write past them, and at least one
+    // for a size of 0, whose byte must not be written.
+    char *buffer = malloc(size > 0 ? size : 1);
+    buffer[0] = '#';
+    JSON_Sink sink;
+    json_sink_init_buffer(&sink, buffer, size);
+    JSON_Status status = json_serialize_to_sink(&sink, value, pretty);
+
+    bool fits = size > expected->length;
+    size_t kept = fits ? expected->length : size > 0 ? size - 1 : 0;
+    const char *string = json_sink_get_string(&sink);
+    if ((status == JSONSuccess) != fits || json_sink_truncated(&sink) == fits ||
+        json_sink_length(&sink) != expected->length || string == NULL ||
+        strlen(string) != kept || memcmp(string, expected->data, kept) != 0 ||
+        (size == 0 && buffer[0] != '#')) {
+        Fail(expected->data, pretty, "buffer sink differs from the reference");
+    } else if (size > 0) {
+        // json_serialize_to_buffer must give the same result.
+        memset(buffer, '#', size);
+        status = pretty ? json_serialize_to_buffer_pretty(value, buffer, size)
+                        : json_serialize_to_buffer(value, buffer, size);
+        if ((status == JSONSuccess) != fits || strlen(buffer) != kept ||
+            memcmp(buffer, expected->data, kept) != 0) {
+            Fail(expected->data, pretty, "json_serialize_to_buffer differs from the buffer sink");
+        }
+    }
+    free(buffer);
+}
+
+static void CheckBuffers(const JSON_Value *value, const Text *expected, bool pretty)
+{
+    size_t length = expected->length;
+    if (length <= MAX_EVERY_SIZE_TEXT) {
+        for (size_t size = 0; size <= length + 2; size++) {
+            CheckBuffer(value, expected, pretty, size);
+        }
+    } else {
+        CheckBuffer(value, expected, pretty, 0);
+        CheckBuffer(value, expected, pretty, 1);
+        CheckBuffer(value, expected, pretty, length);
+        CheckBuffer(value, expected, pretty, length + 1);
+        for (int i = 0; i < SAMPLES; i++) {
+            CheckBuffer(value, expected, pretty, 2 + Below(length));
+        }
+    }
+
+    // Two values into one buffer that fits both.
+    char *buffer = malloc(2 * length + 1);
+    JSON_Sink sink;
+    json_sink_init_buffer(&sink, buffer, 2 * length + 1);
+    if (json_serialize_to_sink(&sink, value, pretty) != JSONSuccess ||
+        json_serialize_to_sink(&sink, value, pretty) != JSONSuccess ||
+        strlen(buffer) != 2 * length || memcmp(buffer, expected->data, length) != 0 ||
+        memcmp(buffer + length, expected->data, length) != 0) {
+        Fail(expected->data, pretty, "buffer sink did not append the second value");
+    }
+    free(buffer);
+}
+
+/// <summary>
+///     Serializes value twice into a writer sink with a chunk of chunkSize bytes, or none for 0,
+///     and returns the number of writes.  failAt is the write that fails, or ULONG_MAX.
+/// </summary>
+static unsigned long CheckWriter(const JSON_Value *value, const Text *expected, bool pretty,
+                                 size_t chunkSize, unsigned long failAt)
+{
+    char *chunk = chunkSize > 0 ? malloc(chunkSize) : NULL;
+    Writer writer;
+    InitWriter(&writer, failAt);
+    JSON_Sink sink;
+    json_sink_init_writer(&sink, chunk, chunkSize, Write, &writer);
+    bool succeeded = json_serialize_to_sink(&sink, value, pretty) == JSONSuccess &&
+                     json_serialize_to_sink(&sink, value, pretty) == JSONSuccess &&
+                     json_sink_flush(&sink) == JSONSuccess;
+
+    Text twice = {NULL, 0, 0};
+    Append(&twice, expected->data, expected->length);
+    Append(&twice, expected->data, expected->length);
+    if (writer.failed) {
+        if (succeeded || writer.calledAfterFailure || !IsPrefix(&writer.text, &twice)) {
+            Fail(expected->data, pretty, "writer sink went on after a failed write");
+        }
+    } else if (!succeeded || writer.emptyWrite || writer.text.length != twice.length ||
+               memcmp(writer.text.data, twice.data, twice.length) != 0 ||
+               json_sink_length(&sink) != twice.length ||
+               json_sink_get_string(&sink) != NULL) {
+        Fail(expected->data, pretty, "writer sink differs from the reference");
+    } else if (chunkSize > 0 && writer.calls > 2 * twice.length / chunkSize + 2) {
+        // A chunk is written when the next piece does not fit in it, so any two writes in a
+        // row hold more than a chunk.
+        Fail(expected->data, pretty, "writer sink wrote chunks that were not full");
+    }
+    free(twice.data);
+    free(writer.text.data);
+    free(chunk);
+    return writer.calls;
+}
+
+static void CheckWriters(const JSON_Value *value, const Text *expected, bool pretty)
+{
+    for (size_t i = 0; i < sizeof(chunkSizes) / sizeof(chunkSizes[0]); i++) {
+        unsigned long calls = CheckWriter(value, expected, pretty, chunkSizes[i], ULONG_MAX);
+        if (calls <= SAMPLES) {
+            for (unsigned long failAt = 0; failAt < calls; failAt++) {
+                CheckWriter(value, expected, pretty, chunkSizes[i], failAt);
+            }
+        } else {
+            for (int j = 0; j < FAILING_WRITES; j++) {
+                CheckWriter(value, expected, pretty, chunkSizes[i], Below(calls));
+            }
+        }
+    }
+}
+
+/// <summary>
+///     Serializes value to a growable sink and to a string with each allocation failing in
+///     turn, which must fail or give the text, and leave nothing allocated.
+/// </summary>
+static void CheckFailingAllocations(const JSON_Value *value, const Text *expected, bool pretty)
+{
+    long baseline = liveAllocations;
+    bool succeeded = false;
+    for (long n = 0; !succeeded && n < 100; n++) {
+        JSON_Sink sink;
+        json_sink_init_growable(&sink);
+        failAfter = n;
+        JSON_Status status = json_serialize_to_sink(&sink, value, pretty);
+        char *string = pretty ? json_serialize_to_string_pretty(value)
+                              : json_serialize_to_string(value);
+        failAfter = -1;
+        const char *sinkString = json_sink_get_string(&sink);
+        if (status == JSONSuccess &&
+            (sinkString == NULL || strcmp(sinkString, expected->data) != 0)) {
+            Fail(expected->data, pretty, "growable sink differs after failed allocations");
+        }
+        if (string != NULL && strcmp(string, expected->data) != 0) {
+            Fail(expected->data, pretty, "json_serialize_to_string differs after failed allocations");
+        }
+        succeeded = status == JSONSuccess && string != NULL;
+        json_free_serialized_string(string);
+        json_sink_free(&sink);
+        if (liveAllocations != baseline) {
+            Fail(expected->data, pretty, "allocations left after a failed allocation");
+            return;
+        }
+    }
+    if (!succeeded) {
+        Fail(expected->data, pretty, "growable sink never succeeded");
+    }
+}
+
+static void CheckValue(const JSON_Value *value)
+{
+    for (int pretty = 0; pretty <= 1; pretty++) {
+        texts++;
+        Text expected = {NULL, 0, 0};
+        Reference(&expected, value, pretty, 0);
+        CheckStrings(value, &expected, pretty);
+        CheckGrowable(value, &expected, pretty);
+        CheckBuffers(value, &expected, pretty);
+        CheckWriters(value, &expected, pretty);
+        CheckFailingAllocations(value, &expected, pretty);
+        free(expected.data);
+    }
+}
+
+static void CheckDocument(const char *document)
+{
+    JSON_Value *value = json_parse_string(document);
+    if (value == NULL) {
+        printf("FAIL: could not parse %.60s\n", document);
+        failures++;
+        return;
+    }
+    CheckValue(value);
+    json_value_free(value);
+}
+
+/// <summary>
+///     Returns depth levels of objects and arrays in turn, each holding a string of every
+///     character below 0x80, a number and the next level.
+/// </summary>
+static JSON_Value *MakeNested(int depth)
+{
+    static char everyCharacter[0x80];
+    for (int c = 1; c < 0x80; c++) {
+        everyCharacter[c - 1] = (char)c;
+    }
+
+    JSON_Value *value = json_value_init_string(depth % 2 == 0 ? everyCharacter : "");
+    for (int level = 0; level < depth; level++) {
+        JSON_Value *container = json_value_init_object();
+        if (level % 2 == 0) {
+            JSON_Object *object = json_value_get_object(container);
+            json_object_set_string(object, "\x01/\"\\\x1f", everyCharacter);
+            json_object_set_number(object, "n", level * 0.5);
+            json_object_set_value(object, "next", value);
+            json_object_set_value(object, "empty", json_value_init_array());
+        } else {
+            json_value_free(container);
+            container = json_value_init_array();
+            JSON_Array *array = json_value_get_array(container);
+            json_array_append_value(array, value);
+            json_array_append_boolean(array, level % 4 == 1);
+            json_array_append_null(array);
+            json_array_append_value(array, json_value_init_object());
+        }
+        value = container;
+    }
+    return value;
+}
+
+int main(void)
+{
+    json_set_allocation_functions(CountingMalloc, CountingFree);
+
+    JsonCorpus_ForEach(CheckDocument);
+
+    static const int depths[] = {0, 1, 2, 3, 10, 100, 300};
+    for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+        JSON_Value *nested = MakeNested(depths[i]);
+        CheckValue(nested);
+        json_value_free(nested);
+    }
+
+    // A sink given no value fails without writing.
+    JSON_Sink sink;
+    json_sink_init_growable(&sink);
+    if (json_serialize_to_sink(&sink, NULL, 0) != JSONFailure || json_sink_length(&sink) != 0) {
+        printf("FAIL: a sink serialized a null value\n");
+        failures++;
+    }
+    json_sink_free(&sink);
+
+    if (liveAllocations != 0) {
+        printf("FAIL: %ld allocations left at the end\n", liveAllocations);
+        failures++;
+    }
+
+    printf("%lu texts checked, %lu failures\n", texts, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
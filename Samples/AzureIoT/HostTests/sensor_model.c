@@ -0,0 +1,520 @@
+// Register-level model of the LSM6DSO on the I2C bus, with an LPS22HH on its sensor hub master
+// bus.  It models what i2c.c relies on: the register address auto-increment, the reset and data
+// ready bits, the output registers, the timestamp, the FIFO in stream mode, including the
+// rollback of the FIFO output address from FIFO_DATA_OUT_Z_H to FIFO_DATA_OUT_TAG, and the
+// sensor hub.  Samples are produced at the configured output data rates as the simulated clock
+// advances.  While MASTER_ON is set, every accelerometer sample triggers the sensor hub, which
+// carries out the slave operations configured in the sensor hub bank and sets STATUS_MASTER.
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/i2c.h>
+
+#include "i2c.h"
+#include "lps22hh_reg.h"
+#include "lsm6dso_reg.h"
+#include "sensor_model.h"
+
+#define FIFO_CAPACITY_WORDS 438
+#define FIFO_TAG_ANGULAR_RATE 0x01
+#define FIFO_TAG_ACCELERATION 0x02
+#define FIFO_TAG_TIMESTAMP 0x04
+
+static SensorModelCounters counters;
+static uint64_t nowUs;
+static bool addNoise;
+static uint32_t noiseState;
+
+static uint8_t registers[256];
+static uint8_t sensorHubRegisters[64];
+static uint8_t addressPointer;
+static bool sensorHubTransfer; // The current transfer selects or accesses the sensor hub bank
+
+static uint64_t lastAccelerationUs;
+static uint64_t lastAngularRateUs;
+static bool accelerationReady;
+static bool angularRateReady;
+static int16_t accelerationOut[3];
+static int16_t angularRateOut[3];
+
+static uint8_t fifo[FIFO_CAPACITY_WORDS][7];
+static int fifoHead;
+static int fifoCount;
+
+static uint8_t lps22hhRegisters[256];
+
+/// <summary>
+///     Returns the rate in Hz of an ODR_XL, ODR_G or BDR field value.
+/// </summary>
+static double DataRateHz(int code)
+{
+    static const double rates[] = {0, 12.5, 26, 52, 104, 208, 416, 833, 1666, 3332, 6664, 1.6};
+    return (code > 0 && code < 12) ? rates[code] : 0;
+}
+
+/// <summary>
+///     Returns uniform noise in [-amplitude, amplitude], or 0 without noise.
+/// </summary>
+static int Noise(int amplitude)
+{
+    if (!addNoise) {
+        return 0;
+    }
+    noiseState = noiseState * 1103515245u + 12345u;
+    return (int)((noiseState >> 16) % (uint32_t)(2 * amplitude + 1)) - amplitude;
+}
+
+static void PutInt16(uint8_t *data, int16_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)((uint16_t)value >> 8);
+}
+
+static void ResetLsm6dso(void)
+{
+    memset(registers, 0, sizeof(registers));
+    memset(sensorHubRegisters, 0, sizeof(sensorHubRegisters));
+    registers[LSM6DSO_WHO_AM_I] = LSM6DSO_ID;
+    registers[LSM6DSO_CTRL3_C] = 0x04; // IF_INC
+    fifoHead = 0;
+    fifoCount = 0;
+}
+
+static void ResetLps22hh(void)
+{
+    memset(lps22hhRegisters, 0, sizeof(lps22hhRegisters));
+    lps22hhRegisters[LPS22HH_WHO_AM_I] = LPS22HH_ID;
+    lps22hhRegisters[LPS22HH_CTRL_REG2] = 0x10; // IF_ADD_INC
+}
+
+/// <summary>
+///     Takes a pressure and temperature sample if the LPS22HH is running.
+/// </summary>
+static void SampleLps22hh(void)
+{
+    if ((lps22hhRegisters[LPS22HH_CTRL_REG1] & 0x70) == 0) {
+        return;
+    }
+    int32_t pressure = (int32_t)(SENSOR_MODEL_PRESSURE_HPA * 4096) + Noise(40);
+    int16_t temperature = (int16_t)(SENSOR_MODEL_TEMPERATURE_DEGC * 100) + (int16_t)Noise(3);
+    lps22hhRegisters[LPS22HH_PRESS_OUT_XL] = (uint8_t)pressure;
+    lps22hhRegisters[LPS22HH_PRESS_OUT_XL + 1] = (uint8_t)(pressure >> 8);
+    lps22hhRegisters[LPS22HH_PRESS_OUT_XL + 2] = (uint8_t)(pressure >> 16);
+    PutInt16(&lps22hhRegisters[LPS22HH_TEMP_OUT_L], temperature);
+    lps22hhRegisters[LPS22HH_STATUS] |= 0x03; // P_DA, T_DA
+}
+
+static uint8_t ReadLps22hhRegister(uint8_t address)
+{
+    if (address == LPS22HH_STATUS) {
+        SampleLps22hh();
+    }
+    uint8_t value = lps22hhRegisters[address];
+    if (address >= LPS22HH_PRESS_OUT_XL && address < LPS22HH_TEMP_OUT_L) {
+        lps22hhRegisters[LPS22HH_STATUS] &= (uint8_t)~0x01;
+    } else if (address == LPS22HH_TEMP_OUT_L || address == LPS22HH_TEMP_OUT_H) {
+        lps22hhRegisters[LPS22HH_STATUS] &= (uint8_t)~0x02;
+    }
+    return value;
+}
+
+static void WriteLps22hhRegister(uint8_t address, uint8_t value)
+{
+    if (address == LPS22HH_CTRL_REG2 && (value & 0x04) != 0) { // SWRESET
+        ResetLps22hh();
+        return;
+    }
+    lps22hhRegisters[address] = value;
+}
+
+/// <summary>
+///     Carries out one sensor hub operation: the operations of slaves 0 to AUX_SENS_ON.  Reads
+///     fill SENSOR_HUB_1 onwards; slave 0 can also write DATAWRITE_SLV0.  Slaves at any other
+///     address than the LPS22HH do not acknowledge.
+/// </summary>
+static void RunSensorHub(void)
+{
+    uint8_t *config = &sensorHubRegisters[LSM6DSO_MASTER_CONFIG];
+    uint8_t *status = &sensorHubRegisters[LSM6DSO_STATUS_MASTER];
+    int slaves = (*config & 0x03) + 1;
+    uint8_t output = LSM6DSO_SENSOR_HUB_1;
+
+    SampleLps22hh();
+    for (int slave = 0; slave < slaves; slave++) {
+        uint8_t address = sensorHubRegisters[LSM6DSO_SLV0_ADD + 3 * slave];
+        uint8_t subAddress = sensorHubRegisters[LSM6DSO_SLV0_SUBADD + 3 * slave];
+        int length = sensorHubRegisters[LSM6DSO_SLV0_CONFIG + 3 * slave] & 0x07;
+
+        if ((address >> 1) != (LPS22HH_I2C_ADD_L >> 1)) {
+            *status |= (uint8_t)(0x08 << slave); // SLAVEx_NACK
+            continue;
+        }
+        counters.lps22hhOperations++;
+        if ((address & 0x01) != 0) {
+            for (int i = 0; i < length && output <= LSM6DSO_SENSOR_HUB_18; i++) {
+                sensorHubRegisters[output++] = ReadLps22hhRegister((uint8_t)(subAddress + i));
+            }
+        } else if (slave == 0 && ((*config & 0x40) == 0 || (*status & 0x80) == 0)) {
+            WriteLps22hhRegister(subAddress, sensorHubRegisters[LSM6DSO_DATAWRITE_SLV0]);
+            if ((*config & 0x40) != 0) {
+                *status |= 0x80; // WR_ONCE_DONE
+            }
+        }
+    }
+    *status |= 0x01; // SENS_HUB_ENDOP
+}
+
+/// <summary>
+///     Returns STATUS_MASTER, which reading clears except for WR_ONCE_DONE.
+/// </summary>
+static uint8_t ReadSensorHubStatus(void)
+{
+    uint8_t value = sensorHubRegisters[LSM6DSO_STATUS_MASTER];
+    sensorHubRegisters[LSM6DSO_STATUS_MASTER] &= 0x80;
+    return value;
+}
+
+/// <summary>
+///     Stores a word in the FIFO.  In stream mode a full FIFO drops its oldest word.
+/// </summary>
+static void PushFifoWord(uint8_t tag, const uint8_t *data)
+{
+    if (fifoCount == FIFO_CAPACITY_WORDS) {
+        fifoHead = (fifoHead + 1) % FIFO_CAPACITY_WORDS;
+        fifoCount--;
+        counters.fifoOverruns++;
+    }
+    int slot = (fifoHead + fifoCount) % FIFO_CAPACITY_WORDS;
+    fifo[slot][0] = (uint8_t)(tag << 3);
+    memcpy(&fifo[slot][1], data, 6);
+    fifoCount++;
+}
+
+/// <summary>
+///     Takes the samples that fall due between the last update and now.
+/// </summary>
+static void Update(void)
+{
+    static const int16_t accelerationRaw[3] = SENSOR_MODEL_ACCELERATION_RAW;
+    static const int16_t angularRateRaw[3] = SENSOR_MODEL_ANGULAR_RATE_RAW;
+    double accelerationHz = DataRateHz(registers[LSM6DSO_CTRL1_XL] >> 4);
+    double angularRateHz = DataRateHz(registers[LSM6DSO_CTRL2_G] >> 4);
+    double accelerationBatchHz = DataRateHz(registers[LSM6DSO_FIFO_CTRL3] & 0x0F);
+    double angularRateBatchHz = DataRateHz(registers[LSM6DSO_FIFO_CTRL3] >> 4);
+    bool fifoOn = (registers[LSM6DSO_FIFO_CTRL4] & 0x07) != 0;
+    bool timestampBatched = (registers[LSM6DSO_FIFO_CTRL4] >> 6) != 0 && (registers[LSM6DSO_CTRL10_C] & 0x20) != 0;
+    static const double sensorHubRatesHz[] = {104, 52, 26, 12.5};
+    double sensorHubHz = sensorHubRatesHz[sensorHubRegisters[LSM6DSO_SLV0_CONFIG] >> 6];
+    bool sensorHubOn = (sensorHubRegisters[LSM6DSO_MASTER_CONFIG] & 0x04) != 0;
+    uint8_t word[6];
+
+    if (accelerationHz > 0) {
+        uint64_t period = (uint64_t)(1e6 / accelerationHz);
+        for (uint64_t t = lastAccelerationUs + period; t <= nowUs; t += period) {
+            lastAccelerationUs = t;
+            for (int axis = 0; axis < 3; axis++) {
+                accelerationOut[axis] = (int16_t)(accelerationRaw[axis] + Noise(20));
+            }
+            accelerationReady = true;
+            if (fifoOn && accelerationBatchHz > 0 && t % (uint64_t)(1e6 / accelerationBatchHz) < period) {
+                if (timestampBatched) {
+                    uint32_t timestamp = (uint32_t)(t / 25);
+                    memset(word, 0, sizeof(word));
+                    memcpy(word, &timestamp, sizeof(timestamp));
+                    PushFifoWord(FIFO_TAG_TIMESTAMP, word);
+                }
+                for (int axis = 0; axis < 3; axis++) {
+                    PutInt16(word + 2 * axis, accelerationOut[axis]);
+                }
+                PushFifoWord(FIFO_TAG_ACCELERATION, word);
+            }
+            if (sensorHubOn && t % (uint64_t)(1e6 / sensorHubHz) < period) {
+                RunSensorHub();
+            }
+        }
+    } else {
+        lastAccelerationUs = nowUs;
+    }
+
+    if (angularRateHz > 0) {
+        uint64_t period = (uint64_t)(1e6 / angularRateHz);
+        for (uint64_t t = lastAngularRateUs + period; t <= nowUs; t += period) {
+            lastAngularRateUs = t;
+            for (int axis = 0; axis < 3; axis++) {
+                angularRateOut[axis] = (int16_t)(angularRateRaw[axis] + Noise(3));
+            }
+            angularRateReady = true;
+            if (fifoOn && angularRateBatchHz > 0 && t % (uint64_t)(1e6 / angularRateBatchHz) < period) {
+                for (int axis = 0; axis < 3; axis++) {
+                    PutInt16(word + 2 * axis, angularRateOut[axis]);
+                }
+                PushFifoWord(FIFO_TAG_ANGULAR_RATE, word);
+            }
+        }
+    } else {
+        lastAngularRateUs = nowUs;
+    }
+}
+
+/// <summary>
+///     Returns the register bank selected by FUNC_CFG_ACCESS: 0 user, 1 sensor hub, 2 embedded
+///     functions.
+/// </summary>
+static int RegisterBank(void)
+{
+    return (registers[LSM6DSO_FUNC_CFG_ACCESS] >> 6) & 0x03;
+}
+
+static uint8_t ReadRegister(uint8_t address)
+{
+    if (address != LSM6DSO_FUNC_CFG_ACCESS && RegisterBank() == 1) {
+        if (address == LSM6DSO_STATUS_MASTER) {
+            return ReadSensorHubStatus();
+        }
+        return address < sizeof(sensorHubRegisters) ? sensorHubRegisters[address] : 0;
+    }
+    if (address != LSM6DSO_FUNC_CFG_ACCESS && RegisterBank() != 0) {
+        return 0;
+    }
+
+    if (address == LSM6DSO_STATUS_REG) {
+        return (uint8_t)((accelerationReady ? 0x01 : 0) | (angularRateReady ? 0x02 : 0) |
+                         (registers[LSM6DSO_CTRL1_XL] != 0 ? 0x04 : 0));
+    }
+    if (address == LSM6DSO_OUT_TEMP_L || address == LSM6DSO_OUT_TEMP_L + 1) {
+        static const uint8_t temperature[2] = {0x40, 0x03}; // 28.3 degC
+        return temperature[address - LSM6DSO_OUT_TEMP_L];
+    }
+    if (address >= LSM6DSO_OUTX_L_G && address < LSM6DSO_OUTX_L_A) {
+        angularRateReady = false;
+        return ((const uint8_t *)angularRateOut)[address - LSM6DSO_OUTX_L_G];
+    }
+    if (address >= LSM6DSO_OUTX_L_A && address <= LSM6DSO_OUTZ_H_A) {
+        accelerationReady = false;
+        return ((const uint8_t *)accelerationOut)[address - LSM6DSO_OUTX_L_A];
+    }
+    if (address == LSM6DSO_STATUS_MASTER_MAINPAGE) {
+        return ReadSensorHubStatus();
+    }
+    if (address == LSM6DSO_FIFO_STATUS1) {
+        return (uint8_t)fifoCount;
+    }
+    if (address == LSM6DSO_FIFO_STATUS2) {
+        return (uint8_t)((fifoCount >> 8) & 0x03);
+    }
+    if (address >= LSM6DSO_TIMESTAMP0 && address <= LSM6DSO_TIMESTAMP3) {
+        uint32_t timestamp = (uint32_t)(nowUs / 25);
+        return ((const uint8_t *)&timestamp)[address - LSM6DSO_TIMESTAMP0];
+    }
+    if (address >= LSM6DSO_FIFO_DATA_OUT_TAG && address <= LSM6DSO_FIFO_DATA_OUT_Z_H) {
+        if (fifoCount == 0) {
+            return 0;
+        }
+        uint8_t value = fifo[fifoHead][address - LSM6DSO_FIFO_DATA_OUT_TAG];
+        if (address == LSM6DSO_FIFO_DATA_OUT_Z_H) {
+            switch (fifo[fifoHead][0] >> 3) {
+            case FIFO_TAG_ACCELERATION:
+                counters.fifoAccelerationWords++;
+                break;
+            case FIFO_TAG_ANGULAR_RATE:
+                counters.fifoAngularRateWords++;
+                break;
+            case FIFO_TAG_TIMESTAMP:
+                counters.fifoTimestampWords++;
+                break;
+            }
+            fifoHead = (fifoHead + 1) % FIFO_CAPACITY_WORDS;
+            fifoCount--;
+        }
+        return value;
+    }
+    return registers[address];
+}
+
+static void WriteRegister(uint8_t address, uint8_t value)
+{
+    if (address == LSM6DSO_FUNC_CFG_ACCESS) {
+        registers[address] = value;
+        sensorHubTransfer = sensorHubTransfer || RegisterBank() == 1;
+        return;
+    }
+    if (RegisterBank() == 1) {
+        if (address == LSM6DSO_MASTER_CONFIG && (value & 0x80) != 0) { // RST_MASTER_REGS
+            memset(sensorHubRegisters, 0, sizeof(sensorHubRegisters));
+        } else if (address < sizeof(sensorHubRegisters)) {
+            sensorHubRegisters[address] = value;
+        }
+        return;
+    }
+    if (RegisterBank() != 0) {
+        return;
+    }
+
+    if (address == LSM6DSO_CTRL3_C && (value & 0x01) != 0) { // SW_RESET
+        ResetLsm6dso();
+        return;
+    }
+    if (address == LSM6DSO_FIFO_CTRL4 && (value & 0x07) == 0) { // Bypass mode empties the FIFO
+        fifoHead = 0;
+        fifoCount = 0;
+    }
+    registers[address] = value;
+}
+
+/// <summary>
+///     Returns the register address that follows address in a burst.
+/// </summary>
+static uint8_t NextAddress(uint8_t address)
+{
+    if (address == LSM6DSO_FIFO_DATA_OUT_Z_H) {
+        return LSM6DSO_FIFO_DATA_OUT_TAG;
+    }
+    return (registers[LSM6DSO_CTRL3_C] & 0x04) != 0 ? (uint8_t)(address + 1) : address;
+}
+
+/// <summary>
+///     Starts a transfer: advances the clock and the samples, and checks the device address.
+/// </summary>
+static int StartTransfer(I2C_DeviceAddress address)
+{
+    nowUs += 1;
+    sensorHubTransfer = RegisterBank() == 1;
+    if (address != LSM6DSO_ADDRESS) {
+        errno = ENXIO;
+        return -1;
+    }
+    Update();
+    return 0;
+}
+
+/// <summary>
+///     Counts a transfer that put busBytes on the bus.
+/// </summary>
+static void EndTransfer(size_t busBytes)
+{
+    counters.busBytes += busBytes;
+    if (sensorHubTransfer) {
+        counters.sensorHubTransfers++;
+        counters.sensorHubBusBytes += busBytes;
+    }
+}
+
+static void WriteBytes(const uint8_t *data, size_t length)
+{
+    addressPointer = data[0];
+    for (size_t i = 1; i < length; i++) {
+        WriteRegister(addressPointer, data[i]);
+        addressPointer = NextAddress(addressPointer);
+    }
+}
+
+static void ReadBytes(uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        data[i] = ReadRegister(addressPointer);
+        addressPointer = NextAddress(addressPointer);
+    }
+}
+
+int I2CMaster_Open(I2C_InterfaceId id)
+{
+    (void)id;
+    return 3;
+}
+
+int I2CMaster_SetBusSpeed(int fd, uint32_t speedInHz)
+{
+    (void)fd;
+    (void)speedInHz;
+    return 0;
+}
+
+int I2CMaster_SetTimeout(int fd, uint32_t timeoutInMs)
+{
+    (void)fd;
+    (void)timeoutInMs;
+    return 0;
+}
+
+ssize_t I2CMaster_Write(int fd, I2C_DeviceAddress address, const uint8_t *buffer, size_t length)
+{
+    (void)fd;
+    counters.writes++;
+    if (StartTransfer(address) != 0 || length == 0) {
+        EndTransfer(1 + length);
+        return -1;
+    }
+    WriteBytes(buffer, length);
+    EndTransfer(1 + length);
+    return (ssize_t)length;
+}
+
+ssize_t I2CMaster_Read(int fd, I2C_DeviceAddress address, uint8_t *buffer, size_t maxLength)
+{
+    (void)fd;
+    counters.reads++;
+    if (StartTransfer(address) != 0) {
+        EndTransfer(1 + maxLength);
+        return -1;
+    }
+    ReadBytes(buffer, maxLength);
+    EndTransfer(1 + maxLength);
+    return (ssize_t)maxLength;
+}
+
+ssize_t I2CMaster_WriteThenRead(int fd, I2C_DeviceAddress address, const uint8_t *writeData,
+                                size_t lenWriteData, uint8_t *readData, size_t lenReadData)
+{
+    (void)fd;
+    counters.writeThenReads++;
+    if (StartTransfer(address) != 0 || lenWriteData == 0) {
+        EndTransfer(1 + lenWriteData + 1 + lenReadData);
+        return -1;
+    }
+    WriteBytes(writeData, lenWriteData);
+    ReadBytes(readData, lenReadData);
+    EndTransfer(1 + lenWriteData + 1 + lenReadData);
+    return (ssize_t)(lenWriteData + lenReadData);
+}
+
+int nanosleep(const struct timespec *duration, struct timespec *remaining)
+{
+    (void)remaining;
+    uint64_t us = (uint64_t)duration->tv_sec * 1000000 + (uint64_t)duration->tv_nsec / 1000;
+    counters.sleeps++;
+    counters.sleptUs += us;
+    nowUs += us;
+    return 0;
+}
+
+void SensorModel_Reset(bool noise)
+{
+    ResetLsm6dso();
+    ResetLps22hh();
+    memset(&counters, 0, sizeof(counters));
+    nowUs = 0;
+    addNoise = noise;
+    noiseState = 12345;
+    addressPointer = 0;
+    lastAccelerationUs = 0;
+    lastAngularRateUs = 0;
+    accelerationReady = false;
+    angularRateReady = false;
+}
+
+uint64_t SensorModel_NowUs(void)
+{
+    return nowUs;
+}
+
+void SensorModel_Advance(uint64_t us)
+{
+    nowUs += us;
+}
+
+SensorModelCounters SensorModel_Counters(void)
+{
+    return counters;
+}
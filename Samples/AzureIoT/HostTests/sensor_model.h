@@ -0,0 +1,52 @@
+// Register-level model of the LSM6DSO on the I2C bus, with an LPS22HH behind its sensor hub, for
+// host tests of i2c.c.  It implements the applibs I2CMaster_* functions and nanosleep on a
+// simulated clock, and counts the I2C transfers and bus bytes they cost.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    unsigned long writes;         // I2CMaster_Write calls
+    unsigned long reads;          // I2CMaster_Read calls
+    unsigned long writeThenReads; // I2CMaster_WriteThenRead calls
+    unsigned long busBytes;       // Bytes put on the bus, address bytes included
+    unsigned long sleeps;         // nanosleep calls
+    uint64_t sleptUs;             // Time spent in nanosleep
+    unsigned long fifoAccelerationWords; // FIFO words read out, by tag
+    unsigned long fifoAngularRateWords;
+    unsigned long fifoTimestampWords;
+    unsigned long fifoOverruns;   // Words dropped because the FIFO was full
+    unsigned long sensorHubTransfers;     // Transfers that select or access the sensor hub bank
+    unsigned long sensorHubBusBytes;      // Bytes those transfers put on the bus
+    unsigned long lps22hhOperations;      // Sensor hub master operations on the LPS22HH
+} SensorModelCounters;
+
+/// <summary>
+///     Powers the model up, clears the counters and sets the clock to 0.
+/// </summary>
+/// <param name="noise">Adds noise to the sensor outputs; without it every sample is the same</param>
+void SensorModel_Reset(bool noise);
+
+/// <summary>
+///     Returns the simulated time in microseconds.  Each transfer takes 1 us and nanosleep
+///     advances the clock by the time asked for.
+/// </summary>
+uint64_t SensorModel_NowUs(void);
+
+/// <summary>
+///     Advances the simulated time, as while the application waits in its event loop.
+/// </summary>
+void SensorModel_Advance(uint64_t us);
+
+/// <summary>
+///     Returns the counters accumulated since SensorModel_Reset.
+/// </summary>
+SensorModelCounters SensorModel_Counters(void);
+
+// Raw outputs of the model, before noise.  The accelerometer is close to 1 g on Z.
+#define SENSOR_MODEL_ACCELERATION_RAW {100, -200, 8197}
+#define SENSOR_MODEL_ANGULAR_RATE_RAW {12, -7, 3}
+#define SENSOR_MODEL_PRESSURE_HPA 1013.25
+#define SENSOR_MODEL_TEMPERATURE_DEGC 23.5
@@ -0,0 +1,336 @@
+// Host test of the sensor reading in i2c.c, against the register model in sensor_model.c.  The
+// event loop timers run on the model's clock.  As in eventloops/i2c_eventloop.c, a timer calls
+// readSensorData every ACCEL_READ_PERIOD_SECONDS and initI2c arms the sensor initialization
+// timer.  Built once polling the output registers and once with SENSOR_FIFO_ACQUISITION.
+//
+// After RUN_SECONDS the test prints when the sensors were ready, the longest timer handler run
+// and the mean cost of a reading, and fails unless the readings match the model.  A reading
+// must not sleep, and must take EXPECTED_TRANSFERS_PER_READING I2C transfers and the bus bytes
+// they account for.  The counts i2c.c logs with ENABLE_I2C_TRANSFER_COUNTS must agree with the
+// model.  With SENSOR_FIFO_ACQUISITION every full period must also hold 12 or 13
+// accelerometer and gyroscope samples, with no FIFO overruns.  The test then reads the LPS22HH
+// once more through the sensor hub pass-through accesses, as readSensorData did before it
+// used the continuous sensor hub reads, and prints what that costs.  Pass -v to see the log of
+// i2c.c.
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lsm6dso_fifo.h"
+
+#include "build_options.h"
+#include "eventloop_timer_utilities.h"
+#include "i2c.h"
+#include "lps22hh_reg.h"
+#include "sensor_model.h"
+
+#define RUN_SECONDS 20
+#define MAX_TIMERS 4
+#define ACCELERATION_TOLERANCE_MG 5.0
+#define ANGULAR_RATE_TOLERANCE_DPS 0.5
+#define PRESSURE_TOLERANCE_HPA 0.1
+#define TEMPERATURE_TOLERANCE_DEGC 0.1
+#define MIN_SAMPLES_PER_PERIOD 12
+#define MAX_SAMPLES_PER_PERIOD 13
+
+// A reading reads the sensor outputs in one burst from STATUS_REG and the LPS22HH outputs with
+// three sensor hub transfers.  With the FIFO it also reads FIFO_STATUS1/2, then the FIFO words in
+// one burst.  Each read costs its data plus 3 bytes, each bank switch 3 bytes.
+#ifdef SENSOR_FIFO_ACQUISITION
+#define EXPECTED_TRANSFERS_PER_READING 6
+#define EXPECTED_BUS_BYTES_PER_READING(fifoWords) (29 + LSM6DSO_FIFO_WORD_SIZE * (fifoWords))
+#else
+#define EXPECTED_TRANSFERS_PER_READING 4
+#define EXPECTED_BUS_BYTES_PER_READING(fifoWords) 33
+#endif
+
+struct EventLoopTimer {
+    EventLoopTimerHandler handler;
+    uint64_t periodUs;
+    uint64_t dueUs;
+    bool armed;
+};
+
+static EventLoopTimer timers[MAX_TIMERS];
+static int timerCount = 0;
+static bool verbose = false;
+
+static unsigned long failures = 0;
+static unsigned long readings = 0;          // Readings taken after the sensors were ready
+static unsigned long periods = 0;           // Those readings that followed another one
+static SensorModelCounters readingCost;     // Sum of the model counters over those periods
+static EventLoopTimer *sensorInitTimer = NULL;
+static unsigned long loggedTransfers = 0;   // Last counts logged by i2c.c
+static unsigned long loggedBusBytes = 0;
+static bool transferCountsLogged = false;
+
+// Defined in i2c.c
+extern lps22hh_ctx_t pressure_ctx;
+extern bool lps22hhDetected;
+
+/// <summary>
+///     Prints the log of i2c.c with -v, and picks up the counts logged by readSensorData.
+/// </summary>
+int Log_Debug(const char *fmt, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    int result = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    if (sscanf(line, "I2C: %lu transfers, %lu bus bytes", &loggedTransfers, &loggedBusBytes) == 2) {
+        transferCountsLogged = true;
+    }
+    if (verbose) {
+        fputs(line, stdout);
+    }
+    return result;
+}
+
+void CloseFdAndPrintError(int fd, const char *fdName)
+{
+    (void)fd;
+    (void)fdName;
+}
+
+EventLoopTimer *CreateEventLoopPeriodicTimer(EventLoop *eventLoop, EventLoopTimerHandler handler,
+                                             const struct timespec *period)
+{
+    (void)eventLoop;
+    if (timerCount == MAX_TIMERS) {
+        return NULL;
+    }
+    EventLoopTimer *timer = &timers[timerCount++];
+    timer->handler = handler;
+    timer->periodUs = (uint64_t)period->tv_sec * 1000000 + (uint64_t)period->tv_nsec / 1000;
+    timer->dueUs = SensorModel_NowUs() + timer->periodUs;
+    timer->armed = true;
+    return timer;
+}
+
+int ConsumeEventLoopTimerEvent(EventLoopTimer *timer)
+{
+    (void)timer;
+    return 0;
+}
+
+int DisarmEventLoopTimer(EventLoopTimer *timer)
+{
+    timer->armed = false;
+    return 0;
+}
+
+void DisposeEventLoopTimer(EventLoopTimer *timer)
+{
+    if (timer != NULL) {
+        timer->armed = false;
+    }
+}
+
+static void Fail(const char *what, double value)
+{
+    printf("FAIL: %s: %g\n", what, value);
+    failures++;
+}
+
+static void CheckNear(const char *what, double value, double expected, double tolerance)
+{
+    if (!(fabs(value - expected) <= tolerance)) {
+        Fail(what, value);
+    }
+}
+
+/// <summary>
+///     Adds the counters of one reading to readingCost and checks them.  The first reading after
+///     the sensors are ready covers less than a period, so it is left out.
+/// </summary>
+static void CheckReadingCost(const SensorModelCounters *before, const SensorModelCounters *after)
+{
+    if (readings == 1) {
+        return;
+    }
+    periods++;
+    unsigned long transfers = (after->writes + after->reads + after->writeThenReads) -
+                              (before->writes + before->reads + before->writeThenReads);
+    unsigned long busBytes = after->busBytes - before->busBytes;
+    unsigned long fifoWords = (after->fifoAccelerationWords + after->fifoAngularRateWords + after->fifoTimestampWords) -
+                              (before->fifoAccelerationWords + before->fifoAngularRateWords + before->fifoTimestampWords);
+    readingCost.writes += after->writes - before->writes;
+    readingCost.reads += after->reads - before->reads;
+    readingCost.writeThenReads += after->writeThenReads - before->writeThenReads;
+    readingCost.busBytes += busBytes;
+    readingCost.sleeps += after->sleeps - before->sleeps;
+    readingCost.sensorHubTransfers += after->sensorHubTransfers - before->sensorHubTransfers;
+    readingCost.sensorHubBusBytes += after->sensorHubBusBytes - before->sensorHubBusBytes;
+    readingCost.lps22hhOperations += after->lps22hhOperations - before->lps22hhOperations;
+
+    if (transfers != EXPECTED_TRANSFERS_PER_READING) {
+        Fail("I2C transfers in a reading", (double)transfers);
+    }
+    if (busBytes != EXPECTED_BUS_BYTES_PER_READING(fifoWords)) {
+        Fail("bus bytes in a reading", (double)busBytes);
+    }
+    if (!transferCountsLogged || loggedTransfers != transfers || loggedBusBytes != busBytes) {
+        Fail("I2C transfers logged by i2c.c", (double)loggedTransfers);
+    }
+
+#ifdef SENSOR_FIFO_ACQUISITION
+    unsigned long accelerationWords = after->fifoAccelerationWords - before->fifoAccelerationWords;
+    unsigned long angularRateWords = after->fifoAngularRateWords - before->fifoAngularRateWords;
+    readingCost.fifoAccelerationWords += accelerationWords;
+    readingCost.fifoAngularRateWords += angularRateWords;
+    readingCost.fifoTimestampWords += after->fifoTimestampWords - before->fifoTimestampWords;
+
+    if (accelerationWords < MIN_SAMPLES_PER_PERIOD || accelerationWords > MAX_SAMPLES_PER_PERIOD) {
+        Fail("accelerometer samples in a period", (double)accelerationWords);
+    }
+    if (angularRateWords < MIN_SAMPLES_PER_PERIOD || angularRateWords > MAX_SAMPLES_PER_PERIOD) {
+        Fail("gyroscope samples in a period", (double)angularRateWords);
+    }
+#endif
+}
+
+/// <summary>
+///     Checks the readings against the model outputs.  The gyroscope is calibrated at rest, so
+///     its readings are close to 0.
+/// </summary>
+static void CheckReadingValues(void)
+{
+    static const int16_t accelerationRaw[3] = SENSOR_MODEL_ACCELERATION_RAW;
+    xl_data acceleration = getXlData();
+    ang_data angularRate = getAngData();
+
+    CheckNear("acceleration x [mg]", acceleration.x, accelerationRaw[0] * 0.122, ACCELERATION_TOLERANCE_MG);
+    CheckNear("acceleration y [mg]", acceleration.y, accelerationRaw[1] * 0.122, ACCELERATION_TOLERANCE_MG);
+    CheckNear("acceleration z [mg]", acceleration.z, accelerationRaw[2] * 0.122, ACCELERATION_TOLERANCE_MG);
+    CheckNear("angular rate x [dps]", angularRate.x, 0.0, ANGULAR_RATE_TOLERANCE_DPS);
+    CheckNear("angular rate y [dps]", angularRate.y, 0.0, ANGULAR_RATE_TOLERANCE_DPS);
+    CheckNear("angular rate z [dps]", angularRate.z, 0.0, ANGULAR_RATE_TOLERANCE_DPS);
+    CheckNear("pressure [hPa]", getPressData().pressure, SENSOR_MODEL_PRESSURE_HPA, PRESSURE_TOLERANCE_HPA);
+    CheckNear("temperature [degC]", getTempData().temp, SENSOR_MODEL_TEMPERATURE_DEGC, TEMPERATURE_TOLERANCE_DEGC);
+}
+
+/// <summary>
+///     Reads the LPS22HH status, pressure and temperature through the pass-through accesses in
+///     i2c.c, and prints the cost.  This is the per-reading work readSensorData did before the
+///     sensor hub read the LPS22HH continuously.  The pass-through accesses reconfigure the
+///     sensor hub, so this is done last.
+/// </summary>
+static void MeasurePassThroughReading(void)
+{
+    SensorModelCounters before = SensorModel_Counters();
+    uint64_t startUs = SensorModel_NowUs();
+    lps22hh_status_t status = {0};
+    uint8_t pressure[4] = {0};
+    int16_t temperature = 0;
+
+    lps22hh_read_reg(&pressure_ctx, LPS22HH_STATUS, (uint8_t *)&status, 1);
+    if (status.p_da && status.t_da) {
+        lps22hh_pressure_raw_get(&pressure_ctx, pressure);
+        lps22hh_temperature_raw_get(&pressure_ctx, (uint8_t *)&temperature);
+    }
+
+    SensorModelCounters after = SensorModel_Counters();
+    printf("LPS22HH through pass-through accesses: %lu I2C transfers, %lu bus bytes, %.1f ms, %.1f ms of them in HAL_Delay\n",
+           (after.writes + after.reads + after.writeThenReads) - (before.writes + before.reads + before.writeThenReads),
+           after.busBytes - before.busBytes, (SensorModel_NowUs() - startUs) / 1e3,
+           (after.sleptUs - before.sleptUs) / 1e3);
+
+    uint32_t pressureRaw = (uint32_t)pressure[0] | ((uint32_t)pressure[1] << 8) | ((uint32_t)pressure[2] << 16);
+    CheckNear("pass-through pressure [hPa]", lps22hh_from_lsb_to_hpa(pressureRaw), SENSOR_MODEL_PRESSURE_HPA, PRESSURE_TOLERANCE_HPA);
+    CheckNear("pass-through temperature [degC]", lps22hh_from_lsb_to_celsius(temperature), SENSOR_MODEL_TEMPERATURE_DEGC, TEMPERATURE_TOLERANCE_DEGC);
+}
+
+static void AccelTimerEventHandler(EventLoopTimer *timer)
+{
+    (void)timer;
+    bool ready = !sensorInitTimer->armed;
+    SensorModelCounters before = SensorModel_Counters();
+
+    transferCountsLogged = false;
+    readSensorData();
+
+    if (ready) {
+        SensorModelCounters after = SensorModel_Counters();
+        readings++;
+        CheckReadingCost(&before, &after);
+        CheckReadingValues();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    SensorModel_Reset(true);
+
+    struct timespec accelReadPeriod = {.tv_sec = ACCEL_READ_PERIOD_SECONDS, .tv_nsec = ACCEL_READ_PERIOD_NANO_SECONDS};
+    CreateEventLoopPeriodicTimer(NULL, &AccelTimerEventHandler, &accelReadPeriod);
+    if (initI2c(NULL) != 0) {
+        printf("FAIL: initI2c\n");
+        return 1;
+    }
+    sensorInitTimer = &timers[timerCount - 1];
+
+    uint64_t readyUs = 0;
+    uint64_t longestHandlerUs = 0;
+    while (SensorModel_NowUs() < (uint64_t)RUN_SECONDS * 1000000) {
+        EventLoopTimer *next = NULL;
+        for (int i = 0; i < timerCount; i++) {
+            if (timers[i].armed && (next == NULL || timers[i].dueUs < next->dueUs)) {
+                next = &timers[i];
+            }
+        }
+        if (SensorModel_NowUs() < next->dueUs) {
+            SensorModel_Advance(next->dueUs - SensorModel_NowUs());
+        }
+        next->dueUs += next->periodUs;
+
+        uint64_t startUs = SensorModel_NowUs();
+        next->handler(next);
+        if (SensorModel_NowUs() - startUs > longestHandlerUs) {
+            longestHandlerUs = SensorModel_NowUs() - startUs;
+        }
+        if (readyUs == 0 && !sensorInitTimer->armed) {
+            readyUs = SensorModel_NowUs();
+        }
+    }
+
+    SensorModelCounters total = SensorModel_Counters();
+    printf("Sensors ready after %.3f s, longest timer handler %.1f ms\n", readyUs / 1e6, longestHandlerUs / 1e3);
+    if (periods == 0) {
+        printf("FAIL: no readings\n");
+        return 1;
+    }
+    if (!lps22hhDetected) {
+        printf("FAIL: LPS22HH not detected\n");
+        failures++;
+    }
+    printf("Per reading: %.1f I2C transfers (%.1f write, %.1f read, %.1f write-then-read), %.1f bus bytes\n",
+           (double)(readingCost.writes + readingCost.reads + readingCost.writeThenReads) / periods,
+           (double)readingCost.writes / periods, (double)readingCost.reads / periods,
+           (double)readingCost.writeThenReads / periods, (double)readingCost.busBytes / periods);
+    printf("LPS22HH through the sensor hub: %.1f I2C transfers, %.1f bus bytes per reading; %.1f sensor hub reads of the LPS22HH per period\n",
+           (double)readingCost.sensorHubTransfers / periods, (double)readingCost.sensorHubBusBytes / periods,
+           (double)readingCost.lps22hhOperations / periods);
+    if (readingCost.sleeps != 0) {
+        Fail("sleeps while reading", (double)readingCost.sleeps);
+    }
+#ifdef SENSOR_FIFO_ACQUISITION
+    printf("FIFO words per reading: %.1f accelerometer, %.1f gyroscope, %.1f timestamp; %lu overruns\n",
+           (double)readingCost.fifoAccelerationWords / periods, (double)readingCost.fifoAngularRateWords / periods,
+           (double)readingCost.fifoTimestampWords / periods, total.fifoOverruns);
+    if (total.fifoOverruns != 0) {
+        Fail("FIFO overruns", (double)total.fifoOverruns);
+    }
+#else
+    (void)total;
+#endif
+    MeasurePassThroughReading();
+    printf("%lu readings, %lu failures\n", readings, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,6 @@
+// Host stand-in for the Azure Sphere SDK header of the same name, with only what the sample
+// sources built by the host tests use.
+
+#pragma once
+
+typedef int GPIO_Id;
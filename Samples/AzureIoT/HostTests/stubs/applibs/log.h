@@ -0,0 +1,7 @@
+// Host stand-in for the Azure Sphere SDK header of the same name, with only what the sample
+// sources built by the host tests use.
+// Log_Debug is implemented by each test.
+
+#pragma once
+
+int Log_Debug(const char *fmt, ...);
@@ -0,0 +1,8 @@
+// Host stand-in for the Azure Sphere SDK header of the same name, with only what the sample
+// sources built by the host tests use.
+
+#pragma once
+
+#include <stdbool.h>
+
+int Networking_IsNetworkingReady(bool *outIsNetworkingReady);
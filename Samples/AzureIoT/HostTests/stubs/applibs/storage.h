@@ -0,0 +1,7 @@
+// Host stand-in for the Azure Sphere SDK header of the same name, with only what the sample
+// sources built by the host tests use.
+// Storage_OpenMutableFile is implemented by each test that needs it.
+
+#pragma once
+
+int Storage_OpenMutableFile(void);
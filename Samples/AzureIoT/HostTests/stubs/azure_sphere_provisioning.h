@@ -0,0 +1,17 @@
+// Host stand-in for the Azure Sphere SDK header of the same name, with only what the sample
+// sources built by the host tests use.
+
+#pragma once
+
+typedef enum {
+    AZURE_SPHERE_PROV_RESULT_OK,
+    AZURE_SPHERE_PROV_RESULT_INVALID_PARAM,
+    AZURE_SPHERE_PROV_RESULT_NETWORK_NOT_READY,
+    AZURE_SPHERE_PROV_RESULT_DEVICEAUTH_NOT_READY,
+    AZURE_SPHERE_PROV_RESULT_PROV_DEVICE_ERROR,
+    AZURE_SPHERE_PROV_RESULT_GENERIC_ERROR
+} AZURE_SPHERE_PROV_RESULT;
+
+typedef struct {
+    AZURE_SPHERE_PROV_RESULT result;
+} AZURE_SPHERE_PROV_RETURN_VALUE;
@@ -0,0 +1,6 @@
+// Host stand-in for the Azure Sphere SDK header of the same name, with only what the sample
+// sources built by the host tests use.
+
+#pragma once
+
+#define AVNET_MT3620_SK_ISU2_I2C 2
@@ -0,0 +1,189 @@
+// Host test of when telemetry_batch.c sends a batch.  Readings are added with
+// TelemetryBatch_Add and TelemetryBatch_AddField, and every document passed to the send
+// function is compared with the one expected.  A batch must go out before a reading whose key
+// it already holds, before a reading that would make it hold more than
+// TELEMETRY_BATCH_MAX_READINGS, and before any reading added once its oldest reading has waited
+// TELEMETRY_BATCH_MAX_LATENCY_SECONDS.  A reading that does not fit behind the batched readings
+// must start a new batch, and one that does not fit in an empty batch must be dropped.  The
+// batcher reads CLOCK_MONOTONIC, which this test replaces with a clock it sets.
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "build_options.h"
+#include "telemetry_batch.h"
+
+#define MAX_SENT 8
+
+static char sent[MAX_SENT][TELEMETRY_BATCH_BUFFER_SIZE + 1];
+static int sentCount = 0;
+static time_t nowSeconds = 1000;
+static unsigned long failures = 0;
+static bool verbose = false;
+
+int Log_Debug(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int result = verbose ? vprintf(fmt, args) : 0;
+    va_end(args);
+    return result;
+}
+
+int clock_gettime(clockid_t clockId, struct timespec *time)
+{
+    (void)clockId;
+    time->tv_sec = nowSeconds;
+    time->tv_nsec = 0;
+    return 0;
+}
+
+static void SendBatch(const char *payload, size_t payloadSize)
+{
+    if (sentCount < MAX_SENT) {
+        memcpy(sent[sentCount], payload, payloadSize);
+        sent[sentCount][payloadSize] = '\0';
+    }
+    sentCount++;
+}
+
+/// <summary>
+///     Fails the test unless exactly the documents in expected were sent since the last check.
+/// </summary>
+static void ExpectSent(const char *step, const char *const *expected, int expectedCount)
+{
+    if (sentCount != expectedCount) {
+        printf("FAIL: %s: %d batches sent, expected %d\n", step, sentCount, expectedCount);
+        failures++;
+    } else {
+        for (int i = 0; i < expectedCount; i++) {
+            if (strcmp(sent[i], expected[i]) != 0) {
+                printf("FAIL: %s: sent %s, expected %s\n", step, sent[i], expected[i]);
+                failures++;
+            }
+        }
+    }
+    sentCount = 0;
+}
+
+static void ExpectNothingSent(const char *step)
+{
+    ExpectSent(step, NULL, 0);
+}
+
+static void ExpectOneSent(const char *step, const char *expected)
+{
+    ExpectSent(step, &expected, 1);
+}
+
+static void RepeatedKey(void)
+{
+    TelemetryBatch_Add("a", "1");
+    TelemetryBatch_Add("b", "2");
+    TelemetryBatch_Add("c", "3");
+    ExpectNothingSent("three keys");
+
+    TelemetryBatch_Add("b", "4");
+    ExpectOneSent("repeated key", "{\"a\":\"1\",\"b\":\"2\",\"c\":\"3\"}");
+
+    TelemetryBatch_Flush();
+    ExpectOneSent("flush after repeated key", "{\"b\":\"4\"}");
+
+    TelemetryBatch_Flush();
+    ExpectNothingSent("flush of an empty batch");
+}
+
+static void MaxReadings(void)
+{
+    char expected[TELEMETRY_BATCH_BUFFER_SIZE] = "{";
+    for (int i = 0; i < TELEMETRY_BATCH_MAX_READINGS; i++) {
+        char key[8];
+        snprintf(key, sizeof(key), "k%d", i);
+        JsonField field = {.name = key, .type = JsonField_Int};
+        JsonFieldValue value = {.integer = i};
+        TelemetryBatch_AddField(&field, &value);
+
+        size_t length = strlen(expected);
+        snprintf(expected + length, sizeof(expected) - length, "%s\"%s\":%d", i > 0 ? "," : "",
+                 key, i);
+    }
+    strcat(expected, "}");
+    ExpectNothingSent("TELEMETRY_BATCH_MAX_READINGS keys");
+
+    TelemetryBatch_Add("last", "x");
+    ExpectOneSent("one key more than TELEMETRY_BATCH_MAX_READINGS", expected);
+
+    TelemetryBatch_Flush();
+    ExpectOneSent("flush after a full batch", "{\"last\":\"x\"}");
+}
+
+static void Latency(void)
+{
+    TelemetryBatch_Add("a", "1");
+    nowSeconds += TELEMETRY_BATCH_MAX_LATENCY_SECONDS - 1;
+    TelemetryBatch_Add("b", "2");
+    ExpectNothingSent("before TELEMETRY_BATCH_MAX_LATENCY_SECONDS");
+
+    // The wait counts from the oldest reading, not from the last one.
+    nowSeconds += 1;
+    TelemetryBatch_Add("c", "3");
+    ExpectOneSent("after TELEMETRY_BATCH_MAX_LATENCY_SECONDS", "{\"a\":\"1\",\"b\":\"2\"}");
+
+    nowSeconds += TELEMETRY_BATCH_MAX_LATENCY_SECONDS - 1;
+    TelemetryBatch_Flush();
+    ExpectOneSent("flush before the latency", "{\"c\":\"3\"}");
+}
+
+static void Overflow(void)
+{
+    // Each reading takes about a third of the buffer, so the third does not fit behind the
+    // first two.
+    static char value[TELEMETRY_BATCH_BUFFER_SIZE / 3];
+    memset(value, 'v', sizeof(value) - 1);
+
+    TelemetryBatch_Add("a", value);
+    TelemetryBatch_Add("b", value);
+    ExpectNothingSent("two large readings");
+    TelemetryBatch_Add("c", value);
+    if (sentCount != 1 || strncmp(sent[0], "{\"a\":", 5) != 0 ||
+        strstr(sent[0], ",\"b\":") == NULL) {
+        printf("FAIL: a reading that does not fit did not send the batch before it\n");
+        failures++;
+    }
+    sentCount = 0;
+
+    static char tooLarge[TELEMETRY_BATCH_BUFFER_SIZE];
+    memset(tooLarge, 'v', sizeof(tooLarge) - 1);
+    if (TelemetryBatch_Add("d", tooLarge)) {
+        printf("FAIL: a reading larger than a batch was added\n");
+        failures++;
+    }
+    if (sentCount != 1 || strncmp(sent[0], "{\"c\":", 5) != 0) {
+        printf("FAIL: the batch was not sent before a reading larger than a batch\n");
+        failures++;
+    }
+    sentCount = 0;
+
+    TelemetryBatch_Flush();
+    ExpectNothingSent("flush after a dropped reading");
+}
+
+int main(int argc, char *argv[])
+{
+    verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    TelemetryBatch_Init(SendBatch);
+
+    RepeatedKey();
+    MaxReadings();
+    Latency();
+    Overflow();
+
+    TelemetryBatchStats stats = TelemetryBatch_GetStats();
+    printf("%lu messages for %lu readings, %lu bytes, %lu failures\n", stats.messages,
+           stats.readings, stats.bytes, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
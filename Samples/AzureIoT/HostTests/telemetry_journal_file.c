@@ -0,0 +1,271 @@
+// Host test of telemetry_journal.c over a temporary file.  The journal region starts at an
+// offset within the file and holds JOURNAL_SLOTS records, so the tests run it around the ring,
+// fill it until it drops its oldest records, and reopen it after every step to check that the
+// file holds the same records.  The file is then damaged as a power cut or flash fault would:
+// each header copy is corrupted in turn, and the data of a record is corrupted.  The layout
+// constants below must match telemetry_journal.c.
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "build_options.h"
+#include "telemetry_journal.h"
+
+#define HEADER_SLOT_SIZE 64
+#define RECORD_HEADER_SIZE 16
+#define SLOT_SIZE (RECORD_HEADER_SIZE + TELEMETRY_JOURNAL_RECORD_SIZE)
+#define JOURNAL_SLOTS 3
+#define REGION_OFFSET 100
+#define REGION_SIZE (2 * HEADER_SLOT_SIZE + JOURNAL_SLOTS * SLOT_SIZE)
+#define FILE_SIZE (REGION_OFFSET + REGION_SIZE)
+
+static int fd = -1;
+static unsigned long failures = 0;
+static bool verbose = false;
+
+int Log_Debug(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int result = verbose ? vprintf(fmt, args) : 0;
+    va_end(args);
+    return result;
+}
+
+static void Fail(const char *step, const char *message)
+{
+    printf("FAIL: %s: %s\n", step, message);
+    failures++;
+}
+
+static void Reopen(void)
+{
+    TelemetryJournal_Close();
+    if (TelemetryJournal_Open(fd, REGION_OFFSET, REGION_SIZE) != 0) {
+        Fail("open", "TelemetryJournal_Open failed");
+    }
+}
+
+/// <summary>
+///     Empties the file and opens a new journal in it.
+/// </summary>
+static void CreateJournal(void)
+{
+    TelemetryJournal_Close();
+    static const char empty[FILE_SIZE];
+    if (pwrite(fd, empty, sizeof(empty), 0) != sizeof(empty)) {
+        Fail("create", "cannot clear the file");
+    }
+    Reopen();
+}
+
+static void Append(int number)
+{
+    char payload[32];
+    int length = snprintf(payload, sizeof(payload), "{\"n\":%d}", number);
+    if (!TelemetryJournal_Append(payload, (size_t)length, 1000 + number)) {
+        Fail("append", payload);
+    }
+}
+
+/// <summary>
+///     Fails the test unless the journal holds exactly the records numbered in expected, oldest
+///     first.  The records are read without being consumed.
+/// </summary>
+static void ExpectHeld(const char *step, const int *expected, unsigned int expectedCount)
+{
+    char message[128];
+    if (TelemetryJournal_Count() != expectedCount) {
+        snprintf(message, sizeof(message), "holds %u records, expected %u",
+                 TelemetryJournal_Count(), expectedCount);
+        Fail(step, message);
+        return;
+    }
+    if (expectedCount == 0) {
+        return;
+    }
+
+    char buffer[TELEMETRY_JOURNAL_RECORD_SIZE];
+    time_t timestamp;
+    uint32_t recordId;
+    ssize_t length = TelemetryJournal_Peek(buffer, sizeof(buffer), &timestamp, &recordId);
+    char payload[32];
+    snprintf(payload, sizeof(payload), "{\"n\":%d}", expected[0]);
+    if (length != (ssize_t)strlen(payload) || memcmp(buffer, payload, (size_t)length) != 0 ||
+        timestamp != 1000 + expected[0]) {
+        snprintf(message, sizeof(message), "oldest record is %.*s at %ld, expected %s at %d",
+                 length > 0 ? (int)length : 0, buffer, (long)timestamp, payload,
+                 1000 + expected[0]);
+        Fail(step, message);
+    }
+}
+
+/// <summary>
+///     Reads, checks and consumes every record, as the replay does once IoT Hub confirms them.
+/// </summary>
+static void ExpectDrained(const char *step, const int *expected, unsigned int expectedCount)
+{
+    for (unsigned int i = 0; i < expectedCount; i++) {
+        ExpectHeld(step, expected + i, expectedCount - i);
+        char buffer[TELEMETRY_JOURNAL_RECORD_SIZE];
+        time_t timestamp;
+        uint32_t recordId;
+        if (TelemetryJournal_Peek(buffer, sizeof(buffer), &timestamp, &recordId) > 0) {
+            TelemetryJournal_Consume(recordId);
+        }
+    }
+    ExpectHeld(step, NULL, 0);
+}
+
+static void WrapAround(void)
+{
+    CreateJournal();
+    ExpectHeld("new journal", NULL, 0);
+
+    // Two records at a time, so that every slot is used at both ends of the held records.
+    for (int i = 0; i < 4 * JOURNAL_SLOTS; i += 2) {
+        Append(i);
+        Append(i + 1);
+        Reopen();
+        const int expected[] = {i, i + 1};
+        ExpectDrained("wrap-around", expected, 2);
+        Reopen();
+        ExpectHeld("wrap-around after consuming", NULL, 0);
+    }
+}
+
+static void DropOldest(void)
+{
+    CreateJournal();
+    Append(1);
+    Append(2);
+    Append(3);
+
+    // The oldest record is being replayed when the journal fills up.
+    char buffer[TELEMETRY_JOURNAL_RECORD_SIZE];
+    time_t timestamp;
+    uint32_t replayedId;
+    TelemetryJournal_Peek(buffer, sizeof(buffer), &timestamp, &replayedId);
+
+    Append(4);
+    Append(5);
+    const int expected[] = {3, 4, 5};
+    ExpectHeld("full journal", expected, JOURNAL_SLOTS);
+
+    // Its confirmation must not remove the record that took its place.
+    TelemetryJournal_Consume(replayedId);
+    ExpectHeld("confirmation of a dropped record", expected, JOURNAL_SLOTS);
+
+    Reopen();
+    ExpectDrained("full journal after reopening", expected, JOURNAL_SLOTS);
+}
+
+static void TornHeader(void)
+{
+    CreateJournal();
+    Append(1);
+    Append(2);
+    Append(3);
+    TelemetryJournal_Close();
+
+    static char image[FILE_SIZE];
+    if (pread(fd, image, sizeof(image), 0) != sizeof(image)) {
+        Fail("torn header", "cannot read the file");
+        return;
+    }
+
+    // The newest copy was written by the last append, so losing it loses only that record.
+    // Losing the other copy loses nothing.
+    unsigned int heldWithCopyCorrupted[2];
+    for (int copy = 0; copy < 2; copy++) {
+        char torn[FILE_SIZE];
+        memcpy(torn, image, sizeof(torn));
+        torn[REGION_OFFSET + copy * HEADER_SLOT_SIZE + 8] ^= 0x5A;
+        pwrite(fd, torn, sizeof(torn), 0);
+        Reopen();
+        heldWithCopyCorrupted[copy] = TelemetryJournal_Count();
+        const int expected[] = {1, 2, 3};
+        ExpectDrained("torn header", expected, heldWithCopyCorrupted[copy]);
+    }
+    if (!((heldWithCopyCorrupted[0] == 2 && heldWithCopyCorrupted[1] == 3) ||
+          (heldWithCopyCorrupted[0] == 3 && heldWithCopyCorrupted[1] == 2))) {
+        char message[96];
+        snprintf(message, sizeof(message), "held %u and %u records, expected 2 and 3",
+                 heldWithCopyCorrupted[0], heldWithCopyCorrupted[1]);
+        Fail("torn header", message);
+    }
+
+    // With both copies corrupted there is nothing to recover, so a new journal is created.
+    image[REGION_OFFSET + 8] ^= 0x5A;
+    image[REGION_OFFSET + HEADER_SLOT_SIZE + 8] ^= 0x5A;
+    pwrite(fd, image, sizeof(image), 0);
+    Reopen();
+    ExpectHeld("both header copies corrupted", NULL, 0);
+    Append(4);
+    Reopen();
+    const int expected[] = {4};
+    ExpectDrained("new journal after corrupted headers", expected, 1);
+}
+
+static void CorruptRecord(void)
+{
+    CreateJournal();
+    Append(1);
+    Append(2);
+    Append(3);
+
+    // Flip a byte of the second record's document.  The first and third must still be read,
+    // and the second discarded when it reaches the head.
+    off_t offset = REGION_OFFSET + 2 * HEADER_SLOT_SIZE + SLOT_SIZE + RECORD_HEADER_SIZE + 2;
+    char byte;
+    pread(fd, &byte, 1, offset);
+    byte ^= 0x01;
+    pwrite(fd, &byte, 1, offset);
+
+    Reopen();
+    const int first[] = {1};
+    ExpectHeld("corrupt record", first, JOURNAL_SLOTS);
+
+    char buffer[TELEMETRY_JOURNAL_RECORD_SIZE];
+    time_t timestamp;
+    uint32_t recordId;
+    TelemetryJournal_Peek(buffer, sizeof(buffer), &timestamp, &recordId);
+    TelemetryJournal_Consume(recordId);
+
+    // The corrupt record is counted until the next read reaches it.
+    const int rest[] = {3};
+    ssize_t length = TelemetryJournal_Peek(buffer, sizeof(buffer), &timestamp, &recordId);
+    if (length != 7 || memcmp(buffer, "{\"n\":3}", 7) != 0) {
+        Fail("after the corrupt record", "the corrupt record was not skipped");
+    }
+    ExpectHeld("after the corrupt record", rest, 1);
+    Reopen();
+    ExpectDrained("after the corrupt record, reopened", rest, 1);
+}
+
+int main(int argc, char *argv[])
+{
+    verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+    FILE *file = tmpfile();
+    if (file == NULL) {
+        printf("FAIL: cannot create a temporary file\n");
+        return EXIT_FAILURE;
+    }
+    fd = fileno(file);
+
+    WrapAround();
+    DropOldest();
+    TornHeader();
+    CorruptRecord();
+
+    TelemetryJournal_Close();
+    fclose(file);
+    printf("%lu failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,12 +1,16 @@
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "applibs_versions.h"
 #include <applibs/log.h>
 #include <applibs/networking.h>
 #include <applibs/eventloop.h>
 #include <applibs/gpio.h>
+#include <applibs/storage.h>
 
 #include "azure_io.h"
 
@@ -20,55 +24,479 @@
 
 #include "eventloop_timer_utilities.h"
 #include "shared.h"
-
-#include "parson.h" // used to parse Device Twin messages.
+#include "telemetry_batch.h"
+#include "telemetry_journal.h"
+#include "telemetry_policy.h"
+#include "device_twin.h"
+#include "dowork_scheduler.h"
+#include "inflight_tracker.h"
+#include "telemetry_compress.h"
+#include "twin_cache.h"
+#include "build_options.h"
+#include "fd.h"
+
+
+#ifdef TELEMETRY_ENCODING_CBOR
+static const char TelemetryContentType[] = "application/cbor";
+#else
+static const char TelemetryContentType[] = "application/json";
+static const char TelemetryContentEncoding[] = "utf-8";
+#endif
+#ifdef TELEMETRY_COMPRESSION
+// Compressed bodies are binary whatever the encoding, so routing must not parse them.  The
+// "compression" property tells consumers to decompress them to TelemetryContentType.
+static const char CompressedTelemetryContentType[] = "application/octet-stream";
+#endif
 
 static const int AzureIoTMinReconnectPeriodSeconds = 60;
 static const int AzureIoTMaxReconnectPeriodSeconds = 10 * 60;
 
-static bool statusLedOn = false;
+static IOTHUB_DEVICE_CLIENT_LL_HANDLE iothubClientHandle = NULL;
+static const int keepalivePeriodSeconds = 20;
+static bool iothubAuthenticated = false;
 static int azureIoTPollPeriodSeconds = 1;
+static int mutableStorageFd = -1;
+static EventLoopTimer *doWorkTimer = NULL;
 
-extern int deviceTwinStatusLedGpioFd;
 extern int AzureIoTDefaultPollPeriodSeconds;
 extern char scopeId[SCOPEID_LENGTH];
 
+// Telemetry messages awaiting confirmation, found by the in-flight context passed to the IoT Hub
+// client.  Live telemetry keeps a copy of its document so that it can be journalled if IoT Hub
+// does not confirm it.  A replayed record stays at the head of the journal until confirmed.
+// Every message holds an in-flight slot, which keeps the number below the size of the table.
+typedef struct {
+    void *inFlightContext;
+    bool replayed;
+    uint32_t recordId;
+    time_t createdTime;
+    size_t payloadSize;
+    char payload[TELEMETRY_JOURNAL_RECORD_SIZE];
+} PendingTelemetry;
+
+static PendingTelemetry pendingTelemetry[AZURE_MAX_IN_FLIGHT_MESSAGES + AZURE_MAX_IN_FLIGHT_EVENTS];
+static bool replayInFlight = false;
+static unsigned int replayBudget = 0;
+
+static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context);
+static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
+                         size_t payloadSize, void *userContextCallback);
+static void ReportStatusCallback(int result, void *context);
+static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
+static const char *getAzureSphereProvisioningResultString(
+    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult);
+static void ReplayTelemetryJournal(void);
+
 /// <summary>
-///     Sends telemetry to IoT Hub
+///     Returns the pending message with the given in-flight context, or a free entry for NULL
 /// </summary>
-/// <param name="key">The telemetry item to update</param>
-/// <param name="value">new telemetry value</param>
-void SendTelemetry(const unsigned char *key, const unsigned char *value)
+static PendingTelemetry *FindPendingTelemetry(void *inFlightContext)
+{
+    for (size_t i = 0; i < sizeof(pendingTelemetry) / sizeof(pendingTelemetry[0]); i++) {
+        if (pendingTelemetry[i].inFlightContext == inFlightContext) {
+            return &pendingTelemetry[i];
+        }
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Arms the DoWork timer to fire after delayMs milliseconds
+/// </summary>
+static void ScheduleDoWork(long delayMs)
 {
-    static char eventBuffer[100] = {0};
-    static const char *EventMsgTemplate = "{ \"%s\": \"%s\" }";
-    int len = snprintf(eventBuffer, sizeof(eventBuffer), EventMsgTemplate, key, value);
-    if (len < 0)
+    struct timespec delay = {.tv_sec = delayMs / 1000, .tv_nsec = (delayMs % 1000) * 1000 * 1000};
+    SetEventLoopTimerOneShot(doWorkTimer, &delay);
+}
+
+/// <summary>
+///     Pumps DoWork on the next pass of the event loop, without waiting for the next period
+/// </summary>
+static void ScheduleDoWorkNow(void)
+{
+    static const struct timespec immediately = {.tv_sec = 0, .tv_nsec = 1};
+    SetEventLoopTimerOneShot(doWorkTimer, &immediately);
+}
+
+/// <summary>
+///     Records that a message or report was handed to the IoT Hub client, and brings the next
+///     DoWork forward so that it goes out without waiting for an idle back-off period.
+/// </summary>
+static void WorkQueued(void)
+{
+    if (DoWorkScheduler_WorkQueued()) {
+        ScheduleDoWork(AZURE_DOWORK_MIN_PERIOD_MS);
+    }
+}
+
+/// <summary>
+///     DoWork timer event: pumps the IoT Hub client and schedules the next pump, quickly while
+///     sends or reports are in flight and backing off exponentially while idle.
+/// </summary>
+static void DoWorkTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
         return;
+    }
+
+    if (iothubClientHandle != NULL) {
+        // Reported properties added outside a twin update, or refused by the client earlier,
+        // go out as one patch per pump.
+        flushDeviceTwinReport();
+        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+        // Confirmations handled by DoWork may let the next journalled message go out.
+        ReplayTelemetryJournal();
+    }
 
-    Log_Debug("Sending IoT Hub Message: %s\n", eventBuffer);
+    DoWorkSchedulerStats before = DoWorkScheduler_GetStats();
+    long nextDelayMs = DoWorkScheduler_Pumped();
+    DoWorkSchedulerStats after = DoWorkScheduler_GetStats();
+    if (after.samples != before.samples) {
+        Log_Debug("INFO: Queued IoT Hub work sent after %ld ms (mean %ld ms, max %ld ms)\n",
+                  after.lastMs, after.totalMs / (long)after.samples, after.maxMs);
+    }
 
-    bool isNetworkingReady = false;
-    if ((Networking_IsNetworkingReady(&isNetworkingReady) == -1) || !isNetworkingReady) {
-        Log_Debug("WARNING: Cannot send IoTHubMessage because network is not up.\n");
+    ScheduleDoWork(nextDelayMs);
+}
+
+/// <summary>
+///     Creates the timer that pumps IoTHubDeviceClient_LL_DoWork
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int InitAzureDoWork(EventLoop *eventLoop)
+{
+    DoWorkScheduler_Init(AZURE_DOWORK_MIN_PERIOD_MS, AZURE_DOWORK_MAX_PERIOD_MS);
+    InFlight_Init(AZURE_MAX_IN_FLIGHT_MESSAGES, AZURE_MAX_IN_FLIGHT_REPORTS,
+                  AZURE_MAX_IN_FLIGHT_EVENTS);
+    doWorkTimer = CreateEventLoopDisarmedTimer(eventLoop, &DoWorkTimerEventHandler);
+    if (doWorkTimer == NULL) {
+        return -1;
+    }
+    ScheduleDoWork(AZURE_DOWORK_MIN_PERIOD_MS);
+    return 0;
+}
+
+void CloseAzureDoWork(void)
+{
+    DisposeEventLoopTimer(doWorkTimer);
+    doWorkTimer = NULL;
+}
+
+/// <summary>
+///     Logs the confirmation latency percentiles of one kind of in-flight item every
+///     AZURE_IN_FLIGHT_LOG_INTERVAL confirmations
+/// </summary>
+static void LogInFlightLatency(InFlightKind kind, const char *name)
+{
+    InFlightLatency latency = InFlight_GetLatency(kind);
+    if (latency.count == 0 || latency.count % AZURE_IN_FLIGHT_LOG_INTERVAL != 0) {
         return;
     }
+    Log_Debug("INFO: %s confirmation latency over %lu: p50 %ld ms, p95 %ld ms, p99 %ld ms, "
+              "max %ld ms\n",
+              name, latency.count, latency.p50Ms, latency.p95Ms, latency.p99Ms, latency.maxMs);
+}
+
+/// <summary>
+///     Returns true while the IoT Hub connection is authenticated
+/// </summary>
+bool IsIoTHubAuthenticated(void)
+{
+    return iothubAuthenticated;
+}
+
+/// <summary>
+///     Hands a telemetry document to the IoT Hub client as a single message
+/// </summary>
+/// <param name="payload">telemetry document, encoded as TelemetryContentType</param>
+/// <param name="payloadSize">length of the document</param>
+/// <param name="createdTime">time the telemetry was produced, or 0 to leave it to IoT Hub</param>
+/// <param name="kind">in-flight window the message counts against</param>
+/// <returns>
+///     the in-flight context passed to SendMessageCallback, or NULL if the IoT Hub client did
+///     not accept the message
+/// </returns>
+static void *SendTelemetryDocument(const char *payload, size_t payloadSize, time_t createdTime,
+                                   InFlightKind kind)
+{
+    // Keep the client's queue bounded: the caller journals the telemetry instead.
+    void *inFlightContext = InFlight_Begin(kind);
+    if (inFlightContext == NULL) {
+        Log_Debug("INFO: %u messages awaiting confirmation, holding back telemetry.\n",
+                  InFlight_Count(kind));
+        return NULL;
+    }
+
+#ifdef TELEMETRY_ENCODING_CBOR
+    Log_Debug("Sending IoT Hub Message: %zu bytes of CBOR\n", payloadSize);
+#else
+    Log_Debug("Sending IoT Hub Message: %.*s\n", (int)payloadSize, payload);
+#endif
+
+#ifdef TELEMETRY_COMPRESSION
+    static char compressedPayload[TELEMETRY_COMPRESSION_MAX_INPUT];
+    int compressedSize = TelemetryCompress_Compress(payload, payloadSize, compressedPayload,
+                                                    sizeof(compressedPayload));
+    bool isCompressed = compressedSize > 0 && (size_t)compressedSize < payloadSize;
+    if (isCompressed) {
+        Log_Debug("INFO: Message compressed from %zu to %d bytes\n", payloadSize, compressedSize);
+        payload = compressedPayload;
+        payloadSize = (size_t)compressedSize;
+    }
+#endif
 
-    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(eventBuffer);
+    IOTHUB_MESSAGE_HANDLE messageHandle =
+        IoTHubMessage_CreateFromByteArray((const unsigned char *)payload, payloadSize);
 
     if (messageHandle == 0) {
         Log_Debug("WARNING: unable to create a new IoTHubMessage\n");
-        return;
+        InFlight_Cancel(inFlightContext);
+        return NULL;
+    }
+
+#ifdef TELEMETRY_COMPRESSION
+    if (isCompressed) {
+        IoTHubMessage_SetContentTypeSystemProperty(messageHandle, CompressedTelemetryContentType);
+        IoTHubMessage_SetProperty(messageHandle, "compression", TELEMETRY_COMPRESSION_PROPERTY);
+    } else
+#endif
+    {
+        IoTHubMessage_SetContentTypeSystemProperty(messageHandle, TelemetryContentType);
+#ifndef TELEMETRY_ENCODING_CBOR
+        IoTHubMessage_SetContentEncodingSystemProperty(messageHandle, TelemetryContentEncoding);
+#endif
     }
 
-    if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, SendMessageCallback,
-                                             /*&callback_param*/ 0) != IOTHUB_CLIENT_OK) {
+    // Replayed telemetry carries the time it was produced so that it is not recorded at the
+    // time it finally reached IoT Hub.
+    if (createdTime != 0) {
+        struct tm createdTimeUtc;
+        char createdTimeString[sizeof("2020-01-01T00:00:00Z")];
+        gmtime_r(&createdTime, &createdTimeUtc);
+        strftime(createdTimeString, sizeof(createdTimeString), "%Y-%m-%dT%H:%M:%SZ",
+                 &createdTimeUtc);
+        IoTHubMessage_SetProperty(messageHandle, "iothub-creation-time-utc", createdTimeString);
+    }
+
+    bool accepted = IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle,
+                                                         SendMessageCallback,
+                                                         inFlightContext) == IOTHUB_CLIENT_OK;
+    if (!accepted) {
         Log_Debug("WARNING: failed to hand over the message to IoTHubClient\n");
+        InFlight_Cancel(inFlightContext);
     } else {
         Log_Debug("INFO: IoTHubClient accepted the message for delivery\n");
+        WorkQueued();
     }
 
     IoTHubMessage_Destroy(messageHandle);
+    return accepted ? inFlightContext : NULL;
+}
+
+/// <summary>
+///     Remembers a message handed to the IoT Hub client until SendMessageCallback confirms it
+/// </summary>
+/// <param name="inFlightContext">context returned by SendTelemetryDocument</param>
+/// <param name="payload">document of live telemetry, or NULL for a replayed journal record</param>
+/// <param name="payloadSize">length of the document</param>
+/// <param name="createdTime">time the telemetry was produced</param>
+/// <param name="recordId">journal record of replayed telemetry</param>
+static void TrackTelemetry(void *inFlightContext, const char *payload, size_t payloadSize,
+                           time_t createdTime, uint32_t recordId)
+{
+    PendingTelemetry *pending = FindPendingTelemetry(NULL);
+    if (pending == NULL) {
+        return;
+    }
+
+    pending->inFlightContext = inFlightContext;
+    pending->replayed = payload == NULL;
+    pending->recordId = recordId;
+    pending->createdTime = createdTime;
+    // A document too large for the journal could not be stored there, so is not copied.
+    pending->payloadSize = payloadSize <= sizeof(pending->payload) ? payloadSize : 0;
+    if (payload != NULL && pending->payloadSize > 0) {
+        memcpy(pending->payload, payload, pending->payloadSize);
+    }
+}
+
+/// <summary>
+///     Sends a telemetry document to IoT Hub, or stores it in the telemetry journal
+///     while the network or IoT Hub connection is down or the in-flight window is full
+/// </summary>
+/// <param name="payload">telemetry document</param>
+/// <param name="payloadSize">length of the document</param>
+/// <param name="kind">in-flight window the message counts against</param>
+/// <returns>true if the message was handed to the IoT Hub client</returns>
+static bool SendOrStoreTelemetry(const char *payload, size_t payloadSize, InFlightKind kind)
+{
+    time_t createdTime = time(NULL);
+    bool isNetworkingReady = false;
+    if ((Networking_IsNetworkingReady(&isNetworkingReady) != -1) && isNetworkingReady &&
+        iothubAuthenticated) {
+        void *inFlightContext = SendTelemetryDocument(payload, payloadSize, 0, kind);
+        if (inFlightContext != NULL) {
+            TrackTelemetry(inFlightContext, payload, payloadSize, createdTime, 0);
+            return true;
+        }
+    }
+
+    if (TelemetryJournal_Append(payload, payloadSize, createdTime)) {
+        Log_Debug("INFO: Telemetry not sent, stored for later (%u messages waiting).\n",
+                  TelemetryJournal_Count());
+    } else {
+        Log_Debug("WARNING: Cannot send IoTHubMessage because network is not up.\n");
+    }
+    return false;
+}
+
+/// <summary>
+///     Sends a batch of bulk telemetry built by the telemetry batcher
+/// </summary>
+static void SendTelemetryMessage(const char *payload, size_t payloadSize)
+{
+    SendOrStoreTelemetry(payload, payloadSize, InFlight_Telemetry);
+}
+
+/// <summary>
+///     Sends the oldest telemetry stored while IoT Hub was not reachable.  The record stays in
+///     the journal until SendMessageCallback confirms it, and only one is in flight at a time,
+///     so the next is sent once the previous one is confirmed.  At most
+///     TELEMETRY_JOURNAL_REPLAY_PER_TICK messages are sent per Azure timer tick so that a long
+///     outage does not flood the connection when it comes back.
+/// </summary>
+static void ReplayTelemetryJournal(void)
+{
+    static char replayBuffer[TELEMETRY_JOURNAL_RECORD_SIZE];
+
+    if (replayInFlight || replayBudget == 0 || !iothubAuthenticated ||
+        TelemetryJournal_Count() == 0) {
+        return;
+    }
+
+    time_t createdTime;
+    uint32_t recordId;
+    ssize_t len =
+        TelemetryJournal_Peek(replayBuffer, sizeof(replayBuffer), &createdTime, &recordId);
+    if (len <= 0) {
+        return;
+    }
+
+    void *inFlightContext =
+        SendTelemetryDocument(replayBuffer, (size_t)len, createdTime, InFlight_Telemetry);
+    if (inFlightContext != NULL) {
+        TrackTelemetry(inFlightContext, NULL, 0, createdTime, recordId);
+        replayInFlight = true;
+        replayBudget--;
+    }
+}
+
+/// <summary>
+///     Initializes the telemetry batcher that collects readings passed to SendTelemetry, and
+///     opens the journal that holds telemetry while IoT Hub is not reachable and the cache of
+///     applied device twin properties, both kept in mutable storage
+/// </summary>
+void InitTelemetry(void)
+{
+    TelemetryBatch_Init(SendTelemetryMessage);
+
+    mutableStorageFd = Storage_OpenMutableFile();
+    if (mutableStorageFd == -1) {
+        Log_Debug("ERROR: Could not open mutable file:  %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+
+    if (TelemetryJournal_Open(mutableStorageFd, TELEMETRY_JOURNAL_OFFSET,
+                              TELEMETRY_JOURNAL_SIZE_BYTES) != 0) {
+        Log_Debug("WARNING: Telemetry journal unavailable, offline telemetry will be dropped.\n");
+    }
+
+    if (TwinCache_Open(mutableStorageFd, TWIN_CACHE_OFFSET, TWIN_CACHE_SIZE_BYTES) != 0) {
+        Log_Debug("WARNING: Twin cache not persisted, twin properties re-applied after restart.\n");
+    }
+}
+
+/// <summary>
+///     Closes the telemetry journal and twin cache
+/// </summary>
+void CloseTelemetry(void)
+{
+    TelemetryJournal_Close();
+    TwinCache_Close();
+    CloseFdAndPrintError(mutableStorageFd, "MutableStorage");
+    mutableStorageFd = -1;
+}
+
+/// <summary>
+///     Queues telemetry for IoT Hub.  Readings are collected into one JSON document and
+///     sent by FlushTelemetry, or earlier if the batch fills up.
+/// </summary>
+/// <param name="key">The telemetry item to update</param>
+/// <param name="value">new telemetry value</param>
+void SendTelemetry(const unsigned char *key, const unsigned char *value)
+{
+    SendTelemetryWithPriority((const char *)key, (const char *)value, TelemetryPriority_Bulk);
+}
+
+/// <summary>
+///     Queues telemetry for IoT Hub in the given delivery class.  High-priority readings skip
+///     the batch, count against their own in-flight window and are pumped to IoT Hub on the
+///     next pass of the event loop.
+/// </summary>
+/// <param name="key">The telemetry item to update</param>
+/// <param name="value">new telemetry value</param>
+/// <param name="priority">delivery class of the reading</param>
+void SendTelemetryWithPriority(const char *key, const char *value, TelemetryPriority priority)
+{
+    if (priority == TelemetryPriority_Bulk) {
+        TelemetryBatch_Add(key, value);
+        return;
+    }
+
+    static char eventBuffer[TELEMETRY_EVENT_BUFFER_SIZE];
+    JsonField field = {.name = key, .type = JsonField_String};
+    JsonFieldValue fieldValue = {.string = value};
+    int len = TelemetryBatch_EncodeReading(eventBuffer, sizeof(eventBuffer), &field, &fieldValue);
+    if (len < 0) {
+        Log_Debug("WARNING: Telemetry event '%s' is too large, dropped.\n", key);
+        return;
+    }
+
+    if (SendOrStoreTelemetry(eventBuffer, (size_t)len, InFlight_Event)) {
+        ScheduleDoWorkNow();
+    }
+}
+
+/// <summary>
+///     Queues typed telemetry for IoT Hub, formatted as described by a static field table.
+///     Numeric readings are filtered by their reporting policy in telemetry_policy.c.
+/// </summary>
+/// <param name="fields">Describes the name and formatting of each reading</param>
+/// <param name="values">Reading values, one per field</param>
+/// <param name="count">Number of readings</param>
+void SendTelemetryFields(const JsonField *fields, const JsonFieldValue *values, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        // Numeric readings that have not moved outside their deadband are not sent.
+        if ((fields[i].type == JsonField_Fixed &&
+             !TelemetryPolicy_ShouldSend(fields[i].name, (float)values[i].number)) ||
+            (fields[i].type == JsonField_Int &&
+             !TelemetryPolicy_ShouldSend(fields[i].name, (float)values[i].integer))) {
+            continue;
+        }
+        TelemetryBatch_AddField(&fields[i], &values[i]);
+    }
+}
+
+/// <summary>
+///     Sends telemetry stored while offline, then the telemetry collected since the last
+///     flush as a single IoT Hub message
+/// </summary>
+void FlushTelemetry(void)
+{
+    replayBudget = TELEMETRY_JOURNAL_REPLAY_PER_TICK;
+    ReplayTelemetryJournal();
+    TelemetryBatch_Flush();
 }
 
 /// <summary>
@@ -142,51 +570,15 @@ void SetupAzureClient(EventLoopTimer *azureTimer)
 
 /// <summary>
 ///     Callback invoked when a Device Twin update is received from IoT Hub.
-///     Updates local state for 'showEvents' (bool).
+///     Applies the desired properties registered in twinArray straight from the payload.
 /// </summary>
 /// <param name="payload">contains the Device Twin JSON document (desired and reported)</param>
 /// <param name="payloadSize">size of the Device Twin JSON document</param>
 void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
                          size_t payloadSize, void *userContextCallback)
 {
-    size_t nullTerminatedJsonSize = payloadSize + 1;
-    char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
-    if (nullTerminatedJsonString == NULL) {
-        Log_Debug("ERROR: Could not allocate buffer for twin update payload.\n");
-        abort();
-    }
-
-    // Copy the provided buffer to a null terminated buffer.
-    memcpy(nullTerminatedJsonString, payload, payloadSize);
-    // Add the null terminator at the end.
-    nullTerminatedJsonString[nullTerminatedJsonSize - 1] = 0;
-
-    JSON_Value *rootProperties = NULL;
-    rootProperties = json_parse_string(nullTerminatedJsonString);
-    if (rootProperties == NULL) {
-        Log_Debug("WARNING: Cannot parse the string as JSON content.\n");
-        goto cleanup;
-    }
-
-    JSON_Object *rootObject = json_value_get_object(rootProperties);
-    JSON_Object *desiredProperties = json_object_dotget_object(rootObject, "desired");
-    if (desiredProperties == NULL) {
-        desiredProperties = rootObject;
-    }
-
-    // Handle the Device Twin Desired Properties here.
-    JSON_Object *LEDState = json_object_dotget_object(desiredProperties, "StatusLED");
-    if (LEDState != NULL) {
-        statusLedOn = (bool)json_object_get_boolean(LEDState, "value");
-        GPIO_SetValue(deviceTwinStatusLedGpioFd,
-                      (statusLedOn == true ? GPIO_Value_Low : GPIO_Value_High));
-        TwinReportBoolState("StatusLED", statusLedOn);
-    }
-
-cleanup:
-    // Release the allocated memory.
-    json_value_free(rootProperties);
-    free(nullTerminatedJsonString);
+    deviceTwinPayloadHandler((const char *)payload, payloadSize,
+                             updateState == DEVICE_TWIN_UPDATE_COMPLETE);
 }
 
 /// <summary>
@@ -246,42 +638,95 @@ const char *getAzureSphereProvisioningResultString(
 }
 
 /// <summary>
-///     Callback confirming message delivered to IoT Hub.
+///     Callback confirming message delivered to IoT Hub.  A replayed journal record is removed
+///     from the journal once IoT Hub confirms it, and live telemetry that IoT Hub does not
+///     confirm is stored in the journal to be sent again.
 /// </summary>
 /// <param name="result">Message delivery status</param>
-/// <param name="context">User specified context</param>
+/// <param name="context">In-flight context returned by SendTelemetryDocument</param>
 void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
-    Log_Debug("INFO: Message received by IoT Hub. Result is: %d\n", result);
+    DoWorkScheduler_WorkCompleted();
+    InFlightKind kind = InFlight_GetKind(context);
+    long latencyMs = InFlight_Complete(context);
+    Log_Debug("INFO: Message received by IoT Hub after %ld ms. Result is: %d\n", latencyMs,
+              result);
+    LogInFlightLatency(kind, kind == InFlight_Event ? "Event" : "Telemetry");
+
+    PendingTelemetry *pending = FindPendingTelemetry(context);
+    if (pending == NULL) {
+        return;
+    }
+    pending->inFlightContext = NULL;
+
+    if (pending->replayed) {
+        replayInFlight = false;
+        if (result == IOTHUB_CLIENT_CONFIRMATION_OK) {
+            TelemetryJournal_Consume(pending->recordId);
+        }
+    } else if (result != IOTHUB_CLIENT_CONFIRMATION_OK && pending->payloadSize > 0 &&
+               TelemetryJournal_Append(pending->payload, pending->payloadSize,
+                                       pending->createdTime)) {
+        Log_Debug("INFO: Telemetry not confirmed, stored for later (%u messages waiting).\n",
+                  TelemetryJournal_Count());
+    }
 }
 
+// Reported-properties updates awaiting confirmation.  Each is passed to the IoT Hub client as
+// the callback context, so ReportStatusCallback can release its in-flight slot and tell the
+// sender how the update went.  The in-flight window keeps the number below
+// AZURE_MAX_IN_FLIGHT_REPORTS.
+typedef struct {
+    bool inUse;
+    void *inFlightContext;
+    TwinReportConfirmedCallback confirmedCallback;
+    void *confirmedContext;
+} PendingReport;
+
+static PendingReport pendingReports[AZURE_MAX_IN_FLIGHT_REPORTS];
+
 /// <summary>
-///     Creates and enqueues a report containing the name and value pair of a Device Twin reported
-///     property. The report is not sent immediately, but it is sent on the next invocation of
-///     IoTHubDeviceClient_LL_DoWork().
+///     Hands a reported-properties document to the IoT Hub client, tracking it in the
+///     in-flight table
 /// </summary>
-/// <param name="propertyName">the IoT Hub Device Twin property name</param>
-/// <param name="propertyValue">the IoT Hub Device Twin property value</param>
-void TwinReportBoolState(const char *propertyName, bool propertyValue)
+/// <returns>true if the IoT Hub client accepted the update</returns>
+static bool SendReportedState(const char *reportedProperties, size_t reportedPropertiesSize,
+                              TwinReportConfirmedCallback confirmedCallback, void *confirmedContext)
 {
-    if (iothubClientHandle == NULL) {
-        Log_Debug("ERROR: client not initialized\n");
-    } else {
-        static char reportedPropertiesString[30] = {0};
-        int len = snprintf(reportedPropertiesString, 30, "{\"%s\":%s}", propertyName,
-                           (propertyValue == true ? "true" : "false"));
-        if (len < 0)
-            return;
-
-        if (IoTHubDeviceClient_LL_SendReportedState(
-                iothubClientHandle, (unsigned char *)reportedPropertiesString,
-                strlen(reportedPropertiesString), ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
-            Log_Debug("ERROR: failed to set reported state for '%s'.\n", propertyName);
-        } else {
-            Log_Debug("INFO: Reported state for '%s' to value '%s'.\n", propertyName,
-                      (propertyValue == true ? "true" : "false"));
+    void *inFlightContext = InFlight_Begin(InFlight_ReportedState);
+    if (inFlightContext == NULL) {
+        Log_Debug("WARNING: %u reported-property updates awaiting confirmation.\n",
+                  InFlight_Count(InFlight_ReportedState));
+        return false;
+    }
+
+    PendingReport *report = NULL;
+    for (size_t i = 0; i < AZURE_MAX_IN_FLIGHT_REPORTS; i++) {
+        if (!pendingReports[i].inUse) {
+            report = &pendingReports[i];
+            break;
         }
     }
+    if (report == NULL) {
+        InFlight_Cancel(inFlightContext);
+        return false;
+    }
+
+    report->inUse = true;
+    report->inFlightContext = inFlightContext;
+    report->confirmedCallback = confirmedCallback;
+    report->confirmedContext = confirmedContext;
+
+    if (IoTHubDeviceClient_LL_SendReportedState(
+            iothubClientHandle, (const unsigned char *)reportedProperties, reportedPropertiesSize,
+            ReportStatusCallback, report) != IOTHUB_CLIENT_OK) {
+        report->inUse = false;
+        InFlight_Cancel(inFlightContext);
+        return false;
+    }
+
+    WorkQueued();
+    return true;
 }
 
 /// <summary>
@@ -289,7 +734,20 @@ void TwinReportBoolState(const char *propertyName, bool propertyValue)
 /// </summary>
 void ReportStatusCallback(int result, void *context)
 {
-    Log_Debug("INFO: Device Twin reported properties update result: HTTP status code %d\n", result);
+    PendingReport *report = context;
+    PendingReport completed = *report;
+    report->inUse = false;
+
+    DoWorkScheduler_WorkCompleted();
+    long latencyMs = InFlight_Complete(completed.inFlightContext);
+    Log_Debug("INFO: Device Twin reported properties update result after %ld ms: "
+              "HTTP status code %d\n",
+              latencyMs, result);
+    LogInFlightLatency(InFlight_ReportedState, "Reported properties");
+
+    if (completed.confirmedCallback != NULL) {
+        completed.confirmedCallback(result >= 200 && result < 300, completed.confirmedContext);
+    }
 }
 
 /// <summary>
@@ -297,28 +755,44 @@ void ReportStatusCallback(int result, void *context)
 ///     The report is not actually sent immediately, but it is sent on the next 
 ///     invocation of AzureIoT_DoPeriodicTasks().
 /// </summary>
-void TwinReportStateJson(
+/// <returns>true if the IoT Hub client accepted the update</returns>
+bool TwinReportStateJson(
 	char *reportedPropertiesString,
 	size_t reportedPropertiesSize)
 {
+	return TwinReportStateJsonConfirmed(reportedPropertiesString, reportedPropertiesSize, NULL, NULL);
+}
+
+/// <summary>
+///     Like TwinReportStateJson, and calls confirmedCallback with the outcome once IoT Hub
+///     confirms or fails an update the client accepted.
+/// </summary>
+/// <returns>true if the IoT Hub client accepted the update</returns>
+bool TwinReportStateJsonConfirmed(
+	char *reportedPropertiesString,
+	size_t reportedPropertiesSize,
+	TwinReportConfirmedCallback confirmedCallback,
+	void *confirmedContext)
+{
 
 	if (iothubClientHandle == NULL) {
 		Log_Debug("ERROR: client not initialized\n");
 	}
 	else {
 		if (reportedPropertiesString != NULL) {
-			if (IoTHubDeviceClient_LL_SendReportedState(iothubClientHandle,
-				(unsigned char *)reportedPropertiesString, reportedPropertiesSize,
-				ReportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
+			if (!SendReportedState(reportedPropertiesString, reportedPropertiesSize,
+					confirmedCallback, confirmedContext)) {
 				Log_Debug("ERROR: failed to set reported state as '%s'.\n",
 					reportedPropertiesString);
 			}
 			else {
 				Log_Debug("INFO: Reported state as '%s'.\n", reportedPropertiesString);
+				return true;
 			}
 		}
 		else {
 			Log_Debug("ERROR: no JSON string for Device Twin reporting.\n");
 		}
 	}
+	return false;
 }
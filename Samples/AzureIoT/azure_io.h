@@ -6,26 +6,57 @@
 #include <iothub.h>
 #include <azure_sphere_provisioning.h>
 
+#include "build_options.h"
+#ifdef AZURE_IOT_LOOPBACK
+#include "iothub_loopback.h"
+#endif
+
 #include "eventloop_timer_utilities.h"
+#include "json_writer.h"
+
+/// <summary>
+///     Delivery class of a telemetry reading.  Bulk readings are batched and may be delayed,
+///     journalled or dropped while the uplink is busy.  High-priority readings are sent as
+///     their own message straight away.
+/// </summary>
+typedef enum {
+    TelemetryPriority_Bulk = 0,
+    TelemetryPriority_High = 1
+} TelemetryPriority;
 
-static IOTHUB_DEVICE_CLIENT_LL_HANDLE iothubClientHandle = NULL;
-static const int keepalivePeriodSeconds = 20;
-static bool iothubAuthenticated = false;
-static void SendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context);
-static void TwinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payload,
-                          size_t payloadSize, void *userContextCallback);
-static void TwinReportBoolState(const char *propertyName, bool propertyValue);
-static void ReportStatusCallback(int result, void *context);
-static const char *GetReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason);
-static const char *getAzureSphereProvisioningResultString(
-    AZURE_SPHERE_PROV_RETURN_VALUE provisioningResult);
+void InitTelemetry(void);
+void CloseTelemetry(void);
 void SendTelemetry(const unsigned char *key, const unsigned char *value);
+void SendTelemetryWithPriority(const char *key, const char *value, TelemetryPriority priority);
+void SendTelemetryFields(const JsonField *fields, const JsonFieldValue *values, size_t count);
+void FlushTelemetry(void);
 void SetupAzureClient(EventLoopTimer *azureTimer);
+int InitAzureDoWork(EventLoop *eventLoop);
+void CloseAzureDoWork(void);
+bool IsIoTHubAuthenticated(void);
 /// <summary>
 ///     Creates and enqueues reported properties state using a prepared json string.
 ///     The report is not actually sent immediately, but it is sent on the next 
 ///     invocation of AzureIoT_DoPeriodicTasks().
 /// </summary>
-void TwinReportStateJson(
+/// <returns>true if the IoT Hub client accepted the update</returns>
+bool TwinReportStateJson(
+	char *reportedPropertiesString,
+	size_t reportedPropertiesSize);
+
+/// <summary>
+///     Called with the outcome of a reported-properties update: succeeded is true when IoT Hub
+///     confirmed it with a 2xx status, false when it failed or the client was destroyed first.
+/// </summary>
+typedef void (*TwinReportConfirmedCallback)(bool succeeded, void *context);
+
+/// <summary>
+///     Like TwinReportStateJson, and calls confirmedCallback with the outcome once IoT Hub
+///     confirms or fails an update the client accepted.
+/// </summary>
+/// <returns>true if the IoT Hub client accepted the update</returns>
+bool TwinReportStateJsonConfirmed(
 	char *reportedPropertiesString,
-	size_t reportedPropertiesSize);
\ No newline at end of file
+	size_t reportedPropertiesSize,
+	TwinReportConfirmedCallback confirmedCallback,
+	void *confirmedContext);
\ No newline at end of file
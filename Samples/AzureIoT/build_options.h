@@ -28,5 +28,137 @@
 #define ACCEL_READ_PERIOD_SECONDS 1
 #define ACCEL_READ_PERIOD_NANO_SECONDS 0
 
+// Read the accelerometer and gyroscope through the LSM6DSO FIFO instead of sampling their output
+// registers once per period.  Samples are batched at the 12.5 Hz output data rate with
+// timestamps, and each period every batched sample is read in one I2C burst and averaged into
+// the reading that is sent.  A burst holds at most SENSOR_FIFO_MAX_WORDS words of 7 bytes; one
+// period of accelerometer, gyroscope and timestamp words needs about 38 per second.
+//#define SENSOR_FIFO_ACQUISITION
+#define SENSOR_FIFO_MAX_WORDS 96
+
+// The sensors are initialized from the event loop, one step every SENSOR_INIT_STEP_MS, so the
+// Azure connection comes up meanwhile.  A step waiting on a device gives up after
+// SENSOR_INIT_STEP_TIMEOUT_MS.  Steps that reach the LPS22HH busy-wait on the sensor hub and
+// can hold the event loop for about 70 ms.  The LPS22HH is looked for LPS22HH_DETECT_ATTEMPTS
+// times, LPS22HH_DETECT_RETRY_MS apart.  The gyroscope offsets are the means of a set of
+// GYRO_CALIBRATION_SAMPLES samples (2 seconds at 12.5 Hz).  A set deviating more than
+// GYRO_CALIBRATION_MAX_STDDEV_DPS on any axis was taken while moving and is taken again, up to
+// GYRO_CALIBRATION_ATTEMPTS sets; the last set is used regardless.
+#define SENSOR_INIT_STEP_MS 10
+#define SENSOR_INIT_STEP_TIMEOUT_MS 500
+#define LPS22HH_DETECT_ATTEMPTS 10
+#define LPS22HH_DETECT_RETRY_MS 100
+#define GYRO_CALIBRATION_SAMPLES 25
+#define GYRO_CALIBRATION_MAX_STDDEV_DPS 0.5f
+#define GYRO_CALIBRATION_ATTEMPTS 3
+
+// IoTHubDeviceClient_LL_DoWork is pumped every AZURE_DOWORK_MIN_PERIOD_MS while messages or
+// reported properties are in flight.  While idle the period doubles after every pump, up to
+// AZURE_DOWORK_MAX_PERIOD_MS, which must stay well below the MQTT keep-alive period.
+#define AZURE_DOWORK_MIN_PERIOD_MS 20
+#define AZURE_DOWORK_MAX_PERIOD_MS 2000
+
+// Maximum number of telemetry messages, reported-property updates and high-priority events
+// handed to the IoT Hub client but not yet confirmed.  Telemetry produced while the window is
+// full goes to the telemetry journal instead of growing the client's queue; reported-property
+// updates are refused.  Events have their own window so that periodic telemetry cannot hold
+// them back.  AZURE_IN_FLIGHT_LOG_INTERVAL is how many confirmations pass between latency logs.
+#define AZURE_MAX_IN_FLIGHT_MESSAGES 8
+#define AZURE_MAX_IN_FLIGHT_REPORTS 4
+#define AZURE_MAX_IN_FLIGHT_EVENTS 4
+#define AZURE_IN_FLIGHT_LOG_INTERVAL 32
+
+// Replaces the IoT Hub device client with the local stand-in in iothub_loopback.c, so that the
+// Azure layer can be exercised and measured without IoT Hub or a network.  Each message is
+// confirmed LOOPBACK_CONFIRM_DELAY_MS (plus up to LOOPBACK_CONFIRM_JITTER_MS) after it is
+// handed over; LOOPBACK_REJECT_PERCENT of messages are refused at hand-over and
+// LOOPBACK_FAIL_PERCENT are confirmed with an error.
+//#define AZURE_IOT_LOOPBACK
+#define LOOPBACK_QUEUE_LENGTH 64
+#define LOOPBACK_CONFIRM_DELAY_MS 200
+#define LOOPBACK_CONFIRM_JITTER_MS 100
+#define LOOPBACK_REJECT_PERCENT 0
+#define LOOPBACK_FAIL_PERCENT 1
+
+// Generates telemetry readings through SendTelemetry and reported-property updates through
+// TwinReportStateJson at the given rates (0 disables either), and logs messages per second,
+// CPU time per message, heap high-water mark and confirmation latency every
+// LOAD_GENERATOR_STATS_PERIOD_SECONDS.  Usually combined with AZURE_IOT_LOOPBACK.
+//#define AZURE_LOAD_GENERATOR
+#define LOAD_GENERATOR_READINGS_PER_SECOND 100
+#define LOAD_GENERATOR_REPORTS_PER_SECOND 2
+#define LOAD_GENERATOR_STATS_PERIOD_SECONDS 10
+
+// Telemetry passed to SendTelemetry is collected into one JSON document and sent as a single
+// IoT Hub message on each Azure timer tick.  A batch is sent early once it holds
+// TELEMETRY_BATCH_MAX_READINGS readings, or once its oldest reading has waited
+// TELEMETRY_BATCH_MAX_LATENCY_SECONDS.
+#define TELEMETRY_BATCH_MAX_READINGS 16
+#define TELEMETRY_BATCH_MAX_LATENCY_SECONDS 5
+#define TELEMETRY_BATCH_BUFFER_SIZE 512
+
+// High-priority telemetry, such as button events, is not batched.  Each reading is sent as
+// its own message, of at most TELEMETRY_EVENT_BUFFER_SIZE bytes, as soon as it is produced.
+#define TELEMETRY_EVENT_BUFFER_SIZE 128
+
+// Encode telemetry messages as CBOR instead of JSON.  Numbers are sent as binary floats and
+// integers rather than strings, which makes sensor telemetry about 40% smaller.  The
+// message content type is set to application/cbor so that IoT Hub consumers can tell the
+// encodings apart.  Telemetry journalled by a build with the other encoding is replayed
+// with the wrong content type, so clear mutable storage when switching.
+//#define TELEMETRY_ENCODING_CBOR
+
+// Compress telemetry messages with LZ4 against a built-in dictionary of common telemetry keys
+// (see telemetry_compress.c).  Compressed messages are sent as application/octet-stream, with no
+// content encoding, and carry a "compression" application property naming the format and
+// dictionary; messages that do not get smaller are sent as they are.
+// Working memory is fixed: a window of TELEMETRY_COMPRESSION_MAX_INPUT bytes plus the
+// dictionary, and two hash tables of 2^TELEMETRY_COMPRESSION_HASH_BITS 16-bit entries.
+//#define TELEMETRY_COMPRESSION
+#define TELEMETRY_COMPRESSION_MAX_INPUT TELEMETRY_BATCH_BUFFER_SIZE
+#define TELEMETRY_COMPRESSION_HASH_BITS 10
+
+// Measures the thread CPU time spent compressing each message, which the load generator logs
+// per KB of input.  Costs two clock_gettime calls per message.
+//#define TELEMETRY_COMPRESSION_CPU_TIME
+
+// Telemetry that cannot be sent while the network or IoT Hub connection is down, or that IoT
+// Hub does not confirm, is kept in a journal in mutable storage.  It is replayed once the
+// connection is authenticated, one message at a time and at most
+// TELEMETRY_JOURNAL_REPLAY_PER_TICK messages per Azure timer tick.  A record leaves the journal
+// when IoT Hub confirms it.  Until then, each live message keeps a copy of up to
+// TELEMETRY_JOURNAL_RECORD_SIZE bytes in memory.  TELEMETRY_JOURNAL_SIZE_BYTES must fit in the
+// MutableStorage SizeKB set in app_manifest.json.
+#define TELEMETRY_JOURNAL_OFFSET 0
+#define TELEMETRY_JOURNAL_SIZE_BYTES (32 * 1024)
+#define TELEMETRY_JOURNAL_RECORD_SIZE TELEMETRY_BATCH_BUFFER_SIZE
+#define TELEMETRY_JOURNAL_REPLAY_PER_TICK 4
+
+// The last applied desired-properties version and values are cached in mutable storage, after
+// the telemetry journal, so that the full twin sent after every reconnect or restart only
+// re-applies and re-reports properties that actually changed.  TWIN_CACHE_MAX_ENTRIES must be
+// at least the number of entries in twinArray.
+#define TWIN_CACHE_OFFSET (TELEMETRY_JOURNAL_OFFSET + TELEMETRY_JOURNAL_SIZE_BYTES)
+#define TWIN_CACHE_SIZE_BYTES 2048
+#define TWIN_CACHE_MAX_ENTRIES 64
+
+// Change-driven telemetry.  A numeric reading is only sent when it has moved by more than its
+// deadband since it was last sent (plus the hysteresis when it changes direction), or when
+// TELEMETRY_MAX_SILENCE_SECONDS have passed.  These are defaults; all of them can be changed
+// through device twin desired properties.  A deadband of 0 sends every change.
+#define TELEMETRY_TEMPERATURE_DEADBAND 0.2f      // degC
+#define TELEMETRY_TEMPERATURE_HYSTERESIS 0.1f
+#define TELEMETRY_PRESSURE_DEADBAND 0.5f         // hPa
+#define TELEMETRY_PRESSURE_HYSTERESIS 0.2f
+#define TELEMETRY_ACCELERATION_DEADBAND 20.0f    // mg
+#define TELEMETRY_ACCELERATION_HYSTERESIS 10.0f
+#define TELEMETRY_ANGULAR_RATE_DEADBAND 2.0f     // dps
+#define TELEMETRY_ANGULAR_RATE_HYSTERESIS 1.0f
+#define TELEMETRY_MAX_SILENCE_SECONDS 300
+
 // Enables I2C read/write debug
-//#define ENABLE_READ_WRITE_DEBUG
\ No newline at end of file
+//#define ENABLE_READ_WRITE_DEBUG
+
+// Logs the number of I2C transfers and the bytes they put on the bus, address bytes included,
+// since the previous sensor reading.  The first count includes the sensor initialization.
+//#define ENABLE_I2C_TRANSFER_COUNTS
\ No newline at end of file
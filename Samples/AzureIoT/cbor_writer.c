@@ -0,0 +1,162 @@
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cbor_writer.h"
+
+// Major types, already shifted into the top three bits of the initial byte.
+#define CBOR_UNSIGNED 0x00
+#define CBOR_NEGATIVE 0x20
+#define CBOR_TEXT 0x60
+#define CBOR_MAP 0xA0
+#define CBOR_SIMPLE 0xE0
+
+#define CBOR_INDEFINITE 0x1F
+#define CBOR_FALSE (CBOR_SIMPLE | 20)
+#define CBOR_TRUE (CBOR_SIMPLE | 21)
+#define CBOR_FLOAT32 (CBOR_SIMPLE | 26)
+#define CBOR_BREAK 0xFF
+
+#define MAX_FIXED_DECIMALS 9
+
+static const double powersOfTen[MAX_FIXED_DECIMALS + 1] = {1e0, 1e1, 1e2, 1e3, 1e4,
+                                                           1e5, 1e6, 1e7, 1e8, 1e9};
+
+static void Append(CborWriter *writer, const void *data, size_t length)
+{
+    if (writer->overflow || length > writer->size - writer->length) {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+static void AppendByte(CborWriter *writer, uint8_t byte)
+{
+    Append(writer, &byte, 1);
+}
+
+/// <summary>
+///     Writes an initial byte and its argument in the shortest form CBOR allows.
+/// </summary>
+static void AppendHead(CborWriter *writer, uint8_t majorType, uint64_t argument)
+{
+    uint8_t head[9];
+    size_t length;
+
+    if (argument < 24) {
+        head[0] = (uint8_t)(majorType | argument);
+        length = 1;
+    } else if (argument <= UINT8_MAX) {
+        head[0] = majorType | 24;
+        length = 2;
+    } else if (argument <= UINT16_MAX) {
+        head[0] = majorType | 25;
+        length = 3;
+    } else if (argument <= UINT32_MAX) {
+        head[0] = majorType | 26;
+        length = 5;
+    } else {
+        head[0] = majorType | 27;
+        length = 9;
+    }
+
+    // Argument bytes follow in network byte order.
+    for (size_t i = length - 1; i > 0; i--) {
+        head[i] = (uint8_t)argument;
+        argument >>= 8;
+    }
+    Append(writer, head, length);
+}
+
+void CborWriter_Init(CborWriter *writer, uint8_t *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->overflow = (size == 0);
+}
+
+void CborWriter_BeginMap(CborWriter *writer)
+{
+    AppendByte(writer, CBOR_MAP | CBOR_INDEFINITE);
+}
+
+void CborWriter_EndMap(CborWriter *writer)
+{
+    AppendByte(writer, CBOR_BREAK);
+}
+
+void CborWriter_Key(CborWriter *writer, const char *key)
+{
+    CborWriter_String(writer, key);
+}
+
+void CborWriter_Float(CborWriter *writer, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint8_t item[5] = {CBOR_FLOAT32, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16),
+                       (uint8_t)(bits >> 8), (uint8_t)bits};
+    Append(writer, item, sizeof(item));
+}
+
+void CborWriter_Int(CborWriter *writer, long value)
+{
+    if (value < 0) {
+        // Negative integers are encoded as -1 - n.
+        AppendHead(writer, CBOR_NEGATIVE, (uint64_t)(-1 - value));
+    } else {
+        AppendHead(writer, CBOR_UNSIGNED, (uint64_t)value);
+    }
+}
+
+void CborWriter_Bool(CborWriter *writer, bool value)
+{
+    AppendByte(writer, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void CborWriter_String(CborWriter *writer, const char *value)
+{
+    size_t length = strlen(value);
+    AppendHead(writer, CBOR_TEXT, length);
+    Append(writer, value, length);
+}
+
+void CborWriter_FieldValue(CborWriter *writer, const JsonField *field, const JsonFieldValue *value)
+{
+    switch (field->type) {
+    case JsonField_Fixed: {
+        unsigned int decimals =
+            field->decimals > MAX_FIXED_DECIMALS ? MAX_FIXED_DECIMALS : field->decimals;
+        double rounded = value->number;
+        if (isfinite(rounded) && fabs(rounded) < 1e15) {
+            rounded = nearbyint(rounded * powersOfTen[decimals]);
+            if (decimals == 0 && rounded >= (double)LONG_MIN && rounded <= (double)LONG_MAX) {
+                CborWriter_Int(writer, (long)rounded);
+                break;
+            }
+            rounded /= powersOfTen[decimals];
+        }
+        CborWriter_Float(writer, (float)rounded);
+        break;
+    }
+    case JsonField_Int:
+        CborWriter_Int(writer, value->integer);
+        break;
+    case JsonField_Bool:
+        CborWriter_Bool(writer, value->boolean);
+        break;
+    case JsonField_String:
+        CborWriter_String(writer, value->string);
+        break;
+    }
+}
+
+int CborWriter_Finish(CborWriter *writer)
+{
+    return writer->overflow ? -1 : (int)writer->length;
+}
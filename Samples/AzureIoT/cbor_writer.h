@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "json_writer.h"
+
+/// <summary>
+///     Writes a CBOR (RFC 7049) data item into a caller-provided buffer without using the heap.
+///     Maps are written with indefinite length so that members can be appended one at a time.
+///     Writing stops at the first item that does not fit; CborWriter_Finish reports it.
+/// </summary>
+typedef struct {
+    uint8_t *buffer;
+    size_t size;
+    size_t length;
+    bool overflow;
+} CborWriter;
+
+void CborWriter_Init(CborWriter *writer, uint8_t *buffer, size_t size);
+void CborWriter_BeginMap(CborWriter *writer);
+void CborWriter_EndMap(CborWriter *writer);
+void CborWriter_Key(CborWriter *writer, const char *key);
+void CborWriter_Float(CborWriter *writer, float value);
+void CborWriter_Int(CborWriter *writer, long value);
+void CborWriter_Bool(CborWriter *writer, bool value);
+void CborWriter_String(CborWriter *writer, const char *value);
+
+/// <summary>
+///     Writes the value of a single field.  Fixed-point fields are rounded to their decimal
+///     places and written as single-precision floats, or as integers when they have no
+///     decimal places.  The quoted flag only applies to JSON and is ignored.
+/// </summary>
+void CborWriter_FieldValue(CborWriter *writer, const JsonField *field, const JsonFieldValue *value);
+
+/// <summary>
+///     Returns the length of the encoded data.
+/// </summary>
+/// <returns>Length of the data, or -1 if it did not fit in the buffer</returns>
+int CborWriter_Finish(CborWriter *writer);
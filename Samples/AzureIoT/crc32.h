@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     CRC-32 (IEEE 802.3) of data, continuing from crc.  Pass 0 to start a new CRC.
+/// </summary>
+uint32_t Crc32(uint32_t crc, const void *data, size_t size);
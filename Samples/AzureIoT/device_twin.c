@@ -1,6 +1,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -18,7 +19,10 @@
 #include <hw/avnet_mt3620_sk.h>
 #include "device_twin.h"
 #include "azure_io.h"
-#include "parson.h"
+#include "json_writer.h"
+#include "telemetry_policy.h"
+#include "twin_cache.h"
+#include "twin_extractor.h"
 #include "build_options.h"
 
 bool userLedRedIsOn = false;
@@ -28,6 +32,7 @@ bool appLedIsOn = false;
 bool wifiLedIsOn = false;
 bool clkBoardRelay1IsOn = true;
 bool clkBoardRelay2IsOn = true;
+bool statusLedOn = false;
 
 extern int userLedRedFd;
 extern int userLedGreenFd;
@@ -37,20 +42,10 @@ extern int appLedFd;
 extern int wifiLedFd;
 extern int clickSocket1Relay1Fd;
 extern int clickSocket1Relay2Fd;
+extern int deviceTwinStatusLedGpioFd;
 
 extern volatile sig_atomic_t terminationRequired;
 
-static const char cstrDeviceTwinJsonInteger[] = "{\"%s\": %d}";
-static const char cstrDeviceTwinJsonFloat[] = "{\"%s\": %.2f}";
-static const char cstrDeviceTwinJsonBool[] = "{\"%s\": %s}";
-static const char cstrDeviceTwinJsonString[] = "{\"%s\": \"%s\"}";
-#ifdef IOT_CENTRAL_APPLICATION
-static const char cstrDeviceTwinJsonFloatIOTC[] = "{\"%s\": {\"value\": %.2f, \"status\" : \"completed\" , \"desiredVersion\" : %d }}";
-static const char cstrDeviceTwinJsonBoolIOTC[] = "{\"%s\": {\"value\": %s, \"status\" : \"completed\" , \"desiredVersion\" : %d }}";
-static const char cstrDeviceTwinJsonIntegerIOTC[] = "{\"%s\": {\"value\": %d, \"status\" : \"completed\" , \"desiredVersion\" : %d }}";
-static const char cstrDeviceTwinJsonStringIOTC[] = "{\"%s\": {\"value\": %s, \"status\" : \"completed\" , \"desiredVersion\" : %d }}";
-#endif 
-
 static int desiredVersion = 0;
 
 // Define each device twin key that we plan to catch, process, and send reported property for.
@@ -67,163 +62,558 @@ twin_t twinArray[] = {
 	{.twinKey = "appLed",.twinVar = &appLedIsOn,.twinFd = &appLedFd,.twinGPIO = AVNET_MT3620_SK_APP_STATUS_LED_YELLOW,.twinType = TYPE_BOOL,.active_high = false},
 	{.twinKey = "wifiLed",.twinVar = &wifiLedIsOn,.twinFd = &wifiLedFd,.twinGPIO = AVNET_MT3620_SK_WLAN_STATUS_LED_YELLOW,.twinType = TYPE_BOOL,.active_high = false},
 	{.twinKey = "clickBoardRelay1",.twinVar = &clkBoardRelay1IsOn,.twinFd = &clickSocket1Relay1Fd,.twinGPIO = AVNET_MT3620_SK_GPIO34,.twinType = TYPE_BOOL,.active_high = true},
-	{.twinKey = "clickBoardRelay2",.twinVar = &clkBoardRelay2IsOn,.twinFd = &clickSocket1Relay2Fd,.twinGPIO = AVNET_MT3620_SK_GPIO0,.twinType = TYPE_BOOL,.active_high = true}};
+	{.twinKey = "clickBoardRelay2",.twinVar = &clkBoardRelay2IsOn,.twinFd = &clickSocket1Relay2Fd,.twinGPIO = AVNET_MT3620_SK_GPIO0,.twinType = TYPE_BOOL,.active_high = true},
+	{.twinKey = "StatusLED",.twinVar = &statusLedOn,.twinFd = &deviceTwinStatusLedGpioFd,.twinGPIO = MT3620_GPIO8,.twinType = TYPE_BOOL,.active_high = false},
+	{.twinKey = "temperatureDeadband",.twinVar = &temperaturePolicySettings.deadband,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "temperatureHysteresis",.twinVar = &temperaturePolicySettings.hysteresis,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "pressureDeadband",.twinVar = &pressurePolicySettings.deadband,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "pressureHysteresis",.twinVar = &pressurePolicySettings.hysteresis,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "accelerationDeadband",.twinVar = &accelerationPolicySettings.deadband,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "accelerationHysteresis",.twinVar = &accelerationPolicySettings.hysteresis,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "angularRateDeadband",.twinVar = &angularRatePolicySettings.deadband,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "angularRateHysteresis",.twinVar = &angularRatePolicySettings.hysteresis,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_FLOAT,.active_high = true},
+	{.twinKey = "telemetryMaxSilenceSeconds",.twinVar = &telemetryMaxSilenceSeconds,.twinFd = NULL,.twinGPIO = NO_GPIO_ASSOCIATED_WITH_TWIN,.twinType = TYPE_INT,.active_high = true}};
 
 // Calculate how many twin_t items are in the array.  We use this to iterate through the structure.
 int twinArraySize = sizeof(twinArray) / sizeof(twin_t);
 
 ///<summary>
-///		check to see if any of the device twin properties have been updated.  If so, send up the current data.
+///		Writes the value of a device twin property in the JSON form matching its type.
 ///</summary>
-void checkAndUpdateDeviceTwin(char* property, void* value, data_type_t type, bool ioTCentralFormat)
+static void writeTwinValue(JsonWriter* writer, void* value, data_type_t type)
 {
-	int nJsonLength = -1;
-
-	char *pjsonBuffer = (char *)malloc(JSON_BUFFER_SIZE);
-	if (pjsonBuffer == NULL) {
-		Log_Debug("ERROR: not enough memory to report device twin changes.");
+	switch (type) {
+	case TYPE_BOOL:
+		JsonWriter_Bool(writer, *(bool*)value);
+		break;
+	case TYPE_FLOAT:
+		JsonWriter_Fixed(writer, *(float*)value, 2, false);
+		break;
+	case TYPE_INT:
+		JsonWriter_Int(writer, *(int*)value, false);
+		break;
+	case TYPE_STRING:
+		JsonWriter_String(writer, (char*)value);
+		break;
 	}
+}
+
+// Reported properties waiting to be sent, merged into one patch.  The writer is given one byte
+// less than the buffer so that there is always room for the closing brace added by
+// flushDeviceTwinReport.  TwinReportStateJson hands a copy of the patch to the IoT Hub client.
+static char reportBuffer[JSON_BUFFER_SIZE];
+static JsonWriter reportWriter;
+static int reportCount = 0;
 
-	if (property != NULL) {
+// Twin cache entries, and the desired version, reported by a patch.  They are written to the
+// twin cache only when IoT Hub confirms the patch.  A patch that fails is reported again, so a
+// value is never remembered as reported when IoT Hub does not have it.
+typedef struct {
+	bool inUse;
+	int count;
+	uint8_t indexes[sizeof(twinArray) / sizeof(twin_t)];
+	TwinCacheValue values[sizeof(twinArray) / sizeof(twin_t)];
+	bool hasVersion;
+	int version;
+} twinReportRecord_t;
 
-		// report current device twin data as reported properties to IoTHub
+static twinReportRecord_t reportRecord;
+static twinReportRecord_t sentReportRecords[AZURE_MAX_IN_FLIGHT_REPORTS];
+
+///<summary>
+///		Writes one reported property as a key and value into the patch.
+///</summary>
+static void writeTwinReport(JsonWriter* writer, const char* property, void* value, data_type_t type, bool ioTCentralFormat)
+{
+	JsonWriter_Key(writer, property);
 
-		switch (type) {
-		case TYPE_BOOL:
 #ifdef IOT_CENTRAL_APPLICATION
-			if (ioTCentralFormat) {
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonBoolIOTC, property, *(bool*)value ? "true" : "false", desiredVersion);
-			}
-			else
+	if (ioTCentralFormat) {
+		JsonWriter_BeginObject(writer);
+		JsonWriter_Key(writer, "value");
+		writeTwinValue(writer, value, type);
+		JsonWriter_Key(writer, "status");
+		JsonWriter_String(writer, "completed");
+		JsonWriter_Key(writer, "desiredVersion");
+		JsonWriter_Int(writer, desiredVersion, false);
+		JsonWriter_EndObject(writer);
+		return;
+	}
 #endif 
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonBool, property, *(bool*)value ? "true" : "false", desiredVersion);
+	writeTwinValue(writer, value, type);
+}
 
+///<summary>
+///		Adds a property to the reported-properties patch, sending the patch first if it is full.
+///</summary>
+///<returns>false if the property could not be added</returns>
+static bool addTwinReport(const char* property, void* value, data_type_t type, bool ioTCentralFormat)
+{
+	for (int attempt = 0; attempt < 2; attempt++) {
+		JsonWriter saved = reportWriter;
+		if (reportCount == 0) {
+			JsonWriter_Init(&reportWriter, reportBuffer, sizeof(reportBuffer) - 1);
+			JsonWriter_BeginObject(&reportWriter);
+		}
+		writeTwinReport(&reportWriter, property, value, type, ioTCentralFormat);
+
+		if (!reportWriter.overflow) {
+			reportCount++;
+			return true;
+		}
+
+		reportWriter = saved;
+		if (reportCount == 0) {
 			break;
-		case TYPE_FLOAT:
-#ifdef IOT_CENTRAL_APPLICATION			
-			if (ioTCentralFormat) {
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonFloatIOTC, property, *(float*)value, desiredVersion);
-			}
-			else
-#endif 
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonFloat, property, *(float*)value, desiredVersion);
-			break;
-		case TYPE_INT:
-#ifdef IOT_CENTRAL_APPLICATION		
-			if (ioTCentralFormat) {
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonIntegerIOTC, property, *(int*)value, desiredVersion);
-			}
-			else
-#endif
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonInteger, property, *(int*)value, desiredVersion);
+		}
+
+		// Did not fit behind the properties already in the patch, so send those and start over.
+		flushDeviceTwinReport();
+	}
+
+	Log_Debug("ERROR: device twin report for '%s' does not fit in %zu bytes.\n", property, sizeof(reportBuffer));
+	return false;
+}
+
+///<summary>
+///		Adds the current value of a device twin property to the reported-properties patch.  The
+///		patch is sent by flushDeviceTwinReport, or earlier if it fills up.
+///</summary>
+void checkAndUpdateDeviceTwin(const char* property, void* value, data_type_t type, bool ioTCentralFormat)
+{
+	if (property == NULL) {
+		return;
+	}
+
+	addTwinReport(property, value, type, ioTCentralFormat);
+}
+
+///<summary>
+///		Reports the value of a twinArray entry, and notes the twin cache entry to write once IoT
+///		Hub confirms the patch.
+///</summary>
+///<returns>false if the property could not be added to the patch</returns>
+static bool reportTwinValue(unsigned int index, TwinCacheValue value)
+{
+	const twin_t* twin = &twinArray[index];
+	if (!addTwinReport(twin->twinKey, twin->twinVar, twin->twinType, true)) {
+		return false;
+	}
+
+	// The patch was sent first if it was full, so this always notes into the patch that holds
+	// the property.  A property reported twice keeps its last value, as it does in IoT Hub.
+	for (int i = 0; i < reportRecord.count; i++) {
+		if (reportRecord.indexes[i] == index) {
+			reportRecord.values[i] = value;
+			return true;
+		}
+	}
+	reportRecord.indexes[reportRecord.count] = (uint8_t)index;
+	reportRecord.values[reportRecord.count] = value;
+	reportRecord.count++;
+	return true;
+}
+
+///<summary>
+///		Reads the value of a twin variable into a twin cache value.
+///</summary>
+static TwinCacheValue currentTwinValue(const twin_t* twin)
+{
+	TwinCacheValue value;
+	memset(&value, 0, sizeof(value));
+
+	switch (twin->twinType) {
+	case TYPE_BOOL:
+		value.boolean = *(bool*)twin->twinVar;
+		break;
+	case TYPE_FLOAT:
+		value.number = *(float*)twin->twinVar;
+		break;
+	case TYPE_INT:
+		value.integer = *(int*)twin->twinVar;
+		break;
+	case TYPE_STRING:
+		break;
+	}
+	return value;
+}
+
+///<summary>
+///		Called when IoT Hub confirms or fails a reported-properties patch.  A confirmed patch
+///		updates the twin cache; the properties of a failed one are reported again with their
+///		current values.
+///</summary>
+static void onTwinReportConfirmed(bool succeeded, void* context)
+{
+	twinReportRecord_t* sent = context;
+	twinReportRecord_t record = *sent;
+	sent->inUse = false;
+
+	if (succeeded) {
+		for (int i = 0; i < record.count; i++) {
+			TwinCache_Reported(record.indexes[i], twinArray[record.indexes[i]].twinKey, record.values[i]);
+		}
+		if (record.hasVersion) {
+			TwinCache_SetDesiredVersion(record.version);
+		}
+		TwinCache_Commit();
+		return;
+	}
+
+	// The next DoWork pump sends them.
+	Log_Debug("WARNING: Device twin update failed, reporting its %d properties again.\n", record.count);
+	for (int i = 0; i < record.count; i++) {
+		reportTwinValue(record.indexes[i], currentTwinValue(&twinArray[record.indexes[i]]));
+	}
+	if (record.hasVersion && (!reportRecord.hasVersion || reportRecord.version < record.version)) {
+		reportRecord.hasVersion = true;
+		reportRecord.version = record.version;
+	}
+}
+
+///<summary>
+///		Sends the reported-properties patch as a single update, if it holds any properties.  A
+///		patch the IoT Hub client refuses stays pending, and more properties can still be added
+///		to it; the DoWork timer tries it again.
+///</summary>
+void flushDeviceTwinReport(void)
+{
+	if (reportCount == 0) {
+		return;
+	}
+
+	// The closing brace is written past the end of the writer's output, so it is overwritten
+	// if the patch stays pending and grows.
+	size_t reportLength = reportWriter.length;
+	reportBuffer[reportLength++] = '}';
+	reportBuffer[reportLength] = '\0';
+
+	twinReportRecord_t* sent = NULL;
+	for (int i = 0; i < AZURE_MAX_IN_FLIGHT_REPORTS; i++) {
+		if (!sentReportRecords[i].inUse) {
+			sent = &sentReportRecords[i];
 			break;
-		case TYPE_STRING:
-#ifdef IOT_CENTRAL_APPLICATION			
-			if (ioTCentralFormat) {
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonStringIOTC, property, (char*)value, desiredVersion);
+		}
+	}
+
+	Log_Debug("[MCU] Updating device twin (%d properties): %s\n", reportCount, reportBuffer);
+	if (sent != NULL) {
+		*sent = reportRecord;
+		sent->inUse = true;
+	}
+	if (sent == NULL || !TwinReportStateJsonConfirmed(reportBuffer, reportLength, onTwinReportConfirmed, sent)) {
+		if (sent != NULL) {
+			sent->inUse = false;
+		}
+		Log_Debug("INFO: Device twin update not accepted, keeping it for the next attempt.\n");
+		return;
+	}
+
+	memset(&reportRecord, 0, sizeof(reportRecord));
+	reportCount = 0;
+}
+
+// Index of twinArray by key, built the first time a twin update arrives.  Each bucket holds a
+// twinArray index or TWIN_INDEX_EMPTY.  The hash seed is chosen when the index is built so that
+// no two keys share a bucket, which makes a lookup one hash, one probe and one key compare.
+// Linear probing keeps lookups correct if no such seed is found within TWIN_INDEX_SEED_TRIES.
+#define TWIN_INDEX_SIZE 128
+#define TWIN_INDEX_EMPTY 0xFF
+#define TWIN_INDEX_SEED_TRIES 1000
+
+_Static_assert(sizeof(twinArray) / sizeof(twin_t) * 2 <= TWIN_INDEX_SIZE,
+	"TWIN_INDEX_SIZE must be at least twice the number of twinArray entries");
+_Static_assert(sizeof(twinArray) / sizeof(twin_t) <= TWIN_CACHE_MAX_ENTRIES,
+	"TWIN_CACHE_MAX_ENTRIES must be at least the number of twinArray entries");
+
+static uint8_t twinIndex[TWIN_INDEX_SIZE];
+static uint32_t twinIndexSeed = 0;
+static bool twinIndexBuilt = false;
+
+///<summary>
+///		Seeded FNV-1a hash of a key, with a final mix so that the low bits used as the bucket
+///		depend on every character.
+///</summary>
+static uint32_t hashTwinKey(const char* key, size_t len, uint32_t seed)
+{
+	uint32_t hash = 2166136261u ^ seed;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (uint8_t)key[i];
+		hash *= 16777619u;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x7feb352du;
+	hash ^= hash >> 15;
+	return hash;
+}
+
+///<summary>
+///		Fills the twin index using the given seed.
+///</summary>
+///<returns>Number of keys that did not land in their own bucket</returns>
+static int fillTwinIndex(uint32_t seed)
+{
+	int collisions = 0;
+
+	memset(twinIndex, TWIN_INDEX_EMPTY, sizeof(twinIndex));
+	for (int i = 0; i < twinArraySize; i++) {
+		uint32_t bucket = hashTwinKey(twinArray[i].twinKey, strlen(twinArray[i].twinKey), seed) & (TWIN_INDEX_SIZE - 1);
+		if (twinIndex[bucket] != TWIN_INDEX_EMPTY) {
+			collisions++;
+			while (twinIndex[bucket] != TWIN_INDEX_EMPTY) {
+				bucket = (bucket + 1) & (TWIN_INDEX_SIZE - 1);
 			}
-			else
-#endif 
-				nJsonLength = snprintf(pjsonBuffer, JSON_BUFFER_SIZE, cstrDeviceTwinJsonString, property, (char*)value, desiredVersion);
-			break;
 		}
+		twinIndex[bucket] = (uint8_t)i;
+	}
+	return collisions;
+}
+
+///<summary>
+///		Builds the twin index, looking for a seed that gives every key its own bucket.
+///</summary>
+static void buildTwinIndex(void)
+{
+	uint32_t seed = 0;
+	int collisions = fillTwinIndex(seed);
+	while (collisions != 0 && seed < TWIN_INDEX_SEED_TRIES) {
+		collisions = fillTwinIndex(++seed);
+	}
+
+	twinIndexSeed = seed;
+	twinIndexBuilt = true;
+	if (collisions != 0) {
+		Log_Debug("WARNING: No collision-free twin index found, %d keys need a second probe.\n", collisions);
+	}
+}
+
+///<summary>
+///		Finds the twinArray entry for a key.
+///</summary>
+///<param name="key">Key to look up, not necessarily NUL-terminated</param>
+///<param name="len">Length of the key</param>
+///<returns>The entry, or NULL if the key is not in twinArray</returns>
+twin_t* findTwinEntry(const char* key, size_t len)
+{
+	if (!twinIndexBuilt) {
+		buildTwinIndex();
+	}
 
-		if (nJsonLength > 0) {
-			Log_Debug("[MCU] Updating device twin: %s\n", pjsonBuffer);
-			TwinReportStateJson(pjsonBuffer, (size_t)nJsonLength);
+	uint32_t bucket = hashTwinKey(key, len, twinIndexSeed) & (TWIN_INDEX_SIZE - 1);
+	for (int probe = 0; probe < TWIN_INDEX_SIZE; probe++) {
+		uint8_t entry = twinIndex[bucket];
+		if (entry == TWIN_INDEX_EMPTY) {
+			return NULL;
+		}
+		if (strncmp(twinArray[entry].twinKey, key, len) == 0 && twinArray[entry].twinKey[len] == '\0') {
+			return &twinArray[entry];
 		}
-		free(pjsonBuffer);
+		bucket = (bucket + 1) & (TWIN_INDEX_SIZE - 1);
 	}
+	return NULL;
 }
 
 ///<summary>
-///		Parses received desired property changes.
+///		Applies a desired property value to its twin variable, drives the associated GPIO, and
+///		reports the new value back.  Values already applied since the app started are skipped,
+///		and values applied and reported before a restart are applied without reporting again.
 ///</summary>
-///<param name="desiredProperties">Address of desired properties JSON_Object</param>
-int deviceTwinChangedHandler(JSON_Object * desiredProperties)
+///<param name="twin">twinArray entry of the property</param>
+///<param name="value">Desired value of the property, decoded to the twin variable's type</param>
+///<param name="reported">Set to false if the new value could not be reported</param>
+///<returns>0 on success, or the GPIO_SetValue error</returns>
+static int applyTwinValue(const twin_t* twin, TwinCacheValue value, bool* reported)
 {
 	int result = 0;
+	unsigned int index = (unsigned int)(twin - twinArray);
 
-	// Pull the twin version out of the message.  We use this value when we echo the new setting back to IoT Connect.
-	if (json_object_has_value(desiredProperties, "$version") != 0)
-	{
-		desiredVersion = (int)json_object_get_number(desiredProperties, "$version");
-	}
-
-#ifdef IOT_CENTRAL_APPLICATION		
-
-	for (int i = 0; i < (sizeof(twinArray) / sizeof(twin_t)); i++) {
-
-		if (json_object_has_value(desiredProperties, twinArray[i].twinKey) != 0)
-		{
-
-			JSON_Object *currentJSONProperties = json_object_dotget_object(desiredProperties, twinArray[i].twinKey);
-
-			switch (twinArray[i].twinType) {
-			case TYPE_BOOL:
-				*(bool*)twinArray[i].twinVar = (bool)json_object_get_boolean(currentJSONProperties, "value");
-				result = GPIO_SetValue(*twinArray[i].twinFd, twinArray[i].active_high ? (GPIO_Value)*(bool*)twinArray[i].twinVar : !(GPIO_Value)*(bool*)twinArray[i].twinVar);
-
-				if (result != 0) {
-					Log_Debug("Fd: %d\n", twinArray[i].twinFd);
-					Log_Debug("FAILURE: Could not set GPIO_%d, %d output value %d: %s (%d).\n", twinArray[i].twinGPIO, twinArray[i].twinFd, (GPIO_Value)*(bool*)twinArray[i].twinVar, strerror(errno), errno);
-					return result;
-				}
-				Log_Debug("Received device update. New %s is %s\n", twinArray[i].twinKey, *(bool*)twinArray[i].twinVar ? "true" : "false");
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_BOOL, true);
-				break;
-			case TYPE_FLOAT:
-				*(float*)twinArray[i].twinVar = (float)json_object_get_number(currentJSONProperties, "value");
-				Log_Debug("Received device update. New %s is %0.2f\n", twinArray[i].twinKey, *(float*)twinArray[i].twinVar);
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_FLOAT, true);
-				break;
-			case TYPE_INT:
-				*(int*)twinArray[i].twinVar = (int)json_object_get_number(currentJSONProperties, "value");
-				Log_Debug("Received device update. New %s is %d\n", twinArray[i].twinKey, *(int*)twinArray[i].twinVar);
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_INT, true);
-				break;
-			case TYPE_STRING:
-				Log_Debug("ERROR: TYPE_STRING case not implemented!");
-				break;
-			}
+	TwinCacheResult cached = TwinCache_Check(index, twin->twinKey, value);
+	if (cached == TwinCache_Unchanged) {
+		return 0;
+	}
+
+	switch (twin->twinType) {
+	case TYPE_BOOL:
+		*(bool*)twin->twinVar = value.boolean;
+		result = GPIO_SetValue(*twin->twinFd, twin->active_high ? (GPIO_Value)*(bool*)twin->twinVar : !(GPIO_Value)*(bool*)twin->twinVar);
+
+		if (result != 0) {
+			Log_Debug("FAILURE: Could not set GPIO_%d, %d output value %d: %s (%d).\n", twin->twinGPIO, *twin->twinFd, (GPIO_Value)*(bool*)twin->twinVar, strerror(errno), errno);
+			return result;
 		}
+		Log_Debug("Received device update. New %s is %s\n", twin->twinKey, *(bool*)twin->twinVar ? "true" : "false");
+		break;
+	case TYPE_FLOAT:
+		*(float*)twin->twinVar = value.number;
+		Log_Debug("Received device update. New %s is %0.2f\n", twin->twinKey, *(float*)twin->twinVar);
+		break;
+	case TYPE_INT:
+		*(int*)twin->twinVar = value.integer;
+		Log_Debug("Received device update. New %s is %d\n", twin->twinKey, *(int*)twin->twinVar);
+		break;
+	case TYPE_STRING:
+		return 0;
 	}
-#else // !IOT_CENTRAL_APPLICATION		
-	
-	for (int i = 0; i < (sizeof(twinArray) / sizeof(twin_t)); i++) {
-
-		if (json_object_has_value(desiredProperties, twinArray[i].twinKey) != 0)
-		{
-
-			switch (twinArray[i].twinType) {
-			case TYPE_BOOL:
-				*(bool*)twinArray[i].twinVar = (bool)json_object_get_boolean(desiredProperties, twinArray[i].twinKey);
-				result = GPIO_SetValue(*twinArray[i].twinFd, twinArray[i].active_high ? (GPIO_Value)*(bool*)twinArray[i].twinVar : !(GPIO_Value)*(bool*)twinArray[i].twinVar);
-
-				if (result != 0) {
-					Log_Debug("Fd: %d\n", twinArray[i].twinFd);
-					Log_Debug("FAILURE: Could not set GPIO_%d, %d output value %d: %s (%d).\n", twinArray[i].twinGPIO, twinArray[i].twinFd, (GPIO_Value)*(bool*)twinArray[i].twinVar, strerror(errno), errno);
-					return result;
-				}
-				Log_Debug("Received device update. New %s is %s\n", twinArray[i].twinKey, *(bool*)twinArray[i].twinVar ? "true" : "false");
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_BOOL, true);
-				break;
-			case TYPE_FLOAT:
-				*(float*)twinArray[i].twinVar = (float)json_object_get_number(desiredProperties, twinArray[i].twinKey);
-				Log_Debug("Received device update. New %s is %0.2f\n", twinArray[i].twinKey, *(float*)twinArray[i].twinVar);
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_FLOAT, true);
-				break;
-			case TYPE_INT:
-				*(int*)twinArray[i].twinVar = (int)json_object_get_number(desiredProperties, twinArray[i].twinKey);
-				Log_Debug("Received device update. New %s is %d\n", twinArray[i].twinKey, *(int*)twinArray[i].twinVar);
-				checkAndUpdateDeviceTwin(twinArray[i].twinKey, twinArray[i].twinVar, TYPE_INT, true);
-				break;
-			case TYPE_STRING:
-				Log_Debug("ERROR: TYPE_STRING case not implemented!");
-				break;
-			}
+
+	// A value restored after a restart was reported before it; IoT Hub already has it.  A value
+	// that could not be reported is not marked applied, so the next update applies and reports
+	// it again.
+	if (cached == TwinCache_Changed && !reportTwinValue(index, value)) {
+		*reported = false;
+		return result;
+	}
+	TwinCache_Applied(index, twin->twinKey, value);
+	return result;
+}
+
+///<summary>
+///		Notes the version of a desired properties update.
+///</summary>
+///<returns>false if this version has already been applied and the update can be ignored</returns>
+static bool acceptDesiredVersion(int version)
+{
+	// We use this value when we echo the new setting back to IoT Connect.
+	desiredVersion = version;
+
+	// The full twin is sent again after every reconnect.  Nothing to do if this version
+	// has already been applied.
+	if (TwinCache_IsVersionApplied(desiredVersion)) {
+		Log_Debug("INFO: Desired properties version %d already applied.\n", desiredVersion);
+		return false;
+	}
+	return true;
+}
+
+///<summary>
+///		Records the version of a desired properties update once all of it has been applied.  If
+///		the update left reports to send, the version is recorded when IoT Hub confirms them.
+///</summary>
+static void recordDesiredVersion(int version)
+{
+	if (reportCount > 0) {
+		reportRecord.hasVersion = true;
+		reportRecord.version = version;
+	}
+	else {
+		TwinCache_SetDesiredVersion(version);
+	}
+}
+
+// Values found by the streaming extractor.  They are held until the walk reaches $version,
+// which IoT Hub puts after the properties, and applied only if that version is new.
+typedef struct {
+	twin_t* twin;
+	TwinCacheValue value;
+} extractedTwinValue_t;
+
+static extractedTwinValue_t extractedValues[sizeof(twinArray) / sizeof(twin_t)];
+static int extractedCount = 0;
+static bool extractedHasVersion = false;
+static int extractedVersion = 0;
+
+///<summary>
+///		Converts a desired property value from the streaming extractor to the type of its twin variable.
+///</summary>
+///<returns>false if the property type is not supported</returns>
+static bool decodeTwinScalar(const twin_t* twin, const TwinScalar* scalar, TwinCacheValue* value)
+{
+	memset(value, 0, sizeof(*value));
+
+	switch (twin->twinType) {
+	case TYPE_BOOL:
+		value->boolean = scalar->type == TwinScalar_Bool && scalar->boolean;
+		return true;
+	case TYPE_FLOAT:
+		value->number = scalar->type == TwinScalar_Number ? (float)scalar->number : 0.0f;
+		return true;
+	case TYPE_INT:
+		value->integer = scalar->type == TwinScalar_Number ? (int32_t)scalar->number : 0;
+		return true;
+	case TYPE_STRING:
+		Log_Debug("ERROR: TYPE_STRING case not implemented!");
+		break;
+	}
+	return false;
+}
+
+static void* findExtractedTwin(const char* key, size_t len)
+{
+	return findTwinEntry(key, len);
+}
+
+static void onExtractedTwinValue(void* property, const TwinScalar* scalar)
+{
+	twin_t* twin = property;
+	TwinCacheValue value;
+	if (!decodeTwinScalar(twin, scalar, &value)) {
+		return;
+	}
+
+	// A key repeated in the document keeps its last value, as it does in a parson DOM.
+	for (int i = 0; i < extractedCount; i++) {
+		if (extractedValues[i].twin == twin) {
+			extractedValues[i].value = value;
+			return;
 		}
 	}
-#endif 
+	extractedValues[extractedCount].twin = twin;
+	extractedValues[extractedCount].value = value;
+	extractedCount++;
+}
+
+static void onExtractedTwinVersion(long version)
+{
+	extractedHasVersion = true;
+	extractedVersion = (int)version;
+}
+
+///<summary>
+///		Applies the desired properties in a raw device twin payload, without copying or parsing it into a DOM.
+///</summary>
+///<param name="payload">Device twin JSON document, not necessarily NUL-terminated</param>
+///<param name="size">Length of the document</param>
+///<param name="complete">true for the complete twin, false for a desired properties patch</param>
+///<returns>0 on success, -1 if the payload is not valid JSON, or the GPIO_SetValue error</returns>
+int deviceTwinPayloadHandler(const char* payload, size_t size, bool complete)
+{
+	static const TwinExtractorCallbacks callbacks = {
+		.findProperty = findExtractedTwin,
+		.onProperty = onExtractedTwinValue,
+		.onVersion = onExtractedTwinVersion,
+		// IoT Central wraps each desired value as {"value": ...}, and IoT Hub users may too (see
+		// IoTHub.md), so both the wrapped and the bare form are accepted in every build.
+		.unwrapValue = true
+	};
+	int result = 0;
+	bool reported = true;
+
+	extractedCount = 0;
+	extractedHasVersion = false;
+	if (TwinExtractor_Parse(payload, size, complete, &callbacks) != 0) {
+		Log_Debug("WARNING: Cannot parse the device twin update as JSON content.\n");
+		return -1;
+	}
+
+	if (extractedHasVersion && !acceptDesiredVersion(extractedVersion)) {
+		return 0;
+	}
+
+	for (int i = 0; i < extractedCount; i++) {
+		result = applyTwinValue(extractedValues[i].twin, extractedValues[i].value, &reported);
+		if (result != 0) {
+			break;
+		}
+	}
+
+	// A version is only recorded once all of it is reported, or the full twin sent after the
+	// next reconnect would be skipped.
+	if (result == 0 && reported && extractedHasVersion) {
+		recordDesiredVersion(extractedVersion);
+	}
 
+	// Everything this update changed is reported in one patch, and remembered across restarts
+	// once IoT Hub confirms it.
+	flushDeviceTwinReport();
+	TwinCache_Commit();
+	return result;
 }
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include <applibs/gpio.h>
-#include "parson.h"
 
-#define JSON_BUFFER_SIZE 128
+// Size of the reported-properties patch.  A patch that fills up is sent and a new one started.
+#define JSON_BUFFER_SIZE 1024
 
 typedef enum {
 	TYPE_INT = 0,
@@ -22,12 +25,29 @@ typedef struct {
 } twin_t;
 
 ///<summary>
-///		Parses received desired property changes.
+///		Applies the desired properties in a raw device twin payload, without copying or parsing it into a DOM.
 ///</summary>
-///<param name="desiredProperties">Address of desired properties JSON_Object</param>
-int deviceTwinChangedHandler(JSON_Object * desiredProperties);
+///<param name="payload">Device twin JSON document, not necessarily NUL-terminated</param>
+///<param name="size">Length of the document</param>
+///<param name="complete">true for the complete twin, false for a desired properties patch</param>
+///<returns>0 on success, -1 if the payload is not valid JSON, or the GPIO_SetValue error</returns>
+int deviceTwinPayloadHandler(const char* payload, size_t size, bool complete);
+
+void checkAndUpdateDeviceTwin(const char*, void*, data_type_t, bool);
 
-void checkAndUpdateDeviceTwin(char*, void*, data_type_t, bool);
+///<summary>
+///		Sends the reported properties added by checkAndUpdateDeviceTwin as one patch.  The patch
+///		stays pending if the IoT Hub client does not accept it.
+///</summary>
+void flushDeviceTwinReport(void);
+
+///<summary>
+///		Finds the twinArray entry for a key in constant time.
+///</summary>
+///<param name="key">Key to look up, not necessarily NUL-terminated</param>
+///<param name="len">Length of the key</param>
+///<returns>The entry, or NULL if the key is not in twinArray</returns>
+twin_t* findTwinEntry(const char* key, size_t len);
 
 
 #define NO_GPIO_ASSOCIATED_WITH_TWIN -1
\ No newline at end of file
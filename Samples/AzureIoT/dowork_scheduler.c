@@ -0,0 +1,89 @@
+#include <stdbool.h>
+#include <time.h>
+
+#include "dowork_scheduler.h"
+
+static long minPeriod = 0;
+static long maxPeriod = 0;
+static long currentPeriod = 0;
+static unsigned int inFlight = 0;
+
+// Set while work has been queued that no DoWork call has picked up yet.
+static bool workWaiting = false;
+static struct timespec workWaitingSince;
+
+static DoWorkSchedulerStats stats;
+
+static long ElapsedMs(const struct timespec *since, const struct timespec *now)
+{
+    return (long)(now->tv_sec - since->tv_sec) * 1000 +
+           (now->tv_nsec - since->tv_nsec) / (1000 * 1000);
+}
+
+void DoWorkScheduler_Init(long minPeriodMs, long maxPeriodMs)
+{
+    minPeriod = minPeriodMs;
+    maxPeriod = maxPeriodMs;
+    currentPeriod = minPeriodMs;
+    inFlight = 0;
+    workWaiting = false;
+    stats = (DoWorkSchedulerStats){0};
+}
+
+bool DoWorkScheduler_WorkQueued(void)
+{
+    inFlight++;
+    if (!workWaiting) {
+        workWaiting = true;
+        clock_gettime(CLOCK_MONOTONIC, &workWaitingSince);
+    }
+
+    bool pumpNow = currentPeriod > minPeriod;
+    currentPeriod = minPeriod;
+    return pumpNow;
+}
+
+void DoWorkScheduler_WorkCompleted(void)
+{
+    if (inFlight > 0) {
+        inFlight--;
+    }
+}
+
+long DoWorkScheduler_Pumped(void)
+{
+    if (workWaiting) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long latency = ElapsedMs(&workWaitingSince, &now);
+
+        stats.samples++;
+        stats.lastMs = latency;
+        stats.totalMs += latency;
+        if (latency > stats.maxMs) {
+            stats.maxMs = latency;
+        }
+        workWaiting = false;
+    }
+
+    // Keep pumping quickly until everything in flight is confirmed, then back off.
+    if (inFlight > 0) {
+        currentPeriod = minPeriod;
+    } else {
+        currentPeriod *= 2;
+        if (currentPeriod > maxPeriod) {
+            currentPeriod = maxPeriod;
+        }
+    }
+    return currentPeriod;
+}
+
+unsigned int DoWorkScheduler_InFlight(void)
+{
+    return inFlight;
+}
+
+DoWorkSchedulerStats DoWorkScheduler_GetStats(void)
+{
+    return stats;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+
+/// <summary>
+///     Latency between work being handed to the IoT Hub client and the IoTHubDeviceClient_LL_DoWork
+///     call that puts it on the wire.
+/// </summary>
+typedef struct {
+    unsigned long samples;
+    long lastMs;
+    long maxMs;
+    long totalMs;
+} DoWorkSchedulerStats;
+
+/// <summary>
+///     Resets the scheduler.  DoWork is pumped every minPeriodMs while work is in flight, and
+///     the period doubles up to maxPeriodMs while the client is idle.
+/// </summary>
+void DoWorkScheduler_Init(long minPeriodMs, long maxPeriodMs);
+
+/// <summary>
+///     Records that a message or reported-state update was handed to the IoT Hub client.
+/// </summary>
+/// <returns>true if DoWork is currently scheduled later than the minimum period and the
+/// caller should pump it right away</returns>
+bool DoWorkScheduler_WorkQueued(void);
+
+/// <summary>
+///     Records that the IoT Hub client confirmed (or gave up on) a queued item.
+/// </summary>
+void DoWorkScheduler_WorkCompleted(void);
+
+/// <summary>
+///     Records that IoTHubDeviceClient_LL_DoWork has just been called.
+/// </summary>
+/// <returns>Delay in milliseconds until DoWork should be called again</returns>
+long DoWorkScheduler_Pumped(void);
+
+/// <summary>
+///     Returns the number of queued items not yet confirmed by the IoT Hub client.
+/// </summary>
+unsigned int DoWorkScheduler_InFlight(void);
+
+DoWorkSchedulerStats DoWorkScheduler_GetStats(void);
@@ -11,6 +11,7 @@
 #include "../exitcodes.h"
 #include "../azure_io.h"
 #include "../i2c.h"
+#include "../load_generator.h"
 
 #include "azure_eventloop.h"
 
@@ -33,7 +34,7 @@ static void AzureTimerEventHandler(EventLoopTimer *timer)
     bool isNetworkReady = false;
     if (Networking_IsNetworkingReady(&isNetworkReady) != -1)
     {
-        if (isNetworkReady && !iothubAuthenticated)
+        if (isNetworkReady && !IsIoTHubAuthenticated())
         {
             SetupAzureClient(azureTimer);
         }
@@ -43,31 +44,34 @@ static void AzureTimerEventHandler(EventLoopTimer *timer)
         Log_Debug("Failed to get Network state\n");
     }
 
-    if (iothubAuthenticated)
+    // IoTHubDeviceClient_LL_DoWork is pumped by its own timer in azure_io.c, so messages
+    // queued here go out without waiting for the next tick.
+    if (IsIoTHubAuthenticated())
     {
         SendTemperature();
-        IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+        FlushTelemetry();
     }
 }
 
+// Telemetry fields sent by this module.  Values are sent as strings with two decimals, as
+// "%3.2f" produced before.
+static const JsonField pressureField = {
+    .name = "Pressure", .type = JsonField_Fixed, .decimals = 2, .quoted = true};
+static const JsonField temperatureField = {
+    .name = "Temperature", .type = JsonField_Fixed, .decimals = 2, .quoted = true};
+
 static int SendPressure() {
     press_data pressure = getPressData();
-    char pressureBuffer[20];
-    int len = snprintf(pressureBuffer, 20, "%3.2f", pressure.pressure);
-    if (len > 0) {
-        SendTelemetry("Pressure", pressureBuffer);
-    }
+    JsonFieldValue value = {.number = pressure.pressure};
+    SendTelemetryFields(&pressureField, &value, 1);
 
     return 0;
 }
 
 static int SendTemperature() {
     temp_data temperature = getTempData();
-    char tempBuffer[20];
-    int len = snprintf(tempBuffer, 20, "%3.2f", temperature.temp);
-    if (len > 0) {
-        SendTelemetry("Temperature", tempBuffer);
-    }
+    JsonFieldValue value = {.number = temperature.temp};
+    SendTelemetryFields(&temperatureField, &value, 1);
 
     return 0;
 }
@@ -88,15 +92,14 @@ static void SendSimulatedTemperature(void)
         temperature -= deltaTemp;
     }
 
-    char tempBuffer[20];
-    int len = snprintf(tempBuffer, 20, "%3.2f", temperature);
-    if (len > 0) {
-        SendTelemetry("Temperature", tempBuffer);
-    }
+    JsonFieldValue value = {.number = temperature};
+    SendTelemetryFields(&temperatureField, &value, 1);
 }
 
 int initAzure(EventLoop *eventLoop)
 {
+    InitTelemetry();
+
     // azureIoTPollPeriodSeconds = AzureIoTDefaultPollPeriodSeconds;
     struct timespec azureTelemetryPeriod = {.tv_sec = AzureIoTDefaultPollPeriodSeconds, .tv_nsec = 0};
     azureTimer =
@@ -105,9 +108,28 @@ int initAzure(EventLoop *eventLoop)
     {
         return ExitCode_Init_AzureTimer;
     }
+
+    if (InitAzureDoWork(eventLoop) != 0)
+    {
+        return ExitCode_Init_AzureDoWorkTimer;
+    }
+
+#ifdef AZURE_LOAD_GENERATOR
+    if (LoadGenerator_Init(eventLoop) != 0)
+    {
+        return ExitCode_Init_LoadGenerator;
+    }
+#endif
+
+    return 0;
 }
 
 void closeAzure(void)
 {
+#ifdef AZURE_LOAD_GENERATOR
+    LoadGenerator_Close();
+#endif
     DisposeEventLoopTimer(azureTimer);
+    CloseAzureDoWork();
+    CloseTelemetry();
 }
@@ -21,7 +21,10 @@ int initI2cTimer(EventLoop *eventLoop) {
 		return ExitCode_Init_AccelleroMeterTimer;
 	}
 
-    initI2c();
+    // The sensors come up in the background.  A missing sensor leaves the readings at zero
+    // rather than stopping the application.
+    initI2c(eventLoop);
+    return 0;
 }
 
 int closeI2cTimer() {
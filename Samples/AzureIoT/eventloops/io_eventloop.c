@@ -89,7 +89,7 @@ void closeIo() {
 static void SendMessageButtonHandler(void)
 {
     if (IsButtonPressed(sendMessageButtonGpioFd, &sendMessageButtonState)) {
-        SendTelemetry("ButtonPress", "True");
+        SendTelemetryWithPriority("ButtonPress", "True", TelemetryPriority_High);
     }
 }
 
@@ -101,7 +101,8 @@ static void SendOrientationButtonHandler(void)
 {
     if (IsButtonPressed(sendOrientationButtonGpioFd, &sendOrientationButtonState)) {
         deviceIsUp = !deviceIsUp;
-        SendTelemetry("Orientation", deviceIsUp ? "Up" : "Down");
+        SendTelemetryWithPriority("Orientation", deviceIsUp ? "Up" : "Down",
+                                  TelemetryPriority_High);
     }
 }
 
@@ -22,6 +22,8 @@ typedef enum {
     ExitCode_Init_AzureTimer = 10,
     ExitCode_Init_AccelleroMeterTimer = 12,
     ExitCode_Init_ThermoMeterTimer = 13,
+    ExitCode_Init_AzureDoWorkTimer = 14,
+    ExitCode_Init_LoadGenerator = 15,
 
     ExitCode_IsButtonPressed_GetValue = 11
 } ExitCode;
\ No newline at end of file
@@ -1 +1,3 @@
-void CloseFdAndPrintError(int fd, const char *fdName);
\ No newline at end of file
+#pragma once
+
+void CloseFdAndPrintError(int fd, const char *fdName);
@@ -48,9 +48,12 @@
 
 #include "device_twin.h"
 #include "build_options.h"
+#include "azure_io.h"
+#include "json_writer.h"
 #include "i2c.h"
 #include "lsm6dso_reg.h"
 #include "lps22hh_reg.h"
+#include "lsm6dso_fifo.h"
 
 #include "eventloop_timer_utilities.h"
 #include "exitcodes.h"
@@ -65,6 +68,46 @@ static axis1bit16_t data_raw_temperature;
 static float lsm6dsoTemperature_degC;
 
 static uint8_t whoamI, rst;
+
+// Steps of the sensor initialization run by SensorInitTimerEventHandler
+typedef enum {
+	SensorInit_CheckId,
+	SensorInit_WaitReset,
+	SensorInit_DetectLps22hh,
+	SensorInit_WaitLps22hhReset,
+	SensorInit_Calibrate,
+	SensorInit_Ready,
+	SensorInit_Failed
+} SensorInitState;
+
+static SensorInitState sensorInitState = SensorInit_CheckId;
+static EventLoopTimer *sensorInitTimer = NULL;
+static unsigned int sensorInitTicks;      // Steps taken in the current state
+static unsigned int sensorInitAttempts;   // LPS22HH detections or calibration sets tried
+
+// Running sums over the calibration set being taken, per axis
+static unsigned int calibrationCount;
+static int64_t calibrationSum[3];
+static int64_t calibrationSumOfSquares[3];
+
+// Each reading gets the data ready flags and the sensor outputs in one burst starting at
+// STATUS_REG; register addresses auto-increment (IF_INC is set by default).  The burst ends at the
+// temperature when the FIFO holds the accelerometer and gyroscope samples, at OUTZ_H_A otherwise.
+#ifdef SENSOR_FIFO_ACQUISITION
+#define LSM6DSO_OUTPUT_BURST_LENGTH (LSM6DSO_OUT_TEMP_H - LSM6DSO_STATUS_REG + 1)
+#else
+#define LSM6DSO_OUTPUT_BURST_LENGTH (LSM6DSO_OUTZ_H_A - LSM6DSO_STATUS_REG + 1)
+#endif
+
+// Longest register write platform_write accepts; the ST drivers write at most 2 registers at once
+#define PLATFORM_WRITE_MAX_LENGTH 16
+static uint8_t platformWriteBuffer[PLATFORM_WRITE_MAX_LENGTH + 1];
+
+#ifdef ENABLE_I2C_TRANSFER_COUNTS
+static unsigned long i2cTransferCount;
+static unsigned long i2cBusByteCount;
+#endif
+
 //int accelTimerFd;
 const uint8_t lsm6dsOAddress = LSM6DSO_ADDRESS;     // Addr = 0x6A
 lsm6dso_ctx_t dev_ctx;
@@ -82,17 +125,31 @@ extern int epollFd;
 static int32_t platform_write(int *fD, uint8_t reg, uint8_t *bufp, uint16_t len);
 static int32_t platform_read(int *fD, uint8_t reg, uint8_t *bufp, uint16_t len);
 
+// Sensor initialization state machine
+static void SensorInitTimerEventHandler(EventLoopTimer *timer);
+
 // Routines to read/write to the LPS22HH device connected to the LSM6DSO sensor hub
 static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, uint16_t len);
 static int32_t lsm6dso_read_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, uint16_t len);
 
+// Telemetry sent for each sensor reading.  Values are sent as strings with the same number
+// of decimals the "%.4lf"/"%.2f"/"%4.2f" message template used.
+static const JsonField sensorTelemetryFields[] = {
+	{.name = "gX",.type = JsonField_Fixed,.decimals = 4,.quoted = true},
+	{.name = "gY",.type = JsonField_Fixed,.decimals = 4,.quoted = true},
+	{.name = "gZ",.type = JsonField_Fixed,.decimals = 4,.quoted = true},
+	{.name = "pressure",.type = JsonField_Fixed,.decimals = 2,.quoted = true},
+	{.name = "aX",.type = JsonField_Fixed,.decimals = 2,.quoted = true},
+	{.name = "aY",.type = JsonField_Fixed,.decimals = 2,.quoted = true},
+	{.name = "aZ",.type = JsonField_Fixed,.decimals = 2,.quoted = true}};
+
 static xl_data xl_data_buffer;
 static ang_data ang_data_buffer;
 static temp_data temp_data_buffer;
 static press_data press_data_buffer;
 
 /// <summary>
-///     Sleep for delayTime ms
+///     Sleeps for delayTime * 10 microseconds.
 /// </summary>
 void HAL_Delay(int delayTime) {
 	struct timespec ts;
@@ -117,22 +174,167 @@ press_data getPressData() {
 	return press_data_buffer;
 }
 
+#ifdef SENSOR_FIFO_ACQUISITION
+static uint8_t fifoWords[SENSOR_FIFO_MAX_WORDS * LSM6DSO_FIFO_WORD_SIZE];
+static Lsm6dsoFifoSample fifoSamples[SENSOR_FIFO_MAX_WORDS];
+static Lsm6dsoFifoDecoder fifoDecoder;
+
+/// <summary>
+///     Batches accelerometer and gyroscope samples, with timestamps, in the LSM6DSO FIFO.
+/// </summary>
+static void configureFifo(void)
+{
+	// FIFO_WTM_IA is raised once a full burst is waiting.
+	lsm6dso_fifo_watermark_set(&dev_ctx, SENSOR_FIFO_MAX_WORDS);
+	lsm6dso_fifo_xl_batch_set(&dev_ctx, LSM6DSO_XL_BATCHED_AT_12Hz5);
+	lsm6dso_fifo_gy_batch_set(&dev_ctx, LSM6DSO_GY_BATCHED_AT_12Hz5);
+	lsm6dso_fifo_timestamp_decimation_set(&dev_ctx, LSM6DSO_DEC_1);
+	lsm6dso_timestamp_set(&dev_ctx, PROPERTY_ENABLE);
+
+	// Once full, the FIFO drops its oldest words.
+	lsm6dso_fifo_mode_set(&dev_ctx, LSM6DSO_STREAM_MODE);
+}
+
+/// <summary>
+///     Drains the LSM6DSO FIFO and averages the samples batched since the last read into
+///     xl_data_buffer and ang_data_buffer.
+/// </summary>
+static void readFifoSamples(void)
+{
+	uint8_t status[2];
+
+	// FIFO_STATUS1 and FIFO_STATUS2 hold the number of unread words.
+	if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_FIFO_STATUS1, status, sizeof(status)) != 0) {
+		return;
+	}
+	uint16_t level = (uint16_t)(status[0] | ((status[1] & 0x03) << 8));
+	if (level == 0) {
+		return;
+	}
+	if (level > SENSOR_FIFO_MAX_WORDS) {
+		level = SENSOR_FIFO_MAX_WORDS;
+	}
+
+	// The address wraps from FIFO_DATA_OUT_Z_H back to FIFO_DATA_OUT_TAG, so every word comes
+	// out of one burst read.
+	if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_FIFO_DATA_OUT_TAG, fifoWords, (uint16_t)(level * LSM6DSO_FIFO_WORD_SIZE)) != 0) {
+		return;
+	}
+	size_t count = Lsm6dsoFifo_Decode(&fifoDecoder, fifoWords, level, fifoSamples, SENSOR_FIFO_MAX_WORDS);
+
+	xl_data xlSum = {0};
+	ang_data angSum = {0};
+	int xlCount = 0;
+	int angCount = 0;
+	for (size_t i = 0; i < count; i++) {
+		const int16_t* raw = fifoSamples[i].raw;
+		switch (fifoSamples[i].kind) {
+		case Lsm6dsoFifo_Acceleration:
+			xlSum.x += lsm6dso_from_fs4_to_mg(raw[0]);
+			xlSum.y += lsm6dso_from_fs4_to_mg(raw[1]);
+			xlSum.z += lsm6dso_from_fs4_to_mg(raw[2]);
+			xlCount++;
+			break;
+		case Lsm6dsoFifo_AngularRate:
+			angSum.x += lsm6dso_from_fs2000_to_mdps(raw[0] - raw_angular_rate_calibration.i16bit[0]) / 1000.0f;
+			angSum.y += lsm6dso_from_fs2000_to_mdps(raw[1] - raw_angular_rate_calibration.i16bit[1]) / 1000.0f;
+			angSum.z += lsm6dso_from_fs2000_to_mdps(raw[2] - raw_angular_rate_calibration.i16bit[2]) / 1000.0f;
+			angCount++;
+			break;
+		case Lsm6dsoFifo_Temperature:
+			break;
+		}
+	}
+
+	if (xlCount > 0) {
+		xl_data_buffer.x = xlSum.x / xlCount;
+		xl_data_buffer.y = xlSum.y / xlCount;
+		xl_data_buffer.z = xlSum.z / xlCount;
+
+		Log_Debug("\nLSM6DSO: Acceleration [mg]  : %.4lf, %.4lf, %.4lf (mean of %d)\n",
+			xl_data_buffer.x, xl_data_buffer.y, xl_data_buffer.z, xlCount);
+	}
+	if (angCount > 0) {
+		ang_data_buffer.x = angSum.x / angCount;
+		ang_data_buffer.y = angSum.y / angCount;
+		ang_data_buffer.z = angSum.z / angCount;
+
+		Log_Debug("LSM6DSO: Angular rate [dps] : %4.2f, %4.2f, %4.2f (mean of %d)\r\n",
+			ang_data_buffer.x, ang_data_buffer.y, ang_data_buffer.z, angCount);
+	}
+	if (count > 0) {
+		Log_Debug("LSM6DSO: FIFO words %u, samples span %lu us\r\n", level,
+			(unsigned long)(fifoSamples[count - 1].timestamp - fifoSamples[0].timestamp) * LSM6DSO_FIFO_TIMESTAMP_US);
+	}
+}
+#endif
+
+// The sensor hub reads PRESS_OUT_XL through TEMP_OUT_H of the LPS22HH on every accelerometer
+// sample, into SENSOR_HUB_1 through SENSOR_HUB_5.
+#define LPS22HH_AUTO_READ_LENGTH 5
+
+/// <summary>
+///     Sets up the LSM6DSO sensor hub to read the LPS22HH pressure and temperature outputs
+///     continuously, replacing the per-register pass-through reads once configuration is done.
+/// </summary>
+static void startLps22hhAutoRead(void)
+{
+	lsm6dso_sh_cfg_read_t sh_cfg_read = {
+		.slv_add = (LPS22HH_I2C_ADD_L & 0xFEU) >> 1, // 7bit I2C address
+		.slv_subadd = LPS22HH_PRESS_OUT_XL,
+		.slv_len = LPS22HH_AUTO_READ_LENGTH};
+
+	lsm6dso_sh_slv0_cfg_read(&dev_ctx, &sh_cfg_read);
+	lsm6dso_sh_slave_connected_set(&dev_ctx, LSM6DSO_SLV_0);
+
+	// The sensor hub runs on accelerometer samples.  The pass-through accesses leave the
+	// accelerometer off or at 104 Hz, so put back the configured rate.
+	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_12Hz5);
+	lsm6dso_sh_master_set(&dev_ctx, PROPERTY_ENABLE);
+}
+
+/// <summary>
+///     Reads the LPS22HH outputs from the sensor hub registers in one burst.  The bank is
+///     switched with plain writes; FUNC_CFG_ACCESS has no other bits to preserve.
+/// </summary>
+static void readLps22hhAutoRead(uint8_t *data)
+{
+	lsm6dso_func_cfg_access_t access = {.reg_access = LSM6DSO_SENSOR_HUB_BANK};
+
+	memset(data, 0, LPS22HH_AUTO_READ_LENGTH);
+	if (lsm6dso_write_reg(&dev_ctx, LSM6DSO_FUNC_CFG_ACCESS, (uint8_t*)&access, 1) == 0) {
+		lsm6dso_read_reg(&dev_ctx, LSM6DSO_SENSOR_HUB_1, data, LPS22HH_AUTO_READ_LENGTH);
+		access.reg_access = LSM6DSO_USER_BANK;
+		lsm6dso_write_reg(&dev_ctx, LSM6DSO_FUNC_CFG_ACCESS, (uint8_t*)&access, 1);
+	}
+}
+
 /// <summary>
 ///     Print latest data from on-board sensors.
 /// </summary>
 int readSensorData()
 {
-	uint8_t reg;
-	lps22hh_reg_t lps22hhReg;
+	// Nothing to read until the sensors are initialized and the gyroscope calibrated
+	if (sensorInitState != SensorInit_Ready) {
+		return 0;
+	}
 
 	// Read the sensors on the lsm6dso device
-	//Read output only if new xl value is available
-	lsm6dso_xl_flag_data_ready_get(&dev_ctx, &reg);
-	if (reg)
+	uint8_t outputs[LSM6DSO_OUTPUT_BURST_LENGTH];
+	lsm6dso_status_reg_t status;
+
+	memset(outputs, 0x00, sizeof(outputs));
+	lsm6dso_read_reg(&dev_ctx, LSM6DSO_STATUS_REG, outputs, sizeof(outputs));
+	memcpy(&status, outputs, sizeof(status));
+
+#ifdef SENSOR_FIFO_ACQUISITION
+	readFifoSamples();
+#else
+	//Use output only if new xl value is available
+	if (status.xlda)
 	{
-		// Read acceleration field data
-		memset(data_raw_acceleration.u8bit, 0x00, 3 * sizeof(int16_t));
-		lsm6dso_acceleration_raw_get(&dev_ctx, data_raw_acceleration.u8bit);
+		// Acceleration field data
+		memcpy(data_raw_acceleration.u8bit, outputs + (LSM6DSO_OUTX_L_A - LSM6DSO_STATUS_REG), 3 * sizeof(int16_t));
 
 		xl_data_buffer.x = lsm6dso_from_fs4_to_mg(data_raw_acceleration.i16bit[0]);
 		xl_data_buffer.y = lsm6dso_from_fs4_to_mg(data_raw_acceleration.i16bit[1]);
@@ -142,12 +344,10 @@ int readSensorData()
 			xl_data_buffer.x, xl_data_buffer.y, xl_data_buffer.z);
 	}
 
-	lsm6dso_gy_flag_data_ready_get(&dev_ctx, &reg);
-	if (reg)
+	if (status.gda)
 	{
-		// Read angular rate field data
-		memset(data_raw_angular_rate.u8bit, 0x00, 3 * sizeof(int16_t));
-		lsm6dso_angular_rate_raw_get(&dev_ctx, data_raw_angular_rate.u8bit);
+		// Angular rate field data
+		memcpy(data_raw_angular_rate.u8bit, outputs + (LSM6DSO_OUTX_L_G - LSM6DSO_STATUS_REG), 3 * sizeof(int16_t));
 
 		// Before we store the mdps values subtract the calibration data we captured at startup.
 		ang_data_buffer.x = (lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[0] - raw_angular_rate_calibration.i16bit[0])) / 1000.0;
@@ -158,13 +358,12 @@ int readSensorData()
 			ang_data_buffer.x, ang_data_buffer.y, ang_data_buffer.z);
 
 	}
+#endif
 
-	lsm6dso_temp_flag_data_ready_get(&dev_ctx, &reg);
-	if (reg)
+	if (status.tda)
 	{
-		// Read temperature data
-		memset(data_raw_temperature.u8bit, 0x00, sizeof(int16_t));
-		lsm6dso_temperature_raw_get(&dev_ctx, data_raw_temperature.u8bit);
+		// Temperature data
+		memcpy(data_raw_temperature.u8bit, outputs + (LSM6DSO_OUT_TEMP_L - LSM6DSO_STATUS_REG), sizeof(int16_t));
 		lsm6dsoTemperature_degC = lsm6dso_from_lsb_to_celsius(data_raw_temperature.i16bit);
 
 		Log_Debug("LSM6DSO: Temperature  [degC]: %.2f\r\n", lsm6dsoTemperature_degC);
@@ -177,17 +376,15 @@ int readSensorData()
 	memset(data_raw_temperature.u8bit, 0x00, sizeof(int16_t));
 
 	if (lps22hhDetected) {
-		lps22hh_read_reg(&pressure_ctx, LPS22HH_STATUS, (uint8_t *)&lps22hhReg, 1);
+		uint8_t lps22hhOut[LPS22HH_AUTO_READ_LENGTH];
+		readLps22hhAutoRead(lps22hhOut);
+		memcpy(data_raw_pressure.u8bit, lps22hhOut, 3);
+		memcpy(data_raw_temperature.u8bit, lps22hhOut + 3, sizeof(int16_t));
 
-		//Read output only if new value is available
-
-		if ((lps22hhReg.status.p_da == 1) && (lps22hhReg.status.t_da == 1))
+		// The sensor hub registers read as zero until its first read of the LPS22HH.
+		if (data_raw_pressure.i32bit != 0)
 		{
-			lps22hh_pressure_raw_get(&pressure_ctx, data_raw_pressure.u8bit);
-
 			press_data_buffer.pressure = lps22hh_from_lsb_to_hpa(data_raw_pressure.i32bit);
-
-			lps22hh_temperature_raw_get(&pressure_ctx, data_raw_temperature.u8bit);
 			temp_data_buffer.temp = lps22hh_from_lsb_to_celsius(data_raw_temperature.i16bit);
 
 			Log_Debug("LPS22HH: Pressure     [hPa] : %.2f\r\n", press_data_buffer.pressure);
@@ -203,87 +400,82 @@ int readSensorData()
 
 
 #if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
+		static bool firstPass = true;
 
 		// We've seen that the first read of the Accelerometer data is garbage.  If this is the first pass
 		// reading data, don't report it to Azure.  Since we're graphing data in Azure, this data point
 		// will skew the data.
 		if (!firstPass) {
 
-			// Allocate memory for a telemetry message to Azure
-			char *pjsonBuffer = (char *)malloc(JSON_BUFFER_SIZE);
-			if (pjsonBuffer == NULL) {
-				Log_Debug("ERROR: not enough memory to send telemetry");
-			}
-
-			// construct the telemetry message
-			snprintf(pjsonBuffer, JSON_BUFFER_SIZE, "{\"gX\":\"%.4lf\", \"gY\":\"%.4lf\", \"gZ\":\"%.4lf\", \"pressure\": \"%.2f\", \"aX\": \"%4.2f\", \"aY\": \"%4.2f\", \"aZ\": \"%4.2f\"}",
-				acceleration_mg[0], acceleration_mg[1], acceleration_mg[2], pressure_hPa, angular_rate_dps[0], angular_rate_dps[1], angular_rate_dps[2]);
-
-			Log_Debug("\n[Info] Sending telemetry: %s\n", pjsonBuffer);
-			AzureIoT_SendMessage(pjsonBuffer);
-			free(pjsonBuffer);
+			// Values in the same order as sensorTelemetryFields
+			JsonFieldValue telemetryValues[] = {
+				{.number = xl_data_buffer.x}, {.number = xl_data_buffer.y}, {.number = xl_data_buffer.z},
+				{.number = press_data_buffer.pressure},
+				{.number = ang_data_buffer.x}, {.number = ang_data_buffer.y}, {.number = ang_data_buffer.z}};
 
+			SendTelemetryFields(sensorTelemetryFields, telemetryValues, sizeof(telemetryValues) / sizeof(telemetryValues[0]));
 		}
 
 		firstPass = false;
 
 #endif 
+
+#ifdef ENABLE_I2C_TRANSFER_COUNTS
+	Log_Debug("I2C: %lu transfers, %lu bus bytes\n", i2cTransferCount, i2cBusByteCount);
+	i2cTransferCount = 0;
+	i2cBusByteCount = 0;
+#endif
 	return 0;
 }
 
-int initMaster() {
-	// Begin MT3620 I2C init 
-	i2cFd = I2CMaster_Open(AVNET_MT3620_SK_ISU2_I2C);
-	if (i2cFd < 0) {
-		Log_Debug("ERROR: I2CMaster_Open: errno=%d (%s)\n", errno, strerror(errno));
-		return -1;
-	}
-
-	int result = I2CMaster_SetBusSpeed(i2cFd, I2C_BUS_SPEED_STANDARD);
-	if (result != 0) {
-		Log_Debug("ERROR: I2CMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
-		return -1;
-	}
+// Converts a time in ms to a count of sensor initialization steps, rounding up
+#define SENSOR_INIT_TICKS(ms) (((ms) + SENSOR_INIT_STEP_MS - 1) / SENSOR_INIT_STEP_MS)
 
-	result = I2CMaster_SetTimeout(i2cFd, 100);
-	if (result != 0) {
-		Log_Debug("ERROR: I2CMaster_SetTimeout: errno=%d (%s)\n", errno, strerror(errno));
-		return -1;
-	}
+/// <summary>
+///     Moves the sensor initialization to a new state and restarts its step count.
+/// </summary>
+static void enterSensorInitState(SensorInitState state)
+{
+	sensorInitState = state;
+	sensorInitTicks = 0;
 }
 
 /// <summary>
-///     Initializes the I2C interface.
+///     Whether the current state has waited longer than SENSOR_INIT_STEP_TIMEOUT_MS.
 /// </summary>
-/// <returns>0 on success, or -1 on failure</returns>
-int initI2c(EventLoop *eventLoop) {
-	if(initMaster() != 0) {
-		return -1;
-	}
+static bool sensorInitTimedOut(void)
+{
+	return sensorInitTicks > SENSOR_INIT_TICKS(SENSOR_INIT_STEP_TIMEOUT_MS);
+}
 
-	// Start lsm6dso specific init
+/// <summary>
+///     Discards the calibration samples taken so far.
+/// </summary>
+static void resetCalibration(void)
+{
+	calibrationCount = 0;
+	memset(calibrationSum, 0, sizeof(calibrationSum));
+	memset(calibrationSumOfSquares, 0, sizeof(calibrationSumOfSquares));
+}
 
-	// Initialize lsm6dso mems driver interface
-	dev_ctx.write_reg = platform_write;
-	dev_ctx.read_reg = platform_read;
-	dev_ctx.handle = &i2cFd;
+/// <summary>
+///     Starts taking the first gyroscope calibration set.
+/// </summary>
+static void startCalibration(void)
+{
+	Log_Debug("LSM6DSO: Calibrating angular rate . . .\n");
+	Log_Debug("LSM6DSO: Please make sure the device is stationary.\n");
 
-	// Check device ID
-	lsm6dso_device_id_get(&dev_ctx, &whoamI);
-	if (whoamI != LSM6DSO_ID) {
-		Log_Debug("LSM6DSO not found!\n");
-		return -1;
-	}
-	else {
-		Log_Debug("LSM6DSO Found!\n");
-	}
-		
-	 // Restore default configuration
-	lsm6dso_reset_set(&dev_ctx, PROPERTY_ENABLE);
-	do {
-		lsm6dso_reset_get(&dev_ctx, &rst);
-	} while (rst);
+	resetCalibration();
+	sensorInitAttempts = 0;
+	enterSensorInitState(SensorInit_Calibrate);
+}
 
+/// <summary>
+///     Configures the LSM6DSO once it has come out of reset.
+/// </summary>
+static void configureLsm6dso(void)
+{
 	 // Disable I3C interface
 	lsm6dso_i3c_disable_set(&dev_ctx, LSM6DSO_I3C_DISABLE);
 
@@ -302,110 +494,263 @@ int initI2c(EventLoop *eventLoop) {
 	// Accelerometer - LPF1 + LPF2 path	
 	lsm6dso_xl_hp_path_on_out_set(&dev_ctx, LSM6DSO_LP_ODR_DIV_100);
 	lsm6dso_xl_filter_lp2_set(&dev_ctx, PROPERTY_ENABLE);
+}
 
-	// lps22hh specific init
+/// <summary>
+///     Looks for the LPS22HH behind the sensor hub once.
+/// </summary>
+/// <returns>true if the LPS22HH answered with its device ID</returns>
+static bool detectLps22hh(void)
+{
+	// Enable pull up on master I2C interface.
+	lsm6dso_sh_pin_mode_set(&dev_ctx, LSM6DSO_INTERNAL_PULL_UP);
+
+	// Check if LPS22HH is connected to Sensor Hub
+	whoamI = 0;
+	if (lps22hh_device_id_get(&pressure_ctx, &whoamI) != 0 || whoamI != LPS22HH_ID) {
+		Log_Debug("LPS22HH not found!\n");
+		return false;
+	}
 
-	// Default the flag to false.  If we fail to communicate with the LPS22HH device, this flag
-	// will cause application execution to skip over LPS22HH specific code.
-	lps22hhDetected = false;
+	Log_Debug("LPS22HH Found!\n");
+	return true;
+}
 
-	// Initialize lps22hh mems driver interface
-	pressure_ctx.read_reg = lsm6dso_read_lps22hh_cx;
-	pressure_ctx.write_reg = lsm6dso_write_lps22hh_cx;
-	pressure_ctx.handle = &i2cFd;
+/// <summary>
+///     Adds a gyroscope sample to the calibration set when one is ready.  When the set is full
+///     and no axis deviates more than GYRO_CALIBRATION_MAX_STDDEV_DPS, the set means become the
+///     angular rate offsets.  The device is assumed to be stationary.
+/// </summary>
+/// <returns>true once the offsets are set</returns>
+static bool takeCalibrationSample(void)
+{
+	uint8_t outputs[LSM6DSO_OUTZ_H_G - LSM6DSO_STATUS_REG + 1];
+	lsm6dso_status_reg_t status;
+
+	// Read the data ready flags and the angular rate field data in one burst
+	if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_STATUS_REG, outputs, sizeof(outputs)) != 0) {
+		return false;
+	}
 
-	int failCount = 10;
+	memcpy(&status, outputs, sizeof(status));
+	if (!status.gda) {
+		return false;
+	}
 
-	while (!lps22hhDetected) {
-		
-		// Enable pull up on master I2C interface.
-		lsm6dso_sh_pin_mode_set(&dev_ctx, LSM6DSO_INTERNAL_PULL_UP);
+	memcpy(data_raw_angular_rate.u8bit, outputs + (LSM6DSO_OUTX_L_G - LSM6DSO_STATUS_REG), 3 * sizeof(int16_t));
 
-		// Check if LPS22HH is connected to Sensor Hub
-		lps22hh_device_id_get(&pressure_ctx, &whoamI);
-		if (whoamI != LPS22HH_ID) {
-			Log_Debug("LPS22HH not found!\n");
-		}
-		else {
-			lps22hhDetected = true;
-			Log_Debug("LPS22HH Found!\n");
+	// A sample arrived, so restart the wait for the next one
+	sensorInitTicks = 0;
+
+	for (int axis = 0; axis < 3; axis++) {
+		int64_t sample = data_raw_angular_rate.i16bit[axis];
+		calibrationSum[axis] += sample;
+		calibrationSumOfSquares[axis] += sample * sample;
+	}
+
+	if (++calibrationCount < GYRO_CALIBRATION_SAMPLES) {
+		return false;
+	}
+
+	// Sample variance of each axis, in LSB^2
+	float maxStdDev_dps = 0.0f;
+	for (int axis = 0; axis < 3; axis++) {
+		double n = calibrationCount;
+		double variance = ((double)calibrationSumOfSquares[axis] - (double)calibrationSum[axis] * calibrationSum[axis] / n) / (n - 1);
+		float stdDev_dps = lsm6dso_from_fs2000_to_mdps(1) * (float)sqrt(variance > 0.0 ? variance : 0.0) / 1000.0f;
+		if (stdDev_dps > maxStdDev_dps) {
+			maxStdDev_dps = stdDev_dps;
 		}
+	}
+
+	if (maxStdDev_dps > GYRO_CALIBRATION_MAX_STDDEV_DPS && ++sensorInitAttempts < GYRO_CALIBRATION_ATTEMPTS) {
+		Log_Debug("LSM6DSO: Angular rate deviates %.2f dps, please make sure the device is stationary.\n", maxStdDev_dps);
+		resetCalibration();
+		return false;
+	}
 
-		// Restore the default configuration
-		lps22hh_reset_set(&pressure_ctx, PROPERTY_ENABLE);
-		do {
-			lps22hh_reset_get(&pressure_ctx, &rst);
-		} while (rst);
+	if (maxStdDev_dps > GYRO_CALIBRATION_MAX_STDDEV_DPS) {
+		Log_Debug("LSM6DSO: Angular rate still deviates %.2f dps, using the offsets anyway\n", maxStdDev_dps);
+	}
 
-		// Enable Block Data Update
-		lps22hh_block_data_update_set(&pressure_ctx, PROPERTY_ENABLE);
+	for (int axis = 0; axis < 3; axis++) {
+		raw_angular_rate_calibration.i16bit[axis] = (int16_t)llround((double)calibrationSum[axis] / calibrationCount);
+	}
 
-		//Set Output Data Rate
-		lps22hh_data_rate_set(&pressure_ctx, LPS22HH_10_Hz_LOW_NOISE);
+	return true;
+}
 
-		// If we failed to detect the lps22hh device, then pause before trying again.
-		if (!lps22hhDetected) {
-			HAL_Delay(100);
+/// <summary>
+///     Takes one step of the sensor initialization, so that the event loop keeps serving the
+///     Azure connection between steps.  A step waiting on a device gives up after
+///     SENSOR_INIT_STEP_TIMEOUT_MS.  The LSM6DSO steps only do a few I2C transfers.  The
+///     DetectLps22hh and WaitLps22hhReset steps reach the LPS22HH through sensor hub pass-through
+///     accesses, and each access busy-waits in waitSensorHubOperation, typically 15 ms and at
+///     most about 40 ms.  The step that finds the LPS22HH takes two accesses, and the one that
+///     configures it five, which holds the event loop for about 70 ms.
+/// </summary>
+static void SensorInitTimerEventHandler(EventLoopTimer *timer)
+{
+	if (ConsumeEventLoopTimerEvent(timer) != 0) {
+		return;
+	}
+
+	sensorInitTicks++;
+
+	switch (sensorInitState) {
+	case SensorInit_CheckId:
+		// Check device ID
+		whoamI = 0;
+		lsm6dso_device_id_get(&dev_ctx, &whoamI);
+		if (whoamI == LSM6DSO_ID) {
+			Log_Debug("LSM6DSO Found!\n");
+
+			 // Restore default configuration
+			lsm6dso_reset_set(&dev_ctx, PROPERTY_ENABLE);
+			enterSensorInitState(SensorInit_WaitReset);
+		}
+		else if (sensorInitTimedOut()) {
+			Log_Debug("LSM6DSO not found!\n");
+			enterSensorInitState(SensorInit_Failed);
+		}
+		break;
+
+	case SensorInit_WaitReset:
+		rst = 1;
+		lsm6dso_reset_get(&dev_ctx, &rst);
+		if (!rst) {
+			configureLsm6dso();
+			sensorInitAttempts = 0;
+			enterSensorInitState(SensorInit_DetectLps22hh);
+		}
+		else if (sensorInitTimedOut()) {
+			Log_Debug("LSM6DSO did not come out of reset!\n");
+			enterSensorInitState(SensorInit_Failed);
+		}
+		break;
+
+	case SensorInit_DetectLps22hh:
+		// Try once straight away, then every LPS22HH_DETECT_RETRY_MS
+		if (sensorInitAttempts > 0 && sensorInitTicks < SENSOR_INIT_TICKS(LPS22HH_DETECT_RETRY_MS)) {
+			break;
 		}
 
-		if (failCount-- == 0) {
-			bool lps22hhDetected = false;
+		sensorInitTicks = 0;
+		if (detectLps22hh()) {
+			// Restore the default configuration
+			lps22hh_reset_set(&pressure_ctx, PROPERTY_ENABLE);
+			enterSensorInitState(SensorInit_WaitLps22hhReset);
+		}
+		else if (++sensorInitAttempts >= LPS22HH_DETECT_ATTEMPTS) {
 			Log_Debug("Failed to read LPS22HH device ID, disabling all access to LPS22HH device!\n");
 			Log_Debug("Usually a power cycle will correct this issue\n");
-			break;
+			startCalibration();
 		}
+		break;
+
+	case SensorInit_WaitLps22hhReset:
+		rst = 1;
+		if (lps22hh_reset_get(&pressure_ctx, &rst) == 0 && !rst) {
+			// Enable Block Data Update
+			lps22hh_block_data_update_set(&pressure_ctx, PROPERTY_ENABLE);
+
+			//Set Output Data Rate
+			lps22hh_data_rate_set(&pressure_ctx, LPS22HH_10_Hz_LOW_NOISE);
+
+			lps22hhDetected = true;
+			startLps22hhAutoRead();
+			startCalibration();
+		}
+		else if (sensorInitTimedOut()) {
+			Log_Debug("LPS22HH did not come out of reset, disabling all access to LPS22HH device!\n");
+			startCalibration();
+		}
+		break;
+
+	case SensorInit_Calibrate:
+		if (takeCalibrationSample()) {
+			Log_Debug("LSM6DSO: Calibrating angular rate complete!\n");
+#ifdef SENSOR_FIFO_ACQUISITION
+			configureFifo();
+#endif
+			enterSensorInitState(SensorInit_Ready);
+		}
+		else if (sensorInitTimedOut()) {
+			Log_Debug("LSM6DSO: No angular rate data, the angular rate is not calibrated!\n");
+			memset(raw_angular_rate_calibration.u8bit, 0x00, 3 * sizeof(int16_t));
+#ifdef SENSOR_FIFO_ACQUISITION
+			configureFifo();
+#endif
+			enterSensorInitState(SensorInit_Ready);
+		}
+		break;
+
+	case SensorInit_Ready:
+	case SensorInit_Failed:
+		break;
 	}
 
-	// Read the raw angular rate data from the device to use as offsets.  We're making the assumption that the device
-	// is stationary.
+	if (sensorInitState == SensorInit_Ready || sensorInitState == SensorInit_Failed) {
+		DisarmEventLoopTimer(timer);
+	}
+}
 
-	uint8_t reg;
-	
-	Log_Debug("LSM6DSO: Calibrating angular rate . . .\n"); 
-	Log_Debug("LSM6DSO: Please make sure the device is stationary.\n");
+int initMaster() {
+	// Begin MT3620 I2C init 
+	i2cFd = I2CMaster_Open(AVNET_MT3620_SK_ISU2_I2C);
+	if (i2cFd < 0) {
+		Log_Debug("ERROR: I2CMaster_Open: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
 
-	do {
+	int result = I2CMaster_SetBusSpeed(i2cFd, I2C_BUS_SPEED_STANDARD);
+	if (result != 0) {
+		Log_Debug("ERROR: I2CMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
 
-		// Delay and read the device until we have data!
-		do {
-			// Read the calibration values
-			HAL_Delay(5000);
-			lsm6dso_gy_flag_data_ready_get(&dev_ctx, &reg);
-		} while (!reg);
+	result = I2CMaster_SetTimeout(i2cFd, 100);
+	if (result != 0) {
+		Log_Debug("ERROR: I2CMaster_SetTimeout: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
 
-		if (reg)
-		{
-			// Read angular rate field data to use for calibration offsets
-			memset(data_raw_angular_rate.u8bit, 0x00, 3 * sizeof(int16_t));
-			lsm6dso_angular_rate_raw_get(&dev_ctx, raw_angular_rate_calibration.u8bit);
-		}
+	return 0;
+}
 
-		// Delay and read the device until we have data!
-		do {
-			// Read the calibration values
-			HAL_Delay(5000);
-			lsm6dso_gy_flag_data_ready_get(&dev_ctx, &reg);
-		} while (!reg);
+/// <summary>
+///     Initializes the I2C interface and starts the sensor initialization.  The sensors are
+///     brought up by SensorInitTimerEventHandler, so this returns without waiting for them.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int initI2c(EventLoop *eventLoop) {
+	if(initMaster() != 0) {
+		return -1;
+	}
 
-		// Read the angular data rate again and verify that after applying the calibration, we have 0 angular rate in all directions
-		if (reg)
-		{
+	// Initialize lsm6dso mems driver interface
+	dev_ctx.write_reg = platform_write;
+	dev_ctx.read_reg = platform_read;
+	dev_ctx.handle = &i2cFd;
 
-			// Read angular rate field data
-			memset(data_raw_angular_rate.u8bit, 0x00, 3 * sizeof(int16_t));
-			lsm6dso_angular_rate_raw_get(&dev_ctx, data_raw_angular_rate.u8bit);
+	// Initialize lps22hh mems driver interface
+	pressure_ctx.read_reg = lsm6dso_read_lps22hh_cx;
+	pressure_ctx.write_reg = lsm6dso_write_lps22hh_cx;
+	pressure_ctx.handle = &i2cFd;
 
-			// Before we store the mdps values subtract the calibration data we captured at startup.
-			ang_data_buffer.x = lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[0] - raw_angular_rate_calibration.i16bit[0]);
-			ang_data_buffer.y = lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[1] - raw_angular_rate_calibration.i16bit[1]);
-			ang_data_buffer.z = lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[2] - raw_angular_rate_calibration.i16bit[2]);
+	// Default the flag to false.  If we fail to communicate with the LPS22HH device, this flag
+	// will cause application execution to skip over LPS22HH specific code.
+	lps22hhDetected = false;
 
-		}
+	enterSensorInitState(SensorInit_CheckId);
 
-	// If the angular values after applying the offset are not all 0.0s, then do it again!
-	} while ((ang_data_buffer.x != 0.0) || (ang_data_buffer.y != 0.0) || (ang_data_buffer.z != 0.0));
+	struct timespec sensorInitStep = { .tv_sec = 0,.tv_nsec = SENSOR_INIT_STEP_MS * 1000000L };
+	sensorInitTimer = CreateEventLoopPeriodicTimer(eventLoop, &SensorInitTimerEventHandler, &sensorInitStep);
+	if (sensorInitTimer == NULL) {
+		enterSensorInitState(SensorInit_Failed);
+		return -1;
+	}
 
-	Log_Debug("LSM6DSO: Calibrating angular rate complete!\n");	
 	return 0;
 }
 
@@ -413,6 +758,8 @@ int initI2c(EventLoop *eventLoop) {
 ///     Closes the I2C interface File Descriptors.
 /// </summary>
 void closeI2c(void) {
+	DisposeEventLoopTimer(sensorInitTimer);
+	sensorInitTimer = NULL;
 	CloseFdAndPrintError(i2cFd, "i2c");
 }
 
@@ -437,13 +784,16 @@ static int32_t platform_write(int *fD, uint8_t reg, uint8_t *bufp,
 	Log_Debug("\n");
 #endif 
 
-	// Construct a new command buffer that contains the register to write to, then the data to write
-	uint8_t cmdBuffer[len + 1];
-	cmdBuffer[0] = reg;
-	for (int i = 0; i < len; i++) {
-		cmdBuffer[i + 1] = bufp[i];
+	if (len > PLATFORM_WRITE_MAX_LENGTH) {
+		Log_Debug("ERROR: platform_write: %u registers exceeds PLATFORM_WRITE_MAX_LENGTH\n", len);
+		return -1;
 	}
 
+	// Fill the command buffer with the register to write to, then the data to write
+	uint8_t *cmdBuffer = platformWriteBuffer;
+	cmdBuffer[0] = reg;
+	memcpy(cmdBuffer + 1, bufp, len);
+
 #ifdef ENABLE_READ_WRITE_DEBUG
 	Log_Debug("cmdBuffer contents: ");
 	for (int i = 0; i < len + 1; i++) {
@@ -459,6 +809,10 @@ static int32_t platform_write(int *fD, uint8_t reg, uint8_t *bufp,
 		Log_Debug("ERROR: platform_write: errno=%d (%s)\n", errno, strerror(errno));
 		return -1;
 	}
+#ifdef ENABLE_I2C_TRANSFER_COUNTS
+	i2cTransferCount++;
+	i2cBusByteCount += 1 + (unsigned long)len + 1;
+#endif
 #ifdef ENABLE_READ_WRITE_DEBUG
 	Log_Debug("Wrote %d bytes to device.\n\n", retVal);
 #endif
@@ -491,19 +845,17 @@ static int32_t platform_read(int *fD, uint8_t reg, uint8_t *bufp,
 ;
 #endif
 
-	// Set the register address to read
-	int32_t retVal = I2CMaster_Write(i2cFd, lsm6dsOAddress, &reg, 1);
+	// Write the register address and read the data into the provided buffer in one transfer,
+	// with a repeated START in between.  Consecutive registers are read in the same burst.
+	int32_t retVal = I2CMaster_WriteThenRead(*fD, lsm6dsOAddress, &reg, 1, bufp, len);
 	if (retVal < 0) {
-		Log_Debug("ERROR: platform_read(write step): errno=%d (%s)\n", errno, strerror(errno));
-		return -1;
-	}
-
-	// Read the data into the provided buffer
-	retVal = I2CMaster_Read(i2cFd, lsm6dsOAddress, bufp, len);
-	if (retVal < 0) {
-		Log_Debug("ERROR: platform_read(read step): errno=%d (%s)\n", errno, strerror(errno));
+		Log_Debug("ERROR: platform_read: errno=%d (%s)\n", errno, strerror(errno));
 		return -1;
 	}
+#ifdef ENABLE_I2C_TRANSFER_COUNTS
+	i2cTransferCount++;
+	i2cBusByteCount += 1 + 1 + 1 + (unsigned long)len;
+#endif
 
 #ifdef ENABLE_READ_WRITE_DEBUG
 	Log_Debug("Read returned: ");
@@ -515,6 +867,36 @@ static int32_t platform_read(int *fD, uint8_t reg, uint8_t *bufp,
 
 	return 0;
 }
+// Number of HAL_Delay(20) polls a sensor hub pass-through access waits for each of its flags.
+// HAL_Delay(20) sleeps 200 us, so each flag is waited for at most about 20 ms: two periods of
+// the 104 Hz accelerometer sample that triggers the sensor hub.
+#define SENSOR_HUB_WAIT_ATTEMPTS 100
+
+/// <summary>
+///     Waits for an accelerometer sample to trigger the sensor hub, then for the sensor hub to
+///     finish its operation.  Gives up after SENSOR_HUB_WAIT_ATTEMPTS polls of each flag, so a
+///     missing LPS22HH cannot stall the caller.
+/// </summary>
+/// <returns>0 when the operation completed, or -1 on timeout</returns>
+static int32_t waitSensorHubOperation(void)
+{
+	uint8_t drdy = 0;
+	lsm6dso_status_master_t master_status = {0};
+	int attempts;
+
+	for (attempts = 0; attempts < SENSOR_HUB_WAIT_ATTEMPTS && !drdy; attempts++) {
+		HAL_Delay(20);
+		lsm6dso_xl_flag_data_ready_get(&dev_ctx, &drdy);
+	}
+
+	for (attempts = 0; attempts < SENSOR_HUB_WAIT_ATTEMPTS && drdy && !master_status.sens_hub_endop; attempts++) {
+		HAL_Delay(20);
+		lsm6dso_sh_status_get(&dev_ctx, &master_status);
+	}
+
+	return master_status.sens_hub_endop ? 0 : -1;
+}
+
 /*
  * @brief  Write lsm2mdl device register (used by configuration functions)
  *
@@ -530,8 +912,6 @@ static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data,
 {
 	axis3bit16_t data_raw_acceleration;
 	int32_t ret;
-	uint8_t drdy;
-	lsm6dso_status_master_t master_status;
 	lsm6dso_sh_cfg_write_t sh_cfg_write;
 
 	// Configure Sensor Hub to write to the LPS22HH, and send the write data
@@ -551,17 +931,9 @@ static int32_t lsm6dso_write_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data,
 
 	/* Wait Sensor Hub operation flag set. */
 	lsm6dso_acceleration_raw_get(&dev_ctx, data_raw_acceleration.u8bit);
-	do
-	{
-		HAL_Delay(20);
-		lsm6dso_xl_flag_data_ready_get(&dev_ctx, &drdy);
-	} while (!drdy);
-
-	do
-	{
-		HAL_Delay(20);
-		lsm6dso_sh_status_get(&dev_ctx, &master_status);
-	} while (!master_status.sens_hub_endop);
+	if (waitSensorHubOperation() != 0) {
+		ret = -1;
+	}
 
 	/* Disable I2C master and XL (trigger). */
 	lsm6dso_sh_master_set(&dev_ctx, PROPERTY_DISABLE);
@@ -585,8 +957,6 @@ static int32_t lsm6dso_read_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, ui
 	lsm6dso_sh_cfg_read_t sh_cfg_read;
 	uint8_t buf_raw[6];
 	int32_t ret;
-	uint8_t drdy;
-	lsm6dso_status_master_t master_status;
 
 	/* Disable accelerometer. */
 	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_OFF);
@@ -612,15 +982,9 @@ static int32_t lsm6dso_read_lps22hh_cx(void* ctx, uint8_t reg, uint8_t* data, ui
 
 	/* Wait Sensor Hub operation flag set. */
 	lsm6dso_acceleration_raw_get(&dev_ctx, buf_raw);
-	do {
-		HAL_Delay(20);
-		lsm6dso_xl_flag_data_ready_get(&dev_ctx, &drdy);
-	} while (!drdy);
-
-	do {
-		HAL_Delay(20);
-		lsm6dso_sh_status_get(&dev_ctx, &master_status);
-	} while (!master_status.sens_hub_endop);
+	if (waitSensorHubOperation() != 0) {
+		ret = -1;
+	}
 
 	/* Disable I2C master and XL(trigger). */
 	lsm6dso_sh_master_set(&dev_ctx, PROPERTY_DISABLE);
@@ -26,10 +26,10 @@ typedef struct {
     float pressure;
 } press_data;
 
-int initI2c();
+int initI2c(EventLoop *eventLoop);
 void closeI2c();
 int readSensorData();
-ang_data getAngBuffer();
+ang_data getAngData();
 xl_data getXlData();
 temp_data getTempData();
 press_data getPressData();
@@ -0,0 +1,175 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "build_options.h"
+#include "inflight_tracker.h"
+
+#define MAX_SLOTS \
+    (AZURE_MAX_IN_FLIGHT_MESSAGES + AZURE_MAX_IN_FLIGHT_REPORTS + AZURE_MAX_IN_FLIGHT_EVENTS)
+
+// Latencies below 16 ms get a bucket each.  Above that, each power of two is split into four
+// buckets, up to 2^24 ms (4.6 hours); anything longer lands in the last bucket.
+#define LINEAR_BUCKETS 16
+#define SUB_BUCKET_BITS 2
+#define MAX_EXPONENT 24
+#define BUCKET_COUNT (LINEAR_BUCKETS + (MAX_EXPONENT - 4 + 1) * (1 << SUB_BUCKET_BITS))
+
+typedef struct {
+    bool inUse;
+    InFlightKind kind;
+    struct timespec enqueued;
+} InFlightSlot;
+
+typedef struct {
+    unsigned long count;
+    long maxMs;
+    uint32_t buckets[BUCKET_COUNT];
+} LatencyHistogram;
+
+static InFlightSlot slots[MAX_SLOTS];
+static unsigned int limits[InFlight_KindCount];
+static unsigned int counts[InFlight_KindCount];
+static LatencyHistogram histograms[InFlight_KindCount];
+
+static unsigned int BucketIndex(long ms)
+{
+    if (ms < LINEAR_BUCKETS) {
+        return ms < 0 ? 0 : (unsigned int)ms;
+    }
+
+    unsigned int exponent = 31 - (unsigned int)__builtin_clz((uint32_t)ms);
+    if (exponent > MAX_EXPONENT) {
+        return BUCKET_COUNT - 1;
+    }
+    unsigned int sub = ((uint32_t)ms >> (exponent - SUB_BUCKET_BITS)) & ((1 << SUB_BUCKET_BITS) - 1);
+    return LINEAR_BUCKETS + (exponent - 4) * (1 << SUB_BUCKET_BITS) + sub;
+}
+
+static long BucketUpperBound(unsigned int index)
+{
+    if (index < LINEAR_BUCKETS) {
+        return (long)index;
+    }
+
+    unsigned int exponent = (index - LINEAR_BUCKETS) / (1 << SUB_BUCKET_BITS) + 4;
+    unsigned int sub = (index - LINEAR_BUCKETS) % (1 << SUB_BUCKET_BITS);
+    long width = 1L << (exponent - SUB_BUCKET_BITS);
+    return ((long)((1 << SUB_BUCKET_BITS) + sub) << (exponent - SUB_BUCKET_BITS)) + width - 1;
+}
+
+static long Percentile(const LatencyHistogram *histogram, unsigned int percent)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    // Rank of the sample at the given percentile, rounded up.
+    unsigned long rank = (histogram->count * percent + 99) / 100;
+    unsigned long seen = 0;
+    for (unsigned int i = 0; i < BUCKET_COUNT; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            long bound = BucketUpperBound(i);
+            return bound < histogram->maxMs ? bound : histogram->maxMs;
+        }
+    }
+    return histogram->maxMs;
+}
+
+void InFlight_Init(unsigned int maxTelemetry, unsigned int maxReportedState,
+                   unsigned int maxEvents)
+{
+    limits[InFlight_Telemetry] = maxTelemetry;
+    limits[InFlight_ReportedState] = maxReportedState;
+    limits[InFlight_Event] = maxEvents;
+    memset(slots, 0, sizeof(slots));
+    memset(counts, 0, sizeof(counts));
+    memset(histograms, 0, sizeof(histograms));
+}
+
+void *InFlight_Begin(InFlightKind kind)
+{
+    if (counts[kind] >= limits[kind]) {
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < MAX_SLOTS; i++) {
+        if (!slots[i].inUse) {
+            slots[i].inUse = true;
+            slots[i].kind = kind;
+            clock_gettime(CLOCK_MONOTONIC, &slots[i].enqueued);
+            counts[kind]++;
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+/// <summary>
+///     Returns the slot a callback context refers to, or NULL if it is not a slot in use.
+/// </summary>
+static InFlightSlot *SlotFromContext(void *context)
+{
+    InFlightSlot *slot = context;
+    if (slot < slots || slot >= slots + MAX_SLOTS || !slot->inUse) {
+        return NULL;
+    }
+    return slot;
+}
+
+void InFlight_Cancel(void *context)
+{
+    InFlightSlot *slot = SlotFromContext(context);
+    if (slot != NULL) {
+        slot->inUse = false;
+        counts[slot->kind]--;
+    }
+}
+
+long InFlight_Complete(void *context)
+{
+    InFlightSlot *slot = SlotFromContext(context);
+    if (slot == NULL) {
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long latency = (long)(now.tv_sec - slot->enqueued.tv_sec) * 1000 +
+                   (now.tv_nsec - slot->enqueued.tv_nsec) / (1000 * 1000);
+
+    LatencyHistogram *histogram = &histograms[slot->kind];
+    histogram->buckets[BucketIndex(latency)]++;
+    histogram->count++;
+    if (latency > histogram->maxMs) {
+        histogram->maxMs = latency;
+    }
+
+    slot->inUse = false;
+    counts[slot->kind]--;
+    return latency;
+}
+
+InFlightKind InFlight_GetKind(void *context)
+{
+    InFlightSlot *slot = SlotFromContext(context);
+    return slot != NULL ? slot->kind : InFlight_Telemetry;
+}
+
+unsigned int InFlight_Count(InFlightKind kind)
+{
+    return counts[kind];
+}
+
+InFlightLatency InFlight_GetLatency(InFlightKind kind)
+{
+    const LatencyHistogram *histogram = &histograms[kind];
+    InFlightLatency latency = {.count = histogram->count,
+                               .p50Ms = Percentile(histogram, 50),
+                               .p95Ms = Percentile(histogram, 95),
+                               .p99Ms = Percentile(histogram, 99),
+                               .maxMs = histogram->maxMs};
+    return latency;
+}
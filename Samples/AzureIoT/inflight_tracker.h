@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+
+typedef enum {
+    InFlight_Telemetry = 0,
+    InFlight_ReportedState = 1,
+    InFlight_Event = 2,
+    InFlight_KindCount = 3
+} InFlightKind;
+
+/// <summary>
+///     Confirmation latency percentiles, in milliseconds.  Each value is the upper bound of
+///     the histogram bucket holding the percentile, so it is accurate to within 25%.
+/// </summary>
+typedef struct {
+    unsigned long count;
+    long p50Ms;
+    long p95Ms;
+    long p99Ms;
+    long maxMs;
+} InFlightLatency;
+
+/// <summary>
+///     Sets the maximum number of unconfirmed items of each kind and clears the table.
+/// </summary>
+void InFlight_Init(unsigned int maxTelemetry, unsigned int maxReportedState,
+                   unsigned int maxEvents);
+
+/// <summary>
+///     Claims an in-flight slot for an item about to be handed to the IoT Hub client.  The
+///     returned pointer is passed to the client as the callback context.
+/// </summary>
+/// <returns>The slot, or NULL if the window for this kind is full</returns>
+void *InFlight_Begin(InFlightKind kind);
+
+/// <summary>
+///     Releases a slot whose item the IoT Hub client did not accept.
+/// </summary>
+void InFlight_Cancel(void *context);
+
+/// <summary>
+///     Releases the slot of a confirmed item and records its confirmation latency.
+/// </summary>
+/// <returns>Milliseconds from InFlight_Begin to confirmation, or -1 if context is not a slot</returns>
+long InFlight_Complete(void *context);
+
+/// <summary>
+///     Returns the kind a slot was claimed for.
+/// </summary>
+/// <returns>The kind, or InFlight_Telemetry if context is not a slot in use</returns>
+InFlightKind InFlight_GetKind(void *context);
+
+/// <summary>
+///     Returns the number of unconfirmed items of the given kind.
+/// </summary>
+unsigned int InFlight_Count(InFlightKind kind);
+
+/// <summary>
+///     Returns the confirmation latency percentiles recorded so far for the given kind.
+/// </summary>
+InFlightLatency InFlight_GetLatency(InFlightKind kind);
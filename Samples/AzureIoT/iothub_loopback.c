@@ -0,0 +1,221 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "build_options.h"
+
+#ifdef AZURE_IOT_LOOPBACK
+
+#include "iothub_loopback.h"
+
+typedef struct {
+    bool inUse;
+    bool isReport;
+    IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK eventCallback;
+    IOTHUB_CLIENT_REPORTED_STATE_CALLBACK reportCallback;
+    void *context;
+    struct timespec due;
+} LoopbackItem;
+
+// Stands in for the client handle; only its address is used.
+static int loopbackClient;
+
+static LoopbackItem queue[LOOPBACK_QUEUE_LENGTH];
+static LoopbackStats stats;
+static bool connected = false;
+static IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK connectionStatusCallback = NULL;
+static void *connectionStatusContext = NULL;
+
+/// <summary>
+///     Returns true with the given probability, in percent.
+/// </summary>
+static bool Chance(int percent)
+{
+    return percent > 0 && (rand() % 100) < percent;
+}
+
+static bool IsDue(const struct timespec *due, const struct timespec *now)
+{
+    return now->tv_sec > due->tv_sec || (now->tv_sec == due->tv_sec && now->tv_nsec >= due->tv_nsec);
+}
+
+/// <summary>
+///     Claims a queue slot for an accepted item, due after the configured confirmation delay.
+/// </summary>
+static LoopbackItem *Enqueue(void)
+{
+    if (Chance(LOOPBACK_REJECT_PERCENT)) {
+        stats.rejected++;
+        return NULL;
+    }
+
+    for (size_t i = 0; i < LOOPBACK_QUEUE_LENGTH; i++) {
+        if (!queue[i].inUse) {
+            long delayMs = LOOPBACK_CONFIRM_DELAY_MS;
+            if (LOOPBACK_CONFIRM_JITTER_MS > 0) {
+                delayMs += rand() % (LOOPBACK_CONFIRM_JITTER_MS + 1);
+            }
+
+            LoopbackItem *item = &queue[i];
+            memset(item, 0, sizeof(*item));
+            item->inUse = true;
+            clock_gettime(CLOCK_MONOTONIC, &item->due);
+            item->due.tv_sec += delayMs / 1000;
+            item->due.tv_nsec += (delayMs % 1000) * 1000 * 1000;
+            if (item->due.tv_nsec >= 1000 * 1000 * 1000) {
+                item->due.tv_sec++;
+                item->due.tv_nsec -= 1000 * 1000 * 1000;
+            }
+            stats.accepted++;
+            return item;
+        }
+    }
+
+    // A full queue is what the real client reports when it runs out of memory.
+    stats.rejected++;
+    return NULL;
+}
+
+/// <summary>
+///     Invokes the callback of a queued item and frees its slot.
+/// </summary>
+static void Complete(LoopbackItem *item, bool destroyed)
+{
+    bool failed = !destroyed && Chance(LOOPBACK_FAIL_PERCENT);
+    if (failed || destroyed) {
+        stats.failed++;
+    } else {
+        stats.confirmed++;
+    }
+
+    // Free the slot first, the callback may queue another item.
+    LoopbackItem completed = *item;
+    item->inUse = false;
+
+    if (completed.isReport) {
+        completed.reportCallback(failed || destroyed ? 500 : 204, completed.context);
+    } else {
+        IOTHUB_CLIENT_CONFIRMATION_RESULT result =
+            destroyed ? IOTHUB_CLIENT_CONFIRMATION_BECAUSE_DESTROY
+                      : (failed ? IOTHUB_CLIENT_CONFIRMATION_ERROR : IOTHUB_CLIENT_CONFIRMATION_OK);
+        completed.eventCallback(result, completed.context);
+    }
+}
+
+AZURE_SPHERE_PROV_RETURN_VALUE Loopback_CreateWithAzureSphereDeviceAuthProvisioning(
+    const char *idScope, unsigned int timeout, IOTHUB_DEVICE_CLIENT_LL_HANDLE *handle)
+{
+    Log_Debug("INFO: Using the IoT Hub loopback, messages will not leave the device.\n");
+    memset(queue, 0, sizeof(queue));
+    connected = false;
+    connectionStatusCallback = NULL;
+    *handle = (IOTHUB_DEVICE_CLIENT_LL_HANDLE)&loopbackClient;
+
+    AZURE_SPHERE_PROV_RETURN_VALUE result = {.result = AZURE_SPHERE_PROV_RESULT_OK};
+    return result;
+}
+
+void Loopback_Destroy(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle)
+{
+    // Like the real client, give every outstanding item back to its owner.
+    for (size_t i = 0; i < LOOPBACK_QUEUE_LENGTH; i++) {
+        if (queue[i].inUse) {
+            Complete(&queue[i], true);
+        }
+    }
+}
+
+void Loopback_DoWork(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle)
+{
+    // The real client reports the connection from DoWork once it is established.
+    if (!connected && connectionStatusCallback != NULL) {
+        connected = true;
+        connectionStatusCallback(IOTHUB_CLIENT_CONNECTION_AUTHENTICATED,
+                                 IOTHUB_CLIENT_CONNECTION_OK, connectionStatusContext);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (size_t i = 0; i < LOOPBACK_QUEUE_LENGTH; i++) {
+        if (queue[i].inUse && IsDue(&queue[i].due, &now)) {
+            Complete(&queue[i], false);
+        }
+    }
+}
+
+IOTHUB_CLIENT_RESULT Loopback_SendEventAsync(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                             IOTHUB_MESSAGE_HANDLE message,
+                                             IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK callback,
+                                             void *context)
+{
+    LoopbackItem *item = Enqueue();
+    if (item == NULL) {
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    const unsigned char *payload;
+    size_t payloadSize;
+    if (IoTHubMessage_GetByteArray(message, &payload, &payloadSize) == IOTHUB_MESSAGE_OK) {
+        stats.bytes += payloadSize;
+    }
+
+    item->eventCallback = callback;
+    item->context = context;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT Loopback_SendReportedState(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                                const unsigned char *reportedState, size_t size,
+                                                IOTHUB_CLIENT_REPORTED_STATE_CALLBACK callback,
+                                                void *context)
+{
+    LoopbackItem *item = Enqueue();
+    if (item == NULL) {
+        return IOTHUB_CLIENT_ERROR;
+    }
+
+    stats.bytes += size;
+    item->isReport = true;
+    item->reportCallback = callback;
+    item->context = context;
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT Loopback_SetOption(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                        const char *optionName, const void *value)
+{
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT Loopback_SetDeviceTwinCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                                    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK callback,
+                                                    void *context)
+{
+    // The loopback has no twin, so desired properties are never delivered.
+    return IOTHUB_CLIENT_OK;
+}
+
+IOTHUB_CLIENT_RESULT Loopback_SetConnectionStatusCallback(
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE handle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK callback,
+    void *context)
+{
+    connectionStatusCallback = callback;
+    connectionStatusContext = context;
+    return IOTHUB_CLIENT_OK;
+}
+
+int Loopback_IsNetworkingReady(bool *outIsNetworkingReady)
+{
+    *outIsNetworkingReady = true;
+    return 0;
+}
+
+LoopbackStats Loopback_GetStats(void)
+{
+    return stats;
+}
+
+#endif // AZURE_IOT_LOOPBACK
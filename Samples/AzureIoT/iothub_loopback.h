@@ -0,0 +1,64 @@
+#pragma once
+
+// Local stand-in for the IoT Hub device client, used when AZURE_IOT_LOOPBACK is defined in
+// build_options.h.  Including this header after the Azure IoT SDK headers redirects the
+// IoTHubDeviceClient_LL_* calls made by the Azure layer to the stand-in, which accepts,
+// delays, confirms and fails messages locally as configured by the LOOPBACK_* options.
+// Messages never leave the device, so the Azure layer can be measured without IoT Hub.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <iothub_client_core_common.h>
+#include <iothub_device_client_ll.h>
+#include <azure_sphere_provisioning.h>
+
+/// <summary>
+///     Counters kept by the stand-in since it was created.
+/// </summary>
+typedef struct {
+    unsigned long accepted;
+    unsigned long rejected;
+    unsigned long confirmed;
+    unsigned long failed;
+    unsigned long bytes;
+} LoopbackStats;
+
+AZURE_SPHERE_PROV_RETURN_VALUE Loopback_CreateWithAzureSphereDeviceAuthProvisioning(
+    const char *idScope, unsigned int timeout, IOTHUB_DEVICE_CLIENT_LL_HANDLE *handle);
+void Loopback_Destroy(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle);
+void Loopback_DoWork(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle);
+IOTHUB_CLIENT_RESULT Loopback_SendEventAsync(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                             IOTHUB_MESSAGE_HANDLE message,
+                                             IOTHUB_CLIENT_EVENT_CONFIRMATION_CALLBACK callback,
+                                             void *context);
+IOTHUB_CLIENT_RESULT Loopback_SendReportedState(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                                const unsigned char *reportedState, size_t size,
+                                                IOTHUB_CLIENT_REPORTED_STATE_CALLBACK callback,
+                                                void *context);
+IOTHUB_CLIENT_RESULT Loopback_SetOption(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                        const char *optionName, const void *value);
+IOTHUB_CLIENT_RESULT Loopback_SetDeviceTwinCallback(IOTHUB_DEVICE_CLIENT_LL_HANDLE handle,
+                                                    IOTHUB_CLIENT_DEVICE_TWIN_CALLBACK callback,
+                                                    void *context);
+IOTHUB_CLIENT_RESULT Loopback_SetConnectionStatusCallback(
+    IOTHUB_DEVICE_CLIENT_LL_HANDLE handle, IOTHUB_CLIENT_CONNECTION_STATUS_CALLBACK callback,
+    void *context);
+
+/// <summary>
+///     Reports networking as ready, so that the loopback works on a device without a network.
+/// </summary>
+int Loopback_IsNetworkingReady(bool *outIsNetworkingReady);
+
+LoopbackStats Loopback_GetStats(void);
+
+#define IoTHubDeviceClient_LL_CreateWithAzureSphereDeviceAuthProvisioning \
+    Loopback_CreateWithAzureSphereDeviceAuthProvisioning
+#define IoTHubDeviceClient_LL_Destroy Loopback_Destroy
+#define IoTHubDeviceClient_LL_DoWork Loopback_DoWork
+#define IoTHubDeviceClient_LL_SendEventAsync Loopback_SendEventAsync
+#define IoTHubDeviceClient_LL_SendReportedState Loopback_SendReportedState
+#define IoTHubDeviceClient_LL_SetOption Loopback_SetOption
+#define IoTHubDeviceClient_LL_SetDeviceTwinCallback Loopback_SetDeviceTwinCallback
+#define IoTHubDeviceClient_LL_SetConnectionStatusCallback Loopback_SetConnectionStatusCallback
+#define Networking_IsNetworkingReady Loopback_IsNetworkingReady
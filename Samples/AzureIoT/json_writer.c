@@ -0,0 +1,237 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+#define MAX_FIXED_DECIMALS 9
+#define MAX_FIXED_LENGTH 32
+
+static const uint32_t powersOfTen[MAX_FIXED_DECIMALS + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+static void Append(JsonWriter *writer, const char *text, size_t length)
+{
+    // Always keep room for the NUL written by JsonWriter_Finish.
+    if (writer->overflow || length >= writer->size - writer->length) {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(writer->buffer + writer->length, text, length);
+    writer->length += length;
+}
+
+static void AppendChar(JsonWriter *writer, char c)
+{
+    Append(writer, &c, 1);
+}
+
+/// <summary>
+///     Writes the separator needed before the next member or element.
+/// </summary>
+static void BeginValue(JsonWriter *writer)
+{
+    if (writer->needsComma) {
+        AppendChar(writer, ',');
+    }
+    writer->needsComma = true;
+}
+
+static void AppendEscaped(JsonWriter *writer, const char *text)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    AppendChar(writer, '"');
+    for (const char *run = text;; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c != '\0' && c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+
+        Append(writer, run, (size_t)(text - run));
+        if (c == '\0') {
+            break;
+        }
+        if (c == '"' || c == '\\') {
+            char escape[2] = {'\\', (char)c};
+            Append(writer, escape, sizeof(escape));
+        } else {
+            char escape[6] = {'\\', 'u', '0', '0', hexDigits[c >> 4], hexDigits[c & 0x0F]};
+            Append(writer, escape, sizeof(escape));
+        }
+        run = text + 1;
+    }
+    AppendChar(writer, '"');
+}
+
+void JsonWriter_Init(JsonWriter *writer, char *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->overflow = (size == 0);
+    writer->needsComma = false;
+}
+
+void JsonWriter_BeginObject(JsonWriter *writer)
+{
+    BeginValue(writer);
+    AppendChar(writer, '{');
+    writer->needsComma = false;
+}
+
+void JsonWriter_EndObject(JsonWriter *writer)
+{
+    AppendChar(writer, '}');
+    writer->needsComma = true;
+}
+
+void JsonWriter_Key(JsonWriter *writer, const char *key)
+{
+    BeginValue(writer);
+    AppendEscaped(writer, key);
+    AppendChar(writer, ':');
+    // The value that follows the key does not take a comma.
+    writer->needsComma = false;
+}
+
+void JsonWriter_Fixed(JsonWriter *writer, double value, unsigned int decimals, bool quoted)
+{
+    char digits[MAX_FIXED_LENGTH];
+    size_t length = JsonWriter_FormatFixed(digits, sizeof(digits), value, decimals);
+
+    BeginValue(writer);
+    if (length == 0) {
+        // Not representable in JSON (NaN or infinity).
+        Append(writer, "null", 4);
+        return;
+    }
+    if (quoted) {
+        AppendChar(writer, '"');
+    }
+    Append(writer, digits, length);
+    if (quoted) {
+        AppendChar(writer, '"');
+    }
+}
+
+void JsonWriter_Int(JsonWriter *writer, long value, bool quoted)
+{
+    JsonWriter_Fixed(writer, (double)value, 0, quoted);
+}
+
+void JsonWriter_Bool(JsonWriter *writer, bool value)
+{
+    BeginValue(writer);
+    if (value) {
+        Append(writer, "true", 4);
+    } else {
+        Append(writer, "false", 5);
+    }
+}
+
+void JsonWriter_String(JsonWriter *writer, const char *value)
+{
+    BeginValue(writer);
+    AppendEscaped(writer, value);
+}
+
+void JsonWriter_FieldValue(JsonWriter *writer, const JsonField *field, const JsonFieldValue *value)
+{
+    switch (field->type) {
+    case JsonField_Fixed:
+        JsonWriter_Fixed(writer, value->number, field->decimals, field->quoted);
+        break;
+    case JsonField_Int:
+        JsonWriter_Int(writer, value->integer, field->quoted);
+        break;
+    case JsonField_Bool:
+        JsonWriter_Bool(writer, value->boolean);
+        break;
+    case JsonField_String:
+        JsonWriter_String(writer, value->string);
+        break;
+    }
+}
+
+void JsonWriter_Fields(JsonWriter *writer, const JsonField *fields, const JsonFieldValue *values,
+                       size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        JsonWriter_Key(writer, fields[i].name);
+        JsonWriter_FieldValue(writer, &fields[i], &values[i]);
+    }
+}
+
+int JsonWriter_Finish(JsonWriter *writer)
+{
+    if (writer->overflow) {
+        if (writer->size > 0) {
+            writer->buffer[0] = '\0';
+        }
+        return -1;
+    }
+    writer->buffer[writer->length] = '\0';
+    return (int)writer->length;
+}
+
+size_t JsonWriter_FormatFixed(char *buffer, size_t size, double value, unsigned int decimals)
+{
+    if (!isfinite(value)) {
+        return 0;
+    }
+    if (decimals > MAX_FIXED_DECIMALS) {
+        decimals = MAX_FIXED_DECIMALS;
+    }
+
+    double magnitude = fabs(value) * powersOfTen[decimals];
+    if (magnitude >= 2251799813685248.0) {
+        // 2^51: beyond it the half-way points below are not exact doubles.  Values this large
+        // do not come from our sensors.
+        int length = snprintf(buffer, size, "%.*f", decimals, value);
+        return (length < 0 || (size_t)length >= size) ? 0 : (size_t)length;
+    }
+
+    // The product was rounded to a double, which can move it across a half-way point, so
+    // compare the exact product with the half-way points around it.  Exact ties round to
+    // even, as printf does.
+    uint64_t scaled = (uint64_t)llrint(magnitude);
+    double above = fma(fabs(value), powersOfTen[decimals], -((double)scaled + 0.5));
+    double below = fma(fabs(value), powersOfTen[decimals], -((double)scaled - 0.5));
+    if (above > 0 || (above == 0 && (scaled & 1) != 0)) {
+        scaled++;
+    } else if (below < 0 || (below == 0 && (scaled & 1) != 0)) {
+        scaled--;
+    }
+    uint64_t integerPart = scaled / powersOfTen[decimals];
+    uint32_t fractionPart = (uint32_t)(scaled % powersOfTen[decimals]);
+
+    // Build the number backwards from its last digit.
+    char digits[MAX_FIXED_LENGTH];
+    char *p = digits + sizeof(digits);
+    for (unsigned int i = 0; i < decimals; i++) {
+        *--p = (char)('0' + fractionPart % 10);
+        fractionPart /= 10;
+    }
+    if (decimals > 0) {
+        *--p = '.';
+    }
+    do {
+        *--p = (char)('0' + integerPart % 10);
+        integerPart /= 10;
+    } while (integerPart != 0);
+    // Like printf, negative values that round to zero, and negative zero, keep their sign.
+    if (signbit(value)) {
+        *--p = '-';
+    }
+
+    size_t length = (size_t)(digits + sizeof(digits) - p);
+    if (length >= size) {
+        return 0;
+    }
+    memcpy(buffer, p, length);
+    buffer[length] = '\0';
+    return length;
+}
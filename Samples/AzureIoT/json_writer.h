@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// <summary>
+///     Writes a JSON document into a caller-provided buffer without using the heap.
+///     Writing stops at the first value that does not fit; JsonWriter_Finish reports it.
+/// </summary>
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t length;
+    bool overflow;
+    bool needsComma;
+} JsonWriter;
+
+typedef enum {
+    JsonField_Fixed = 0,
+    JsonField_Int = 1,
+    JsonField_Bool = 2,
+    JsonField_String = 3
+} JsonFieldType;
+
+/// <summary>
+///     Describes one member of a JSON object.  Tables of fields are declared once and
+///     written with JsonWriter_Fields.
+/// </summary>
+typedef struct {
+    const char *name;
+    JsonFieldType type;
+    // Number of decimal places written for JsonField_Fixed.
+    uint8_t decimals;
+    // Write a numeric value as a JSON string, e.g. "23.40" instead of 23.40.
+    bool quoted;
+} JsonField;
+
+typedef union {
+    double number;
+    long integer;
+    bool boolean;
+    const char *string;
+} JsonFieldValue;
+
+void JsonWriter_Init(JsonWriter *writer, char *buffer, size_t size);
+void JsonWriter_BeginObject(JsonWriter *writer);
+void JsonWriter_EndObject(JsonWriter *writer);
+void JsonWriter_Key(JsonWriter *writer, const char *key);
+void JsonWriter_Fixed(JsonWriter *writer, double value, unsigned int decimals, bool quoted);
+void JsonWriter_Int(JsonWriter *writer, long value, bool quoted);
+void JsonWriter_Bool(JsonWriter *writer, bool value);
+void JsonWriter_String(JsonWriter *writer, const char *value);
+
+/// <summary>
+///     Writes the value of a single field, formatted as the field describes.
+/// </summary>
+void JsonWriter_FieldValue(JsonWriter *writer, const JsonField *field, const JsonFieldValue *value);
+
+/// <summary>
+///     Writes count name/value members described by fields, with values taken from values.
+/// </summary>
+void JsonWriter_Fields(JsonWriter *writer, const JsonField *fields, const JsonFieldValue *values,
+                       size_t count);
+
+/// <summary>
+///     NUL-terminates the document.
+/// </summary>
+/// <returns>Length of the document, or -1 if it did not fit in the buffer</returns>
+int JsonWriter_Finish(JsonWriter *writer);
+
+/// <summary>
+///     Formats value with a fixed number of decimal places (at most 9), like "%.*f" but
+///     without going through the C library's floating point formatting.
+/// </summary>
+/// <returns>Number of characters written, excluding the NUL, or 0 if buffer is too small</returns>
+size_t JsonWriter_FormatFixed(char *buffer, size_t size, double value, unsigned int decimals);
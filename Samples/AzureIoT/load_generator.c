@@ -0,0 +1,219 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include <applibs/log.h>
+
+#include "build_options.h"
+
+#ifdef AZURE_LOAD_GENERATOR
+
+#include "azure_io.h"
+#include "eventloop_timer_utilities.h"
+#include "inflight_tracker.h"
+#include "load_generator.h"
+#include "telemetry_batch.h"
+#include "telemetry_compress.h"
+
+// Readings are spread over this many keys so that they batch the way sensor readings do.
+#define LOAD_GENERATOR_KEYS 8
+
+static EventLoopTimer *telemetryTimer = NULL;
+static EventLoopTimer *reportTimer = NULL;
+static EventLoopTimer *statsTimer = NULL;
+
+static unsigned long readingsGenerated = 0;
+static unsigned long reportsGenerated = 0;
+
+// Values at the start of the current stats period.
+static struct timespec periodStart;
+static struct timespec periodStartCpu;
+static unsigned long periodStartReadings = 0;
+static unsigned long periodStartMessages = 0;
+static unsigned long periodStartConfirmed = 0;
+
+static uintptr_t heapBase = 0;
+static uintptr_t heapHighWater = 0;
+
+static long ElapsedUs(const struct timespec *start, const struct timespec *end)
+{
+    return (long)(end->tv_sec - start->tv_sec) * 1000 * 1000 +
+           (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/// <summary>
+///     Returns the heap in use.  With glibc 2.33 or later, as in the host tests, this is the
+///     bytes malloc has handed out and not taken back, including blocks it maps on their own.
+///     The C library on the device has no mallinfo, so there it is the program break, which
+///     never comes down and misses blocks malloc maps on their own.
+/// </summary>
+static uintptr_t HeapInUse(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return (uintptr_t)(info.uordblks + info.hblkhd);
+#else
+    return (uintptr_t)sbrk(0);
+#endif
+}
+
+/// <summary>
+///     Records the heap in use.  It is sampled on every generator tick, so this is the
+///     high-water mark seen at those points rather than an exact peak.
+/// </summary>
+static void SampleHeap(void)
+{
+    uintptr_t inUse = HeapInUse();
+    if (inUse > heapHighWater) {
+        heapHighWater = inUse;
+    }
+}
+
+/// <summary>
+///     Returns the number of telemetry messages and events confirmed by the IoT Hub client.
+/// </summary>
+static unsigned long ConfirmedMessages(void)
+{
+    return InFlight_GetLatency(InFlight_Telemetry).count + InFlight_GetLatency(InFlight_Event).count;
+}
+
+static void TelemetryTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    char key[sizeof("load0")];
+    char value[12];
+    snprintf(key, sizeof(key), "load%u", (unsigned int)(readingsGenerated % LOAD_GENERATOR_KEYS));
+    snprintf(value, sizeof(value), "%lu", readingsGenerated);
+    SendTelemetry((const unsigned char *)key, (const unsigned char *)value);
+    readingsGenerated++;
+
+    SampleHeap();
+}
+
+static void ReportTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    char reportedProperties[sizeof("{\"loadSequence\":18446744073709551615}")];
+    int len = snprintf(reportedProperties, sizeof(reportedProperties), "{\"loadSequence\":%lu}",
+                       reportsGenerated);
+    TwinReportStateJson(reportedProperties, (size_t)len);
+    reportsGenerated++;
+
+    SampleHeap();
+}
+
+static void StatsTimerEventHandler(EventLoopTimer *timer)
+{
+    if (ConsumeEventLoopTimerEvent(timer) != 0) {
+        return;
+    }
+
+    struct timespec now, nowCpu;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &nowCpu);
+
+    long elapsedUs = ElapsedUs(&periodStart, &now);
+    long cpuUs = ElapsedUs(&periodStartCpu, &nowCpu);
+    unsigned long messages = TelemetryBatch_GetStats().messages - periodStartMessages;
+    unsigned long readings = readingsGenerated - periodStartReadings;
+    unsigned long confirmed = ConfirmedMessages() - periodStartConfirmed;
+    InFlightLatency latency = InFlight_GetLatency(InFlight_Telemetry);
+
+    if (elapsedUs > 0) {
+        Log_Debug("LOAD: %lu readings/s, %lu messages/s, %lu confirmed/s\n",
+                  readings * 1000 * 1000 / (unsigned long)elapsedUs,
+                  messages * 1000 * 1000 / (unsigned long)elapsedUs,
+                  confirmed * 1000 * 1000 / (unsigned long)elapsedUs);
+    }
+    Log_Debug("LOAD: CPU %ld us per message, %ld us per reading, heap high-water %lu bytes\n",
+              messages > 0 ? cpuUs / (long)messages : 0, readings > 0 ? cpuUs / (long)readings : 0,
+              (unsigned long)(heapHighWater - heapBase));
+    Log_Debug("LOAD: confirmation latency p50 %ld ms, p95 %ld ms, p99 %ld ms, max %ld ms\n",
+              latency.p50Ms, latency.p95Ms, latency.p99Ms, latency.maxMs);
+#ifdef TELEMETRY_COMPRESSION
+    TelemetryCompressStats compress = TelemetryCompress_GetStats();
+    if (compress.inputBytes > 0) {
+#ifdef TELEMETRY_COMPRESSION_CPU_TIME
+        Log_Debug("LOAD: compression %lu%% of input size, %lu us CPU per KB in\n",
+                  compress.outputBytes * 100 / compress.inputBytes,
+                  compress.cpuUs * 1024 / compress.inputBytes);
+#else
+        Log_Debug("LOAD: compression %lu%% of input size\n",
+                  compress.outputBytes * 100 / compress.inputBytes);
+#endif
+    }
+#endif
+#ifdef AZURE_IOT_LOOPBACK
+    LoopbackStats loopback = Loopback_GetStats();
+    Log_Debug("LOAD: loopback accepted %lu, rejected %lu, confirmed %lu, failed %lu, %lu bytes\n",
+              loopback.accepted, loopback.rejected, loopback.confirmed, loopback.failed,
+              loopback.bytes);
+#endif
+
+    periodStart = now;
+    periodStartCpu = nowCpu;
+    periodStartReadings = readingsGenerated;
+    periodStartMessages = TelemetryBatch_GetStats().messages;
+    periodStartConfirmed = ConfirmedMessages();
+}
+
+/// <summary>
+///     Creates a periodic timer firing ratePerSecond times per second, or none if the rate is 0.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int CreateRateTimer(EventLoop *eventLoop, EventLoopTimerHandler handler,
+                           long ratePerSecond, EventLoopTimer **timer)
+{
+    if (ratePerSecond <= 0) {
+        return 0;
+    }
+
+    long periodNs = 1000L * 1000 * 1000 / ratePerSecond;
+    struct timespec period = {.tv_sec = periodNs / (1000 * 1000 * 1000),
+                              .tv_nsec = periodNs % (1000 * 1000 * 1000)};
+    *timer = CreateEventLoopPeriodicTimer(eventLoop, handler, &period);
+    return *timer == NULL ? -1 : 0;
+}
+
+int LoadGenerator_Init(EventLoop *eventLoop)
+{
+    heapBase = heapHighWater = HeapInUse();
+    clock_gettime(CLOCK_MONOTONIC, &periodStart);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &periodStartCpu);
+
+    static const struct timespec statsPeriod = {.tv_sec = LOAD_GENERATOR_STATS_PERIOD_SECONDS,
+                                                .tv_nsec = 0};
+    statsTimer = CreateEventLoopPeriodicTimer(eventLoop, &StatsTimerEventHandler, &statsPeriod);
+    if (statsTimer == NULL ||
+        CreateRateTimer(eventLoop, &TelemetryTimerEventHandler,
+                        LOAD_GENERATOR_READINGS_PER_SECOND, &telemetryTimer) != 0 ||
+        CreateRateTimer(eventLoop, &ReportTimerEventHandler, LOAD_GENERATOR_REPORTS_PER_SECOND,
+                        &reportTimer) != 0) {
+        return -1;
+    }
+
+    Log_Debug("INFO: Load generator running: %d readings/s, %d reports/s\n",
+              LOAD_GENERATOR_READINGS_PER_SECOND, LOAD_GENERATOR_REPORTS_PER_SECOND);
+    return 0;
+}
+
+void LoadGenerator_Close(void)
+{
+    DisposeEventLoopTimer(telemetryTimer);
+    DisposeEventLoopTimer(reportTimer);
+    DisposeEventLoopTimer(statsTimer);
+    telemetryTimer = reportTimer = statsTimer = NULL;
+}
+
+#endif // AZURE_LOAD_GENERATOR
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <applibs/eventloop.h>
+
+/// <summary>
+///     Starts generating telemetry and reported-property load at the rates set by the
+///     LOAD_GENERATOR_* options in build_options.h, and logs throughput, CPU time per message,
+///     heap high-water mark and confirmation latency every LOAD_GENERATOR_STATS_PERIOD_SECONDS.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+int LoadGenerator_Init(EventLoop *eventLoop);
+
+void LoadGenerator_Close(void);
@@ -0,0 +1,54 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lsm6dso_fifo.h"
+
+// Sensor tags, in bits 7..3 of the tag byte (see lsm6dso_fifo_tag_t).
+#define FIFO_TAG_GYRO 0x01
+#define FIFO_TAG_XL 0x02
+#define FIFO_TAG_TEMPERATURE 0x03
+#define FIFO_TAG_TIMESTAMP 0x04
+
+static int16_t ReadInt16(const uint8_t *data)
+{
+    return (int16_t)(uint16_t)(data[0] | (data[1] << 8));
+}
+
+size_t Lsm6dsoFifo_Decode(Lsm6dsoFifoDecoder *decoder, const uint8_t *words, size_t wordCount,
+                          Lsm6dsoFifoSample *samples, size_t maxSamples)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < wordCount && count < maxSamples; i++) {
+        const uint8_t *word = words + i * LSM6DSO_FIFO_WORD_SIZE;
+        const uint8_t *data = word + 1;
+
+        Lsm6dsoFifoSample *sample = &samples[count];
+        switch (word[0] >> 3) {
+        case FIFO_TAG_TIMESTAMP:
+            decoder->timestamp = (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+                                 ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+            continue;
+        case FIFO_TAG_XL:
+            sample->kind = Lsm6dsoFifo_Acceleration;
+            break;
+        case FIFO_TAG_GYRO:
+            sample->kind = Lsm6dsoFifo_AngularRate;
+            break;
+        case FIFO_TAG_TEMPERATURE:
+            sample->kind = Lsm6dsoFifo_Temperature;
+            break;
+        default:
+            decoder->skippedWords++;
+            continue;
+        }
+
+        sample->timestamp = decoder->timestamp;
+        sample->raw[0] = ReadInt16(data);
+        sample->raw[1] = ReadInt16(data + 2);
+        sample->raw[2] = ReadInt16(data + 4);
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Each FIFO word is a tag byte followed by six data bytes, read from FIFO_DATA_OUT_TAG
+// through FIFO_DATA_OUT_Z_H.
+#define LSM6DSO_FIFO_WORD_SIZE 7
+
+// Timestamps count in steps of 25 microseconds.
+#define LSM6DSO_FIFO_TIMESTAMP_US 25
+
+typedef enum {
+    Lsm6dsoFifo_Acceleration = 0,
+    Lsm6dsoFifo_AngularRate = 1,
+    Lsm6dsoFifo_Temperature = 2
+} Lsm6dsoFifoSampleKind;
+
+/// <summary>
+///     A sample taken from the FIFO, with the raw output of the sensor and the timestamp of
+///     the batch it was stored in.  Temperature samples only use raw[0].
+/// </summary>
+typedef struct {
+    Lsm6dsoFifoSampleKind kind;
+    uint32_t timestamp;
+    int16_t raw[3];
+} Lsm6dsoFifoSample;
+
+/// <summary>
+///     Decoder state kept from one FIFO read to the next.  Zero-initialize before first use.
+/// </summary>
+typedef struct {
+    uint32_t timestamp;
+    unsigned long skippedWords;
+} Lsm6dsoFifoDecoder;
+
+/// <summary>
+///     Decodes FIFO words read in one burst.  Timestamp words are not returned as samples;
+///     they set the timestamp of the samples that follow them.  Words of sensors not listed in
+///     Lsm6dsoFifoSampleKind are skipped.
+/// </summary>
+/// <param name="decoder">Decoder state</param>
+/// <param name="words">wordCount words of LSM6DSO_FIFO_WORD_SIZE bytes</param>
+/// <param name="samples">Receives at most maxSamples samples, oldest first</param>
+/// <returns>The number of samples written</returns>
+size_t Lsm6dsoFifo_Decode(Lsm6dsoFifoDecoder *decoder, const uint8_t *words, size_t wordCount,
+                          Lsm6dsoFifoSample *samples, size_t maxSamples);
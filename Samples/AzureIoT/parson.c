@@ -3,6 +3,12 @@
     https://github.com/kgabis/parson at commit id 4f3eaa6
     Patched to avoid any usage of fopen(), and removed implicit
     cast warnings by making them explicit.
+    Extended with arena parsing (json_parse_string_arena), in-situ
+    parsing (json_parse_string_insitu), hashed name lookup in large
+    objects, vectorized scanning, an integer fast path for number parsing,
+    shortest round-trip number serialization and single-pass streaming
+    serialization (json_serialize_to_sink) and compiled dotted paths
+    (json_path_compile).
 */
 
 /*
@@ -41,31 +47,69 @@
 #include <ctype.h>
 #include <math.h>
 #include <errno.h>
+#include <float.h>
+
+/* Whitespace, string and UTF-8 scanning use vector instructions where the compiler targets
+   them: AVX2 or SSE2 on x86. The NEON kernels for ARM have not been run on hardware yet, so
+   they are only used when PARSON_NEON is defined; ARM builds use the scalar loops otherwise.
+   Define PARSON_NO_SIMD to use the scalar loops everywhere; results are the same either way. */
+#if !defined(PARSON_NO_SIMD) && defined(__GNUC__)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2
+#define SIMD_BLOCK_SIZE 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SSE2
+#define SIMD_BLOCK_SIZE 16
+#elif defined(PARSON_NEON) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define SIMD_NEON
+#define SIMD_BLOCK_SIZE 16
+#endif
+#endif
 
 /* Apparently sscanf is not implemented in some "standard" libraries, so don't use it, if you
  * don't have to. */
 #define sscanf THINK_TWICE_ABOUT_USING_SSCANF
 
 #define STARTING_CAPACITY 16
+#define SINK_STARTING_CAPACITY 256
+#define ARENA_STARTING_CAPACITY 4 /* arena arrays are not trimmed, so start small */
 #define MAX_NESTING 2048
 
-#define FLOAT_FORMAT "%1.17g" /* do not increase precision without incresing NUM_BUF_SIZE */
-/* double printed with "%1.17g" shouldn't be longer than 25 bytes so let's use 64 */
+/* Objects with more than OBJECT_INDEX_THRESHOLD names get an open addressing hash index of
+   their names, kept at most half full. */
+#define OBJECT_INDEX_THRESHOLD 8
+#define OBJECT_INDEX_MIN_CAPACITY 32
+#define NOT_FOUND ((size_t)-1)
+
+/* numbers are serialized with at most 17 digits, a sign, a point and a 5 character exponent
+   (or up to 21 digits with a sign when integral), so 64 bytes is plenty */
 #define NUM_BUF_SIZE 64
+/* integers of up to 15 digits are exact in a double, so they are parsed without strtod */
+#define MAX_FAST_INTEGER_DIGITS 15
 
 #define SIZEOF_TOKEN(a) (sizeof(a) - 1)
 #define SKIP_CHAR(str) ((*str)++)
-#define SKIP_WHITESPACES(str)                 \
-    while (isspace((unsigned char)(**str))) { \
-        SKIP_CHAR(str);                       \
-    }
+#define SKIP_WHITESPACES(str) (*(str) = skip_whitespaces(*(str)))
+/* isspace in the C locale: space and \t \n \v \f \r */
+#define IS_SPACE(c) ((c) == ' ' || (unsigned char)((c) - '\t') <= '\r' - '\t')
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+/* Arena blocks are at least ARENA_MIN_BLOCK_SIZE bytes. The first block is sized from the
+   number of names and values in the document (see arena_estimate), which holds typical
+   documents whole. */
+#define ARENA_MIN_BLOCK_SIZE 256
+#define ARENA_BYTES_PER_TOKEN (sizeof(JSON_Value) + 4 * sizeof(void *))
+#define ARENA_ALIGNMENT sizeof(double)
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
 #undef malloc
 #undef free
 
-static JSON_Malloc_Function parson_malloc = malloc;
-static JSON_Free_Function parson_free = free;
+static JSON_Malloc_Function parson_malloc_fun = malloc;
+static JSON_Free_Function parson_free_fun = free;
 
 #define IS_CONT(b) (((unsigned char)(b)&0xC0) == 0x80) /* is utf-8 continuation byte */
 
@@ -79,18 +123,48 @@ typedef union json_value_value {
     int null;
 } JSON_Value_Value;
 
+/* type is narrowed to a char to make room for flags without growing the value */
 struct json_value_t {
     JSON_Value *parent;
-    JSON_Value_Type type;
+    signed char type;
+    unsigned char flags;
     JSON_Value_Value value;
 };
 
+/* Value flags telling which memory of a value came from an arena, and so is not freed on
+   its own. JSON_VALUE_NAME_IN_ARENA is about the name the value has in its parent object. */
+#define JSON_VALUE_IN_ARENA 0x01         /* the value, its string and its object or array */
+#define JSON_VALUE_MEMBERS_IN_ARENA 0x02 /* names and values of an object, items of an array */
+#define JSON_VALUE_INDEX_IN_ARENA 0x04   /* name index of an object */
+#define JSON_VALUE_NAME_IN_ARENA 0x08
+#define JSON_VALUE_ARENA_ROOT 0x10       /* root of an arena document, inside its JSON_Arena */
+#define JSON_VALUE_MUTATED 0x20          /* arena root of a document holding heap memory */
+
+typedef struct json_object_slot_t {
+    unsigned int hash;
+    unsigned int item; /* index in names and values plus one, 0 if the slot is empty */
+} JSON_Object_Slot;
+
 struct json_object_t {
     JSON_Value *wrapping_value;
     char **names;
     JSON_Value **values;
     size_t count;
     size_t capacity;
+    JSON_Object_Slot *index; /* NULL until count exceeds OBJECT_INDEX_THRESHOLD */
+    size_t index_capacity;   /* power of two */
+};
+
+typedef struct json_path_segment_t {
+    const char *name; /* NUL-terminated copy inside the path */
+    size_t name_len;
+    unsigned int hash;
+} JSON_Path_Segment;
+
+/* Allocated in one block: the path, then its segments, then the names they point at */
+struct json_path_t {
+    size_t count;
+    JSON_Path_Segment *segments;
 };
 
 struct json_array_t {
@@ -100,6 +174,46 @@ struct json_array_t {
     size_t capacity;
 };
 
+/* An arena is a list of blocks filled by a bump pointer. Everything allocated while parsing
+   into an arena comes from it, and freeing the root value releases all blocks at once. Values
+   record in their flags which of their memory came from the arena, and frees of it are
+   skipped, so values added to an arena document after parsing still come from the heap; such
+   documents are walked when freed to release them. Strings of an in-situ parse stay in the
+   caller's buffer and are skipped in the same way. The root value is moved into the arena
+   header, so that freeing it finds the arena without a search. */
+typedef struct json_arena_block_t {
+    struct json_arena_block_t *next;
+    size_t size;
+    size_t used;
+} JSON_Arena_Block;
+
+typedef struct json_arena_t {
+    JSON_Value root;
+    JSON_Arena_Block *blocks; /* newest first; the last one also holds this struct */
+    int in_situ;              /* strings are unescaped over the input */
+} JSON_Arena;
+
+static JSON_Arena *building_arena = NULL; /* arena of the parse in progress */
+
+/* Arena */
+static JSON_Arena_Block *arena_block_init(size_t size);
+static JSON_Arena *arena_init(size_t size, int in_situ);
+static void *arena_alloc(JSON_Arena *arena, size_t size);
+static size_t arena_estimate(const char *string, size_t string_len, int in_situ);
+static unsigned char arena_flag(unsigned char flags, unsigned char flag);
+static void arena_note_insert(JSON_Value *container);
+static void arena_release(JSON_Arena *arena);
+static void *parson_malloc(size_t size);
+static void parson_free(void *ptr);
+
+/* Scanning */
+static const char *skip_whitespaces(const char *string);
+static const char *find_quote_or_escape(const char *string);
+static const char *skip_ascii(const char *string, const char *string_end);
+
+/* Numbers */
+static int format_number(char *buf, double number);
+
 /* Various */
 static void remove_comments(char *string, const char *start_token, const char *end_token);
 static char *parson_strndup(const char *string, size_t n);
@@ -116,7 +230,19 @@ static JSON_Object *json_object_init(JSON_Value *wrapping_value);
 static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value);
+static JSON_Status json_object_add_no_copy(JSON_Object *object, char *name, size_t name_len,
+                                           JSON_Value *value);
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity);
+static unsigned int hash_name(const char *name, size_t name_len);
+static void json_object_index_free(JSON_Object *object);
+static JSON_Status json_object_index_rebuild(JSON_Object *object, size_t new_capacity);
+static void json_object_index_insert(JSON_Object *object, unsigned int hash, size_t item);
+static size_t json_object_index_find(const JSON_Object *object, const char *name,
+                                     size_t name_len, unsigned int hash);
+static void json_object_index_remove(JSON_Object *object, size_t slot);
+static size_t json_object_find(const JSON_Object *object, const char *name, size_t name_len);
+static size_t json_object_find_hashed(const JSON_Object *object, const char *name,
+                                      size_t name_len, unsigned int hash);
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len);
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
@@ -148,11 +274,612 @@ static JSON_Value *parse_null_value(const char **string);
 static JSON_Value *parse_value(const char **string, size_t nesting);
 
 /* Serialization */
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf);
-static int json_serialize_string(const char *string, char *buf);
-static int append_indent(char *buf, int level);
-static int append_string(char *buf, const char *string);
+static int json_serialize_to_sink_r(const JSON_Value *value, JSON_Sink *sink, int level,
+                                    int is_pretty, char *num_buf);
+static int json_serialize_string(const char *string, JSON_Sink *sink);
+static int append_indent(JSON_Sink *sink, int level);
+
+/* Sinks */
+static int sink_append(JSON_Sink *sink, const char *data, size_t size);
+static int sink_write(JSON_Sink *sink);
+static int sink_grow(JSON_Sink *sink, size_t needed);
+static int sink_serialize(JSON_Sink *sink, const JSON_Value *value, int is_pretty);
+
+/* Arena */
+static JSON_Arena_Block *arena_block_init(size_t size)
+{
+    JSON_Arena_Block *block =
+        (JSON_Arena_Block *)parson_malloc_fun(ARENA_ALIGN(sizeof(JSON_Arena_Block)) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+static JSON_Arena *arena_init(size_t size, int in_situ)
+{
+    JSON_Arena *arena = NULL;
+    JSON_Arena_Block *block = arena_block_init(MAX(size, ARENA_MIN_BLOCK_SIZE));
+    if (block == NULL) {
+        return NULL;
+    }
+    arena = (JSON_Arena *)((char *)block + ARENA_ALIGN(sizeof(JSON_Arena_Block)));
+    block->used = ARENA_ALIGN(sizeof(JSON_Arena));
+    arena->blocks = block;
+    arena->in_situ = in_situ;
+    return arena;
+}
+
+static void *arena_alloc(JSON_Arena *arena, size_t size)
+{
+    JSON_Arena_Block *block = arena->blocks;
+    size = ARENA_ALIGN(size);
+    if (block->size - block->used < size) {
+        block = arena_block_init(MAX(size, block->size * 2));
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    block->used += size;
+    return (char *)block + ARENA_ALIGN(sizeof(JSON_Arena_Block)) + block->used - size;
+}
+
+/* Bytes a document is likely to take in an arena: every name or value costs about
+   ARENA_BYTES_PER_TOKEN, and strings that are copied take about their length in the input.
+   Commas, colons and opening brackets ('[' | 0x20 is '{') count the names and values closely
+   enough. They are counted a word at a time: a byte of x is zero exactly when the high bit of
+   the same byte of WORD_ZERO_BYTES(x) is set. */
+#define WORD_ONES ((size_t)-1 / 0xFF)
+#define WORD_HIGHS (WORD_ONES * 0x80)
+#define WORD_ZERO_BYTES(x) (~((((x) & ~WORD_HIGHS) + ~WORD_HIGHS) | (x) | ~WORD_HIGHS))
+static size_t arena_estimate(const char *string, size_t string_len, int in_situ)
+{
+    size_t i = 0, tokens = 1, word = 0, hits = 0;
+    unsigned char c;
+    for (; i + sizeof(size_t) <= string_len; i += sizeof(size_t)) {
+        memcpy(&word, string + i, sizeof(size_t));
+        hits = WORD_ZERO_BYTES(word ^ (WORD_ONES * ',')) |
+               WORD_ZERO_BYTES(word ^ (WORD_ONES * ':')) |
+               WORD_ZERO_BYTES((word | (WORD_ONES * 0x20)) ^ (WORD_ONES * '{'));
+        tokens += ((hits >> 7) * WORD_ONES) >> (sizeof(size_t) * 8 - 8); /* sums the bytes */
+    }
+    for (; i < string_len; i++) {
+        c = (unsigned char)string[i];
+        tokens += (size_t)((c == ',') | (c == ':') | ((c | 0x20) == '{'));
+    }
+    return tokens * ARENA_BYTES_PER_TOKEN + (in_situ ? 0 : string_len);
+}
+
+/* Returns flags with flag set if the memory it is about is being allocated in an arena */
+static unsigned char arena_flag(unsigned char flags, unsigned char flag)
+{
+    return (unsigned char)(building_arena != NULL ? flags | flag : flags & ~flag);
+}
+
+/* Called when a value is stored into a container. Once a heap value has been stored into an
+   arena document, freeing the document has to walk it. The arena values above a container
+   lead up to the root of its own arena. */
+static void arena_note_insert(JSON_Value *container)
+{
+    if (building_arena != NULL) {
+        return;
+    }
+    while (container != NULL && (container->flags & JSON_VALUE_IN_ARENA)) {
+        if (container->flags & JSON_VALUE_ARENA_ROOT) {
+            container->flags |= JSON_VALUE_MUTATED;
+            return;
+        }
+        container = container->parent;
+    }
+}
+
+static void arena_release(JSON_Arena *arena)
+{
+    JSON_Arena_Block *block = arena->blocks, *next = NULL;
+    while (block != NULL) {
+        next = block->next;
+        parson_free_fun(block);
+        block = next;
+    }
+}
+
+static void *parson_malloc(size_t size)
+{
+    if (building_arena != NULL) {
+        return arena_alloc(building_arena, size);
+    }
+    return parson_malloc_fun(size);
+}
+
+/* Arena memory is never passed in after parsing, its owners check their flags first */
+static void parson_free(void *ptr)
+{
+    if (ptr == NULL || building_arena != NULL) {
+        return;
+    }
+    parson_free_fun(ptr);
+}
+
+/* Scanning
+   Each wide kernel returns a mask with bits set for the bytes of a block that stop the scan,
+   SIMD_MASK_BITS bits per byte. Scans that stop at the string terminator use aligned loads,
+   which cannot cross into an unmapped page, so they may read up to a block past the
+   terminator; they are exempt from address sanitizing for that reason. */
+#ifdef SIMD_BLOCK_SIZE
+#define SIMD_NO_SANITIZE __attribute__((no_sanitize_address))
+#define IS_BLOCK_ALIGNED(ptr) (((size_t)(ptr) & (SIMD_BLOCK_SIZE - 1)) == 0)
+
+#if defined(SIMD_AVX2)
+#define SIMD_MASK_BITS 1
+SIMD_NO_SANITIZE static unsigned long long simd_not_space_mask(const char *block)
+{
+    __m256i v = _mm256_load_si256((const __m256i *)block);
+    __m256i controls = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i space = _mm256_or_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(controls, _mm256_set1_epi8('\r' - '\t')), controls));
+    return ~(unsigned long long)(unsigned int)_mm256_movemask_epi8(space) & 0xFFFFFFFFull;
+}
+
+SIMD_NO_SANITIZE static unsigned long long simd_quote_mask(const char *block)
+{
+    __m256i v = _mm256_load_si256((const __m256i *)block);
+    __m256i stop = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\"')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))),
+        _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+    return (unsigned int)_mm256_movemask_epi8(stop);
+}
+
+static unsigned long long simd_non_ascii_mask(const char *block)
+{
+    return (unsigned int)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)block));
+}
+#elif defined(SIMD_SSE2)
+#define SIMD_MASK_BITS 1
+SIMD_NO_SANITIZE static unsigned long long simd_not_space_mask(const char *block)
+{
+    __m128i v = _mm_load_si128((const __m128i *)block);
+    __m128i controls = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i space =
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(_mm_min_epu8(controls, _mm_set1_epi8('\r' - '\t')), controls));
+    return ~(unsigned long long)_mm_movemask_epi8(space) & 0xFFFFull;
+}
+
+SIMD_NO_SANITIZE static unsigned long long simd_quote_mask(const char *block)
+{
+    __m128i v = _mm_load_si128((const __m128i *)block);
+    __m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\"')),
+                                             _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+                                _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    return (unsigned int)_mm_movemask_epi8(stop);
+}
+
+static unsigned long long simd_non_ascii_mask(const char *block)
+{
+    return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)block));
+}
+#elif defined(SIMD_NEON)
+#define SIMD_MASK_BITS 4
+/* NEON has no movemask; narrowing each 16-bit lane by 4 leaves a nibble per byte */
+static unsigned long long simd_nibble_mask(uint8x16_t bytes)
+{
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(bytes), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+}
+
+SIMD_NO_SANITIZE static unsigned long long simd_not_space_mask(const char *block)
+{
+    uint8x16_t v = vld1q_u8((const uint8_t *)__builtin_assume_aligned(block, 16));
+    uint8x16_t space =
+        vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')),
+                 vcleq_u8(vsubq_u8(v, vdupq_n_u8('\t')), vdupq_n_u8('\r' - '\t')));
+    return ~simd_nibble_mask(space);
+}
+
+SIMD_NO_SANITIZE static unsigned long long simd_quote_mask(const char *block)
+{
+    uint8x16_t v = vld1q_u8((const uint8_t *)__builtin_assume_aligned(block, 16));
+    uint8x16_t stop = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('\"')), vceqq_u8(v, vdupq_n_u8('\\'))),
+                               vceqq_u8(v, vdupq_n_u8(0)));
+    return simd_nibble_mask(stop);
+}
+
+static unsigned long long simd_non_ascii_mask(const char *block)
+{
+    return simd_nibble_mask(vtstq_u8(vld1q_u8((const uint8_t *)block), vdupq_n_u8(0x80)));
+}
+#endif
+
+#define FIRST_STOP(block, mask) ((block) + (__builtin_ctzll(mask) / SIMD_MASK_BITS))
+
+SIMD_NO_SANITIZE static const char *skip_whitespaces_wide(const char *string)
+{
+    unsigned long long mask;
+    for (;;) {
+        mask = simd_not_space_mask(string);
+        if (mask != 0) {
+            return FIRST_STOP(string, mask);
+        }
+        string += SIMD_BLOCK_SIZE;
+    }
+}
+
+SIMD_NO_SANITIZE static const char *find_quote_or_escape_wide(const char *string)
+{
+    unsigned long long mask;
+    for (;;) {
+        mask = simd_quote_mask(string);
+        if (mask != 0) {
+            return FIRST_STOP(string, mask);
+        }
+        string += SIMD_BLOCK_SIZE;
+    }
+}
+#endif /* SIMD_BLOCK_SIZE */
+
+static const char *skip_whitespaces(const char *string)
+{
+    /* Runs between tokens are mostly short, so blocks are only used once one reaches an
+       alignment boundary. */
+    while (IS_SPACE(*string)) {
+        string++;
+#ifdef SIMD_BLOCK_SIZE
+        if (IS_BLOCK_ALIGNED(string)) {
+            return skip_whitespaces_wide(string);
+        }
+#endif
+    }
+    return string;
+}
+
+/* Returns the first '\"', '\\' or '\0' */
+static const char *find_quote_or_escape(const char *string)
+{
+    while (*string != '\"' && *string != '\\' && *string != '\0') {
+        string++;
+#ifdef SIMD_BLOCK_SIZE
+        if (IS_BLOCK_ALIGNED(string)) {
+            return find_quote_or_escape_wide(string);
+        }
+#endif
+    }
+    return string;
+}
+
+/* Returns the first byte that is not 7-bit ASCII, or a position at most a block before
+   string_end from which bytes have to be checked one by one. */
+static const char *skip_ascii(const char *string, const char *string_end)
+{
+#ifdef SIMD_BLOCK_SIZE
+    unsigned long long mask;
+    while (string_end - string >= SIMD_BLOCK_SIZE) {
+        mask = simd_non_ascii_mask(string);
+        if (mask != 0) {
+            return FIRST_STOP(string, mask);
+        }
+        string += SIMD_BLOCK_SIZE;
+    }
+#else
+    (void)string_end;
+#endif
+    return string;
+}
+
+/* Numbers
+   Doubles are serialized with the fewest digits that read back as the same value, using
+   Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with
+   Integers", 2010). A double v is scaled by a cached power of ten into the range where its
+   digits can be generated with 64-bit integer arithmetic, between the scaled boundaries of
+   the interval of values that round to v. */
+typedef struct diy_fp_t {
+    unsigned long long f;
+    int e;
+} DIY_FP;
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_HIDDEN_BIT 0x0010000000000000ULL
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+
+/* 10^k as 64-bit significand and binary exponent, for k = -348, -340, ..., 340 */
+static const unsigned long long cached_powers_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL};
+
+static const short cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066};
+
+static const unsigned int pow10_u32[] = {1,      10,      100,      1000,      10000,
+                                         100000, 1000000, 10000000, 100000000, 1000000000};
+
+static DIY_FP diy_fp_from_double(double d)
+{
+    DIY_FP v;
+    unsigned long long bits;
+    int biased_e;
+    memcpy(&bits, &d, sizeof(bits));
+    biased_e = (int)((bits >> DP_SIGNIFICAND_SIZE) & 0x7FF);
+    v.f = bits & DP_SIGNIFICAND_MASK;
+    if (biased_e != 0) {
+        v.f += DP_HIDDEN_BIT;
+        v.e = biased_e - DP_EXPONENT_BIAS;
+    } else {
+        v.e = 1 - DP_EXPONENT_BIAS;
+    }
+    return v;
+}
+
+static DIY_FP diy_fp_multiply(DIY_FP x, DIY_FP y)
+{
+    DIY_FP r;
+    const unsigned long long mask32 = 0xFFFFFFFFULL;
+    unsigned long long a = x.f >> 32, b = x.f & mask32, c = y.f >> 32, d = y.f & mask32;
+    unsigned long long ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    unsigned long long tmp = (bd >> 32) + (ad & mask32) + (bc & mask32);
+    tmp += 1ULL << 31; /* round */
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static DIY_FP diy_fp_normalize(DIY_FP v)
+{
+#ifdef __GNUC__
+    int shift = __builtin_clzll(v.f);
+    v.f <<= shift;
+    v.e -= shift;
+#else
+    while ((v.f & 0x8000000000000000ULL) == 0) {
+        v.f <<= 1;
+        v.e--;
+    }
+#endif
+    return v;
+}
+
+/* Boundaries m- and m+ of the values that round to v, with m+ normalized and m- scaled to
+   the same exponent */
+static void diy_fp_boundaries(DIY_FP v, DIY_FP *minus, DIY_FP *plus)
+{
+    DIY_FP pl, mi;
+    pl.f = (v.f << 1) + 1;
+    pl.e = v.e - 1;
+    pl = diy_fp_normalize(pl);
+    if (v.f == DP_HIDDEN_BIT) { /* the boundary below a power of two is closer */
+        mi.f = (v.f << 2) - 1;
+        mi.e = v.e - 2;
+    } else {
+        mi.f = (v.f << 1) - 1;
+        mi.e = v.e - 1;
+    }
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *plus = pl;
+    *minus = mi;
+}
+
+/* Returns the cached power 10^-k that brings a number with binary exponent e into range */
+static DIY_FP cached_power(int e, int *k)
+{
+    DIY_FP power;
+    double dk = (-61 - e) * 0.30102999566398114 + 347; /* dk is positive, so ceil by hand */
+    int ik = (int)dk;
+    unsigned int index;
+    if (dk - ik > 0.0) {
+        ik++;
+    }
+    index = (unsigned int)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index << 3));
+    power.f = cached_powers_f[index];
+    power.e = cached_powers_e[index];
+    return power;
+}
+
+static int count_decimal_digits(unsigned int n)
+{
+    int digits = 1;
+    while (digits < 10 && n >= pow10_u32[digits]) {
+        digits++;
+    }
+    return digits;
+}
+
+/* Moves the last digit towards w while the result stays inside the rounding interval */
+static void grisu_round(char *buffer, int len, unsigned long long delta, unsigned long long rest,
+                        unsigned long long ten_kappa, unsigned long long wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static void grisu_digits(DIY_FP w, DIY_FP mp, unsigned long long delta, char *buffer, int *len,
+                         int *k)
+{
+    const int one_e = -mp.e;
+    const unsigned long long one_f = 1ULL << one_e;
+    const unsigned long long wp_w = mp.f - w.f;
+    unsigned int p1 = (unsigned int)(mp.f >> one_e), d;
+    unsigned long long p2 = mp.f & (one_f - 1), tmp;
+    int kappa = count_decimal_digits(p1);
+    *len = 0;
+
+    while (kappa > 0) {
+        d = p1 / pow10_u32[kappa - 1];
+        p1 %= pow10_u32[kappa - 1];
+        if (d != 0 || *len != 0) {
+            buffer[(*len)++] = (char)('0' + d);
+        }
+        kappa--;
+        tmp = ((unsigned long long)p1 << one_e) + p2;
+        if (tmp <= delta) {
+            *k += kappa;
+            grisu_round(buffer, *len, delta, tmp, (unsigned long long)pow10_u32[kappa] << one_e,
+                        wp_w);
+            return;
+        }
+    }
+
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        d = (unsigned int)(p2 >> one_e);
+        if (d != 0 || *len != 0) {
+            buffer[(*len)++] = (char)('0' + d);
+        }
+        p2 &= one_f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            grisu_round(buffer, *len, delta, p2, one_f,
+                        -kappa < 10 ? wp_w * pow10_u32[-kappa] : 0);
+            return;
+        }
+    }
+}
+
+/* Writes the shortest digits of a positive, finite value; value = digits * 10^k */
+static int grisu2(double value, char *digits, int *k)
+{
+    DIY_FP v = diy_fp_from_double(value), w_minus, w_plus, c_mk, w, wp, wm;
+    int len = 0;
+    diy_fp_boundaries(v, &w_minus, &w_plus);
+    c_mk = cached_power(w_plus.e, k);
+    w = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+    wp = diy_fp_multiply(w_plus, c_mk);
+    wm = diy_fp_multiply(w_minus, c_mk);
+    wm.f++;
+    wp.f--;
+    grisu_digits(w, wp, wp.f - wm.f, digits, &len, k);
+    return len;
+}
+
+static char *write_exponent(char *buf, int exponent)
+{
+    if (exponent < 0) {
+        *buf++ = '-';
+        exponent = -exponent;
+    }
+    if (exponent >= 100) {
+        *buf++ = (char)('0' + exponent / 100);
+        exponent %= 100;
+        *buf++ = (char)('0' + exponent / 10);
+    } else if (exponent >= 10) {
+        *buf++ = (char)('0' + exponent / 10);
+    }
+    *buf++ = (char)('0' + exponent % 10);
+    return buf;
+}
+
+/* Writes a finite number in its shortest round-trip form, e.g. 23.4, 300, 1e-7, 1.5e300.
+   Returns the length, not counting the terminating NUL. */
+static int format_number(char *buf, double number)
+{
+    char digits[24], *out = buf;
+    int len = 0, k = 0, point = 0, i;
+    unsigned long long integer;
+
+    if (number < 0 || (number == 0 && 1 / number < 0)) {
+        *out++ = '-';
+        number = -number;
+    }
+    if (number == 0) {
+        *out++ = '0';
+        *out = '\0';
+        return (int)(out - buf);
+    }
+    if (number < 1e15 && number == (double)(unsigned long long)number) { /* integral: exact */
+        integer = (unsigned long long)number;
+        do {
+            digits[len++] = (char)('0' + integer % 10);
+            integer /= 10;
+        } while (integer != 0);
+        while (len > 0) {
+            *out++ = digits[--len];
+        }
+        *out = '\0';
+        return (int)(out - buf);
+    }
+
+    len = grisu2(number, digits, &k);
+    point = len + k; /* position of the decimal point relative to the first digit */
+    if (k >= 0 && point <= 21) { /* 1234e7 -> 12340000000 */
+        memcpy(out, digits, (size_t)len);
+        out += len;
+        for (i = 0; i < k; i++) {
+            *out++ = '0';
+        }
+    } else if (point > 0 && point <= 21) { /* 1234e-2 -> 12.34 */
+        memcpy(out, digits, (size_t)point);
+        out += point;
+        *out++ = '.';
+        memcpy(out, digits + point, (size_t)(len - point));
+        out += len - point;
+    } else if (point > -6 && point <= 0) { /* 1234e-6 -> 0.001234 */
+        *out++ = '0';
+        *out++ = '.';
+        for (i = point; i < 0; i++) {
+            *out++ = '0';
+        }
+        memcpy(out, digits, (size_t)len);
+        out += len;
+    } else { /* 1234e30 -> 1.234e33 */
+        *out++ = digits[0];
+        if (len > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, (size_t)(len - 1));
+            out += len - 1;
+        }
+        *out++ = 'e';
+        out = write_exponent(out, point - 1);
+    }
+    *out = '\0';
+    return (int)(out - buf);
+}
 
 /* Various */
 static char *parson_strndup(const char *string, size_t n)
@@ -262,6 +989,10 @@ static int is_valid_utf8(const char *string, size_t string_len)
     int len = 0;
     const char *string_end = string + string_len;
     while (string < string_end) {
+        string = skip_ascii(string, string_end);
+        if (string == string_end) {
+            break;
+        }
         if (!verify_utf8_sequence((const unsigned char *)string, &len)) {
             return 0;
         }
@@ -334,6 +1065,8 @@ static JSON_Object *json_object_init(JSON_Value *wrapping_value)
     new_obj->values = (JSON_Value **)NULL;
     new_obj->capacity = 0;
     new_obj->count = 0;
+    new_obj->index = NULL;
+    new_obj->index_capacity = 0;
     return new_obj;
 }
 
@@ -348,27 +1081,51 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
 static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_t name_len,
                                     JSON_Value *value)
 {
-    size_t index = 0;
+    char *new_name = NULL;
     if (object == NULL || name == NULL || value == NULL) {
         return JSONFailure;
     }
+    new_name = parson_strndup(name, name_len);
+    if (new_name == NULL) {
+        return JSONFailure;
+    }
+    if (json_object_add_no_copy(object, new_name, name_len, value) == JSONFailure) {
+        parson_free(new_name);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+/* Adds a name-value pair, taking ownership of name only if it succeeds */
+static JSON_Status json_object_add_no_copy(JSON_Object *object, char *name, size_t name_len,
+                                           JSON_Value *value)
+{
+    size_t index = 0;
     if (json_object_getn_value(object, name, name_len) != NULL) {
         return JSONFailure;
     }
     if (object->count >= object->capacity) {
-        size_t new_capacity = MAX(object->capacity * 2, STARTING_CAPACITY);
+        size_t new_capacity = MAX(object->capacity * 2, building_arena != NULL
+                                                           ? ARENA_STARTING_CAPACITY
+                                                           : STARTING_CAPACITY);
         if (json_object_resize(object, new_capacity) == JSONFailure) {
             return JSONFailure;
         }
     }
     index = object->count;
-    object->names[index] = parson_strndup(name, name_len);
-    if (object->names[index] == NULL) {
-        return JSONFailure;
-    }
+    object->names[index] = name;
+    arena_note_insert(object->wrapping_value);
+    value->flags = arena_flag(value->flags, JSON_VALUE_NAME_IN_ARENA);
     value->parent = json_object_get_wrapping_value(object);
     object->values[index] = value;
     object->count++;
+    if (object->index != NULL && object->count * 2 <= object->index_capacity) {
+        json_object_index_insert(object, hash_name(name, name_len), index);
+    } else if (object->count > OBJECT_INDEX_THRESHOLD &&
+               json_object_index_rebuild(object, MAX(object->index_capacity * 2,
+                                                     OBJECT_INDEX_MIN_CAPACITY)) == JSONFailure) {
+        json_object_index_free(object); /* lookups fall back to scanning the names */
+    }
     return JSONSuccess;
 }
 
@@ -394,53 +1151,185 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
         memcpy(temp_names, object->names, object->count * sizeof(char *));
         memcpy(temp_values, object->values, object->count * sizeof(JSON_Value *));
     }
-    parson_free(object->names);
-    parson_free(object->values);
+    if (!(object->wrapping_value->flags & JSON_VALUE_MEMBERS_IN_ARENA)) {
+        parson_free(object->names);
+        parson_free(object->values);
+    }
+    object->wrapping_value->flags =
+        arena_flag(object->wrapping_value->flags, JSON_VALUE_MEMBERS_IN_ARENA);
     object->names = temp_names;
     object->values = temp_values;
     object->capacity = new_capacity;
     return JSONSuccess;
 }
 
-static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
-                                          size_t name_len)
+/* FNV-1a */
+static unsigned int hash_name(const char *name, size_t name_len)
 {
-    size_t i, name_length;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        name_length = strlen(object->names[i]);
-        if (name_length != name_len) {
-            continue;
+    unsigned int hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < name_len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void json_object_index_free(JSON_Object *object)
+{
+    if (!(object->wrapping_value->flags & JSON_VALUE_INDEX_IN_ARENA)) {
+        parson_free(object->index);
+    }
+    object->index = NULL;
+    object->index_capacity = 0;
+}
+
+static JSON_Status json_object_index_rebuild(JSON_Object *object, size_t new_capacity)
+{
+    size_t i;
+    JSON_Object_Slot *new_index = NULL;
+    while (new_capacity < object->count * 2) { /* an index dropped earlier restarts small */
+        new_capacity *= 2;
+    }
+    new_index = (JSON_Object_Slot *)parson_malloc(new_capacity * sizeof(JSON_Object_Slot));
+    if (new_index == NULL) {
+        return JSONFailure;
+    }
+    memset(new_index, 0, new_capacity * sizeof(JSON_Object_Slot));
+    json_object_index_free(object);
+    object->wrapping_value->flags =
+        arena_flag(object->wrapping_value->flags, JSON_VALUE_INDEX_IN_ARENA);
+    object->index = new_index;
+    object->index_capacity = new_capacity;
+    for (i = 0; i < object->count; i++) {
+        json_object_index_insert(object, hash_name(object->names[i], strlen(object->names[i])),
+                                 i);
+    }
+    return JSONSuccess;
+}
+
+static void json_object_index_insert(JSON_Object *object, unsigned int hash, size_t item)
+{
+    size_t mask = object->index_capacity - 1;
+    size_t slot = hash & mask;
+    while (object->index[slot].item != 0) {
+        slot = (slot + 1) & mask;
+    }
+    object->index[slot].hash = hash;
+    object->index[slot].item = (unsigned int)(item + 1);
+}
+
+/* Returns the slot holding name, or NOT_FOUND */
+static size_t json_object_index_find(const JSON_Object *object, const char *name,
+                                     size_t name_len, unsigned int hash)
+{
+    size_t mask = object->index_capacity - 1;
+    size_t slot = hash & mask;
+    const char *item_name = NULL;
+    while (object->index[slot].item != 0) {
+        if (object->index[slot].hash == hash) {
+            item_name = object->names[object->index[slot].item - 1];
+            if (strncmp(item_name, name, name_len) == 0 && item_name[name_len] == '\0') {
+                return slot;
+            }
         }
-        if (strncmp(object->names[i], name, name_len) == 0) {
-            return object->values[i];
+        slot = (slot + 1) & mask;
+    }
+    return NOT_FOUND;
+}
+
+/* Empties a slot, shifting later entries of the same probe run back so that none of them
+   becomes unreachable. */
+static void json_object_index_remove(JSON_Object *object, size_t slot)
+{
+    size_t mask = object->index_capacity - 1;
+    size_t next = (slot + 1) & mask, home = 0;
+    object->index[slot].item = 0;
+    while (object->index[next].item != 0) {
+        home = object->index[next].hash & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            object->index[slot] = object->index[next];
+            object->index[next].item = 0;
+            slot = next;
         }
+        next = (next + 1) & mask;
     }
-    return NULL;
+}
+
+/* Returns the position of name in names and values, or NOT_FOUND */
+static size_t json_object_find(const JSON_Object *object, const char *name, size_t name_len)
+{
+    size_t i, slot;
+    if (object == NULL || name == NULL) {
+        return NOT_FOUND;
+    }
+    if (object->index != NULL) {
+        slot = json_object_index_find(object, name, name_len, hash_name(name, name_len));
+        return slot == NOT_FOUND ? NOT_FOUND : object->index[slot].item - 1;
+    }
+    for (i = 0; i < object->count; i++) {
+        if (strncmp(object->names[i], name, name_len) == 0 && object->names[i][name_len] == '\0') {
+            return i;
+        }
+    }
+    return NOT_FOUND;
+}
+
+/* Same as json_object_find, for a name whose hash is already known */
+static size_t json_object_find_hashed(const JSON_Object *object, const char *name,
+                                      size_t name_len, unsigned int hash)
+{
+    size_t slot;
+    if (object == NULL || object->index == NULL) {
+        return json_object_find(object, name, name_len);
+    }
+    slot = json_object_index_find(object, name, name_len, hash);
+    return slot == NOT_FOUND ? NOT_FOUND : object->index[slot].item - 1;
+}
+
+static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
+                                          size_t name_len)
+{
+    size_t i = json_object_find(object, name, name_len);
+    return i == NOT_FOUND ? NULL : object->values[i];
 }
 
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value)
 {
-    size_t i = 0, last_item_index = 0;
-    if (object == NULL || json_object_get_value(object, name) == NULL) {
+    size_t i = 0, last_item_index = 0, name_len = 0, slot = 0;
+    if (object == NULL || name == NULL) {
+        return JSONFailure;
+    }
+    name_len = strlen(name);
+    i = json_object_find(object, name, name_len);
+    if (i == NOT_FOUND) {
         return JSONFailure;
     }
     last_item_index = json_object_get_count(object) - 1;
-    for (i = 0; i < json_object_get_count(object); i++) {
-        if (strcmp(object->names[i], name) == 0) {
-            parson_free(object->names[i]);
-            if (free_value) {
-                json_value_free(object->values[i]);
-            }
-            if (i != last_item_index) { /* Replace key value pair with one from the end */
-                object->names[i] = object->names[last_item_index];
-                object->values[i] = object->values[last_item_index];
-            }
-            object->count -= 1;
-            return JSONSuccess;
+    if (object->index != NULL) {
+        json_object_index_remove(object, json_object_index_find(object, name, name_len,
+                                                                hash_name(name, name_len)));
+        if (i != last_item_index) { /* the last pair moves to i */
+            slot = json_object_index_find(object, object->names[last_item_index],
+                                          strlen(object->names[last_item_index]),
+                                          hash_name(object->names[last_item_index],
+                                                    strlen(object->names[last_item_index])));
+            object->index[slot].item = (unsigned int)(i + 1);
         }
     }
-    return JSONFailure; /* No execution path should end here */
+    if (!(object->values[i]->flags & JSON_VALUE_NAME_IN_ARENA)) {
+        parson_free(object->names[i]);
+    }
+    if (free_value) {
+        json_value_free(object->values[i]);
+    }
+    if (i != last_item_index) { /* Replace key value pair with one from the end */
+        object->names[i] = object->names[last_item_index];
+        object->values[i] = object->values[last_item_index];
+    }
+    object->count -= 1;
+    return JSONSuccess;
 }
 
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
@@ -463,13 +1352,23 @@ static JSON_Status json_object_dotremove_internal(JSON_Object *object, const cha
 static void json_object_free(JSON_Object *object)
 {
     size_t i;
+    unsigned char flags = object->wrapping_value->flags;
     for (i = 0; i < object->count; i++) {
-        parson_free(object->names[i]);
+        if (!(object->values[i]->flags & JSON_VALUE_NAME_IN_ARENA)) {
+            parson_free(object->names[i]);
+        }
         json_value_free(object->values[i]);
     }
-    parson_free(object->names);
-    parson_free(object->values);
-    parson_free(object);
+    if (!(flags & JSON_VALUE_MEMBERS_IN_ARENA)) {
+        parson_free(object->names);
+        parson_free(object->values);
+    }
+    if (!(flags & JSON_VALUE_INDEX_IN_ARENA)) {
+        parson_free(object->index);
+    }
+    if (!(flags & JSON_VALUE_IN_ARENA)) {
+        parson_free(object);
+    }
 }
 
 /* JSON Array */
@@ -489,11 +1388,14 @@ static JSON_Array *json_array_init(JSON_Value *wrapping_value)
 static JSON_Status json_array_add(JSON_Array *array, JSON_Value *value)
 {
     if (array->count >= array->capacity) {
-        size_t new_capacity = MAX(array->capacity * 2, STARTING_CAPACITY);
+        size_t new_capacity = MAX(array->capacity * 2, building_arena != NULL
+                                                           ? ARENA_STARTING_CAPACITY
+                                                           : STARTING_CAPACITY);
         if (json_array_resize(array, new_capacity) == JSONFailure) {
             return JSONFailure;
         }
     }
+    arena_note_insert(array->wrapping_value);
     value->parent = json_array_get_wrapping_value(array);
     array->items[array->count] = value;
     array->count++;
@@ -513,7 +1415,11 @@ static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity)
     if (array->items != NULL && array->count > 0) {
         memcpy(new_items, array->items, array->count * sizeof(JSON_Value *));
     }
-    parson_free(array->items);
+    if (!(array->wrapping_value->flags & JSON_VALUE_MEMBERS_IN_ARENA)) {
+        parson_free(array->items);
+    }
+    array->wrapping_value->flags =
+        arena_flag(array->wrapping_value->flags, JSON_VALUE_MEMBERS_IN_ARENA);
     array->items = new_items;
     array->capacity = new_capacity;
     return JSONSuccess;
@@ -522,11 +1428,16 @@ static JSON_Status json_array_resize(JSON_Array *array, size_t new_capacity)
 static void json_array_free(JSON_Array *array)
 {
     size_t i;
+    unsigned char flags = array->wrapping_value->flags;
     for (i = 0; i < array->count; i++) {
         json_value_free(array->items[i]);
     }
-    parson_free(array->items);
-    parson_free(array);
+    if (!(flags & JSON_VALUE_MEMBERS_IN_ARENA)) {
+        parson_free(array->items);
+    }
+    if (!(flags & JSON_VALUE_IN_ARENA)) {
+        parson_free(array);
+    }
 }
 
 /* JSON Value */
@@ -537,6 +1448,7 @@ static JSON_Value *json_value_init_string_no_copy(char *string)
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->flags = arena_flag(0, JSON_VALUE_IN_ARENA);
     new_value->type = JSONString;
     new_value->value.string = string;
     return new_value;
@@ -549,14 +1461,16 @@ static JSON_Status skip_quotes(const char **string)
         return JSONFailure;
     }
     SKIP_CHAR(string);
-    while (**string != '\"') {
+    for (;;) {
+        *string = find_quote_or_escape(*string);
+        if (**string == '\"') {
+            break;
+        } else if (**string == '\0') {
+            return JSONFailure;
+        }
+        SKIP_CHAR(string); /* backslash */
         if (**string == '\0') {
             return JSONFailure;
-        } else if (**string == '\\') {
-            SKIP_CHAR(string);
-            if (**string == '\0') {
-                return JSONFailure;
-            }
         }
         SKIP_CHAR(string);
     }
@@ -621,7 +1535,12 @@ static char *process_string(const char *input, size_t len)
     size_t initial_size = (len + 1) * sizeof(char);
     size_t final_size = 0;
     char *output = NULL, *output_ptr = NULL, *resized_output = NULL;
-    output = (char *)parson_malloc(initial_size);
+    if (building_arena != NULL && building_arena->in_situ) {
+        /* In situ: the output never gets ahead of the input, so unescape over it */
+        output = (char *)input;
+    } else {
+        output = (char *)parson_malloc(initial_size);
+    }
     if (output == NULL) {
         goto error;
     }
@@ -672,6 +1591,9 @@ static char *process_string(const char *input, size_t len)
         input_ptr++;
     }
     *output_ptr = '\0';
+    if (building_arena != NULL) { /* a shrunk copy would not give the space back */
+        return output;
+    }
     /* resize to new length */
     final_size = (size_t)(output_ptr - output) + 1;
     /* todo: don't resize if final_size == initial_size */
@@ -775,13 +1697,13 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
             json_value_free(output_value);
             return NULL;
         }
-        if (json_object_add(output_object, new_key, new_value) == JSONFailure) {
+        if (json_object_add_no_copy(output_object, new_key, strlen(new_key), new_value) ==
+            JSONFailure) {
             parson_free(new_key);
             json_value_free(new_value);
             json_value_free(output_value);
             return NULL;
         }
-        parson_free(new_key);
         SKIP_WHITESPACES(string);
         if (**string != ',') {
             break;
@@ -790,8 +1712,9 @@ static JSON_Value *parse_object_value(const char **string, size_t nesting)
         SKIP_WHITESPACES(string);
     }
     SKIP_WHITESPACES(string);
-    if (**string != '}' || /* Trim object after parsing is over */
-        json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure) {
+    if (**string != '}' || /* Trim object after parsing is over, unless in an arena */
+        (building_arena == NULL &&
+         json_object_resize(output_object, json_object_get_count(output_object)) == JSONFailure)) {
         json_value_free(output_value);
         return NULL;
     }
@@ -837,8 +1760,9 @@ static JSON_Value *parse_array_value(const char **string, size_t nesting)
         SKIP_WHITESPACES(string);
     }
     SKIP_WHITESPACES(string);
-    if (**string != ']' || /* Trim array after parsing is over */
-        json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure) {
+    if (**string != ']' || /* Trim array after parsing is over, unless in an arena */
+        (building_arena == NULL &&
+         json_array_resize(output_array, json_array_get_count(output_array)) == JSONFailure)) {
         json_value_free(output_value);
         return NULL;
     }
@@ -879,9 +1803,31 @@ static JSON_Value *parse_number_value(const char **string)
 {
     char *end;
     double number = 0;
+    const char *start = *string;
+    const char *digits = start + (*start == '-');
+    const char *ptr = digits;
+    unsigned long long integer = 0;
+    while (*ptr >= '0' && *ptr <= '9' && ptr - digits < MAX_FAST_INTEGER_DIGITS) {
+        integer = integer * 10 + (unsigned long long)(*ptr - '0');
+        ptr++;
+    }
+    /* Plain integers are exact, so only fractions, exponents and long or malformed numbers
+       need strtod. Leading zeros are refused as is_decimal does. */
+    if (ptr != digits && !(*ptr >= '0' && *ptr <= '9') && *ptr != '.' && *ptr != 'e' &&
+        *ptr != 'E' && *ptr != 'x' && *ptr != 'X') {
+        if (*digits == '0' && ptr - digits > 1) {
+            return NULL;
+        }
+        *string = ptr;
+        number = (double)integer;
+        return json_value_init_number(digits != start ? -number : number);
+    }
     errno = 0;
     number = strtod(*string, &end);
-    if (errno || !is_decimal(*string, (size_t)(end - *string))) {
+    /* strtod also reports ERANGE for subnormal results, which format_number writes; only
+       overflow and underflow to zero are refused */
+    if ((errno && !(errno == ERANGE && number != 0 && fabs(number) < DBL_MIN)) ||
+        !is_decimal(*string, (size_t)(end - *string))) {
         return NULL;
     }
     *string = end;
@@ -899,32 +1845,22 @@ static JSON_Value *parse_null_value(const char **string)
 }
 
 /* Serialization */
-#define APPEND_STRING(str)                   \
-    do {                                     \
-        written = append_string(buf, (str)); \
-        if (written < 0) {                   \
-            return -1;                       \
-        }                                    \
-        if (buf != NULL) {                   \
-            buf += written;                  \
-        }                                    \
-        written_total += written;            \
+#define APPEND_STRING(str)                                    \
+    do {                                                      \
+        if (sink_append(sink, (str), SIZEOF_TOKEN(str)) < 0) { \
+            return -1;                                        \
+        }                                                     \
     } while (0)
 
-#define APPEND_INDENT(level)                   \
-    do {                                       \
-        written = append_indent(buf, (level)); \
-        if (written < 0) {                     \
-            return -1;                         \
-        }                                      \
-        if (buf != NULL) {                     \
-            buf += written;                    \
-        }                                      \
-        written_total += written;              \
+#define APPEND_INDENT(level)                    \
+    do {                                        \
+        if (append_indent(sink, (level)) < 0) { \
+            return -1;                          \
+        }                                       \
     } while (0)
 
-static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
-                                      char *num_buf)
+static int json_serialize_to_sink_r(const JSON_Value *value, JSON_Sink *sink, int level,
+                                    int is_pretty, char *num_buf)
 {
     const char *key = NULL, *string = NULL;
     JSON_Value *temp_value = NULL;
@@ -932,7 +1868,7 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
     JSON_Object *object = NULL;
     size_t i = 0, count = 0;
     double num = 0.0;
-    int written = -1, written_total = 0;
+    int written = -1;
 
     switch (json_value_get_type(value)) {
     case JSONArray:
@@ -947,14 +1883,9 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
                 APPEND_INDENT(level + 1);
             }
             temp_value = json_array_get_value(array, i);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0) {
+            if (json_serialize_to_sink_r(temp_value, sink, level + 1, is_pretty, num_buf) < 0) {
                 return -1;
             }
-            if (buf != NULL) {
-                buf += written;
-            }
-            written_total += written;
             if (i < (count - 1)) {
                 APPEND_STRING(",");
             }
@@ -966,7 +1897,7 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             APPEND_INDENT(level);
         }
         APPEND_STRING("]");
-        return written_total;
+        return 0;
     case JSONObject:
         object = json_value_get_object(value);
         count = json_object_get_count(object);
@@ -982,27 +1913,17 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             if (is_pretty) {
                 APPEND_INDENT(level + 1);
             }
-            written = json_serialize_string(key, buf);
-            if (written < 0) {
+            if (json_serialize_string(key, sink) < 0) {
                 return -1;
             }
-            if (buf != NULL) {
-                buf += written;
-            }
-            written_total += written;
             APPEND_STRING(":");
             if (is_pretty) {
                 APPEND_STRING(" ");
             }
-            temp_value = json_object_get_value(object, key);
-            written = json_serialize_to_buffer_r(temp_value, buf, level + 1, is_pretty, num_buf);
-            if (written < 0) {
+            temp_value = json_object_get_value_at(object, i);
+            if (json_serialize_to_sink_r(temp_value, sink, level + 1, is_pretty, num_buf) < 0) {
                 return -1;
             }
-            if (buf != NULL) {
-                buf += written;
-            }
-            written_total += written;
             if (i < (count - 1)) {
                 APPEND_STRING(",");
             }
@@ -1014,45 +1935,30 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             APPEND_INDENT(level);
         }
         APPEND_STRING("}");
-        return written_total;
+        return 0;
     case JSONString:
         string = json_value_get_string(value);
         if (string == NULL) {
             return -1;
         }
-        written = json_serialize_string(string, buf);
-        if (written < 0) {
-            return -1;
-        }
-        if (buf != NULL) {
-            buf += written;
-        }
-        written_total += written;
-        return written_total;
+        return json_serialize_string(string, sink);
     case JSONBoolean:
         if (json_value_get_boolean(value)) {
             APPEND_STRING("true");
         } else {
             APPEND_STRING("false");
         }
-        return written_total;
+        return 0;
     case JSONNumber:
         num = json_value_get_number(value);
-        if (buf != NULL) {
-            num_buf = buf;
-        }
-        written = sprintf(num_buf, FLOAT_FORMAT, num);
+        written = format_number(num_buf, num);
         if (written < 0) {
             return -1;
         }
-        if (buf != NULL) {
-            buf += written;
-        }
-        written_total += written;
-        return written_total;
+        return sink_append(sink, num_buf, (size_t)written);
     case JSONNull:
         APPEND_STRING("null");
-        return written_total;
+        return 0;
     case JSONError:
         return -1;
     default:
@@ -1060,14 +1966,21 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
     }
 }
 
-static int json_serialize_string(const char *string, char *buf)
+/* Characters that are copied as they are go to the sink in runs, not one at a time */
+static int json_serialize_string(const char *string, JSON_Sink *sink)
 {
-    size_t i = 0, len = strlen(string);
+    size_t i = 0, run = 0, len = strlen(string);
     char c = '\0';
-    int written = -1, written_total = 0;
     APPEND_STRING("\"");
     for (i = 0; i < len; i++) {
         c = string[i];
+        if ((unsigned char)c >= 0x20 && c != '\"' && c != '\\' && c != '/') {
+            continue;
+        }
+        if (i > run && sink_append(sink, string + run, i - run) < 0) {
+            return -1;
+        }
+        run = i + 1;
         switch (c) {
         case '\"':
             APPEND_STRING("\\\"");
@@ -1180,49 +2093,174 @@ static int json_serialize_string(const char *string, char *buf)
             APPEND_STRING("\\u001f");
             break;
         default:
-            if (buf != NULL) {
-                buf[0] = c;
-                buf += 1;
-            }
-            written_total += 1;
             break;
         }
     }
+    if (len > run && sink_append(sink, string + run, len - run) < 0) {
+        return -1;
+    }
     APPEND_STRING("\"");
-    return written_total;
+    return 0;
 }
 
-static int append_indent(char *buf, int level)
+static int append_indent(JSON_Sink *sink, int level)
 {
     int i;
-    int written = -1, written_total = 0;
     for (i = 0; i < level; i++) {
         APPEND_STRING("    ");
     }
-    return written_total;
+    return 0;
 }
 
-static int append_string(char *buf, const char *string)
+#undef APPEND_STRING
+#undef APPEND_INDENT
+
+/* Sinks */
+static int sink_append(JSON_Sink *sink, const char *data, size_t size)
 {
-    if (buf == NULL) {
-        return (int)strlen(string);
+    size_t room = sink->capacity - sink->used;
+    sink->total += size;
+    if (size <= room) {
+        memcpy(sink->buf + sink->used, data, size);
+        sink->used += size;
+        return 0;
     }
-    return sprintf(buf, "%s", string);
+    if (sink->write_fun != NULL) {
+        if (sink_write(sink) < 0) {
+            return -1;
+        }
+        if (size >= sink->capacity) { /* too large to collect, pass it on as it is */
+            return sink->write_fun(sink->context, data, size) == 0 ? 0 : -1;
+        }
+        memcpy(sink->buf, data, size);
+        sink->used = size;
+        return 0;
+    }
+    if (sink->growable) {
+        if (sink_grow(sink, sink->used + size) < 0) {
+            return -1;
+        }
+        memcpy(sink->buf + sink->used, data, size);
+        sink->used += size;
+        return 0;
+    }
+    if (room > 0) {
+        memcpy(sink->buf + sink->used, data, room);
+        sink->used += room;
+    }
+    sink->truncated = 1;
+    return 0;
 }
 
-#undef APPEND_STRING
-#undef APPEND_INDENT
+static int sink_write(JSON_Sink *sink)
+{
+    if (sink->used > 0 && sink->write_fun(sink->context, sink->buf, sink->used) != 0) {
+        return -1;
+    }
+    sink->used = 0;
+    return 0;
+}
+
+/* The capacity of buffer sinks leaves out the byte for the terminating NUL */
+static int sink_grow(JSON_Sink *sink, size_t needed)
+{
+    size_t new_capacity = sink->capacity > 0 ? sink->capacity : SINK_STARTING_CAPACITY;
+    char *new_buf = NULL;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    new_buf = (char *)parson_malloc(new_capacity + 1);
+    if (new_buf == NULL) {
+        return -1;
+    }
+    if (sink->buf != NULL) {
+        memcpy(new_buf, sink->buf, sink->used);
+        parson_free(sink->buf);
+    }
+    sink->buf = new_buf;
+    sink->capacity = new_capacity;
+    return 0;
+}
+
+static int sink_serialize(JSON_Sink *sink, const JSON_Value *value, int is_pretty)
+{
+    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
+                                   it only once */
+    int res = json_serialize_to_sink_r(value, sink, 0, is_pretty, num_buf);
+    if (sink->write_fun == NULL && sink->buf != NULL) {
+        sink->buf[sink->used] = '\0';
+    }
+    return res;
+}
 
 /* Parser API */
+static JSON_Value *parse_root_value(const char *string)
+{
+    if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
+        string = string + 3; /* Support for UTF-8 BOM */
+    }
+    return parse_value((const char **)&string, 0);
+}
+
+static JSON_Value *parse_root_value_in_arena(const char *string, int in_situ)
+{
+    JSON_Value *result = NULL, *root = NULL;
+    size_t i, string_len = strlen(string);
+    JSON_Arena *arena = arena_init(arena_estimate(string, string_len, in_situ), in_situ);
+    if (arena == NULL) {
+        return NULL;
+    }
+    building_arena = arena;
+    result = parse_root_value(string);
+    building_arena = NULL;
+    if (result == NULL) {
+        arena_release(arena);
+        return NULL;
+    }
+    /* Move the root into the arena header, where freeing it finds the arena */
+    root = &arena->root;
+    *root = *result;
+    root->flags |= JSON_VALUE_ARENA_ROOT;
+    if (root->type == JSONObject) {
+        root->value.object->wrapping_value = root;
+        for (i = 0; i < root->value.object->count; i++) {
+            root->value.object->values[i]->parent = root;
+        }
+    } else if (root->type == JSONArray) {
+        root->value.array->wrapping_value = root;
+        for (i = 0; i < root->value.array->count; i++) {
+            root->value.array->items[i]->parent = root;
+        }
+    }
+    return root;
+}
+
 JSON_Value *json_parse_string(const char *string)
 {
     if (string == NULL) {
         return NULL;
     }
-    if (string[0] == '\xEF' && string[1] == '\xBB' && string[2] == '\xBF') {
-        string = string + 3; /* Support for UTF-8 BOM */
+#ifdef PARSON_ARENA_DEFAULT
+    return parse_root_value_in_arena(string, 0);
+#else
+    return parse_root_value(string);
+#endif
+}
+
+JSON_Value *json_parse_string_arena(const char *string)
+{
+    if (string == NULL) {
+        return NULL;
     }
-    return parse_value((const char **)&string, 0);
+    return parse_root_value_in_arena(string, 0);
+}
+
+JSON_Value *json_parse_string_insitu(char *string)
+{
+    if (string == NULL) {
+        return NULL;
+    }
+    return parse_root_value_in_arena(string, 1);
 }
 
 JSON_Value *json_parse_string_with_comments(const char *string)
@@ -1236,7 +2274,11 @@ JSON_Value *json_parse_string_with_comments(const char *string)
     remove_comments(string_mutable_copy, "/*", "*/");
     remove_comments(string_mutable_copy, "//", "\n");
     string_mutable_copy_ptr = string_mutable_copy;
+#ifdef PARSON_ARENA_DEFAULT
+    result = parse_root_value_in_arena(string_mutable_copy_ptr, 0);
+#else
     result = parse_value((const char **)&string_mutable_copy_ptr, 0);
+#endif
     parson_free(string_mutable_copy);
     return result;
 }
@@ -1312,6 +2354,92 @@ int json_object_dotget_boolean(const JSON_Object *object, const char *name)
     return json_value_get_boolean(json_object_dotget_value(object, name));
 }
 
+JSON_Path *json_path_compile(const char *name)
+{
+    size_t name_len = 0, count = 1, i = 0, start = 0;
+    JSON_Path *path = NULL;
+    char *names = NULL;
+    if (name == NULL) {
+        return NULL;
+    }
+    name_len = strlen(name);
+    for (i = 0; i < name_len; i++) {
+        if (name[i] == '.') {
+            count++;
+        }
+    }
+    path = (JSON_Path *)parson_malloc(sizeof(JSON_Path) + count * sizeof(JSON_Path_Segment) +
+                                      name_len + 1);
+    if (path == NULL) {
+        return NULL;
+    }
+    path->count = 0;
+    path->segments = (JSON_Path_Segment *)(path + 1);
+    names = (char *)(path->segments + count);
+    memcpy(names, name, name_len + 1);
+    for (i = 0; i <= name_len; i++) {
+        if (names[i] == '.' || names[i] == '\0') {
+            names[i] = '\0';
+            path->segments[path->count].name = names + start;
+            path->segments[path->count].name_len = i - start;
+            path->segments[path->count].hash = hash_name(names + start, i - start);
+            path->count++;
+            start = i + 1;
+        }
+    }
+    return path;
+}
+
+void json_path_free(JSON_Path *path)
+{
+    parson_free(path);
+}
+
+JSON_Value *json_object_path_get_value(const JSON_Object *object, const JSON_Path *path)
+{
+    const JSON_Path_Segment *segment = NULL;
+    JSON_Value *value = NULL;
+    size_t i = 0, item = 0;
+    if (path == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < path->count; i++) {
+        segment = &path->segments[i];
+        item = json_object_find_hashed(object, segment->name, segment->name_len, segment->hash);
+        if (item == NOT_FOUND) {
+            return NULL;
+        }
+        value = object->values[item];
+        object = json_value_get_object(value);
+    }
+    return value;
+}
+
+const char *json_object_path_get_string(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_string(json_object_path_get_value(object, path));
+}
+
+JSON_Object *json_object_path_get_object(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_object(json_object_path_get_value(object, path));
+}
+
+JSON_Array *json_object_path_get_array(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_array(json_object_path_get_value(object, path));
+}
+
+double json_object_path_get_number(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_number(json_object_path_get_value(object, path));
+}
+
+int json_object_path_get_boolean(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_boolean(json_object_path_get_value(object, path));
+}
+
 size_t json_object_get_count(const JSON_Object *object)
 {
     return object ? object->count : 0;
@@ -1443,12 +2571,23 @@ JSON_Value *json_value_get_parent(const JSON_Value *value)
 
 void json_value_free(JSON_Value *value)
 {
+    unsigned char flags = 0;
+    if (value == NULL) {
+        return;
+    }
+    flags = value->flags;
+    if ((flags & JSON_VALUE_ARENA_ROOT) && !(flags & JSON_VALUE_MUTATED)) {
+        arena_release((JSON_Arena *)value); /* nothing outside the arena to free */
+        return;
+    }
     switch (json_value_get_type(value)) {
     case JSONObject:
         json_object_free(value->value.object);
         break;
     case JSONString:
-        parson_free(value->value.string);
+        if (!(flags & JSON_VALUE_IN_ARENA)) {
+            parson_free(value->value.string);
+        }
         break;
     case JSONArray:
         json_array_free(value->value.array);
@@ -1456,7 +2595,11 @@ void json_value_free(JSON_Value *value)
     default:
         break;
     }
-    parson_free(value);
+    if (flags & JSON_VALUE_ARENA_ROOT) {
+        arena_release((JSON_Arena *)value);
+    } else if (!(flags & JSON_VALUE_IN_ARENA)) {
+        parson_free(value);
+    }
 }
 
 JSON_Value *json_value_init_object(void)
@@ -1466,6 +2609,7 @@ JSON_Value *json_value_init_object(void)
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->flags = arena_flag(0, JSON_VALUE_IN_ARENA);
     new_value->type = JSONObject;
     new_value->value.object = json_object_init(new_value);
     if (!new_value->value.object) {
@@ -1482,6 +2626,7 @@ JSON_Value *json_value_init_array(void)
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->flags = arena_flag(0, JSON_VALUE_IN_ARENA);
     new_value->type = JSONArray;
     new_value->value.array = json_array_init(new_value);
     if (!new_value->value.array) {
@@ -1525,6 +2670,7 @@ JSON_Value *json_value_init_number(double number)
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->flags = arena_flag(0, JSON_VALUE_IN_ARENA);
     new_value->type = JSONNumber;
     new_value->value.number = number;
     return new_value;
@@ -1537,6 +2683,7 @@ JSON_Value *json_value_init_boolean(int boolean)
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->flags = arena_flag(0, JSON_VALUE_IN_ARENA);
     new_value->type = JSONBoolean;
     new_value->value.boolean = boolean ? 1 : 0;
     return new_value;
@@ -1549,6 +2696,7 @@ JSON_Value *json_value_init_null(void)
         return NULL;
     }
     new_value->parent = NULL;
+    new_value->flags = arena_flag(0, JSON_VALUE_IN_ARENA);
     new_value->type = JSONNull;
     return new_value;
 }
@@ -1633,89 +2781,130 @@ JSON_Value *json_value_deep_copy(const JSON_Value *value)
     }
 }
 
-size_t json_serialization_size(const JSON_Value *value)
+void json_sink_init_buffer(JSON_Sink *sink, char *buf, size_t size)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 0, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    memset(sink, 0, sizeof(JSON_Sink));
+    if (buf != NULL && size > 0) {
+        sink->buf = buf;
+        sink->capacity = size - 1;
+        buf[0] = '\0';
+    }
 }
 
-JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes)
+void json_sink_init_growable(JSON_Sink *sink)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
+    memset(sink, 0, sizeof(JSON_Sink));
+    sink->growable = 1;
+}
+
+void json_sink_init_writer(JSON_Sink *sink, char *chunk, size_t chunk_size,
+                           JSON_Sink_Write_Function write_fun, void *context)
+{
+    memset(sink, 0, sizeof(JSON_Sink));
+    sink->buf = chunk;
+    sink->capacity = chunk != NULL ? chunk_size : 0;
+    sink->write_fun = write_fun;
+    sink->context = context;
+}
+
+JSON_Status json_serialize_to_sink(JSON_Sink *sink, const JSON_Value *value, int is_pretty)
+{
+    if (sink == NULL || sink_serialize(sink, value, is_pretty) < 0 || sink->truncated) {
         return JSONFailure;
     }
-    written = json_serialize_to_buffer_r(value, buf, 0, 0, NULL);
-    if (written < 0) {
+    return JSONSuccess;
+}
+
+JSON_Status json_sink_flush(JSON_Sink *sink)
+{
+    if (sink == NULL || (sink->write_fun != NULL && sink_write(sink) < 0)) {
         return JSONFailure;
     }
     return JSONSuccess;
 }
 
-char *json_serialize_to_string(const JSON_Value *value)
+size_t json_sink_length(const JSON_Sink *sink)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
+    return sink == NULL ? 0 : sink->total;
+}
+
+int json_sink_truncated(const JSON_Sink *sink)
+{
+    return sink == NULL ? 0 : sink->truncated;
+}
+
+const char *json_sink_get_string(const JSON_Sink *sink)
+{
+    if (sink == NULL || sink->write_fun != NULL) {
         return NULL;
     }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
-        return NULL;
+    return sink->buf != NULL ? sink->buf : "";
+}
+
+void json_sink_free(JSON_Sink *sink)
+{
+    if (sink == NULL || !sink->growable) {
+        return;
+    }
+    parson_free(sink->buf);
+    json_sink_init_growable(sink);
+}
+
+size_t json_serialization_size(const JSON_Value *value)
+{
+    JSON_Sink sink;
+    json_sink_init_buffer(&sink, NULL, 0); /* counts without storing anything */
+    if (sink_serialize(&sink, value, 0) < 0) {
+        return 0;
     }
-    serialization_result = json_serialize_to_buffer(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
+    return sink.total + 1;
+}
+
+JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes)
+{
+    JSON_Sink sink;
+    json_sink_init_buffer(&sink, buf, buf_size_in_bytes);
+    return json_serialize_to_sink(&sink, value, 0);
+}
+
+char *json_serialize_to_string(const JSON_Value *value)
+{
+    JSON_Sink sink;
+    json_sink_init_growable(&sink);
+    if (json_serialize_to_sink(&sink, value, 0) == JSONFailure) {
+        json_sink_free(&sink);
         return NULL;
     }
-    return buf;
+    return sink.buf;
 }
 
 size_t json_serialization_size_pretty(const JSON_Value *value)
 {
-    char num_buf[NUM_BUF_SIZE]; /* recursively allocating buffer on stack is a bad idea, so let's do
-                                   it only once */
-    int res = json_serialize_to_buffer_r(value, NULL, 0, 1, num_buf);
-    return res < 0 ? 0 : (size_t)(res + 1);
+    JSON_Sink sink;
+    json_sink_init_buffer(&sink, NULL, 0); /* counts without storing anything */
+    if (sink_serialize(&sink, value, 1) < 0) {
+        return 0;
+    }
+    return sink.total + 1;
 }
 
 JSON_Status json_serialize_to_buffer_pretty(const JSON_Value *value, char *buf,
                                             size_t buf_size_in_bytes)
 {
-    int written = -1;
-    size_t needed_size_in_bytes = json_serialization_size_pretty(value);
-    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
-        return JSONFailure;
-    }
-    written = json_serialize_to_buffer_r(value, buf, 0, 1, NULL);
-    if (written < 0) {
-        return JSONFailure;
-    }
-    return JSONSuccess;
+    JSON_Sink sink;
+    json_sink_init_buffer(&sink, buf, buf_size_in_bytes);
+    return json_serialize_to_sink(&sink, value, 1);
 }
 
 char *json_serialize_to_string_pretty(const JSON_Value *value)
 {
-    JSON_Status serialization_result = JSONFailure;
-    size_t buf_size_bytes = json_serialization_size_pretty(value);
-    char *buf = NULL;
-    if (buf_size_bytes == 0) {
-        return NULL;
-    }
-    buf = (char *)parson_malloc(buf_size_bytes);
-    if (buf == NULL) {
-        return NULL;
-    }
-    serialization_result = json_serialize_to_buffer_pretty(value, buf, buf_size_bytes);
-    if (serialization_result == JSONFailure) {
-        json_free_serialized_string(buf);
+    JSON_Sink sink;
+    json_sink_init_growable(&sink);
+    if (json_serialize_to_sink(&sink, value, 1) == JSONFailure) {
+        json_sink_free(&sink);
         return NULL;
     }
-    return buf;
+    return sink.buf;
 }
 
 void json_free_serialized_string(char *string)
@@ -1743,6 +2932,7 @@ JSON_Status json_array_replace_value(JSON_Array *array, size_t ix, JSON_Value *v
         return JSONFailure;
     }
     json_value_free(json_array_get_value(array, ix));
+    arena_note_insert(array->wrapping_value);
     value->parent = json_array_get_wrapping_value(array);
     array->items[ix] = value;
     return JSONSuccess;
@@ -1880,16 +3070,16 @@ JSON_Status json_object_set_value(JSON_Object *object, const char *name, JSON_Va
     if (object == NULL || name == NULL || value == NULL || value->parent != NULL) {
         return JSONFailure;
     }
-    old_value = json_object_get_value(object, name);
-    if (old_value != NULL) { /* free and overwrite old value */
+    i = json_object_find(object, name, strlen(name));
+    if (i != NOT_FOUND) { /* free and overwrite old value */
+        old_value = object->values[i];
+        value->flags = (unsigned char)((value->flags & ~JSON_VALUE_NAME_IN_ARENA) |
+                                       (old_value->flags & JSON_VALUE_NAME_IN_ARENA));
         json_value_free(old_value);
-        for (i = 0; i < json_object_get_count(object); i++) {
-            if (strcmp(object->names[i], name) == 0) {
-                value->parent = json_object_get_wrapping_value(object);
-                object->values[i] = value;
-                return JSONSuccess;
-            }
-        }
+        arena_note_insert(object->wrapping_value);
+        value->parent = json_object_get_wrapping_value(object);
+        object->values[i] = value;
+        return JSONSuccess;
     }
     /* add new key value pair */
     return json_object_add(object, name, value);
@@ -2028,10 +3218,13 @@ JSON_Status json_object_clear(JSON_Object *object)
         return JSONFailure;
     }
     for (i = 0; i < json_object_get_count(object); i++) {
-        parson_free(object->names[i]);
+        if (!(object->values[i]->flags & JSON_VALUE_NAME_IN_ARENA)) {
+            parson_free(object->names[i]);
+        }
         json_value_free(object->values[i]);
     }
     object->count = 0;
+    json_object_index_free(object);
     return JSONSuccess;
 }
 
@@ -2197,6 +3390,6 @@ int json_boolean(const JSON_Value *value)
 
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun)
 {
-    parson_malloc = malloc_fun;
-    parson_free = free_fun;
+    parson_malloc_fun = malloc_fun;
+    parson_free_fun = free_fun;
 }
@@ -3,6 +3,12 @@
     https://github.com/kgabis/parson at commit id 4f3eaa6
     Patched to avoid any usage of fopen(), and removed implicit
     cast warnings by making them explicit.
+    Extended with arena parsing (json_parse_string_arena), in-situ
+    parsing (json_parse_string_insitu), hashed name lookup in large
+    objects, vectorized scanning, an integer fast path for number parsing,
+    shortest round-trip number serialization and single-pass streaming
+    serialization (json_serialize_to_sink) and compiled dotted paths
+    (json_path_compile).
 */
 
 /*
@@ -41,6 +47,7 @@ extern "C" {
 typedef struct json_object_t JSON_Object;
 typedef struct json_array_t JSON_Array;
 typedef struct json_value_t JSON_Value;
+typedef struct json_path_t JSON_Path;
 
 enum json_value_type {
     JSONError = -1,
@@ -66,6 +73,20 @@ void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Fu
 /*  Parses first JSON value in a string, returns NULL in case of error */
 JSON_Value *json_parse_string(const char *string);
 
+/*  Parses first JSON value in a string into an arena, returns NULL in case of error.
+    All values, strings and arrays of the document come from a few large blocks instead of one
+    allocation each, and json_value_free of the returned root releases them in one step.
+    Freeing or removing other values of the document does not give their memory back until
+    the root is freed. Define PARSON_ARENA_DEFAULT to make json_parse_string and
+    json_parse_string_with_comments parse into an arena too. */
+JSON_Value *json_parse_string_arena(const char *string);
+
+/*  Parses first JSON value in a mutable string in place, returns NULL in case of error.
+    Strings and names are unescaped inside string and the document points at them instead of
+    copies, so string is modified and must outlive the returned value. The rest of the
+    document is kept in an arena, as with json_parse_string_arena. */
+JSON_Value *json_parse_string_insitu(char *string);
+
 /*  Parses first JSON value in a string and ignores comments (/ * * / and //),
     returns NULL in case of error */
 JSON_Value *json_parse_string_with_comments(const char *string);
@@ -84,6 +105,46 @@ char *json_serialize_to_string_pretty(const JSON_Value *value);
 void json_free_serialized_string(char *string); /* frees string from json_serialize_to_string and
                                                    json_serialize_to_string_pretty */
 
+/* Streaming serialization
+   Serializes in a single pass through a sink, without computing the size first. A sink is set
+   up with one of the json_sink_init functions; its members are private. Every value passed to
+   json_serialize_to_sink is appended to what the sink already holds. */
+typedef int (*JSON_Sink_Write_Function)(void *context, const char *data,
+                                        size_t size); /* returns 0 on success */
+
+typedef struct json_sink_t {
+    char *buf;
+    size_t capacity;
+    size_t used;
+    size_t total;
+    int growable;
+    int truncated;
+    JSON_Sink_Write_Function write_fun;
+    void *context;
+} JSON_Sink;
+
+/* Fixed buffer of size bytes, always NUL-terminated. Output that does not fit is dropped but
+   still counted, so json_sink_length + 1 is the size that would have been needed. */
+void json_sink_init_buffer(JSON_Sink *sink, char *buf, size_t size);
+
+/* Buffer that grows as needed, allocated with the allocation functions. Free it with
+   json_sink_free. */
+void json_sink_init_growable(JSON_Sink *sink);
+
+/* Collects output in chunk and passes it to write_fun each time chunk_size bytes are ready.
+   Call json_sink_flush after the last value to pass on the rest. */
+void json_sink_init_writer(JSON_Sink *sink, char *chunk, size_t chunk_size,
+                           JSON_Sink_Write_Function write_fun, void *context);
+
+/* Returns JSONFailure if value can't be serialized, write_fun fails, a growable buffer can't
+   grow or a fixed buffer is truncated */
+JSON_Status json_serialize_to_sink(JSON_Sink *sink, const JSON_Value *value, int is_pretty);
+JSON_Status json_sink_flush(JSON_Sink *sink);
+size_t json_sink_length(const JSON_Sink *sink); /* bytes serialized, including dropped ones */
+int json_sink_truncated(const JSON_Sink *sink);
+const char *json_sink_get_string(const JSON_Sink *sink); /* NULL for writer sinks */
+void json_sink_free(JSON_Sink *sink);
+
 /* Comparing */
 int json_value_equals(const JSON_Value *a, const JSON_Value *b);
 
@@ -122,6 +183,19 @@ double json_object_dotget_number(const JSON_Object *object,
 int json_object_dotget_boolean(const JSON_Object *object,
                                const char *name); /* returns -1 on fail */
 
+/* Compiled paths are dotted names split into names and hashed once, for lookups that are
+ repeated many times. Lookups through them behave exactly like dotget functions. */
+JSON_Path *json_path_compile(const char *name); /* returns NULL on fail */
+void json_path_free(JSON_Path *path);
+JSON_Value *json_object_path_get_value(const JSON_Object *object, const JSON_Path *path);
+const char *json_object_path_get_string(const JSON_Object *object, const JSON_Path *path);
+JSON_Object *json_object_path_get_object(const JSON_Object *object, const JSON_Path *path);
+JSON_Array *json_object_path_get_array(const JSON_Object *object, const JSON_Path *path);
+double json_object_path_get_number(const JSON_Object *object,
+                                   const JSON_Path *path); /* returns 0 on fail */
+int json_object_path_get_boolean(const JSON_Object *object,
+                                 const JSON_Path *path); /* returns -1 on fail */
+
 /* Functions to get available names */
 size_t json_object_get_count(const JSON_Object *object);
 const char *json_object_get_name(const JSON_Object *object, size_t index);
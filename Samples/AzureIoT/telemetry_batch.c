@@ -0,0 +1,194 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "build_options.h"
+#include "cbor_writer.h"
+#include "json_writer.h"
+#include "telemetry_batch.h"
+
+static TelemetryBatchSendFunction batchSendFunction = NULL;
+
+// The document under construction.  The writer is given one byte less than the buffer so
+// that there is always room for the end of the object added by TelemetryBatch_Flush.
+static char batchBuffer[TELEMETRY_BATCH_BUFFER_SIZE];
+#ifdef TELEMETRY_ENCODING_CBOR
+typedef CborWriter BatchWriter;
+#else
+typedef JsonWriter BatchWriter;
+#endif
+static BatchWriter batchWriter;
+static unsigned int batchReadings = 0;
+static uint32_t batchKeyHashes[TELEMETRY_BATCH_MAX_READINGS];
+static struct timespec batchOldestReading;
+
+static TelemetryBatchStats batchStats;
+
+/// <summary>
+///     FNV-1a hash of a key, used to detect a key that is already in the batch.
+/// </summary>
+static uint32_t HashKey(const char *key)
+{
+    uint32_t hash = 2166136261u;
+    while (*key != '\0') {
+        hash ^= (uint8_t)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool BatchHasKey(uint32_t keyHash)
+{
+    for (unsigned int i = 0; i < batchReadings; i++) {
+        if (batchKeyHashes[i] == keyHash) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool BatchIsDue(void)
+{
+    if (batchReadings == 0) {
+        return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - batchOldestReading.tv_sec) >= TELEMETRY_BATCH_MAX_LATENCY_SECONDS;
+}
+
+static void ResetBatch(void)
+{
+#ifdef TELEMETRY_ENCODING_CBOR
+    CborWriter_Init(&batchWriter, (uint8_t *)batchBuffer, sizeof(batchBuffer) - 1);
+#else
+    JsonWriter_Init(&batchWriter, batchBuffer, sizeof(batchBuffer) - 1);
+#endif
+    batchReadings = 0;
+}
+
+/// <summary>
+///     Appends one reading to the batch, opening the object first if the batch is empty.
+/// </summary>
+static void WriteReading(const JsonField *field, const JsonFieldValue *value)
+{
+#ifdef TELEMETRY_ENCODING_CBOR
+    if (batchReadings == 0) {
+        CborWriter_BeginMap(&batchWriter);
+    }
+    CborWriter_Key(&batchWriter, field->name);
+    CborWriter_FieldValue(&batchWriter, field, value);
+#else
+    if (batchReadings == 0) {
+        JsonWriter_BeginObject(&batchWriter);
+    }
+    JsonWriter_Key(&batchWriter, field->name);
+    JsonWriter_FieldValue(&batchWriter, field, value);
+#endif
+}
+
+void TelemetryBatch_Init(TelemetryBatchSendFunction sendFunction)
+{
+    batchSendFunction = sendFunction;
+    ResetBatch();
+    memset(&batchStats, 0, sizeof(batchStats));
+}
+
+bool TelemetryBatch_Add(const char *key, const char *value)
+{
+    JsonField field = {.name = key, .type = JsonField_String};
+    JsonFieldValue fieldValue = {.string = value};
+    return TelemetryBatch_AddField(&field, &fieldValue);
+}
+
+bool TelemetryBatch_AddField(const JsonField *field, const JsonFieldValue *value)
+{
+    uint32_t keyHash = HashKey(field->name);
+    if (BatchHasKey(keyHash) || batchReadings == TELEMETRY_BATCH_MAX_READINGS || BatchIsDue()) {
+        TelemetryBatch_Flush();
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        BatchWriter saved = batchWriter;
+        WriteReading(field, value);
+
+        if (!batchWriter.overflow) {
+            if (batchReadings == 0) {
+                clock_gettime(CLOCK_MONOTONIC, &batchOldestReading);
+            }
+            batchKeyHashes[batchReadings++] = keyHash;
+            return true;
+        }
+
+        batchWriter = saved;
+        if (batchReadings == 0) {
+            break;
+        }
+
+        // Did not fit behind the readings already batched, so send those and start over.
+        TelemetryBatch_Flush();
+    }
+
+    Log_Debug("WARNING: Telemetry reading '%s' is too large for a batch, dropped.\n", field->name);
+    return false;
+}
+
+void TelemetryBatch_Flush(void)
+{
+    if (batchReadings == 0) {
+        return;
+    }
+
+    size_t batchLength = batchWriter.length;
+#ifdef TELEMETRY_ENCODING_CBOR
+    batchBuffer[batchLength++] = (char)0xFF; // break, ending the indefinite-length map
+#else
+    batchBuffer[batchLength++] = '}';
+    batchBuffer[batchLength] = '\0';
+#endif
+
+    batchStats.messages++;
+    batchStats.readings += batchReadings;
+    batchStats.bytes += batchLength;
+
+    Log_Debug("INFO: Telemetry batch of %u readings, %zu bytes (%lu messages for %lu readings)\n",
+              batchReadings, batchLength, batchStats.messages, batchStats.readings);
+
+    if (batchSendFunction != NULL) {
+        batchSendFunction(batchBuffer, batchLength);
+    }
+
+    ResetBatch();
+}
+
+int TelemetryBatch_EncodeReading(char *buffer, size_t size, const JsonField *field,
+                                 const JsonFieldValue *value)
+{
+#ifdef TELEMETRY_ENCODING_CBOR
+    CborWriter writer;
+    CborWriter_Init(&writer, (uint8_t *)buffer, size);
+    CborWriter_BeginMap(&writer);
+    CborWriter_Key(&writer, field->name);
+    CborWriter_FieldValue(&writer, field, value);
+    CborWriter_EndMap(&writer);
+    return CborWriter_Finish(&writer);
+#else
+    JsonWriter writer;
+    JsonWriter_Init(&writer, buffer, size);
+    JsonWriter_BeginObject(&writer);
+    JsonWriter_Key(&writer, field->name);
+    JsonWriter_FieldValue(&writer, field, value);
+    JsonWriter_EndObject(&writer);
+    return JsonWriter_Finish(&writer);
+#endif
+}
+
+TelemetryBatchStats TelemetryBatch_GetStats(void)
+{
+    return batchStats;
+}
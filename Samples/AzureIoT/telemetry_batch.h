@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "json_writer.h"
+
+/// <summary>
+///     Function used by the batcher to hand a completed JSON document to the uplink.
+/// </summary>
+typedef void (*TelemetryBatchSendFunction)(const char *payload, size_t payloadSize);
+
+/// <summary>
+///     Running totals kept by the batcher, used to compare the per-reading cost of
+///     batched and unbatched telemetry.
+/// </summary>
+typedef struct {
+    unsigned long messages;
+    unsigned long readings;
+    unsigned long bytes;
+} TelemetryBatchStats;
+
+/// <summary>
+///     Initializes the batcher.  Completed batches are passed to sendFunction.
+/// </summary>
+void TelemetryBatch_Init(TelemetryBatchSendFunction sendFunction);
+
+/// <summary>
+///     Adds a key/value reading to the current batch.  The batch is flushed first if it
+///     already holds this key, is full, or has exceeded its maximum latency.
+/// </summary>
+/// <returns>true if the reading was added, false if it could not fit in an empty batch</returns>
+bool TelemetryBatch_Add(const char *key, const char *value);
+
+/// <summary>
+///     Adds a typed reading to the current batch, formatted as field describes.
+/// </summary>
+/// <returns>true if the reading was added, false if it could not fit in an empty batch</returns>
+bool TelemetryBatch_AddField(const JsonField *field, const JsonFieldValue *value);
+
+/// <summary>
+///     Encodes a single reading as a complete document, in the same encoding as batches.
+/// </summary>
+/// <returns>Length of the document, or -1 if it did not fit in the buffer</returns>
+int TelemetryBatch_EncodeReading(char *buffer, size_t size, const JsonField *field,
+                                 const JsonFieldValue *value);
+
+/// <summary>
+///     Sends the current batch, if it holds any readings.
+/// </summary>
+void TelemetryBatch_Flush(void);
+
+/// <summary>
+///     Returns the number of messages, readings and bytes sent so far.
+/// </summary>
+TelemetryBatchStats TelemetryBatch_GetStats(void);
@@ -0,0 +1,198 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "build_options.h"
+#include "telemetry_compress.h"
+
+#define HASH_SIZE (1 << TELEMETRY_COMPRESSION_HASH_BITS)
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+// LZ4 requires the last five bytes of a block to be literals, and the last match to start
+// at least twelve bytes before the end.
+#define LAST_LITERALS 5
+#define MATCH_FIND_LIMIT 12
+
+// Text that telemetry documents are likely to repeat.  It is treated as if it preceded every
+// document, so the first occurrence of a key in a document can already be a short match.
+// Changing it breaks decoding of messages in flight; change TELEMETRY_COMPRESSION_PROPERTY too.
+static const char dictionary[] = "\"ButtonPress\":\"True\",\"Orientation\":\"Down\",\"Up\","
+                                 "\"Temperature\":\"\",\"Pressure\":\"\",\"pressure\":\"\","
+                                 "\"aX\":\"-\",\"aY\":\"-\",\"aZ\":\"-\","
+                                 "\"gX\":\"-\",\"gY\":\"-\",\"gZ\":\"-\"";
+#define DICTIONARY_SIZE (sizeof(dictionary) - 1)
+
+// The dictionary followed by the document being compressed.  Positions in the hash tables are
+// offsets into the window plus one, so that 0 means empty.
+static uint8_t window[DICTIONARY_SIZE + TELEMETRY_COMPRESSION_MAX_INPUT];
+static uint16_t hashTable[HASH_SIZE];
+// hashTable as it is after hashing the dictionary, copied in at the start of every document.
+static uint16_t dictionaryHashTable[HASH_SIZE];
+static bool dictionaryHashed = false;
+
+static TelemetryCompressStats compressStats;
+
+static uint32_t Read32(size_t position)
+{
+    uint32_t value;
+    memcpy(&value, window + position, sizeof(value));
+    return value;
+}
+
+static uint32_t Hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - TELEMETRY_COMPRESSION_HASH_BITS);
+}
+
+static void HashDictionary(void)
+{
+    memcpy(window, dictionary, DICTIONARY_SIZE);
+    memset(dictionaryHashTable, 0, sizeof(dictionaryHashTable));
+    for (size_t position = 0; position + MIN_MATCH <= DICTIONARY_SIZE; position++) {
+        dictionaryHashTable[Hash(Read32(position))] = (uint16_t)(position + 1);
+    }
+    dictionaryHashed = true;
+}
+
+/// <summary>
+///     Writes a literal or match length continuation: 255 per byte until the remainder.
+/// </summary>
+static bool WriteLength(uint8_t **out, const uint8_t *outEnd, size_t length)
+{
+    while (length >= 255) {
+        if (*out >= outEnd) {
+            return false;
+        }
+        *(*out)++ = 255;
+        length -= 255;
+    }
+    if (*out >= outEnd) {
+        return false;
+    }
+    *(*out)++ = (uint8_t)length;
+    return true;
+}
+
+/// <summary>
+///     Writes one LZ4 sequence: the literals from anchor, then a match of matchLength bytes at
+///     offset back, or no match if matchLength is 0.
+/// </summary>
+static bool WriteSequence(uint8_t **out, const uint8_t *outEnd, size_t anchor,
+                          size_t literalLength, size_t offset, size_t matchLength)
+{
+    if (*out >= outEnd) {
+        return false;
+    }
+    uint8_t *token = (*out)++;
+    *token = (uint8_t)((literalLength < 15 ? literalLength : 15) << 4);
+    if (literalLength >= 15 && !WriteLength(out, outEnd, literalLength - 15)) {
+        return false;
+    }
+
+    if (literalLength > (size_t)(outEnd - *out)) {
+        return false;
+    }
+    memcpy(*out, window + anchor, literalLength);
+    *out += literalLength;
+
+    if (matchLength == 0) {
+        return true;
+    }
+
+    if (outEnd - *out < 2) {
+        return false;
+    }
+    *(*out)++ = (uint8_t)offset;
+    *(*out)++ = (uint8_t)(offset >> 8);
+
+    size_t extra = matchLength - MIN_MATCH;
+    *token |= (uint8_t)(extra < 15 ? extra : 15);
+    return extra < 15 || WriteLength(out, outEnd, extra - 15);
+}
+
+int TelemetryCompress_Compress(const char *input, size_t inputSize, char *output,
+                               size_t outputSize)
+{
+    if (inputSize > TELEMETRY_COMPRESSION_MAX_INPUT) {
+        return -1;
+    }
+
+#ifdef TELEMETRY_COMPRESSION_CPU_TIME
+    struct timespec cpuStart;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+#endif
+
+    if (!dictionaryHashed) {
+        HashDictionary();
+    }
+    memcpy(window + DICTIONARY_SIZE, input, inputSize);
+    memcpy(hashTable, dictionaryHashTable, sizeof(hashTable));
+
+    uint8_t *out = (uint8_t *)output;
+    const uint8_t *outEnd = out + outputSize;
+    size_t end = DICTIONARY_SIZE + inputSize;
+    size_t anchor = DICTIONARY_SIZE;
+    size_t position = DICTIONARY_SIZE;
+    bool fits = true;
+
+    while (fits && inputSize >= MATCH_FIND_LIMIT && position + MATCH_FIND_LIMIT <= end) {
+        uint32_t sequence = Read32(position);
+        uint32_t hash = Hash(sequence);
+        size_t candidate = hashTable[hash];
+        hashTable[hash] = (uint16_t)(position + 1);
+
+        if (candidate == 0 || position - (candidate - 1) > MAX_OFFSET ||
+            Read32(candidate - 1) != sequence) {
+            position++;
+            continue;
+        }
+
+        size_t reference = candidate - 1;
+        // Extend the match backwards over literals not yet written.
+        while (position > anchor && reference > 0 &&
+               window[position - 1] == window[reference - 1]) {
+            position--;
+            reference--;
+        }
+
+        size_t matchLength = MIN_MATCH;
+        while (position + matchLength < end - LAST_LITERALS &&
+               window[reference + matchLength] == window[position + matchLength]) {
+            matchLength++;
+        }
+
+        fits = WriteSequence(&out, outEnd, anchor, position - anchor, position - reference,
+                             matchLength);
+        position += matchLength;
+        anchor = position;
+
+        // Hash a position inside the match so that a repeat of its tail can be found.
+        if (position - 2 >= DICTIONARY_SIZE && position + MIN_MATCH <= end) {
+            hashTable[Hash(Read32(position - 2))] = (uint16_t)(position - 2 + 1);
+        }
+    }
+
+    fits = fits && WriteSequence(&out, outEnd, anchor, end - anchor, 0, 0);
+
+#ifdef TELEMETRY_COMPRESSION_CPU_TIME
+    struct timespec cpuEnd;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+    compressStats.cpuUs += (unsigned long)((cpuEnd.tv_sec - cpuStart.tv_sec) * 1000 * 1000 +
+                                           (cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1000);
+#endif
+
+    if (!fits) {
+        return -1;
+    }
+
+    compressStats.messages++;
+    compressStats.inputBytes += inputSize;
+    compressStats.outputBytes += (unsigned long)(out - (uint8_t *)output);
+    return (int)(out - (uint8_t *)output);
+}
+
+TelemetryCompressStats TelemetryCompress_GetStats(void)
+{
+    return compressStats;
+}
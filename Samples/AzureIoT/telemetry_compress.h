@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+
+// Value of the "compression" application property set on compressed telemetry messages.
+// Payloads are LZ4 blocks compressed against the dictionary in telemetry_compress.c, and are
+// decompressed with LZ4_decompress_safe_usingDict and the same dictionary.  The dictionary
+// name changes whenever the dictionary does.
+#define TELEMETRY_COMPRESSION_PROPERTY "lz4-block;dict=telemetry-v1"
+
+/// <summary>
+///     Bytes in, bytes out and CPU time spent by the compressor, used to weigh its ratio
+///     against its cost.  cpuUs stays 0 unless TELEMETRY_COMPRESSION_CPU_TIME is defined.
+/// </summary>
+typedef struct {
+    unsigned long messages;
+    unsigned long inputBytes;
+    unsigned long outputBytes;
+    unsigned long cpuUs;
+} TelemetryCompressStats;
+
+/// <summary>
+///     Compresses a telemetry document.  Uses only static working memory: the dictionary and
+///     document share one window of TELEMETRY_COMPRESSION_MAX_INPUT bytes plus the dictionary,
+///     and matches are found through a hash table of 2^TELEMETRY_COMPRESSION_HASH_BITS entries.
+/// </summary>
+/// <returns>Size of the compressed document, or -1 if the input is larger than
+/// TELEMETRY_COMPRESSION_MAX_INPUT or the output did not fit</returns>
+int TelemetryCompress_Compress(const char *input, size_t inputSize, char *output,
+                               size_t outputSize);
+
+TelemetryCompressStats TelemetryCompress_GetStats(void);
@@ -0,0 +1,222 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "build_options.h"
+#include "crc32.h"
+#include "telemetry_journal.h"
+
+// The journal region starts with two copies of the header, written alternately so that a
+// torn header write always leaves the previous copy intact.  Fixed-size record slots follow
+// and are used as a ring buffer: appending writes one slot and one header copy, consuming
+// writes one header copy.
+
+#define JOURNAL_MAGIC 0x4C4E524Au // "JRNL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SLOT_SIZE 64
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slotSize;
+    uint32_t slotCount;
+    uint32_t sequence;
+    uint32_t head;
+    uint32_t count;
+    uint32_t crc;
+} JournalHeader;
+
+typedef struct {
+    uint32_t crc;
+    uint16_t length;
+    uint16_t reserved;
+    int64_t timestamp;
+} JournalRecordHeader;
+
+#define JOURNAL_SLOT_SIZE (sizeof(JournalRecordHeader) + TELEMETRY_JOURNAL_RECORD_SIZE)
+
+static int journalFd = -1;
+static off_t journalOffset;
+static JournalHeader header;
+
+// Counts the records removed from the head since the journal was opened, so that the oldest
+// record is identified by headRecordId and the others by their distance from it.
+static uint32_t headRecordId;
+
+static uint32_t HeaderCrc(const JournalHeader *h)
+{
+    return Crc32(0, h, offsetof(JournalHeader, crc));
+}
+
+static uint32_t RecordCrc(const JournalRecordHeader *record, const void *payload)
+{
+    uint32_t crc = Crc32(0, &record->length, sizeof(record->length));
+    crc = Crc32(crc, &record->timestamp, sizeof(record->timestamp));
+    return Crc32(crc, payload, record->length);
+}
+
+static off_t SlotOffset(uint32_t slot)
+{
+    return journalOffset + 2 * JOURNAL_HEADER_SLOT_SIZE + (off_t)slot * (off_t)JOURNAL_SLOT_SIZE;
+}
+
+/// <summary>
+///     Drops the oldest record from the header in memory; the caller writes the header.
+/// </summary>
+static void RemoveHead(void)
+{
+    header.head = (header.head + 1) % header.slotCount;
+    header.count--;
+    headRecordId++;
+}
+
+static int WriteHeader(void)
+{
+    header.sequence++;
+    header.crc = HeaderCrc(&header);
+
+    off_t offset = journalOffset + (header.sequence & 1) * JOURNAL_HEADER_SLOT_SIZE;
+    if (pwrite(journalFd, &header, sizeof(header), offset) != sizeof(header)) {
+        Log_Debug("ERROR: Could not write telemetry journal header: %s (%d).\n", strerror(errno),
+                  errno);
+        return -1;
+    }
+    return 0;
+}
+
+static bool ReadHeader(int copy, JournalHeader *h)
+{
+    off_t offset = journalOffset + copy * JOURNAL_HEADER_SLOT_SIZE;
+    if (pread(journalFd, h, sizeof(*h), offset) != sizeof(*h)) {
+        return false;
+    }
+    return h->magic == JOURNAL_MAGIC && h->version == JOURNAL_VERSION && h->crc == HeaderCrc(h);
+}
+
+int TelemetryJournal_Open(int fd, off_t regionOffset, size_t regionSize)
+{
+    journalFd = fd;
+    journalOffset = regionOffset;
+    headRecordId = 0;
+
+    if (regionSize < 2 * JOURNAL_HEADER_SLOT_SIZE + JOURNAL_SLOT_SIZE) {
+        Log_Debug("ERROR: Telemetry journal region of %zu bytes is too small.\n", regionSize);
+        journalFd = -1;
+        return -1;
+    }
+    uint32_t slotCount = (uint32_t)((regionSize - 2 * JOURNAL_HEADER_SLOT_SIZE) / JOURNAL_SLOT_SIZE);
+
+    JournalHeader copies[2];
+    bool valid[2] = {ReadHeader(0, &copies[0]), ReadHeader(1, &copies[1])};
+    for (int i = 0; i < 2; i++) {
+        valid[i] = valid[i] && copies[i].slotSize == JOURNAL_SLOT_SIZE &&
+                   copies[i].slotCount == slotCount && copies[i].head < slotCount &&
+                   copies[i].count <= slotCount;
+    }
+
+    if (valid[0] || valid[1]) {
+        // Use the most recently written copy; sequence numbers are compared with wraparound.
+        int newest = (valid[0] && valid[1])
+                         ? ((int32_t)(copies[1].sequence - copies[0].sequence) > 0 ? 1 : 0)
+                         : (valid[1] ? 1 : 0);
+        header = copies[newest];
+        Log_Debug("INFO: Telemetry journal opened with %u stored records.\n", header.count);
+        return 0;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = JOURNAL_MAGIC;
+    header.version = JOURNAL_VERSION;
+    header.slotSize = (uint16_t)JOURNAL_SLOT_SIZE;
+    header.slotCount = slotCount;
+    Log_Debug("INFO: Creating telemetry journal with %u record slots.\n", slotCount);
+    if (WriteHeader() != 0) {
+        journalFd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void TelemetryJournal_Close(void)
+{
+    journalFd = -1;
+}
+
+bool TelemetryJournal_Append(const char *payload, size_t payloadSize, time_t timestamp)
+{
+    if (journalFd < 0 || payloadSize > TELEMETRY_JOURNAL_RECORD_SIZE) {
+        return false;
+    }
+
+    if (header.count == header.slotCount) {
+        Log_Debug("WARNING: Telemetry journal full, discarding oldest record.\n");
+        RemoveHead();
+    }
+
+    JournalRecordHeader record = {.length = (uint16_t)payloadSize, .timestamp = timestamp};
+    record.crc = RecordCrc(&record, payload);
+
+    uint32_t slot = (header.head + header.count) % header.slotCount;
+    off_t offset = SlotOffset(slot);
+    if (pwrite(journalFd, &record, sizeof(record), offset) != sizeof(record) ||
+        pwrite(journalFd, payload, payloadSize, offset + (off_t)sizeof(record)) !=
+            (ssize_t)payloadSize) {
+        Log_Debug("ERROR: Could not write telemetry journal record: %s (%d).\n", strerror(errno),
+                  errno);
+        return false;
+    }
+
+    header.count++;
+    return WriteHeader() == 0;
+}
+
+ssize_t TelemetryJournal_Peek(char *buffer, size_t bufferSize, time_t *timestamp,
+                              uint32_t *recordId)
+{
+    if (journalFd < 0) {
+        return -1;
+    }
+
+    while (header.count > 0) {
+        JournalRecordHeader record;
+        off_t offset = SlotOffset(header.head);
+        if (pread(journalFd, &record, sizeof(record), offset) != sizeof(record)) {
+            return -1;
+        }
+
+        if (record.length <= TELEMETRY_JOURNAL_RECORD_SIZE && record.length <= bufferSize &&
+            pread(journalFd, buffer, record.length, offset + (off_t)sizeof(record)) ==
+                record.length &&
+            record.crc == RecordCrc(&record, buffer)) {
+            *timestamp = (time_t)record.timestamp;
+            *recordId = headRecordId;
+            return record.length;
+        }
+
+        Log_Debug("WARNING: Discarding corrupt telemetry journal record.\n");
+        RemoveHead();
+        WriteHeader();
+    }
+
+    return 0;
+}
+
+void TelemetryJournal_Consume(uint32_t recordId)
+{
+    if (journalFd < 0 || header.count == 0 || recordId != headRecordId) {
+        return;
+    }
+
+    RemoveHead();
+    WriteHeader();
+}
+
+unsigned int TelemetryJournal_Count(void)
+{
+    return journalFd < 0 ? 0 : header.count;
+}
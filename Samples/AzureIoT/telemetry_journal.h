@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/// <summary>
+///     Opens the telemetry journal kept in a region of a file.  On the device the file is the
+///     application's mutable storage file; any regular file works the same way.  If the
+///     region does not hold a valid journal, an empty one is created.
+/// </summary>
+/// <param name="fd">File descriptor open for reading and writing</param>
+/// <param name="regionOffset">Offset of the journal region within the file</param>
+/// <param name="regionSize">Size in bytes of the journal region</param>
+/// <returns>0 on success, or -1 on failure</returns>
+int TelemetryJournal_Open(int fd, off_t regionOffset, size_t regionSize);
+
+/// <summary>
+///     Closes the journal.  The file descriptor is not closed.
+/// </summary>
+void TelemetryJournal_Close(void);
+
+/// <summary>
+///     Appends a telemetry document to the journal.  When the journal is full the oldest
+///     record is discarded to make room.
+/// </summary>
+/// <param name="payload">Telemetry document</param>
+/// <param name="payloadSize">Size of the document, at most TELEMETRY_JOURNAL_RECORD_SIZE</param>
+/// <param name="timestamp">Time at which the telemetry was produced</param>
+/// <returns>true if the record was written</returns>
+bool TelemetryJournal_Append(const char *payload, size_t payloadSize, time_t timestamp);
+
+/// <summary>
+///     Reads the oldest record without removing it.  Records that fail their CRC check are
+///     discarded and the next one is returned instead.
+/// </summary>
+/// <param name="buffer">Receives the telemetry document</param>
+/// <param name="bufferSize">Size of buffer, at least TELEMETRY_JOURNAL_RECORD_SIZE</param>
+/// <param name="timestamp">Receives the time at which the telemetry was produced</param>
+/// <param name="recordId">Receives the identifier to pass to TelemetryJournal_Consume</param>
+/// <returns>Size of the document, 0 if the journal is empty, or -1 on failure</returns>
+ssize_t TelemetryJournal_Peek(char *buffer, size_t bufferSize, time_t *timestamp,
+                              uint32_t *recordId);
+
+/// <summary>
+///     Removes the oldest record, if it is still the record TelemetryJournal_Peek returned
+///     recordId for.  Does nothing if that record has since been discarded to make room.
+/// </summary>
+void TelemetryJournal_Consume(uint32_t recordId);
+
+/// <summary>
+///     Returns the number of records held in the journal.
+/// </summary>
+unsigned int TelemetryJournal_Count(void);
@@ -0,0 +1,79 @@
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "build_options.h"
+#include "telemetry_policy.h"
+
+TelemetryPolicySettings temperaturePolicySettings = {
+    .deadband = TELEMETRY_TEMPERATURE_DEADBAND, .hysteresis = TELEMETRY_TEMPERATURE_HYSTERESIS};
+TelemetryPolicySettings pressurePolicySettings = {
+    .deadband = TELEMETRY_PRESSURE_DEADBAND, .hysteresis = TELEMETRY_PRESSURE_HYSTERESIS};
+TelemetryPolicySettings accelerationPolicySettings = {
+    .deadband = TELEMETRY_ACCELERATION_DEADBAND, .hysteresis = TELEMETRY_ACCELERATION_HYSTERESIS};
+TelemetryPolicySettings angularRatePolicySettings = {
+    .deadband = TELEMETRY_ANGULAR_RATE_DEADBAND, .hysteresis = TELEMETRY_ANGULAR_RATE_HYSTERESIS};
+
+int telemetryMaxSilenceSeconds = TELEMETRY_MAX_SILENCE_SECONDS;
+
+// One entry per telemetry field that is filtered.  The names match the JsonField tables
+// used to send the readings.
+static TelemetryPolicy policies[] = {
+    {.name = "Temperature", .settings = &temperaturePolicySettings},
+    {.name = "Pressure", .settings = &pressurePolicySettings},
+    {.name = "pressure", .settings = &pressurePolicySettings},
+    {.name = "gX", .settings = &accelerationPolicySettings},
+    {.name = "gY", .settings = &accelerationPolicySettings},
+    {.name = "gZ", .settings = &accelerationPolicySettings},
+    {.name = "aX", .settings = &angularRatePolicySettings},
+    {.name = "aY", .settings = &angularRatePolicySettings},
+    {.name = "aZ", .settings = &angularRatePolicySettings}};
+
+static TelemetryPolicy *FindPolicy(const char *name)
+{
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(policies[i].name, name) == 0) {
+            return &policies[i];
+        }
+    }
+    return NULL;
+}
+
+bool TelemetryPolicy_ShouldSend(const char *name, float value)
+{
+    TelemetryPolicy *policy = FindPolicy(name);
+    if (policy == NULL) {
+        return true;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    float change = value - policy->lastSent;
+    int direction = (change > 0) - (change < 0);
+    bool send = !policy->hasSent;
+
+    if (!send) {
+        // Reversing direction needs the hysteresis on top of the deadband.
+        float required = policy->settings->deadband;
+        if (direction != 0 && policy->lastDirection != 0 && direction != policy->lastDirection) {
+            required += policy->settings->hysteresis;
+        }
+        send = fabsf(change) > required;
+    }
+
+    if (!send && telemetryMaxSilenceSeconds > 0) {
+        send = (now.tv_sec - policy->lastSentTime.tv_sec) >= telemetryMaxSilenceSeconds;
+    }
+
+    if (send) {
+        if (policy->hasSent && direction != 0) {
+            policy->lastDirection = direction;
+        }
+        policy->hasSent = true;
+        policy->lastSent = value;
+        policy->lastSentTime = now;
+    }
+    return send;
+}
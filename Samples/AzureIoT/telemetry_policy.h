@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+
+/// <summary>
+///     Reporting settings shared by one or more telemetry fields.  The values can be changed
+///     at run time through device twin desired properties.
+/// </summary>
+typedef struct {
+    // A reading is sent when it differs from the last sent value by more than this.
+    // 0 sends every change.
+    float deadband;
+    // Extra change required before a reversal of direction is sent, so that a value
+    // wobbling around the edge of the deadband is not reported on every wobble.
+    float hysteresis;
+} TelemetryPolicySettings;
+
+/// <summary>
+///     Reporting state of one telemetry field.
+/// </summary>
+typedef struct {
+    const char *name;
+    const TelemetryPolicySettings *settings;
+    bool hasSent;
+    float lastSent;
+    int lastDirection;
+    struct timespec lastSentTime;
+} TelemetryPolicy;
+
+// Settings changed through the device twin.
+extern TelemetryPolicySettings temperaturePolicySettings;
+extern TelemetryPolicySettings pressurePolicySettings;
+extern TelemetryPolicySettings accelerationPolicySettings;
+extern TelemetryPolicySettings angularRatePolicySettings;
+
+// A reading is always sent once this many seconds have passed since the field was last
+// sent, even if it has not changed.  0 disables the forced send.
+extern int telemetryMaxSilenceSeconds;
+
+/// <summary>
+///     Decides whether a reading of the named telemetry field should be sent, and records it
+///     as sent if so.  Fields without a policy are always sent.
+/// </summary>
+/// <param name="name">Telemetry field name</param>
+/// <param name="value">New reading</param>
+/// <returns>true if the reading should be sent</returns>
+bool TelemetryPolicy_ShouldSend(const char *name, float value);
+
@@ -0,0 +1,193 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+#include "build_options.h"
+#include "crc32.h"
+#include "twin_cache.h"
+
+// The cache region holds two copies of the cache, written alternately so that a torn write
+// always leaves the previous copy intact.  The copy with the newest sequence number wins.
+
+#define TWIN_CACHE_MAGIC 0x4E495754u // "TWIN"
+#define TWIN_CACHE_FORMAT 1
+
+typedef struct {
+    uint32_t keyHash; // 0 if nothing is cached for this entry
+    uint32_t value;
+} TwinCacheEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t format;
+    uint16_t entryCount;
+    uint32_t sequence;
+    int32_t desiredVersion;
+    uint32_t crc;
+    TwinCacheEntry entries[TWIN_CACHE_MAX_ENTRIES];
+} TwinCacheImage;
+
+static int cacheFd = -1;
+static off_t cacheOffset;
+static size_t copySize;
+static TwinCacheImage cache;
+static bool dirty = false;
+// Whether each entry has been applied since the app started, and the value applied; not
+// persisted.  The persisted entries hold the values IoT Hub confirmed as reported.
+static bool applied[TWIN_CACHE_MAX_ENTRIES];
+static uint32_t appliedValues[TWIN_CACHE_MAX_ENTRIES];
+static uint32_t appliedKeyHashes[TWIN_CACHE_MAX_ENTRIES];
+
+static uint32_t HashKey(const char *key)
+{
+    uint32_t hash = 2166136261u;
+    while (*key != '\0') {
+        hash ^= (uint8_t)*key++;
+        hash *= 16777619u;
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+static uint32_t ImageCrc(const TwinCacheImage *image)
+{
+    uint32_t crc = Crc32(0, image, offsetof(TwinCacheImage, crc));
+    return Crc32(crc, image->entries, sizeof(image->entries));
+}
+
+static bool ReadCopy(int copy, TwinCacheImage *image)
+{
+    off_t offset = cacheOffset + (off_t)copy * (off_t)copySize;
+    if (pread(cacheFd, image, sizeof(*image), offset) != sizeof(*image)) {
+        return false;
+    }
+    return image->magic == TWIN_CACHE_MAGIC && image->format == TWIN_CACHE_FORMAT &&
+           image->entryCount == TWIN_CACHE_MAX_ENTRIES && image->crc == ImageCrc(image);
+}
+
+int TwinCache_Open(int fd, off_t regionOffset, size_t regionSize)
+{
+    memset(&cache, 0, sizeof(cache));
+    memset(applied, 0, sizeof(applied));
+    cache.magic = TWIN_CACHE_MAGIC;
+    cache.format = TWIN_CACHE_FORMAT;
+    cache.entryCount = TWIN_CACHE_MAX_ENTRIES;
+    dirty = false;
+
+    if (regionSize / 2 < sizeof(TwinCacheImage)) {
+        Log_Debug("ERROR: Twin cache region of %zu bytes is too small.\n", regionSize);
+        return -1;
+    }
+
+    cacheFd = fd;
+    cacheOffset = regionOffset;
+    copySize = regionSize / 2;
+
+    static TwinCacheImage copies[2];
+    bool valid[2] = {ReadCopy(0, &copies[0]), ReadCopy(1, &copies[1])};
+    if (valid[0] || valid[1]) {
+        // Sequence numbers are compared with wraparound.
+        int newest = (valid[0] && valid[1])
+                         ? ((int32_t)(copies[1].sequence - copies[0].sequence) > 0 ? 1 : 0)
+                         : (valid[1] ? 1 : 0);
+        cache = copies[newest];
+        Log_Debug("INFO: Twin cache loaded at desired version %d.\n", cache.desiredVersion);
+    }
+    return 0;
+}
+
+void TwinCache_Close(void)
+{
+    TwinCache_Commit();
+    cacheFd = -1;
+}
+
+TwinCacheResult TwinCache_Check(unsigned int index, const char *key, TwinCacheValue value)
+{
+    if (index >= TWIN_CACHE_MAX_ENTRIES) {
+        return TwinCache_Changed;
+    }
+
+    uint32_t keyHash = HashKey(key);
+    if (applied[index] && appliedKeyHashes[index] == keyHash && appliedValues[index] == value.bits) {
+        return TwinCache_Unchanged;
+    }
+
+    const TwinCacheEntry *entry = &cache.entries[index];
+    if (entry->keyHash != keyHash || entry->value != value.bits) {
+        return TwinCache_Changed;
+    }
+    return TwinCache_NotApplied;
+}
+
+void TwinCache_Applied(unsigned int index, const char *key, TwinCacheValue value)
+{
+    if (index >= TWIN_CACHE_MAX_ENTRIES) {
+        return;
+    }
+
+    applied[index] = true;
+    appliedKeyHashes[index] = HashKey(key);
+    appliedValues[index] = value.bits;
+}
+
+void TwinCache_Reported(unsigned int index, const char *key, TwinCacheValue value)
+{
+    if (index >= TWIN_CACHE_MAX_ENTRIES) {
+        return;
+    }
+
+    TwinCacheEntry *entry = &cache.entries[index];
+    uint32_t keyHash = HashKey(key);
+    if (entry->keyHash != keyHash || entry->value != value.bits) {
+        entry->keyHash = keyHash;
+        entry->value = value.bits;
+        dirty = true;
+    }
+}
+
+bool TwinCache_IsVersionApplied(int version)
+{
+    if (version != cache.desiredVersion) {
+        return false;
+    }
+    for (unsigned int i = 0; i < TWIN_CACHE_MAX_ENTRIES; i++) {
+        if (cache.entries[i].keyHash != 0 && !applied[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int TwinCache_GetDesiredVersion(void)
+{
+    return cache.desiredVersion;
+}
+
+void TwinCache_SetDesiredVersion(int version)
+{
+    if (cache.desiredVersion != version) {
+        cache.desiredVersion = version;
+        dirty = true;
+    }
+}
+
+void TwinCache_Commit(void)
+{
+    if (!dirty || cacheFd < 0) {
+        return;
+    }
+
+    cache.sequence++;
+    cache.crc = ImageCrc(&cache);
+    off_t offset = cacheOffset + (off_t)(cache.sequence & 1) * (off_t)copySize;
+    if (pwrite(cacheFd, &cache, sizeof(cache), offset) != sizeof(cache)) {
+        Log_Debug("ERROR: Could not write twin cache: %s (%d).\n", strerror(errno), errno);
+        return;
+    }
+    dirty = false;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/// <summary>
+///     A device twin property value as stored in the cache.  Values are compared through bits,
+///     so clear the whole union before setting one member.
+/// </summary>
+typedef union {
+    bool boolean;
+    int32_t integer;
+    float number;
+    uint32_t bits;
+} TwinCacheValue;
+
+typedef enum {
+    // The value differs from the last one applied, and IoT Hub has not confirmed a report of it.
+    TwinCache_Changed = 0,
+    // IoT Hub confirmed a report of the value, but it has not been applied to the hardware
+    // since the app started.
+    TwinCache_NotApplied = 1,
+    // The value has already been applied since the app started.
+    TwinCache_Unchanged = 2
+} TwinCacheResult;
+
+/// <summary>
+///     Loads the cache from a region of a file.  The cache still works in memory if the region
+///     cannot be used, but is then not kept across restarts.
+/// </summary>
+/// <returns>0 on success, or -1 if the region is unusable</returns>
+int TwinCache_Open(int fd, off_t regionOffset, size_t regionSize);
+
+/// <summary>
+///     Stops writing the cache to its file.  The file descriptor is not closed.
+/// </summary>
+void TwinCache_Close(void);
+
+/// <summary>
+///     Compares a desired value with the last value applied for a property.
+/// </summary>
+/// <param name="index">Index of the property in twinArray, below TWIN_CACHE_MAX_ENTRIES</param>
+/// <param name="key">Name of the property, checked so that a reordered twinArray is not
+/// mistaken for unchanged values</param>
+TwinCacheResult TwinCache_Check(unsigned int index, const char *key, TwinCacheValue value);
+
+/// <summary>
+///     Records that a value was applied to the hardware.  This is kept in memory only.
+/// </summary>
+void TwinCache_Applied(unsigned int index, const char *key, TwinCacheValue value);
+
+/// <summary>
+///     Records that IoT Hub confirmed a report of a value.  This is what is kept across restarts,
+///     so call it only from the reported-state confirmation.
+/// </summary>
+void TwinCache_Reported(unsigned int index, const char *key, TwinCacheValue value);
+
+/// <summary>
+///     Returns true if the given desired-properties version was the last one recorded, and every
+///     cached value has been applied since the app started.
+/// </summary>
+bool TwinCache_IsVersionApplied(int version);
+
+/// <summary>
+///     Returns the last desired-properties version recorded, or 0 if none.
+/// </summary>
+int TwinCache_GetDesiredVersion(void);
+
+/// <summary>
+///     Records a desired-properties version once every value in it is applied, and IoT Hub
+///     confirmed the reports of those that changed.
+/// </summary>
+void TwinCache_SetDesiredVersion(int version);
+
+/// <summary>
+///     Writes the cache to its file if it changed since it was last written.
+/// </summary>
+void TwinCache_Commit(void);
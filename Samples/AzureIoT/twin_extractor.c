@@ -0,0 +1,279 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "twin_extractor.h"
+
+// Limits the recursion used to skip nested values.
+#define MAX_DEPTH 32
+// Longest number accepted; numbers are copied out to be NUL-terminated for strtod.
+#define MAX_NUMBER_LENGTH 32
+
+typedef struct {
+    const char *next;
+    const char *end;
+} Scanner;
+
+static void SkipWhitespace(Scanner *s)
+{
+    while (s->next < s->end &&
+           (*s->next == ' ' || *s->next == '\t' || *s->next == '\n' || *s->next == '\r')) {
+        s->next++;
+    }
+}
+
+static bool Consume(Scanner *s, char c)
+{
+    SkipWhitespace(s);
+    if (s->next < s->end && *s->next == c) {
+        s->next++;
+        return true;
+    }
+    return false;
+}
+
+static bool Peek(Scanner *s, char c)
+{
+    SkipWhitespace(s);
+    return s->next < s->end && *s->next == c;
+}
+
+/// <summary>
+///     Scans a string, returning its raw contents between the quotes.
+/// </summary>
+static bool ScanString(Scanner *s, const char **start, size_t *length)
+{
+    if (!Consume(s, '"')) {
+        return false;
+    }
+
+    *start = s->next;
+    while (s->next < s->end) {
+        char c = *s->next++;
+        if (c == '"') {
+            *length = (size_t)(s->next - 1 - *start);
+            return true;
+        }
+        if (c == '\\') {
+            if (s->next == s->end) {
+                return false;
+            }
+            s->next++;
+        }
+    }
+    return false;
+}
+
+static bool MatchLiteral(Scanner *s, const char *literal)
+{
+    size_t length = strlen(literal);
+    if ((size_t)(s->end - s->next) < length || memcmp(s->next, literal, length) != 0) {
+        return false;
+    }
+    s->next += length;
+    return true;
+}
+
+/// <summary>
+///     Scans a string, number, true, false or null.
+/// </summary>
+static bool ScanScalar(Scanner *s, TwinScalar *value)
+{
+    memset(value, 0, sizeof(*value));
+    SkipWhitespace(s);
+    if (s->next == s->end) {
+        return false;
+    }
+
+    switch (*s->next) {
+    case '"':
+        value->type = TwinScalar_String;
+        return ScanString(s, &value->string, &value->stringLength);
+    case 't':
+        value->type = TwinScalar_Bool;
+        value->boolean = true;
+        return MatchLiteral(s, "true");
+    case 'f':
+        value->type = TwinScalar_Bool;
+        return MatchLiteral(s, "false");
+    case 'n':
+        value->type = TwinScalar_Null;
+        return MatchLiteral(s, "null");
+    }
+
+    const char *start = s->next;
+    while (s->next < s->end && strchr("+-0123456789.eE", *s->next) != NULL) {
+        s->next++;
+    }
+    size_t length = (size_t)(s->next - start);
+    if (length == 0 || length >= MAX_NUMBER_LENGTH) {
+        return false;
+    }
+
+    char number[MAX_NUMBER_LENGTH];
+    memcpy(number, start, length);
+    number[length] = '\0';
+    char *numberEnd;
+    value->type = TwinScalar_Number;
+    value->number = strtod(number, &numberEnd);
+    return numberEnd == number + length;
+}
+
+static bool SkipValue(Scanner *s, int depth);
+
+/// <summary>
+///     Skips the members of an object or elements of an array whose opening bracket has been
+///     consumed.
+/// </summary>
+static bool SkipContainer(Scanner *s, char close, int depth)
+{
+    if (Consume(s, close)) {
+        return true;
+    }
+    do {
+        if (close == '}') {
+            const char *key;
+            size_t keyLength;
+            if (!ScanString(s, &key, &keyLength) || !Consume(s, ':')) {
+                return false;
+            }
+        }
+        if (!SkipValue(s, depth + 1)) {
+            return false;
+        }
+    } while (Consume(s, ','));
+    return Consume(s, close);
+}
+
+static bool SkipValue(Scanner *s, int depth)
+{
+    if (depth > MAX_DEPTH) {
+        return false;
+    }
+    if (Consume(s, '{')) {
+        return SkipContainer(s, '}', depth);
+    }
+    if (Consume(s, '[')) {
+        return SkipContainer(s, ']', depth);
+    }
+    TwinScalar ignored;
+    return ScanScalar(s, &ignored);
+}
+
+static bool KeyIs(const char *key, size_t keyLength, const char *name)
+{
+    return strlen(name) == keyLength && memcmp(key, name, keyLength) == 0;
+}
+
+/// <summary>
+///     Delivers the value of a registered property, unwrapping {"value": ...} if configured.
+/// </summary>
+static bool ExtractProperty(Scanner *s, void *property, const TwinExtractorCallbacks *callbacks)
+{
+    TwinScalar value;
+
+    if (callbacks->unwrapValue && Consume(s, '{')) {
+        if (Consume(s, '}')) {
+            return true;
+        }
+        do {
+            const char *key;
+            size_t keyLength;
+            if (!ScanString(s, &key, &keyLength) || !Consume(s, ':')) {
+                return false;
+            }
+            if (KeyIs(key, keyLength, "value") && !Peek(s, '{') && !Peek(s, '[')) {
+                if (!ScanScalar(s, &value)) {
+                    return false;
+                }
+                if (callbacks->onProperty != NULL) {
+                    callbacks->onProperty(property, &value);
+                }
+            } else if (!SkipValue(s, 2)) {
+                return false;
+            }
+        } while (Consume(s, ','));
+        return Consume(s, '}');
+    }
+
+    if (Peek(s, '{') || Peek(s, '[')) {
+        return SkipValue(s, 1);
+    }
+    if (!ScanScalar(s, &value)) {
+        return false;
+    }
+    if (callbacks->onProperty != NULL) {
+        callbacks->onProperty(property, &value);
+    }
+    return true;
+}
+
+/// <summary>
+///     Walks the desired properties object.
+/// </summary>
+static bool ExtractDesired(Scanner *s, const TwinExtractorCallbacks *callbacks)
+{
+    if (!Consume(s, '{')) {
+        return false;
+    }
+    if (Consume(s, '}')) {
+        return true;
+    }
+
+    do {
+        const char *key;
+        size_t keyLength;
+        if (!ScanString(s, &key, &keyLength) || !Consume(s, ':')) {
+            return false;
+        }
+
+        if (KeyIs(key, keyLength, "$version")) {
+            TwinScalar version;
+            if (!ScanScalar(s, &version)) {
+                return false;
+            }
+            if (version.type == TwinScalar_Number && callbacks->onVersion != NULL) {
+                callbacks->onVersion((long)version.number);
+            }
+            continue;
+        }
+
+        void *property = callbacks->findProperty(key, keyLength);
+        if (!(property != NULL ? ExtractProperty(s, property, callbacks) : SkipValue(s, 1))) {
+            return false;
+        }
+    } while (Consume(s, ','));
+    return Consume(s, '}');
+}
+
+int TwinExtractor_Parse(const char *payload, size_t size, bool complete,
+                        const TwinExtractorCallbacks *callbacks)
+{
+    Scanner s = {.next = payload, .end = payload + size};
+
+    if (!complete) {
+        return ExtractDesired(&s, callbacks) ? 0 : -1;
+    }
+
+    // A complete twin is {"desired": {...}, "reported": {...}}.
+    if (!Consume(&s, '{')) {
+        return -1;
+    }
+    if (Consume(&s, '}')) {
+        return 0;
+    }
+    do {
+        const char *key;
+        size_t keyLength;
+        if (!ScanString(&s, &key, &keyLength) || !Consume(&s, ':')) {
+            return -1;
+        }
+        bool ok = KeyIs(key, keyLength, "desired") ? ExtractDesired(&s, callbacks)
+                                                   : SkipValue(&s, 1);
+        if (!ok) {
+            return -1;
+        }
+    } while (Consume(&s, ','));
+    return Consume(&s, '}') ? 0 : -1;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    TwinScalar_Null = 0,
+    TwinScalar_Bool = 1,
+    TwinScalar_Number = 2,
+    TwinScalar_String = 3
+} TwinScalarType;
+
+/// <summary>
+///     A desired property value.  Strings point into the payload and are not unescaped.
+/// </summary>
+typedef struct {
+    TwinScalarType type;
+    bool boolean;
+    double number;
+    const char *string;
+    size_t stringLength;
+} TwinScalar;
+
+typedef struct {
+    // Returns a non-NULL handle for each desired property that should be delivered to
+    // onProperty.  Keys point into the payload and are not NUL-terminated or unescaped.
+    void *(*findProperty)(const char *key, size_t keyLength);
+    // Receives the value of a property accepted by findProperty.  May be NULL.
+    void (*onProperty)(void *property, const TwinScalar *value);
+    // Receives the $version of the desired properties.  May be NULL.
+    void (*onVersion)(long version);
+    // Deliver the "value" member of object values, as IoT Central wraps desired properties.
+    bool unwrapValue;
+} TwinExtractorCallbacks;
+
+/// <summary>
+///     Walks a device twin payload once, in place, without allocating, and delivers $version
+///     and the desired properties accepted by findProperty.  Values of other properties, and
+///     non-scalar values, are skipped without being decoded.
+/// </summary>
+/// <param name="payload">Twin document; need not be NUL-terminated</param>
+/// <param name="size">Length of the document</param>
+/// <param name="complete">true for a complete twin, whose desired properties are under
+/// "desired"; false for a patch of desired properties</param>
+/// <returns>0 on success, or -1 if the payload is not valid JSON.  Callbacks made before the
+/// error was found are not undone.</returns>
+int TwinExtractor_Parse(const char *payload, size_t size, bool complete,
+                        const TwinExtractorCallbacks *callbacks);